@@ -36,6 +36,7 @@
 #include "bufparser.h"
 #include "digest.h"
 #include "runtime.h"
+#include "cache.h"
 #include "config.h"
 
 #ifdef DEBUG_AUTHENTICODE
@@ -111,6 +112,14 @@ struct pecoff_image_info {
 	pecoff_section_t *	section;
 
 	authenticode_image_info_t auth_info;
+
+	/* authenticode digests computed so far */
+	unsigned int		num_digests;
+	tpm_evdigest_t		digests[DIGEST_MULTI_MAX];
+
+	/* Once the image data has been dropped (or if the image was
+	 * loaded from the cache), this holds the signer certificate */
+	buffer_t *		signer_der;
 };
 
 #define MSDOS_STUB_PE_OFFSET	0x3c
@@ -146,7 +155,7 @@ pecoff_image_info_alloc(buffer_t *data, const char *display_name)
 void
 pecoff_image_info_free(pecoff_image_info_t *img)
 {
-	buffer_free(img->data);
+	buffer_free(img->signer_der);
 	free(img->display_name);
 	free(img->data_dirs);
 	free(img->section);
@@ -263,11 +272,10 @@ authenticode_finalize(authenticode_image_info_t *info)
 	}
 }
 
-static tpm_evdigest_t *
-authenticode_compute(authenticode_image_info_t *info, buffer_t *in, digest_ctx_t *digest)
+static bool
+authenticode_compute(authenticode_image_info_t *info, buffer_t *in, digest_multi_ctx_t *digest)
 {
 	unsigned int area_index;
-	static tpm_evdigest_t md;
 
 	authenticode_finalize(info);
 
@@ -277,14 +285,14 @@ authenticode_compute(authenticode_image_info_t *info, buffer_t *in, digest_ctx_t
 		if (!buffer_seek_read(in, area->addr)
 		 || buffer_available(in) < area->size) {
 			error("area %u points outside file data?!\n", area_index);
-			return NULL;
+			return false;
 		}
 
 		pe_debug("  Hashing range 0x%x->0x%x\n", area->addr, area->addr + area->size);
-		digest_ctx_update(digest, buffer_read_pointer(in), area->size);
+		digest_multi_ctx_update(digest, buffer_read_pointer(in), area->size);
 	}
 
-	return digest_ctx_final(digest, &md);
+	return true;
 }
 
 static inline bool
@@ -659,6 +667,10 @@ __pecoff_process_certificate_table(buffer_t *in, const pecoff_image_info_t *img,
 	return true;
 }
 
+/*
+ * Note that the image info does not take ownership of the data buffer;
+ * call pecoff_image_info_drop_data() before releasing it.
+ */
 pecoff_image_info_t *
 pecoff_inspect(buffer_t *in, const char *display_name)
 {
@@ -704,10 +716,53 @@ failed:
 	return NULL;
 }
 
-tpm_evdigest_t *
-authenticode_get_digest(pecoff_image_info_t *img, digest_ctx_t *digest)
+/*
+ * When predicting several PCR banks, we get asked for the same image's digest
+ * once per algorithm. Compute the digests for all algorithms the runtime
+ * was configured with in a single pass over the image, and remember them.
+ */
+const tpm_evdigest_t *
+authenticode_get_digest(pecoff_image_info_t *img, const tpm_algo_info_t *algo)
 {
-	return authenticode_compute(&img->auth_info, img->data, digest);
+	const tpm_algo_info_t * const *algos;
+	digest_multi_ctx_t *digest;
+	unsigned int i, count;
+	bool ok;
+
+	for (i = 0; i < img->num_digests; ++i) {
+		if (img->digests[i].algo == algo)
+			return &img->digests[i];
+	}
+
+	if (img->data == NULL) {
+		error("%s: image data no longer available, cannot compute %s digest\n",
+				img->display_name, algo->openssl_name);
+		return NULL;
+	}
+
+	algos = runtime_get_digest_algorithms(&count);
+	for (i = 0; algos && i < count && algos[i] != algo; ++i)
+		;
+	if (algos == NULL || i >= count) {
+		algos = &algo;
+		count = 1;
+	}
+
+	if (img->num_digests + count > DIGEST_MULTI_MAX)
+		img->num_digests = 0;
+
+	if (!(digest = digest_multi_ctx_new(count, algos)))
+		return NULL;
+
+	ok = authenticode_compute(&img->auth_info, img->data, digest)
+	  && digest_multi_ctx_final(digest, &img->digests[img->num_digests]);
+	digest_multi_ctx_free(digest);
+
+	if (!ok)
+		return NULL;
+
+	img->num_digests += count;
+	return authenticode_get_digest(img, algo);
 }
 
 cert_table_t *
@@ -715,6 +770,11 @@ authenticode_get_certificate_table(const pecoff_image_info_t *img)
 {
 	cert_table_t *result = NULL;
 
+	if (img->data == NULL) {
+		error("%s: image data not available\n", img->display_name);
+		return NULL;
+	}
+
 	result = cert_table_alloc();
 	if (!__pecoff_process_certificate_table(img->data, img, result)) {
 		cert_table_free(result);
@@ -724,8 +784,8 @@ authenticode_get_certificate_table(const pecoff_image_info_t *img)
 	return result;
 }
 
-parsed_cert_t *
-authenticode_get_signer(const pecoff_image_info_t *img)
+static bool
+__authenticode_find_signer(const pecoff_image_info_t *img, parsed_cert_t **ret)
 {
 	cert_table_t *cert_tbl;
 	parsed_cert_t *signer = NULL;
@@ -734,7 +794,7 @@ authenticode_get_signer(const pecoff_image_info_t *img)
 	cert_tbl = authenticode_get_certificate_table(img);
 	if (cert_tbl == NULL) {
 		error("failed to read certificate table\n");
-		return NULL;
+		return false;
 	}
 
 	for (i = 0; i < cert_tbl->count; ++i) {
@@ -745,9 +805,186 @@ authenticode_get_signer(const pecoff_image_info_t *img)
 			break;
 	}
 
+	cert_table_free(cert_tbl);
+	*ret = signer;
+	return true;
+}
+
+parsed_cert_t *
+authenticode_get_signer(const pecoff_image_info_t *img)
+{
+	parsed_cert_t *signer = NULL;
+
+	if (img->data == NULL) {
+		if (img->signer_der)
+			signer = cert_parse(img->signer_der);
+	} else
+	if (!__authenticode_find_signer(img, &signer))
+		return NULL;
+
 	if (signer == NULL)
 		error("unable to find a valid signer cert in certificate table\n");
 
-	cert_table_free(cert_tbl);
 	return signer;
 }
+
+/*
+ * Persistent cache of authenticode digests and signers.
+ * Hashing shim, grub and the kernel is the most expensive part of a
+ * prediction, but these images change only when packages get updated.
+ * So we remember digests and signer by file identity; any change to
+ * size, mtime or ctime of the file invalidates the entry.
+ */
+#define AUTHENTICODE_CACHE_TYPE		"authenticode"
+#define AUTHENTICODE_CACHE_MAGIC	0x41434331	/* "ACC1" */
+
+pecoff_image_info_t *
+authenticode_cache_lookup(const cache_file_id_t *id, const char *display_name)
+{
+	const tpm_algo_info_t * const *algos;
+	pecoff_image_info_t *img = NULL;
+	cache_file_id_t cached_id;
+	unsigned int i, j, count;
+	uint32_t magic, num_digests, signer_len;
+	buffer_t *bp;
+
+	if (!(algos = runtime_get_digest_algorithms(&count)))
+		return NULL;
+
+	if (!(bp = cache_read(AUTHENTICODE_CACHE_TYPE, cache_file_id_key(id))))
+		return NULL;
+
+	if (!buffer_get_u32le(bp, &magic) || magic != AUTHENTICODE_CACHE_MAGIC
+	 || !cache_file_id_get(bp, &cached_id)
+	 || !buffer_get_u32le(bp, &num_digests)
+	 || num_digests > DIGEST_MULTI_MAX)
+		goto bad_entry;
+
+	if (!cache_file_id_equal(id, &cached_id)) {
+		debug("%s: cache entry is stale\n", display_name);
+		goto out;
+	}
+
+	img = pecoff_image_info_alloc(NULL, display_name);
+	for (i = 0; i < num_digests; ++i) {
+		tpm_evdigest_t *md = &img->digests[i];
+		uint16_t algo_id, size;
+
+		if (!buffer_get_u16le(bp, &algo_id)
+		 || !buffer_get_u16le(bp, &size)
+		 || !(md->algo = digest_by_tpm_alg(algo_id))
+		 || size != md->algo->digest_size
+		 || !buffer_get(bp, md->data, size))
+			goto bad_entry;
+		md->size = size;
+	}
+	img->num_digests = num_digests;
+
+	if (!buffer_get_u32le(bp, &signer_len) || signer_len > buffer_available(bp))
+		goto bad_entry;
+
+	if (signer_len) {
+		img->signer_der = buffer_alloc_write(signer_len);
+		buffer_put(img->signer_der, buffer_read_pointer(bp), signer_len);
+	}
+
+	/* The entry is only useful if it has all the digests we need */
+	for (j = 0; j < count; ++j) {
+		for (i = 0; i < img->num_digests && img->digests[i].algo != algos[j]; ++i)
+			;
+		if (i >= img->num_digests) {
+			debug("%s: cache entry lacks %s digest\n", display_name, algos[j]->openssl_name);
+			goto discard;
+		}
+	}
+
+	debug("%s: using cached authenticode digest\n", display_name);
+	goto out;
+
+bad_entry:
+	debug("%s: ignoring corrupt cache entry\n", display_name);
+	cache_remove(AUTHENTICODE_CACHE_TYPE, cache_file_id_key(id));
+
+discard:
+	if (img)
+		pecoff_image_info_free(img);
+	img = NULL;
+
+out:
+	buffer_free(bp);
+	return img;
+}
+
+/*
+ * Compute the digests for all algorithms we've been configured with
+ * and extract the signer. After that, we no longer need the image data,
+ * and the caller can release it.
+ */
+bool
+pecoff_image_info_drop_data(pecoff_image_info_t *img)
+{
+	const tpm_algo_info_t * const *algos;
+	parsed_cert_t *signer = NULL;
+	unsigned int i, count;
+
+	if (img->data == NULL)
+		return true;
+
+	if (!(algos = runtime_get_digest_algorithms(&count))) {
+		error("%s: no digest algorithms configured\n", img->display_name);
+		return false;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (!authenticode_get_digest(img, algos[i]))
+			return false;
+	}
+
+	if (!__authenticode_find_signer(img, &signer))
+		return false;
+
+	if (signer) {
+		img->signer_der = parsed_cert_encode(signer);
+		parsed_cert_free(signer);
+	}
+
+	img->data = NULL;
+	return true;
+}
+
+/*
+ * Store digests and signer in the cache. This expects that
+ * pecoff_image_info_drop_data() has been called.
+ */
+void
+authenticode_cache_update(const pecoff_image_info_t *img, const cache_file_id_t *id)
+{
+	const buffer_t *der = img->signer_der;
+	buffer_t *bp;
+	unsigned int i;
+
+	if (img->data != NULL)
+		return;
+
+	bp = buffer_alloc_write(64 + img->num_digests * (4 + EVP_MAX_MD_SIZE) + (der? der->wpos : 0));
+	buffer_put_u32le(bp, AUTHENTICODE_CACHE_MAGIC);
+	cache_file_id_put(bp, id);
+	buffer_put_u32le(bp, img->num_digests);
+	for (i = 0; i < img->num_digests; ++i) {
+		const tpm_evdigest_t *md = &img->digests[i];
+
+		buffer_put_u16le(bp, md->algo->tcg_id);
+		buffer_put_u16le(bp, md->size);
+		buffer_put(bp, md->data, md->size);
+	}
+
+	if (der) {
+		buffer_put_u32le(bp, der->wpos);
+		buffer_put(bp, der->data, der->wpos);
+	} else {
+		buffer_put_u32le(bp, 0);
+	}
+
+	cache_write(AUTHENTICODE_CACHE_TYPE, cache_file_id_key(id), bp);
+	buffer_free(bp);
+}
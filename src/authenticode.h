@@ -25,9 +25,12 @@
 
 extern pecoff_image_info_t *pecoff_inspect(buffer_t *img_data, const char *display_name);
 extern void		pecoff_image_info_free(pecoff_image_info_t *);
-extern tpm_evdigest_t *	authenticode_get_digest(pecoff_image_info_t *, digest_ctx_t *);
+extern bool		pecoff_image_info_drop_data(pecoff_image_info_t *);
+extern const tpm_evdigest_t *authenticode_get_digest(pecoff_image_info_t *, const tpm_algo_info_t *);
 extern cert_table_t *	authenticode_get_certificate_table(const pecoff_image_info_t *img);
 extern parsed_cert_t *	authenticode_get_signer(const pecoff_image_info_t *);
+extern pecoff_image_info_t *authenticode_cache_lookup(const cache_file_id_t *, const char *display_name);
+extern void		authenticode_cache_update(const pecoff_image_info_t *, const cache_file_id_t *);
 
 #endif /* AUTHENTICODE_H */
 
@@ -0,0 +1,158 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+
+#include "batch.h"
+#include "util.h"
+
+/*
+ * Batch mode.
+ *
+ * The batch file contains one pcr-oracle command line per line, minus
+ * the program name. Empty lines, and lines starting with '#', are ignored.
+ * Words are separated by white space; they can be quoted using single or
+ * double quotes, and a backslash escapes the next character (except inside
+ * single quotes).
+ *
+ * All commands run in the calling process, one after the other, so that
+ * they can share whatever state the previous ones have set up. We stop at
+ * the first command that fails.
+ */
+int
+batch_split_line(char *line, char **argv, unsigned int max_args, const char **errmsg)
+{
+	char *src = line, *dst = line;
+	unsigned int argc = 0;
+
+	while (true) {
+		char quote = 0;
+
+		while (isspace((unsigned char) *src))
+			++src;
+		if (*src == '\0' || *src == '#')
+			break;
+
+		if (argc + 1 >= max_args) {
+			*errmsg = "too many arguments";
+			return -1;
+		}
+		argv[argc++] = dst;
+
+		while (*src) {
+			char cc = *src++;
+
+			if (quote) {
+				if (cc == quote) {
+					quote = 0;
+					continue;
+				}
+				if (cc == '\\' && quote == '"' && *src)
+					cc = *src++;
+			} else {
+				if (isspace((unsigned char) cc))
+					break;
+				if (cc == '\'' || cc == '"') {
+					quote = cc;
+					continue;
+				}
+				if (cc == '\\' && *src)
+					cc = *src++;
+			}
+			*dst++ = cc;
+		}
+
+		if (quote) {
+			*errmsg = "unterminated quoted string";
+			return -1;
+		}
+
+		/* We may have just overwritten the separator we broke at,
+		 * but never anything we have yet to look at. */
+		*dst++ = '\0';
+	}
+
+	argv[argc] = NULL;
+	return argc;
+}
+
+int
+batch_run(const char *path, batch_handler_fn_t *handler)
+{
+	char *argv[BATCH_MAX_ARGS + 1];
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned int lineno = 0;
+	int exit_code = 0;
+	FILE *fp;
+
+	if (!strcmp(path, "-")) {
+		fp = stdin;
+		path = "<stdin>";
+	} else
+	if ((fp = fopen(path, "r")) == NULL) {
+		error("Unable to open batch file %s: %m\n", path);
+		return 1;
+	}
+
+	while (getline(&line, &line_size, fp) >= 0) {
+		const char *errmsg = NULL;
+		int argc;
+
+		lineno++;
+
+		argv[0] = "pcr-oracle";
+		argc = batch_split_line(line, argv + 1, BATCH_MAX_ARGS, &errmsg);
+		if (argc < 0) {
+			error("%s:%u: %s\n", path, lineno, errmsg);
+			exit_code = 1;
+			break;
+		}
+		if (argc == 0)
+			continue;
+
+		debug("%s:%u: running command\n", path, lineno);
+
+		/* Have getopt_long start over */
+		optind = 0;
+
+		exit_code = handler(argc + 1, argv);
+		fflush(stdout);
+
+		if (exit_code != 0) {
+			error("%s:%u: command failed with exit code %d\n", path, lineno, exit_code);
+			break;
+		}
+	}
+
+	if (ferror(fp)) {
+		error("Error reading batch file %s: %m\n", path);
+		exit_code = 1;
+	}
+
+	if (fp != stdin)
+		fclose(fp);
+	free(line);
+	return exit_code;
+}
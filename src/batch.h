@@ -0,0 +1,35 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "types.h"
+
+#define BATCH_MAX_ARGS		256
+
+typedef int		batch_handler_fn_t(int argc, char **argv);
+
+extern int		batch_run(const char *path, batch_handler_fn_t *handler);
+extern int		batch_split_line(char *line, char **argv, unsigned int max_args,
+				const char **errmsg);
+
+#endif /* BATCH_H */
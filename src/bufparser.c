@@ -19,10 +19,14 @@
  */
 
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "bufparser.h"
 #include "runtime.h" /* just for the flags */
@@ -74,33 +78,209 @@ buffer_read_file(const char *filename, int flags)
 	return bp;
 }
 
+/*
+ * Map a file read-only. The resulting buffer must be released
+ * using buffer_unmap().
+ */
+buffer_t *
+buffer_map_file(const char *filename)
+{
+	buffer_t *bp;
+	struct stat stb;
+	void *data;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		error("Unable to open file %s: %m\n", filename);
+		return NULL;
+	}
+
+	if (fstat(fd, &stb) < 0)
+		fatal("Cannot stat %s: %m\n", filename);
+
+	bp = calloc(1, sizeof(*bp));
+	if (stb.st_size != 0) {
+		data = mmap(NULL, stb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			fatal("Cannot map %s: %m\n", filename);
+
+		buffer_init_read(bp, data, stb.st_size);
+	}
+
+	close(fd);
+
+	debug2("Mapped %lu bytes from %s\n", (unsigned long) stb.st_size, filename);
+	return bp;
+}
+
+/*
+ * Allocate a buffer backed by an anonymous mapping, so that its memory
+ * is returned to the system when it's released using buffer_unmap().
+ */
+buffer_t *
+buffer_alloc_mapped(unsigned long size)
+{
+	buffer_t *bp;
+	void *data;
+
+	bp = calloc(1, sizeof(*bp));
+	if (size != 0) {
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data == MAP_FAILED)
+			fatal("Cannot allocate buffer of %lu bytes: %m\n", size);
+
+		buffer_init_write(bp, data, size);
+	}
+
+	return bp;
+}
+
+void
+buffer_unmap(buffer_t *bp)
+{
+	if (bp == NULL)
+		return;
+
+	if (bp->data)
+		munmap(bp->data, bp->size);
+	free(bp);
+}
+
+/*
+ * Set up a temporary file next to the (symlink resolved) target, so that
+ * it can be renamed over the target once it has been written.
+ * Returns -1 if the target cannot be replaced this way, in which case the
+ * caller falls back to writing it in place.
+ */
+static int
+__buffer_open_replacement(const char *filename, char *realname, char *tmpname)
+{
+	char dirbuf[PATH_MAX], *slash;
+	struct stat stb;
+	bool exists;
+	mode_t mode;
+	int fd;
+
+	if (realpath(filename, realname) == NULL) {
+		if (errno != ENOENT)
+			return -1;
+		if (snprintf(realname, PATH_MAX, "%s", filename) >= PATH_MAX)
+			return -1;
+	}
+
+	exists = (stat(realname, &stb) == 0);
+	if (exists && !S_ISREG(stb.st_mode))
+		return -1;
+
+	snprintf(dirbuf, sizeof(dirbuf), "%s", realname);
+	if ((slash = strrchr(dirbuf, '/')) == NULL)
+		strcpy(dirbuf, ".");
+	else if (slash == dirbuf)
+		slash[1] = '\0';
+	else
+		*slash = '\0';
+
+	if (access(dirbuf, W_OK) < 0)
+		return -1;
+
+	if (snprintf(tmpname, PATH_MAX, "%s.XXXXXX", realname) >= PATH_MAX)
+		return -1;
+	if ((fd = mkstemp(tmpname)) < 0)
+		return -1;
+
+	if (exists) {
+		/* Preserve owner and permissions of the file we replace.
+		 * Changing the owner requires privileges; if we don't have them,
+		 * the file ends up owned by us, as it would after an in-place
+		 * rewrite by a different user. */
+		(void) fchown(fd, stb.st_uid, stb.st_gid);
+		mode = stb.st_mode & 07777;
+	} else {
+		mode = umask(0);
+		umask(mode);
+		mode = 0666 & ~mode;
+	}
+
+	if (fchmod(fd, mode) < 0) {
+		close(fd);
+		unlink(tmpname);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * With RUNTIME_WRITE_ATOMIC, a regular file is replaced via a temporary
+ * file and rename(), so that anyone reading it (say, systemd-cryptsetup
+ * reading a signed policy) never sees a partially written file.
+ * With RUNTIME_WRITE_NOFAIL, errors are reported and false is returned
+ * rather than aborting.
+ */
 bool
-buffer_write_file(const char *filename, buffer_t *bp)
+buffer_write_file_ext(const char *filename, buffer_t *bp, int flags)
 {
+	char realname[PATH_MAX], tmpname[PATH_MAX];
 	unsigned int written = 0;
-	int fd, n;
-	bool closeit = true;
+	int fd = -1, n;
+	bool closeit = true, atomic = false;
 
 	if (filename == NULL || !strcmp(filename, "-")) {
 		closeit = false;
 		fd = 1;
-	} else
-	if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
-		fatal("Unable to open file %s: %m\n", filename);
+	} else {
+		if (flags & RUNTIME_WRITE_ATOMIC) {
+			fd = __buffer_open_replacement(filename, realname, tmpname);
+			atomic = (fd >= 0);
+		}
+
+		if (fd < 0 && (fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+			error("Unable to open file %s: %m\n", filename);
+			goto failed;
+		}
 	}
 
 	while ((n = buffer_available(bp)) != 0) {
 		n = write(fd, buffer_read_pointer(bp), n);
-		if (n < 0)
-			fatal("write error on %s: %m\n", filename);
+		if (n < 0) {
+			error("write error on %s: %m\n", filename);
+			goto failed;
+		}
 
 		buffer_skip(bp, n);
 		written += n;
 	}
 
+	if (atomic) {
+		if (fsync(fd) < 0) {
+			error("Unable to sync %s: %m\n", tmpname);
+			goto failed;
+		}
+		if (rename(tmpname, realname) < 0) {
+			error("Unable to rename %s to %s: %m\n", tmpname, realname);
+			goto failed;
+		}
+	}
+
 	if (closeit)
 		close(fd);
 
 	debug2("Wrote %u bytes to %s\n", written, filename);
 	return true;
+
+failed:
+	if (atomic)
+		unlink(tmpname);
+	if (closeit && fd >= 0)
+		close(fd);
+
+	if (!(flags & RUNTIME_WRITE_NOFAIL))
+		fatal("Unable to write %s\n", filename);
+	return false;
+}
+
+bool
+buffer_write_file(const char *filename, buffer_t *bp)
+{
+	return buffer_write_file_ext(filename, bp, 0);
 }
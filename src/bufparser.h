@@ -328,5 +328,9 @@ buffer_copy(buffer_t *src, unsigned int count, buffer_t *dst)
 
 extern buffer_t *		buffer_read_file(const char *filename, int flags);
 extern bool			buffer_write_file(const char *filename, buffer_t *bp);
+extern bool			buffer_write_file_ext(const char *filename, buffer_t *bp, int flags);
+extern buffer_t *		buffer_map_file(const char *filename);
+extern buffer_t *		buffer_alloc_mapped(unsigned long size);
+extern void			buffer_unmap(buffer_t *bp);
 
 #endif /* BUFPARSER_H */
@@ -0,0 +1,363 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include "cache.h"
+#include "bufparser.h"
+#include "util.h"
+
+/*
+ * A simple on-disk cache for things that are expensive to compute, but
+ * do not change between invocations unless the underlying files change.
+ * Entries live in <cache_dir>/<type>/<key>.
+ *
+ * The cache is purely an optimization; any failure to read or write it
+ * results in a debug message, and we simply compute things the hard way.
+ */
+static bool		cache_enabled = true;
+
+void
+cache_set_enabled(bool enabled)
+{
+	if (cache_enabled && !enabled)
+		debug("Disabling persistent cache\n");
+	cache_enabled = enabled;
+}
+
+bool
+cache_is_enabled(void)
+{
+	return cache_enabled;
+}
+
+static const char *
+cache_path(const char *type, const char *key)
+{
+	static __thread char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s/%s", PCR_ORACLE_CACHE_DIR, type, key);
+	return path;
+}
+
+static bool
+cache_mkdir_p(char *path)
+{
+	char *s;
+	bool ok;
+
+	if (mkdir(path, 0700) >= 0 || errno == EEXIST)
+		return true;
+
+	if (errno != ENOENT)
+		return false;
+
+	if (!(s = strrchr(path, '/')) || s == path)
+		return false;
+
+	*s = '\0';
+	ok = cache_mkdir_p(path);
+	*s = '/';
+
+	return ok && (mkdir(path, 0700) >= 0 || errno == EEXIST);
+}
+
+buffer_t *
+cache_read(const char *type, const char *key)
+{
+	const char *path;
+	struct stat stb;
+	buffer_t *bp;
+	int fd, n;
+
+	if (!cache_enabled)
+		return NULL;
+
+	path = cache_path(type, key);
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (errno != ENOENT)
+			debug("Unable to open cache file %s: %m\n", path);
+		return NULL;
+	}
+
+	if (fstat(fd, &stb) < 0 || !S_ISREG(stb.st_mode)) {
+		close(fd);
+		return NULL;
+	}
+
+	bp = buffer_alloc_write(stb.st_size);
+	n = read(fd, bp->data, stb.st_size);
+	close(fd);
+
+	if (n != stb.st_size) {
+		debug("Short read from cache file %s\n", path);
+		buffer_free(bp);
+		return NULL;
+	}
+
+	bp->wpos = n;
+	debug2("Read %u bytes from cache file %s\n", n, path);
+	return bp;
+}
+
+/*
+ * Write the cache entry to a temporary file and rename it into place,
+ * so that concurrent readers never see a partially written entry.
+ */
+bool
+cache_write(const char *type, const char *key, buffer_t *bp)
+{
+	char path[PATH_MAX], temp[PATH_MAX];
+	char *s;
+	int fd;
+
+	if (!cache_enabled)
+		return false;
+
+	snprintf(path, sizeof(path), "%s", cache_path(type, key));
+	snprintf(temp, sizeof(temp), "%s.%u", path, (unsigned int) getpid());
+
+	if ((s = strrchr(path, '/')) != NULL) {
+		*s = '\0';
+		if (!cache_mkdir_p(path)) {
+			debug("Unable to create cache directory %s: %m\n", path);
+			return false;
+		}
+		*s = '/';
+	}
+
+	if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+		debug("Unable to create cache file %s: %m\n", temp);
+		return false;
+	}
+
+	while (buffer_available(bp)) {
+		int n;
+
+		n = write(fd, buffer_read_pointer(bp), buffer_available(bp));
+		if (n < 0) {
+			debug("Error writing cache file %s: %m\n", temp);
+			close(fd);
+			goto failed;
+		}
+		buffer_skip(bp, n);
+	}
+
+	if (close(fd) < 0 || rename(temp, path) < 0) {
+		debug("Unable to update cache file %s: %m\n", path);
+		goto failed;
+	}
+
+	debug2("Updated cache file %s\n", path);
+	return true;
+
+failed:
+	(void) unlink(temp);
+	return false;
+}
+
+void
+cache_remove(const char *type, const char *key)
+{
+	const char *path;
+
+	if (!cache_enabled)
+		return;
+
+	path = cache_path(type, key);
+	if (unlink(path) < 0 && errno != ENOENT)
+		debug("Unable to remove cache file %s: %m\n", path);
+}
+
+/*
+ * Mark an entry as recently used. Entries are evicted in order of their
+ * modification time, since atime is not reliable on most systems.
+ */
+void
+cache_touch(const char *type, const char *key)
+{
+	const char *path;
+
+	if (!cache_enabled)
+		return;
+
+	path = cache_path(type, key);
+	if (utimensat(AT_FDCWD, path, NULL, 0) < 0 && errno != ENOENT)
+		debug("Unable to touch cache file %s: %m\n", path);
+}
+
+struct cache_entry_info {
+	char *			name;
+	off_t			size;
+	struct timespec		mtime;
+};
+
+static int
+cache_entry_info_cmp(const void *a, const void *b)
+{
+	const struct cache_entry_info *ea = a, *eb = b;
+
+	if (ea->mtime.tv_sec != eb->mtime.tv_sec)
+		return ea->mtime.tv_sec < eb->mtime.tv_sec? -1 : 1;
+	if (ea->mtime.tv_nsec != eb->mtime.tv_nsec)
+		return ea->mtime.tv_nsec < eb->mtime.tv_nsec? -1 : 1;
+	return 0;
+}
+
+/*
+ * Keep the total size of all entries of the given type below max_size,
+ * by removing the least recently used ones.
+ */
+void
+cache_trim(const char *type, unsigned long max_size)
+{
+	struct cache_entry_info *entries = NULL;
+	unsigned int i, count = 0;
+	unsigned long total = 0;
+	char dir_path[PATH_MAX];
+	struct dirent *d;
+	DIR *dir;
+	int dfd;
+
+	if (!cache_enabled)
+		return;
+
+	snprintf(dir_path, sizeof(dir_path), "%s/%s", PCR_ORACLE_CACHE_DIR, type);
+	if (!(dir = opendir(dir_path)))
+		return;
+
+	dfd = dirfd(dir);
+	while ((d = readdir(dir)) != NULL) {
+		struct stat stb;
+
+		if (d->d_name[0] == '.')
+			continue;
+
+		if (fstatat(dfd, d->d_name, &stb, AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(stb.st_mode))
+			continue;
+
+		if ((count % 64) == 0) {
+			entries = realloc(entries, (count + 64) * sizeof(entries[0]));
+			if (entries == NULL)
+				fatal("%s: out of memory\n", __func__);
+		}
+
+		entries[count].name = strdup(d->d_name);
+		entries[count].size = stb.st_size;
+		entries[count].mtime = stb.st_mtim;
+		total += stb.st_size;
+		count++;
+	}
+
+	if (total > max_size) {
+		qsort(entries, count, sizeof(entries[0]), cache_entry_info_cmp);
+
+		for (i = 0; i < count && total > max_size; ++i) {
+			if (unlinkat(dfd, entries[i].name, 0) < 0) {
+				debug("Unable to remove cache file %s/%s: %m\n", dir_path, entries[i].name);
+				continue;
+			}
+			total -= entries[i].size;
+		}
+
+		debug("Evicted %u entries from %s\n", i, dir_path);
+	}
+
+	closedir(dir);
+
+	for (i = 0; i < count; ++i)
+		free(entries[i].name);
+	free(entries);
+}
+
+/*
+ * Helper functions for file identities
+ */
+void
+cache_file_id_from_stat(cache_file_id_t *id, const struct stat *stb)
+{
+	memset(id, 0, sizeof(*id));
+	id->dev = stb->st_dev;
+	id->ino = stb->st_ino;
+	id->size = stb->st_size;
+	id->mtime_sec = stb->st_mtim.tv_sec;
+	id->mtime_nsec = stb->st_mtim.tv_nsec;
+	id->ctime_sec = stb->st_ctim.tv_sec;
+	id->ctime_nsec = stb->st_ctim.tv_nsec;
+}
+
+/*
+ * Device and inode number are used as the name of the cache entry;
+ * the remaining fields are stored in the entry and checked on lookup.
+ */
+const char *
+cache_file_id_key(const cache_file_id_t *id)
+{
+	static __thread char key[64];
+
+	snprintf(key, sizeof(key), "%llx-%llx",
+			(unsigned long long) id->dev,
+			(unsigned long long) id->ino);
+	return key;
+}
+
+bool
+cache_file_id_put(buffer_t *bp, const cache_file_id_t *id)
+{
+	return buffer_put_u64le(bp, id->dev)
+	    && buffer_put_u64le(bp, id->ino)
+	    && buffer_put_u64le(bp, id->size)
+	    && buffer_put_u64le(bp, id->mtime_sec)
+	    && buffer_put_u64le(bp, id->mtime_nsec)
+	    && buffer_put_u64le(bp, id->ctime_sec)
+	    && buffer_put_u64le(bp, id->ctime_nsec);
+}
+
+bool
+cache_file_id_get(buffer_t *bp, cache_file_id_t *id)
+{
+	return buffer_get_u64le(bp, &id->dev)
+	    && buffer_get_u64le(bp, &id->ino)
+	    && buffer_get_u64le(bp, &id->size)
+	    && buffer_get_u64le(bp, &id->mtime_sec)
+	    && buffer_get_u64le(bp, &id->mtime_nsec)
+	    && buffer_get_u64le(bp, &id->ctime_sec)
+	    && buffer_get_u64le(bp, &id->ctime_nsec);
+}
+
+bool
+cache_file_id_equal(const cache_file_id_t *a, const cache_file_id_t *b)
+{
+	return a->dev == b->dev
+	    && a->ino == b->ino
+	    && a->size == b->size
+	    && a->mtime_sec == b->mtime_sec
+	    && a->mtime_nsec == b->mtime_nsec
+	    && a->ctime_sec == b->ctime_sec
+	    && a->ctime_nsec == b->ctime_nsec;
+}
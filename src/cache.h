@@ -0,0 +1,55 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <sys/stat.h>
+#include "types.h"
+
+#define PCR_ORACLE_CACHE_DIR	"/var/cache/pcr-oracle"
+
+/*
+ * Identifies a file across invocations. If any of these change, we
+ * consider the file modified.
+ */
+struct cache_file_id {
+	uint64_t		dev;
+	uint64_t		ino;
+	uint64_t		size;
+	uint64_t		mtime_sec, mtime_nsec;
+	uint64_t		ctime_sec, ctime_nsec;
+};
+
+extern void		cache_set_enabled(bool);
+extern bool		cache_is_enabled(void);
+extern buffer_t *	cache_read(const char *type, const char *key);
+extern bool		cache_write(const char *type, const char *key, buffer_t *);
+extern void		cache_remove(const char *type, const char *key);
+extern void		cache_touch(const char *type, const char *key);
+extern void		cache_trim(const char *type, unsigned long max_size);
+
+extern void		cache_file_id_from_stat(cache_file_id_t *, const struct stat *);
+extern const char *	cache_file_id_key(const cache_file_id_t *);
+extern bool		cache_file_id_put(buffer_t *, const cache_file_id_t *);
+extern bool		cache_file_id_get(buffer_t *, cache_file_id_t *);
+extern bool		cache_file_id_equal(const cache_file_id_t *, const cache_file_id_t *);
+
+#endif /* CACHE_H */
@@ -0,0 +1,764 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <json_object.h>
+
+#include "depend.h"
+#include "runtime.h"
+#include "bufparser.h"
+#include "digest.h"
+#include "cache.h"
+#include "util.h"
+
+/*
+ * A dependency describes one input of a prediction, together with
+ * what it looked like at the time: the stat() identity for files, and
+ * a sha256 digest for things that have no useful identity of their own,
+ * like EFI variables or the GPT.
+ */
+struct dependency {
+	int			type;
+	char *			name;
+	char *			arg;
+	uint64_t		lba;
+	uint32_t		count;
+
+	bool			missing;
+	cache_file_id_t		id;
+	tpm_evdigest_t		md;
+};
+
+struct dependency_list {
+	unsigned int		count;
+	struct dependency *	items;
+};
+
+static dependency_list_t *	dependency_recorder;
+
+dependency_list_t *
+dependency_list_new(void)
+{
+	return calloc(1, sizeof(dependency_list_t));
+}
+
+static void
+dependency_destroy(struct dependency *dep)
+{
+	drop_string(&dep->name);
+	drop_string(&dep->arg);
+}
+
+void
+dependency_list_free(dependency_list_t *list)
+{
+	unsigned int i;
+
+	for (i = 0; i < list->count; ++i)
+		dependency_destroy(&list->items[i]);
+	if (list->items)
+		free(list->items);
+	free(list);
+}
+
+unsigned int
+dependency_list_count(const dependency_list_t *list)
+{
+	return list->count;
+}
+
+static inline bool
+__string_equal(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return !strcmp(a, b);
+}
+
+static struct dependency *
+dependency_list_find(const dependency_list_t *list, int type, const char *name, const char *arg,
+		uint64_t lba, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < list->count; ++i) {
+		struct dependency *dep = &list->items[i];
+
+		if (dep->type == type
+		 && dep->lba == lba && dep->count == count
+		 && __string_equal(dep->name, name)
+		 && __string_equal(dep->arg, arg))
+			return dep;
+	}
+	return NULL;
+}
+
+static struct dependency *
+dependency_list_add(dependency_list_t *list, int type, const char *name, const char *arg,
+		uint64_t lba, unsigned int count)
+{
+	struct dependency *dep;
+
+	if ((list->count % 16) == 0) {
+		list->items = realloc(list->items, (list->count + 16) * sizeof(list->items[0]));
+		if (list->items == NULL)
+			fatal("%s: out of memory\n", __func__);
+	}
+
+	dep = &list->items[list->count++];
+	memset(dep, 0, sizeof(*dep));
+	dep->type = type;
+	assign_string(&dep->name, name);
+	assign_string(&dep->arg, arg);
+	dep->lba = lba;
+	dep->count = count;
+	return dep;
+}
+
+void
+dependency_list_merge(dependency_list_t *list, const dependency_list_t *other)
+{
+	unsigned int i;
+
+	for (i = 0; i < other->count; ++i) {
+		const struct dependency *src = &other->items[i];
+		struct dependency *dep;
+
+		if (dependency_list_find(list, src->type, src->name, src->arg, src->lba, src->count))
+			continue;
+
+		dep = dependency_list_add(list, src->type, src->name, src->arg, src->lba, src->count);
+		dep->missing = src->missing;
+		dep->id = src->id;
+		dep->md = src->md;
+	}
+}
+
+/*
+ * Serialization
+ */
+static bool
+__put_string(buffer_t *bp, const char *s)
+{
+	unsigned int len = s? strlen(s) : 0;
+	uint8_t present = (s != NULL);
+
+	return buffer_put_u8(bp, &present)
+	    && buffer_put_u32le(bp, len)
+	    && buffer_put(bp, s, len);
+}
+
+static bool
+__get_string(buffer_t *bp, char **var)
+{
+	uint8_t present;
+	uint32_t len;
+
+	if (!buffer_get_u8(bp, &present)
+	 || !buffer_get_u32le(bp, &len)
+	 || len > buffer_available(bp))
+		return false;
+
+	if (present) {
+		*var = malloc(len + 1);
+		if (!buffer_get(bp, *var, len))
+			return false;
+		(*var)[len] = '\0';
+	} else if (len != 0)
+		return false;
+
+	return true;
+}
+
+bool
+dependency_list_encode(buffer_t *bp, const dependency_list_t *list)
+{
+	unsigned int i;
+
+	if (!buffer_put_u32le(bp, list->count))
+		return false;
+
+	for (i = 0; i < list->count; ++i) {
+		const struct dependency *dep = &list->items[i];
+		uint8_t missing = dep->missing;
+
+		if (!buffer_put_u32le(bp, dep->type)
+		 || !__put_string(bp, dep->name)
+		 || !__put_string(bp, dep->arg)
+		 || !buffer_put_u64le(bp, dep->lba)
+		 || !buffer_put_u32le(bp, dep->count)
+		 || !buffer_put_u8(bp, &missing)
+		 || !cache_file_id_put(bp, &dep->id)
+		 || !buffer_put_u16le(bp, dep->md.algo? dep->md.algo->tcg_id : 0)
+		 || !buffer_put_u16le(bp, dep->md.size)
+		 || !buffer_put(bp, dep->md.data, dep->md.size))
+			return false;
+	}
+
+	return true;
+}
+
+dependency_list_t *
+dependency_list_decode(buffer_t *bp)
+{
+	dependency_list_t *list;
+	uint32_t i, count;
+
+	if (!buffer_get_u32le(bp, &count))
+		return NULL;
+
+	list = dependency_list_new();
+	for (i = 0; i < count; ++i) {
+		struct dependency *dep;
+		uint32_t type;
+		uint16_t algo, size;
+		uint8_t missing;
+
+		if (!buffer_get_u32le(bp, &type))
+			goto failed;
+
+		dep = dependency_list_add(list, type, NULL, NULL, 0, 0);
+		if (!__get_string(bp, &dep->name)
+		 || !__get_string(bp, &dep->arg)
+		 || !buffer_get_u64le(bp, &dep->lba)
+		 || !buffer_get_u32le(bp, &dep->count)
+		 || !buffer_get_u8(bp, &missing)
+		 || !cache_file_id_get(bp, &dep->id)
+		 || !buffer_get_u16le(bp, &algo)
+		 || !buffer_get_u16le(bp, &size)
+		 || size > sizeof(dep->md.data)
+		 || !buffer_get(bp, dep->md.data, size))
+			goto failed;
+
+		dep->missing = missing;
+		dep->md.algo = algo? digest_by_tpm_alg(algo) : NULL;
+		dep->md.size = size;
+	}
+
+	return list;
+
+failed:
+	dependency_list_free(list);
+	return NULL;
+}
+
+/*
+ * Recording
+ */
+dependency_list_t *
+dependency_record_start(dependency_list_t *list)
+{
+	dependency_list_t *previous = dependency_recorder;
+
+	dependency_recorder = list;
+	return previous;
+}
+
+void
+dependency_record_stop(dependency_list_t *previous)
+{
+	dependency_recorder = previous;
+}
+
+bool
+dependency_is_recording(void)
+{
+	return dependency_recorder != NULL;
+}
+
+void
+dependency_add_list(const dependency_list_t *list)
+{
+	if (dependency_recorder != NULL)
+		dependency_list_merge(dependency_recorder, list);
+}
+
+static void
+__dependency_set_digest(struct dependency *dep, const buffer_t *data)
+{
+	const tpm_evdigest_t *md;
+
+	md = digest_compute(digest_by_name("sha256"), buffer_read_pointer(data), buffer_available(data));
+	if (md == NULL)
+		fatal("Unable to compute sha256 digest\n");
+	dep->md = *md;
+}
+
+static bool
+__dependency_stat_file(const char *path, cache_file_id_t *id)
+{
+	struct stat stb;
+
+	if (stat(path, &stb) < 0) {
+		if (errno != ENOENT && errno != ENOTDIR)
+			debug("Cannot stat %s: %m\n", path);
+		return false;
+	}
+
+	cache_file_id_from_stat(id, &stb);
+	return true;
+}
+
+void
+dependency_add_file(const char *path)
+{
+	struct dependency *dep;
+
+	if (dependency_recorder == NULL || path == NULL || !strcmp(path, "-"))
+		return;
+
+	if (dependency_list_find(dependency_recorder, DEPENDENCY_FILE, path, NULL, 0, 0))
+		return;
+
+	dep = dependency_list_add(dependency_recorder, DEPENDENCY_FILE, path, NULL, 0, 0);
+	dep->missing = !__dependency_stat_file(path, &dep->id);
+}
+
+void
+dependency_add_efi_variable(const char *name, const buffer_t *data)
+{
+	struct dependency *dep;
+
+	if (dependency_recorder == NULL)
+		return;
+
+	if (dependency_list_find(dependency_recorder, DEPENDENCY_EFI_VARIABLE, name, NULL, 0, 0))
+		return;
+
+	dep = dependency_list_add(dependency_recorder, DEPENDENCY_EFI_VARIABLE, name, NULL, 0, 0);
+	if (data == NULL)
+		dep->missing = true;
+	else
+		__dependency_set_digest(dep, data);
+}
+
+void
+dependency_add_efi_application(const char *partition, const char *application, const cache_file_id_t *id)
+{
+	struct dependency *dep;
+
+	if (dependency_recorder == NULL)
+		return;
+
+	if (dependency_list_find(dependency_recorder, DEPENDENCY_EFI_APPLICATION, partition, application, 0, 0))
+		return;
+
+	dep = dependency_list_add(dependency_recorder, DEPENDENCY_EFI_APPLICATION, partition, application, 0, 0);
+	if (id == NULL)
+		dep->missing = true;
+	else
+		dep->id = *id;
+}
+
+void
+dependency_add_blocks(const char *device, uint64_t lba, unsigned int count, const buffer_t *data)
+{
+	struct dependency *dep;
+
+	if (dependency_recorder == NULL)
+		return;
+
+	if (dependency_list_find(dependency_recorder, DEPENDENCY_BLOCKS, device, NULL, lba, count))
+		return;
+
+	dep = dependency_list_add(dependency_recorder, DEPENDENCY_BLOCKS, device, NULL, lba, count);
+	__dependency_set_digest(dep, data);
+}
+
+void
+dependency_add_lookup(int type, const char *key, const char *value)
+{
+	struct dependency *dep;
+
+	if (dependency_recorder == NULL)
+		return;
+
+	if (dependency_list_find(dependency_recorder, type, key, NULL, 0, 0))
+		return;
+
+	dep = dependency_list_add(dependency_recorder, type, key, NULL, 0, 0);
+	if (value == NULL)
+		dep->missing = true;
+	else
+		assign_string(&dep->arg, value);
+}
+
+/*
+ * Checking whether the system still looks the way it did when
+ * the dependencies were recorded.
+ */
+static bool
+__dependency_check_data(const struct dependency *dep, buffer_t *data)
+{
+	struct dependency current;
+
+	if (data == NULL)
+		return dep->missing;
+	if (dep->missing)
+		return false;
+
+	__dependency_set_digest(&current, data);
+	return digest_equal(&current.md, &dep->md);
+}
+
+static bool
+__dependency_check_blocks(const struct dependency *dep)
+{
+	block_dev_io_t *io;
+	buffer_t *data;
+	bool ok;
+
+	if (!(io = runtime_blockdev_open(dep->name)))
+		return false;
+
+	data = runtime_blockdev_read_lba(io, dep->lba, dep->count);
+	runtime_blockdev_close(io);
+
+	if (data == NULL)
+		return false;
+
+	ok = __dependency_check_data(dep, data);
+	buffer_free(data);
+	return ok;
+}
+
+static bool
+__dependency_check_lookup(const struct dependency *dep, char *value)
+{
+	bool ok;
+
+	if (value == NULL)
+		return dep->missing;
+
+	ok = !dep->missing && __string_equal(dep->arg, value);
+	free(value);
+	return ok;
+}
+
+static bool
+dependency_is_current(const struct dependency *dep)
+{
+	cache_file_id_t id;
+	buffer_t *data;
+	bool ok;
+
+	switch (dep->type) {
+	case DEPENDENCY_FILE:
+		if (!__dependency_stat_file(dep->name, &id))
+			return dep->missing;
+		return !dep->missing && cache_file_id_equal(&id, &dep->id);
+
+	case DEPENDENCY_EFI_VARIABLE:
+		data = runtime_read_efi_variable(dep->name);
+		ok = __dependency_check_data(dep, data);
+		if (data)
+			buffer_free(data);
+		return ok;
+
+	case DEPENDENCY_EFI_APPLICATION:
+		if (!runtime_identify_efi_application(dep->name, dep->arg, &id))
+			return dep->missing;
+		return !dep->missing && cache_file_id_equal(&id, &dep->id);
+
+	case DEPENDENCY_BLOCKS:
+		return __dependency_check_blocks(dep);
+
+	case DEPENDENCY_PARTUUID:
+		return __dependency_check_lookup(dep, runtime_blockdev_by_partuuid(dep->name));
+
+	case DEPENDENCY_PARTITION_DISK:
+		return __dependency_check_lookup(dep, runtime_disk_for_partition(dep->name));
+	}
+
+	return false;
+}
+
+static const char *
+dependency_describe(const struct dependency *dep)
+{
+	static __thread char buffer[PATH_MAX + 64];
+
+	switch (dep->type) {
+	case DEPENDENCY_FILE:
+		snprintf(buffer, sizeof(buffer), "file %s", dep->name);
+		break;
+	case DEPENDENCY_EFI_VARIABLE:
+		snprintf(buffer, sizeof(buffer), "EFI variable %s", dep->name);
+		break;
+	case DEPENDENCY_EFI_APPLICATION:
+		snprintf(buffer, sizeof(buffer), "EFI application (%s)%s", dep->name, dep->arg);
+		break;
+	case DEPENDENCY_BLOCKS:
+		snprintf(buffer, sizeof(buffer), "blocks %llu-%llu of %s",
+				(unsigned long long) dep->lba,
+				(unsigned long long) (dep->lba + dep->count - 1), dep->name);
+		break;
+	case DEPENDENCY_PARTUUID:
+		snprintf(buffer, sizeof(buffer), "partition UUID %s", dep->name);
+		break;
+	case DEPENDENCY_PARTITION_DISK:
+		snprintf(buffer, sizeof(buffer), "disk of partition %s", dep->name);
+		break;
+	default:
+		snprintf(buffer, sizeof(buffer), "unknown dependency type %d", dep->type);
+	}
+
+	return buffer;
+}
+
+bool
+dependency_list_is_current(const dependency_list_t *list)
+{
+	unsigned int i;
+
+	for (i = 0; i < list->count; ++i) {
+		const struct dependency *dep = &list->items[i];
+
+		if (!dependency_is_current(dep)) {
+			debug("Dependency changed: %s\n", dependency_describe(dep));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Call fn for every file system path the list refers to, so that callers
+ * can watch them for changes.
+ */
+void
+dependency_list_foreach_path(const dependency_list_t *list, void (*fn)(const char *path, void *), void *user_data)
+{
+	char path[PATH_MAX];
+	unsigned int i;
+
+	for (i = 0; i < list->count; ++i) {
+		const struct dependency *dep = &list->items[i];
+
+		switch (dep->type) {
+		case DEPENDENCY_FILE:
+			fn(dep->name, user_data);
+			break;
+
+		case DEPENDENCY_EFI_VARIABLE:
+			snprintf(path, sizeof(path), "%s/%s", RUNTIME_EFIVARS_DIR, dep->name);
+			fn(path, user_data);
+			break;
+		}
+	}
+}
+
+/*
+ * Write the list of dependencies as a JSON document, so that other tools
+ * can decide whether a prediction is still valid (or which files to watch)
+ * without running pcr-oracle. Unlike the cache, the manifest carries a
+ * sha256 digest for files and EFI applications as well.
+ */
+static bool
+__dependency_digest_file(const char *path, tpm_evdigest_t *md)
+{
+	unsigned char buffer[65536];
+	digest_ctx_t *ctx;
+	int fd, n;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return false;
+
+	ctx = digest_ctx_new(digest_by_name("sha256"));
+	while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+		digest_ctx_update(ctx, buffer, n);
+	close(fd);
+
+	if (n == 0)
+		digest_ctx_final(ctx, md);
+	digest_ctx_free(ctx);
+	return n == 0;
+}
+
+static bool
+__dependency_digest_efi_application(const struct dependency *dep, tpm_evdigest_t *md)
+{
+	const tpm_evdigest_t *computed;
+	buffer_t *data;
+
+	if (!(data = runtime_map_efi_application(dep->name, dep->arg)))
+		return false;
+
+	computed = digest_buffer(digest_by_name("sha256"), data);
+	runtime_release_efi_application(data);
+
+	if (computed == NULL)
+		return false;
+	*md = *computed;
+	return true;
+}
+
+static void
+__manifest_add_string(struct json_object *obj, const char *name, const char *value)
+{
+	if (value != NULL)
+		json_object_object_add(obj, name, json_object_new_string(value));
+}
+
+static void
+__manifest_add_file_id(struct json_object *obj, const cache_file_id_t *id)
+{
+	char timebuf[64];
+
+	json_object_object_add(obj, "dev", json_object_new_int64(id->dev));
+	json_object_object_add(obj, "ino", json_object_new_int64(id->ino));
+	json_object_object_add(obj, "size", json_object_new_int64(id->size));
+
+	snprintf(timebuf, sizeof(timebuf), "%llu.%09llu",
+			(unsigned long long) id->mtime_sec, (unsigned long long) id->mtime_nsec);
+	__manifest_add_string(obj, "mtime", timebuf);
+	snprintf(timebuf, sizeof(timebuf), "%llu.%09llu",
+			(unsigned long long) id->ctime_sec, (unsigned long long) id->ctime_nsec);
+	__manifest_add_string(obj, "ctime", timebuf);
+}
+
+static void
+__manifest_add_digest(struct json_object *obj, const tpm_evdigest_t *md)
+{
+	__manifest_add_string(obj, "sha256", digest_print_value(md));
+}
+
+static struct json_object *
+dependency_to_json(const struct dependency *dep)
+{
+	struct json_object *obj;
+	tpm_evdigest_t md;
+	struct stat stb;
+
+	obj = json_object_new_object();
+	json_object_object_add(obj, "exists", json_object_new_boolean(!dep->missing));
+
+	switch (dep->type) {
+	case DEPENDENCY_FILE:
+		__manifest_add_string(obj, "type", "file");
+		__manifest_add_string(obj, "path", dep->name);
+		if (dep->missing)
+			break;
+		__manifest_add_file_id(obj, &dep->id);
+		if (stat(dep->name, &stb) >= 0 && S_ISREG(stb.st_mode)
+		 && __dependency_digest_file(dep->name, &md))
+			__manifest_add_digest(obj, &md);
+		break;
+
+	case DEPENDENCY_EFI_VARIABLE:
+		__manifest_add_string(obj, "type", "efi-variable");
+		__manifest_add_string(obj, "name", dep->name);
+		if (!dep->missing)
+			__manifest_add_digest(obj, &dep->md);
+		break;
+
+	case DEPENDENCY_EFI_APPLICATION:
+		__manifest_add_string(obj, "type", "efi-application");
+		__manifest_add_string(obj, "partition", dep->name);
+		__manifest_add_string(obj, "path", dep->arg);
+		if (dep->missing)
+			break;
+		__manifest_add_file_id(obj, &dep->id);
+		if (__dependency_digest_efi_application(dep, &md))
+			__manifest_add_digest(obj, &md);
+		break;
+
+	case DEPENDENCY_BLOCKS:
+		__manifest_add_string(obj, "type", "blocks");
+		__manifest_add_string(obj, "device", dep->name);
+		json_object_object_add(obj, "lba", json_object_new_int64(dep->lba));
+		json_object_object_add(obj, "count", json_object_new_int64(dep->count));
+		__manifest_add_digest(obj, &dep->md);
+		break;
+
+	case DEPENDENCY_PARTUUID:
+		__manifest_add_string(obj, "type", "partuuid");
+		__manifest_add_string(obj, "uuid", dep->name);
+		__manifest_add_string(obj, "device", dep->arg);
+		break;
+
+	case DEPENDENCY_PARTITION_DISK:
+		__manifest_add_string(obj, "type", "partition-disk");
+		__manifest_add_string(obj, "partition", dep->name);
+		__manifest_add_string(obj, "disk", dep->arg);
+		break;
+
+	default:
+		json_object_put(obj);
+		return NULL;
+	}
+
+	return obj;
+}
+
+bool
+dependency_list_write_manifest(const dependency_list_t *list, const char *path)
+{
+	struct json_object *doc, *items;
+	const char *text;
+	unsigned int i;
+	bool ok = true;
+	FILE *fp;
+
+	doc = json_object_new_object();
+	json_object_object_add(doc, "version", json_object_new_int(1));
+
+	items = json_object_new_array();
+	json_object_object_add(doc, "dependencies", items);
+
+	for (i = 0; i < list->count; ++i) {
+		struct json_object *obj;
+
+		if ((obj = dependency_to_json(&list->items[i])) != NULL)
+			json_object_array_add(items, obj);
+	}
+
+	text = json_object_to_json_string_ext(doc, JSON_C_TO_STRING_PRETTY);
+
+	if (path == NULL || !strcmp(path, "-")) {
+		fp = stdout;
+	} else if (!(fp = fopen(path, "w"))) {
+		error("Unable to open %s for writing: %m\n", path);
+		ok = false;
+		goto out;
+	}
+
+	fprintf(fp, "%s\n", text);
+	if (fp != stdout) {
+		if (fclose(fp) != 0) {
+			error("Error writing %s: %m\n", path);
+			ok = false;
+		}
+	} else {
+		fflush(fp);
+	}
+
+out:
+	json_object_put(doc);
+	return ok;
+}
@@ -0,0 +1,64 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#ifndef DEPEND_H
+#define DEPEND_H
+
+#include "types.h"
+
+/*
+ * While predicting, we record every piece of system state the prediction
+ * was derived from, so that we can later tell whether a cached result is
+ * still valid.
+ */
+enum {
+	DEPENDENCY_FILE = 1,		/* any file or directory, identified by stat() */
+	DEPENDENCY_EFI_VARIABLE,	/* contents of an EFI variable */
+	DEPENDENCY_EFI_APPLICATION,	/* file on an EFI system partition */
+	DEPENDENCY_BLOCKS,		/* sectors read from a block device */
+	DEPENDENCY_PARTUUID,		/* partition UUID -> block device */
+	DEPENDENCY_PARTITION_DISK,	/* partition -> disk */
+};
+
+extern dependency_list_t *	dependency_list_new(void);
+extern void			dependency_list_free(dependency_list_t *);
+extern unsigned int		dependency_list_count(const dependency_list_t *);
+extern void			dependency_list_merge(dependency_list_t *, const dependency_list_t *);
+extern bool			dependency_list_encode(buffer_t *, const dependency_list_t *);
+extern dependency_list_t *	dependency_list_decode(buffer_t *);
+extern bool			dependency_list_is_current(const dependency_list_t *);
+extern bool			dependency_list_write_manifest(const dependency_list_t *, const char *path);
+extern void			dependency_list_foreach_path(const dependency_list_t *,
+					void (*fn)(const char *path, void *), void *user_data);
+
+extern dependency_list_t *	dependency_record_start(dependency_list_t *);
+extern void			dependency_record_stop(dependency_list_t *previous);
+extern bool			dependency_is_recording(void);
+
+extern void			dependency_add_file(const char *path);
+extern void			dependency_add_efi_variable(const char *name, const buffer_t *data);
+extern void			dependency_add_efi_application(const char *partition, const char *application,
+					const cache_file_id_t *);
+extern void			dependency_add_blocks(const char *device, uint64_t lba, unsigned int count,
+					const buffer_t *data);
+extern void			dependency_add_lookup(int type, const char *key, const char *value);
+extern void			dependency_add_list(const dependency_list_t *);
+
+#endif /* DEPEND_H */
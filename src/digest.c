@@ -57,6 +57,69 @@ struct parsed_cert {
 	X509 *		x;
 };
 
+/*
+ * Looking up the EVP_MD by name and initializing a fresh context is
+ * much more expensive than hashing the 64 to 128 bytes of a PCR extend
+ * operation. So we do this once per algorithm, and clone the
+ * initialized context whenever we need a new one.
+ */
+struct digest_engine {
+	const EVP_MD *	evp_md;
+	EVP_MD_CTX *	initial;	/* initialized, never updated */
+	EVP_MD_CTX *	scratch;	/* for one-shot digests */
+};
+
+static struct digest_engine	digest_engines[TPM2_ALG_MAX];
+
+static struct digest_engine *
+digest_engine_get(const tpm_algo_info_t *algo_info)
+{
+	struct digest_engine *engine;
+	const EVP_MD *evp_md;
+	EVP_MD_CTX *initial;
+
+	if (algo_info->tcg_id >= TPM2_ALG_MAX)
+		fatal("%s: bad algorithm id %u\n", __func__, algo_info->tcg_id);
+
+	engine = &digest_engines[algo_info->tcg_id];
+	if (engine->initial != NULL)
+		return engine;
+
+	evp_md = EVP_get_digestbyname(algo_info->openssl_name);
+	if (evp_md == NULL) {
+		error("Unknown message digest %s\n", algo_info->openssl_name);
+		return NULL;
+	}
+
+	assert(EVP_MD_size(evp_md) == algo_info->digest_size);
+
+	/* Do not set engine->initial before it's usable; fatal() may be
+	 * trapped by libpcroracle, and the engine looked up again later. */
+	engine->evp_md = evp_md;
+	engine->scratch = EVP_MD_CTX_new();
+	initial = EVP_MD_CTX_new();
+	if (!EVP_DigestInit_ex(initial, evp_md, NULL))
+		fatal("%s: unable to initialize %s digest\n", __func__, algo_info->openssl_name);
+
+	engine->initial = initial;
+	return engine;
+}
+
+/*
+ * One-shot digest using the engine's scratch context. The caller
+ * must make sure that result has room for the algorithm's digest size.
+ */
+static bool
+digest_engine_compute(struct digest_engine *engine, const void *data, unsigned int size,
+			unsigned char *result, unsigned int *result_size)
+{
+	EVP_MD_CTX *mdctx = engine->scratch;
+
+	return EVP_MD_CTX_copy_ex(mdctx, engine->initial)
+	    && EVP_DigestUpdate(mdctx, data, size)
+	    && EVP_DigestFinal_ex(mdctx, result, result_size);
+}
+
 const tpm_algo_info_t *
 __digest_by_tpm_alg(unsigned int algo_id, const tpm_algo_info_t *algorithms, unsigned int num_algoritms)
 {
@@ -95,7 +158,7 @@ digest_by_name(const char *name)
 const char *
 digest_algo_name(const tpm_evdigest_t *md)
 {
-	static char temp[32];
+	static __thread char temp[32];
 	const char *name;
 
 	if (md->algo == NULL)
@@ -112,7 +175,7 @@ digest_algo_name(const tpm_evdigest_t *md)
 const char *
 digest_print(const tpm_evdigest_t *md)
 {
-	static char buffer[1024];
+	static __thread char buffer[1024];
 
 	snprintf(buffer, sizeof(buffer), "%s: %s",
 			digest_algo_name(md),
@@ -123,7 +186,7 @@ digest_print(const tpm_evdigest_t *md)
 const char *
 digest_print_value(const tpm_evdigest_t *md)
 {
-	static char buffer[2 * sizeof(md->data) + 1];
+	static __thread char buffer[2 * sizeof(md->data) + 1];
 	unsigned int i;
 
 	assert(md->size <= sizeof(md->data));
@@ -150,22 +213,63 @@ digest_set(tpm_evdigest_t *md, const tpm_algo_info_t *algo_info,
 const tpm_evdigest_t *
 digest_compute(const tpm_algo_info_t *algo_info, const void *data, unsigned int size)
 {
-	static tpm_evdigest_t md;
-	digest_ctx_t *ctx;
+	static __thread tpm_evdigest_t md;
+	struct digest_engine *engine;
 
 	memset(&md, 0, sizeof(md));
-	ctx = digest_ctx_new(algo_info);
-	if (ctx == NULL)
+	if (!(engine = digest_engine_get(algo_info)))
 		return NULL;
 
-	digest_ctx_update(ctx, data, size);
-	if (!digest_ctx_final(ctx, &md))
+	if (!digest_engine_compute(engine, data, size, md.data, &md.size))
 		return NULL;
 
-	digest_ctx_free(ctx);
+	md.algo = algo_info;
 	return &md;
 }
 
+/*
+ * PCR extend: pcr = H(pcr || d)
+ * For the common algorithms, the input has a fixed size, so we assemble
+ * it in a stack buffer and hash it with a single update call.
+ */
+static inline bool
+__digest_extend_fixed(struct digest_engine *engine, tpm_evdigest_t *pcr, const tpm_evdigest_t *d, unsigned int size)
+{
+	unsigned char buffer[2 * EVP_MAX_MD_SIZE];
+
+	memcpy(buffer, pcr->data, size);
+	memcpy(buffer + size, d->data, size);
+	return digest_engine_compute(engine, buffer, 2 * size, pcr->data, &pcr->size);
+}
+
+bool
+digest_extend(tpm_evdigest_t *pcr, const tpm_evdigest_t *d)
+{
+	struct digest_engine *engine;
+	EVP_MD_CTX *mdctx;
+
+	if (pcr->algo != d->algo || pcr->size != d->size) {
+		error("%s: algorithm mismatch\n", __func__);
+		return false;
+	}
+
+	if (!(engine = digest_engine_get(pcr->algo)))
+		return false;
+
+	switch (pcr->algo->tcg_id) {
+	case __TPM2_ALG_sha256:
+		return __digest_extend_fixed(engine, pcr, d, 32);
+	case __TPM2_ALG_sha384:
+		return __digest_extend_fixed(engine, pcr, d, 48);
+	}
+
+	mdctx = engine->scratch;
+	return EVP_MD_CTX_copy_ex(mdctx, engine->initial)
+	    && EVP_DigestUpdate(mdctx, pcr->data, pcr->size)
+	    && EVP_DigestUpdate(mdctx, d->data, d->size)
+	    && EVP_DigestFinal_ex(mdctx, pcr->data, &pcr->size);
+}
+
 const tpm_evdigest_t *
 digest_buffer(const tpm_algo_info_t *algo_info, struct buffer *buffer)
 {
@@ -228,20 +332,15 @@ struct digest_ctx {
 digest_ctx_t *
 digest_ctx_new(const tpm_algo_info_t *algo_info)
 {
-	const EVP_MD *evp_md;
+	struct digest_engine *engine;
 	digest_ctx_t *ctx;
 
-	evp_md = EVP_get_digestbyname(algo_info->openssl_name);
-	if (evp_md == NULL) {
-		error("Unknown message digest %s\n", algo_info->openssl_name);
+	if (!(engine = digest_engine_get(algo_info)))
 		return NULL;
-	}
-
-	assert(EVP_MD_size(evp_md) == algo_info->digest_size);
 
 	ctx = calloc(1, sizeof(*ctx));
 	ctx->mdctx = EVP_MD_CTX_new();
-	EVP_DigestInit_ex(ctx->mdctx, evp_md, NULL);
+	EVP_MD_CTX_copy_ex(ctx->mdctx, engine->initial);
 
 	ctx->md.algo = algo_info;
 
@@ -286,6 +385,110 @@ digest_ctx_free(digest_ctx_t *ctx)
 	free(ctx);
 }
 
+/*
+ * Drive several digest algorithms from a single update call.
+ * The data is fed to the algorithms in chunks small enough to stay
+ * in the CPU cache while all of them consume it, so hashing the data
+ * with N algorithms costs little more than hashing it with the slowest one.
+ */
+#define DIGEST_MULTI_CHUNK	(16 * 1024)
+
+struct digest_multi_ctx {
+	unsigned int	count;
+	digest_ctx_t *	ctx[DIGEST_MULTI_MAX];
+};
+
+digest_multi_ctx_t *
+digest_multi_ctx_new(unsigned int count, const tpm_algo_info_t * const *algos)
+{
+	digest_multi_ctx_t *multi;
+	unsigned int i;
+
+	if (count > DIGEST_MULTI_MAX) {
+		error("%s: too many digest algorithms (%u)\n", __func__, count);
+		return NULL;
+	}
+
+	multi = calloc(1, sizeof(*multi));
+	for (i = 0; i < count; ++i) {
+		if (!(multi->ctx[i] = digest_ctx_new(algos[i]))) {
+			digest_multi_ctx_free(multi);
+			return NULL;
+		}
+		multi->count++;
+	}
+
+	return multi;
+}
+
+void
+digest_multi_ctx_update(digest_multi_ctx_t *multi, const void *data, unsigned int size)
+{
+	const unsigned char *p = data;
+	unsigned int i;
+
+	if (multi->count == 1) {
+		digest_ctx_update(multi->ctx[0], data, size);
+		return;
+	}
+
+	while (size) {
+		unsigned int chunk = size;
+
+		if (chunk > DIGEST_MULTI_CHUNK)
+			chunk = DIGEST_MULTI_CHUNK;
+
+		for (i = 0; i < multi->count; ++i)
+			digest_ctx_update(multi->ctx[i], p, chunk);
+
+		p += chunk;
+		size -= chunk;
+	}
+}
+
+/*
+ * Store the resulting digests in result[0] ... result[count - 1],
+ * in the order in which the algorithms were given.
+ */
+bool
+digest_multi_ctx_final(digest_multi_ctx_t *multi, tpm_evdigest_t *result)
+{
+	unsigned int i;
+
+	for (i = 0; i < multi->count; ++i) {
+		if (!digest_ctx_final(multi->ctx[i], &result[i]))
+			return false;
+	}
+
+	return true;
+}
+
+void
+digest_multi_ctx_free(digest_multi_ctx_t *multi)
+{
+	unsigned int i;
+
+	for (i = 0; i < multi->count; ++i)
+		digest_ctx_free(multi->ctx[i]);
+	free(multi);
+}
+
+bool
+digest_multi_compute(unsigned int count, const tpm_algo_info_t * const *algos,
+		const void *data, unsigned int size, tpm_evdigest_t *result)
+{
+	digest_multi_ctx_t *multi;
+	bool ok;
+
+	if (!(multi = digest_multi_ctx_new(count, algos)))
+		return false;
+
+	digest_multi_ctx_update(multi, data, size);
+	ok = digest_multi_ctx_final(multi, result);
+	digest_multi_ctx_free(multi);
+	return ok;
+}
+
 /*
  * Information hiding for X509 certs
  */
@@ -309,7 +512,7 @@ parsed_cert_free(parsed_cert_t *cert)
 static const char *
 ossl_cert_subject(const X509 *x)
 {
-	static char namebuf[128];
+	static __thread char namebuf[128];
 	X509_NAME *name;
 
 	if (x == NULL)
@@ -324,7 +527,7 @@ ossl_cert_subject(const X509 *x)
 static const char *
 ossl_cert_issuer(const X509 *x)
 {
-	static char namebuf[128];
+	static __thread char namebuf[128];
 	X509_NAME *name;
 
 	if (x == NULL)
@@ -378,6 +581,18 @@ parsed_cert_issued_by(const parsed_cert_t *cert, const parsed_cert_t *potential_
 	return ossl_cert_issued_by(cert->x, potential_issuer->x);
 }
 
+unsigned long
+parsed_cert_subject_hash(const parsed_cert_t *cert)
+{
+	return X509_subject_name_hash(cert->x);
+}
+
+unsigned long
+parsed_cert_issuer_hash(const parsed_cert_t *cert)
+{
+	return X509_issuer_name_hash(cert->x);
+}
+
 parsed_cert_t *
 cert_parse(const buffer_t *bp)
 {
@@ -413,6 +628,12 @@ x509_as_buffer(X509 *x509)
 	return bp;
 }
 
+buffer_t *
+parsed_cert_encode(const parsed_cert_t *cert)
+{
+	return x509_as_buffer(cert->x);
+}
+
 parsed_cert_t *
 pkcs7_extract_signer(buffer_t *data)
 {
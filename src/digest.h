@@ -71,6 +71,16 @@ extern void			digest_ctx_free(digest_ctx_t *);
 extern const tpm_evdigest_t *	digest_buffer(const tpm_algo_info_t *, buffer_t *);
 extern const tpm_evdigest_t *	digest_compute(const tpm_algo_info_t *, const void *, unsigned int);
 extern const tpm_evdigest_t *	digest_from_file(const tpm_algo_info_t *algo_info, const char *filename, int flags);
+extern bool			digest_extend(tpm_evdigest_t *pcr, const tpm_evdigest_t *d);
+
+#define DIGEST_MULTI_MAX	4
+
+extern digest_multi_ctx_t *	digest_multi_ctx_new(unsigned int count, const tpm_algo_info_t * const *algos);
+extern void			digest_multi_ctx_update(digest_multi_ctx_t *, const void *, unsigned int);
+extern bool			digest_multi_ctx_final(digest_multi_ctx_t *, tpm_evdigest_t *result);
+extern void			digest_multi_ctx_free(digest_multi_ctx_t *);
+extern bool			digest_multi_compute(unsigned int count, const tpm_algo_info_t * const *algos,
+					const void *data, unsigned int size, tpm_evdigest_t *result);
 
 extern const tpm_algo_info_t *	__digest_by_tpm_alg(unsigned int, const tpm_algo_info_t *, unsigned int);
 
@@ -79,8 +89,11 @@ extern parsed_cert_t *		pkcs7_extract_signer(buffer_t *);
 
 extern parsed_cert_t *		cert_parse(const buffer_t *);
 extern void			parsed_cert_free(parsed_cert_t *);
+extern buffer_t *		parsed_cert_encode(const parsed_cert_t *);
 extern const char *		parsed_cert_subject(const parsed_cert_t *);
 extern const char *		parsed_cert_issuer(const parsed_cert_t *);
 extern bool			parsed_cert_issued_by(const parsed_cert_t *cert, const parsed_cert_t *potential_issuer);
+extern unsigned long		parsed_cert_subject_hash(const parsed_cert_t *);
+extern unsigned long		parsed_cert_issuer_hash(const parsed_cert_t *);
 
 #endif /* DIGEST_H */
@@ -0,0 +1,563 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+#include <openssl/obj_mac.h>
+#include <tss2_esys.h>
+#include <tss2_mu.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/param_build.h>
+#endif
+
+#include "duplicate.h"
+#include "digest.h"
+#include "tpm.h"
+#include "util.h"
+
+/*
+ * Create a sealed object for a TPM we do not have access to, given just the
+ * public area of the storage key it is to be imported under. This follows
+ * the duplication scheme of TPM 2.0 Part 1, section 23.3, using an outer
+ * wrapper only:
+ *
+ *   seed	random; encrypted to the parent with RSA-OAEP, or derived
+ *		from ECDH with an ephemeral key
+ *   symKey	KDFa(pNameAlg, seed, "STORAGE", name, NULL, symBits)
+ *   hmacKey	KDFa(pNameAlg, seed, "INTEGRITY", NULL, NULL, digestBits)
+ *   duplicate	outerHMAC || AES-CFB(symKey, TPM2B_SENSITIVE)
+ *
+ * where outerHMAC = HMAC(pNameAlg, hmacKey, encrypted sensitive || name).
+ * The target TPM turns this into a regular private area using TPM2_Import.
+ */
+
+/* Labels include the terminating NUL byte */
+#define DUPLICATE_LABEL		"DUPLICATE"
+#define STORAGE_LABEL		"STORAGE"
+#define INTEGRITY_LABEL		"INTEGRITY"
+
+#define ECC_P256_SIZE		32
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+# define __set1_encoded_point(pkey, data, len)	EVP_PKEY_set1_encoded_public_key(pkey, data, len)
+# define __get1_encoded_point(pkey, datap)	EVP_PKEY_get1_encoded_public_key(pkey, datap)
+#else
+# define __set1_encoded_point(pkey, data, len)	EVP_PKEY_set1_tls_encodedpoint(pkey, data, len)
+# define __get1_encoded_point(pkey, datap)	EVP_PKEY_get1_tls_encodedpoint(pkey, datap)
+#endif
+
+static inline void
+__put_be32(unsigned char *p, uint32_t value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static const EVP_MD *
+duplicate_md(TPMI_ALG_HASH alg)
+{
+	const tpm_algo_info_t *algo;
+	const EVP_MD *md = NULL;
+
+	if ((algo = digest_by_tpm_alg(alg)) != NULL)
+		md = EVP_get_digestbyname(algo->openssl_name);
+	if (md == NULL)
+		error("Unsupported name algorithm %u\n", alg);
+	return md;
+}
+
+/*
+ * KDFa from TPM 2.0 Part 1, section 11.4.10.2 (SP800-108 in counter mode with HMAC)
+ */
+static bool
+kdfa(const EVP_MD *md, const void *key, unsigned int key_len, const char *label,
+		const void *context_u, unsigned int u_len,
+		const void *context_v, unsigned int v_len,
+		unsigned int bits, unsigned char *result)
+{
+	unsigned int label_len = strlen(label) + 1;
+	unsigned int size = bits / 8, done = 0;
+	unsigned char *data, *p;
+	uint32_t counter = 0;
+	bool ok = true;
+
+	data = malloc(4 + label_len + u_len + v_len + 4);
+
+	while (ok && done < size) {
+		unsigned char md_buf[EVP_MAX_MD_SIZE];
+		unsigned int md_len, count;
+
+		p = data;
+		__put_be32(p, ++counter);
+		p += 4;
+		memcpy(p, label, label_len);
+		p += label_len;
+		if (u_len)
+			memcpy(p, context_u, u_len);
+		p += u_len;
+		if (v_len)
+			memcpy(p, context_v, v_len);
+		p += v_len;
+		__put_be32(p, bits);
+		p += 4;
+
+		if (!HMAC(md, key, key_len, data, p - data, md_buf, &md_len)) {
+			ok = false;
+			break;
+		}
+
+		count = size - done;
+		if (count > md_len)
+			count = md_len;
+		memcpy(result + done, md_buf, count);
+		done += count;
+	}
+
+	free(data);
+	return ok;
+}
+
+/*
+ * KDFe from TPM 2.0 Part 1, section 11.4.10.3 (SP800-56A concatenation KDF)
+ */
+static bool
+kdfe(const EVP_MD *md, const void *z, unsigned int z_len, const char *use,
+		const void *party_u, unsigned int u_len,
+		const void *party_v, unsigned int v_len,
+		unsigned int bits, unsigned char *result)
+{
+	unsigned int size = bits / 8, done = 0;
+	uint32_t counter = 0;
+	EVP_MD_CTX *ctx;
+	bool ok = true;
+
+	ctx = EVP_MD_CTX_new();
+	while (ok && done < size) {
+		unsigned char md_buf[EVP_MAX_MD_SIZE], counter_buf[4];
+		unsigned int md_len, count;
+
+		__put_be32(counter_buf, ++counter);
+		ok = EVP_DigestInit_ex(ctx, md, NULL)
+		  && EVP_DigestUpdate(ctx, counter_buf, 4)
+		  && EVP_DigestUpdate(ctx, z, z_len)
+		  && EVP_DigestUpdate(ctx, use, strlen(use) + 1)
+		  && EVP_DigestUpdate(ctx, party_u, u_len)
+		  && EVP_DigestUpdate(ctx, party_v, v_len)
+		  && EVP_DigestFinal_ex(ctx, md_buf, &md_len);
+		if (!ok)
+			break;
+
+		count = size - done;
+		if (count > md_len)
+			count = md_len;
+		memcpy(result + done, md_buf, count);
+		done += count;
+	}
+
+	EVP_MD_CTX_free(ctx);
+	return ok;
+}
+
+static EVP_PKEY *
+rsa_public_key_from_tpm(const TPMT_PUBLIC *pub)
+{
+	const TPM2B_PUBLIC_KEY_RSA *modulus = &pub->unique.rsa;
+	uint32_t exponent = pub->parameters.rsaDetail.exponent;
+	EVP_PKEY *pkey = NULL;
+	BIGNUM *n, *e;
+
+	/* An exponent of 0 denotes the default exponent */
+	if (exponent == 0)
+		exponent = RSA_F4;
+
+	n = BN_bin2bn(modulus->buffer, modulus->size, NULL);
+	e = BN_new();
+	BN_set_word(e, exponent);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	{
+		OSSL_PARAM_BLD *bld = OSSL_PARAM_BLD_new();
+		OSSL_PARAM *params = NULL;
+		EVP_PKEY_CTX *ctx = NULL;
+
+		if (OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_N, n)
+		 && OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_E, e)
+		 && (params = OSSL_PARAM_BLD_to_param(bld)) != NULL
+		 && (ctx = EVP_PKEY_CTX_new_from_name(NULL, "RSA", NULL)) != NULL
+		 && EVP_PKEY_fromdata_init(ctx) > 0
+		 && EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) <= 0)
+			pkey = NULL;
+
+		EVP_PKEY_CTX_free(ctx);
+		OSSL_PARAM_free(params);
+		OSSL_PARAM_BLD_free(bld);
+		BN_free(n);
+		BN_free(e);
+	}
+#else
+	{
+		RSA *rsa = RSA_new();
+
+		if (!RSA_set0_key(rsa, n, e, NULL)) {
+			BN_free(n);
+			BN_free(e);
+			RSA_free(rsa);
+			return NULL;
+		}
+
+		pkey = EVP_PKEY_new();
+		if (!EVP_PKEY_assign_RSA(pkey, rsa)) {
+			RSA_free(rsa);
+			EVP_PKEY_free(pkey);
+			pkey = NULL;
+		}
+	}
+#endif
+
+	return pkey;
+}
+
+/*
+ * For an RSA parent, the seed is random, and encrypted using OAEP with
+ * the parent's name algorithm and the label "DUPLICATE".
+ */
+static bool
+duplicate_seed_rsa(const TPMT_PUBLIC *parent, const EVP_MD *md,
+		unsigned char *seed, unsigned int seed_len,
+		TPM2B_ENCRYPTED_SECRET *encrypted_seed)
+{
+	EVP_PKEY_CTX *ctx = NULL;
+	EVP_PKEY *pkey = NULL;
+	unsigned char *label;
+	size_t out_len;
+	bool ok = false;
+
+	if (RAND_bytes(seed, seed_len) != 1)
+		goto out;
+
+	if (!(pkey = rsa_public_key_from_tpm(parent)))
+		goto out;
+
+	if (!(ctx = EVP_PKEY_CTX_new(pkey, NULL))
+	 || EVP_PKEY_encrypt_init(ctx) <= 0
+	 || EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) <= 0
+	 || EVP_PKEY_CTX_set_rsa_oaep_md(ctx, md) <= 0
+	 || EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, md) <= 0)
+		goto out;
+
+	/* The context takes ownership of the label */
+	label = OPENSSL_memdup(DUPLICATE_LABEL, sizeof(DUPLICATE_LABEL));
+	if (EVP_PKEY_CTX_set0_rsa_oaep_label(ctx, label, sizeof(DUPLICATE_LABEL)) <= 0) {
+		OPENSSL_free(label);
+		goto out;
+	}
+
+	out_len = sizeof(encrypted_seed->secret);
+	if (EVP_PKEY_encrypt(ctx, encrypted_seed->secret, &out_len, seed, seed_len) <= 0)
+		goto out;
+
+	encrypted_seed->size = out_len;
+	ok = true;
+
+out:
+	if (!ok)
+		error("Unable to encrypt the duplication seed to the RSA parent key\n");
+	if (ctx)
+		EVP_PKEY_CTX_free(ctx);
+	if (pkey)
+		EVP_PKEY_free(pkey);
+	return ok;
+}
+
+/*
+ * For an ECC parent, we generate an ephemeral key on the parent's curve. The seed
+ * is derived from the shared secret using KDFe, and the ephemeral public key is
+ * what we pass to the TPM.
+ */
+static bool
+duplicate_seed_ecc(const TPMT_PUBLIC *parent, const EVP_MD *md,
+		unsigned char *seed, unsigned int seed_len,
+		TPM2B_ENCRYPTED_SECRET *encrypted_seed)
+{
+	const TPMS_ECC_POINT *parent_point = &parent->unique.ecc;
+	unsigned char point[1 + 2 * ECC_P256_SIZE], z[ECC_P256_SIZE];
+	unsigned char *ephemeral_point = NULL;
+	EVP_PKEY *ephemeral = NULL, *peer = NULL;
+	EVP_PKEY_CTX *ctx = NULL;
+	TPMS_ECC_POINT ephemeral_public;
+	size_t z_len = sizeof(z), offset = 0;
+	bool ok = false;
+
+	if (parent->parameters.eccDetail.curveID != TPM2_ECC_NIST_P256) {
+		error("Unsupported ECC curve %u in parent key\n", parent->parameters.eccDetail.curveID);
+		return false;
+	}
+
+	if (parent_point->x.size != ECC_P256_SIZE || parent_point->y.size != ECC_P256_SIZE) {
+		error("Bad ECC point in parent key\n");
+		return false;
+	}
+
+	if (!(ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL))
+	 || EVP_PKEY_keygen_init(ctx) <= 0
+	 || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1) <= 0
+	 || EVP_PKEY_keygen(ctx, &ephemeral) <= 0)
+		goto out;
+	EVP_PKEY_CTX_free(ctx);
+	ctx = NULL;
+
+	point[0] = POINT_CONVERSION_UNCOMPRESSED;
+	memcpy(point + 1, parent_point->x.buffer, ECC_P256_SIZE);
+	memcpy(point + 1 + ECC_P256_SIZE, parent_point->y.buffer, ECC_P256_SIZE);
+
+	if (!(peer = EVP_PKEY_new())
+	 || !EVP_PKEY_copy_parameters(peer, ephemeral)
+	 || !__set1_encoded_point(peer, point, sizeof(point)))
+		goto out;
+
+	/* Z is the x coordinate of the shared point */
+	if (!(ctx = EVP_PKEY_CTX_new(ephemeral, NULL))
+	 || EVP_PKEY_derive_init(ctx) <= 0
+	 || EVP_PKEY_derive_set_peer(ctx, peer) <= 0
+	 || EVP_PKEY_derive(ctx, z, &z_len) <= 0)
+		goto out;
+
+	if (__get1_encoded_point(ephemeral, &ephemeral_point) != sizeof(point))
+		goto out;
+
+	memset(&ephemeral_public, 0, sizeof(ephemeral_public));
+	ephemeral_public.x.size = ECC_P256_SIZE;
+	memcpy(ephemeral_public.x.buffer, ephemeral_point + 1, ECC_P256_SIZE);
+	ephemeral_public.y.size = ECC_P256_SIZE;
+	memcpy(ephemeral_public.y.buffer, ephemeral_point + 1 + ECC_P256_SIZE, ECC_P256_SIZE);
+
+	if (!kdfe(md, z, z_len, DUPLICATE_LABEL,
+				ephemeral_public.x.buffer, ECC_P256_SIZE,
+				parent_point->x.buffer, ECC_P256_SIZE,
+				seed_len * 8, seed))
+		goto out;
+
+	if (Tss2_MU_TPMS_ECC_POINT_Marshal(&ephemeral_public, encrypted_seed->secret,
+				sizeof(encrypted_seed->secret), &offset) != TSS2_RC_SUCCESS)
+		goto out;
+
+	encrypted_seed->size = offset;
+	ok = true;
+
+out:
+	if (!ok)
+		error("Unable to derive the duplication seed from the ECC parent key\n");
+	OPENSSL_cleanse(z, sizeof(z));
+	if (ephemeral_point)
+		OPENSSL_free(ephemeral_point);
+	if (ctx)
+		EVP_PKEY_CTX_free(ctx);
+	if (peer)
+		EVP_PKEY_free(peer);
+	if (ephemeral)
+		EVP_PKEY_free(ephemeral);
+	return ok;
+}
+
+static bool
+aes_cfb_encrypt(const EVP_CIPHER *cipher, const unsigned char *key,
+		const unsigned char *in, unsigned int in_len, unsigned char *out)
+{
+	unsigned char iv[16] = { 0 };
+	EVP_CIPHER_CTX *ctx;
+	int len, final_len;
+	bool ok;
+
+	ctx = EVP_CIPHER_CTX_new();
+	ok = EVP_EncryptInit_ex(ctx, cipher, NULL, key, iv)
+	  && EVP_EncryptUpdate(ctx, out, &len, in, in_len)
+	  && EVP_EncryptFinal_ex(ctx, out + len, &final_len);
+	EVP_CIPHER_CTX_free(ctx);
+
+	return ok;
+}
+
+static const EVP_CIPHER *
+duplicate_cipher(const TPMT_SYM_DEF_OBJECT *sym)
+{
+	if (sym->algorithm == TPM2_ALG_AES && sym->mode.sym == TPM2_ALG_CFB) {
+		switch (sym->keyBits.sym) {
+		case 128:
+			return EVP_aes_128_cfb128();
+		case 192:
+			return EVP_aes_192_cfb128();
+		case 256:
+			return EVP_aes_256_cfb128();
+		}
+	}
+
+	error("Unsupported symmetric algorithm in parent key\n");
+	return NULL;
+}
+
+/*
+ * Build the public and sensitive areas of a sealed data object. Objects that
+ * are to be imported cannot be fixedTPM or fixedParent.
+ */
+static bool
+duplicate_make_object(const TPM2B_DIGEST *policy, const TPM2B_SENSITIVE_DATA *secret,
+		TPM2B_PUBLIC *sealed_public, TPM2B_SENSITIVE *sensitive)
+{
+	TPMT_PUBLIC *pub = &sealed_public->publicArea;
+	TPMT_SENSITIVE *sens = &sensitive->sensitiveArea;
+	const tpm_algo_info_t *algo;
+	digest_ctx_t *ctx;
+	tpm_evdigest_t md;
+
+	memset(sealed_public, 0, sizeof(*sealed_public));
+	sealed_public->size = sizeof(TPMT_PUBLIC);
+	pub->type = TPM2_ALG_KEYEDHASH;
+	pub->nameAlg = TPM2_ALG_SHA256;
+	pub->objectAttributes = 0;
+	pub->authPolicy = *policy;
+	pub->parameters.keyedHashDetail.scheme.scheme = TPM2_ALG_NULL;
+
+	algo = digest_by_tpm_alg(pub->nameAlg);
+
+	memset(sensitive, 0, sizeof(*sensitive));
+	sens->sensitiveType = TPM2_ALG_KEYEDHASH;
+	sens->seedValue.size = algo->digest_size;
+	if (RAND_bytes(sens->seedValue.buffer, sens->seedValue.size) != 1)
+		return false;
+	sens->sensitive.bits = *secret;
+
+	/* The unique field of a data object is H(seedValue || data) */
+	ctx = digest_ctx_new(algo);
+	digest_ctx_update(ctx, sens->seedValue.buffer, sens->seedValue.size);
+	digest_ctx_update(ctx, sens->sensitive.bits.buffer, sens->sensitive.bits.size);
+	digest_ctx_final(ctx, &md);
+	digest_ctx_free(ctx);
+
+	pub->unique.keyedHash.size = md.size;
+	memcpy(pub->unique.keyedHash.buffer, md.data, md.size);
+	return true;
+}
+
+bool
+tpm_duplicate_sealed_secret(const TPM2B_PUBLIC *parent,
+		const TPM2B_DIGEST *policy, const TPM2B_SENSITIVE_DATA *secret,
+		TPM2B_PUBLIC *sealed_public, TPM2B_PRIVATE *duplicate,
+		TPM2B_ENCRYPTED_SECRET *encrypted_seed)
+{
+	const TPMT_PUBLIC *parent_area = &parent->publicArea;
+	const TPMA_OBJECT storage_attrs = TPMA_OBJECT_RESTRICTED|TPMA_OBJECT_DECRYPT;
+	unsigned char seed[EVP_MAX_MD_SIZE], sym_key[32], hmac_key[EVP_MAX_MD_SIZE];
+	unsigned char plain[sizeof(TPM2B_SENSITIVE)];
+	unsigned char *hmac_data = NULL, *enc;
+	const EVP_CIPHER *cipher;
+	const EVP_MD *md;
+	TPM2B_SENSITIVE sensitive;
+	TPM2B_DIGEST outer_hmac;
+	TPM2B_NAME name;
+	unsigned int seed_len, hmac_len;
+	size_t plain_len = 0, offset = 0;
+	bool ok = false;
+
+	if ((parent_area->objectAttributes & storage_attrs) != storage_attrs) {
+		error("The parent key is not a storage key\n");
+		return false;
+	}
+
+	if (!(md = duplicate_md(parent_area->nameAlg)))
+		return false;
+	if (!(cipher = duplicate_cipher(&parent_area->parameters.asymDetail.symmetric)))
+		return false;
+
+	if (!duplicate_make_object(policy, secret, sealed_public, &sensitive))
+		goto out;
+
+	if (!tss_public_name(sealed_public, &name))
+		goto out;
+
+	seed_len = EVP_MD_size(md);
+	switch (parent_area->type) {
+	case TPM2_ALG_RSA:
+		ok = duplicate_seed_rsa(parent_area, md, seed, seed_len, encrypted_seed);
+		break;
+	case TPM2_ALG_ECC:
+		ok = duplicate_seed_ecc(parent_area, md, seed, seed_len, encrypted_seed);
+		break;
+	default:
+		error("Unsupported parent key type %u\n", parent_area->type);
+		break;
+	}
+	if (!ok)
+		goto out;
+	ok = false;
+
+	if (!kdfa(md, seed, seed_len, STORAGE_LABEL, name.name, name.size, NULL, 0,
+				EVP_CIPHER_key_length(cipher) * 8, sym_key)
+	 || !kdfa(md, seed, seed_len, INTEGRITY_LABEL, NULL, 0, NULL, 0,
+				seed_len * 8, hmac_key))
+		goto out;
+
+	if (Tss2_MU_TPM2B_SENSITIVE_Marshal(&sensitive, plain, sizeof(plain), &plain_len) != TSS2_RC_SUCCESS)
+		goto out;
+
+	/* The duplicate is the outer HMAC as a TPM2B, followed by the encrypted sensitive area */
+	if (2 + seed_len + plain_len > sizeof(duplicate->buffer))
+		goto out;
+	enc = duplicate->buffer + 2 + seed_len;
+
+	if (!aes_cfb_encrypt(cipher, sym_key, plain, plain_len, enc))
+		goto out;
+
+	hmac_data = malloc(plain_len + name.size);
+	memcpy(hmac_data, enc, plain_len);
+	memcpy(hmac_data + plain_len, name.name, name.size);
+
+	if (!HMAC(md, hmac_key, seed_len, hmac_data, plain_len + name.size, outer_hmac.buffer, &hmac_len))
+		goto out;
+	outer_hmac.size = hmac_len;
+
+	if (Tss2_MU_TPM2B_DIGEST_Marshal(&outer_hmac, duplicate->buffer, 2 + seed_len, &offset) != TSS2_RC_SUCCESS)
+		goto out;
+
+	duplicate->size = offset + plain_len;
+	ok = true;
+
+out:
+	if (!ok)
+		error("Unable to create importable sealed object\n");
+
+	OPENSSL_cleanse(seed, sizeof(seed));
+	OPENSSL_cleanse(sym_key, sizeof(sym_key));
+	OPENSSL_cleanse(hmac_key, sizeof(hmac_key));
+	OPENSSL_cleanse(plain, sizeof(plain));
+	OPENSSL_cleanse(&sensitive, sizeof(sensitive));
+	if (hmac_data)
+		free(hmac_data);
+	return ok;
+}
@@ -0,0 +1,34 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#ifndef DUPLICATE_H
+#define DUPLICATE_H
+
+#include <stdbool.h>
+#include <tss2_tpm2_types.h>
+
+extern bool		tpm_duplicate_sealed_secret(const TPM2B_PUBLIC *parent,
+				const TPM2B_DIGEST *policy,
+				const TPM2B_SENSITIVE_DATA *secret,
+				TPM2B_PUBLIC *sealed_public,
+				TPM2B_PRIVATE *duplicate,
+				TPM2B_ENCRYPTED_SECRET *encrypted_seed);
+
+#endif /* DUPLICATE_H */
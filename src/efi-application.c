@@ -30,7 +30,9 @@
 #include "bufparser.h"
 #include "runtime.h"
 #include "authenticode.h"
+#include "cache.h"
 #include "digest.h"
+#include "efi-sigdb.h"
 #include "sd-boot.h"
 #include "util.h"
 
@@ -68,7 +70,7 @@ __tpm_event_efi_bsa_print(tpm_parsed_event_t *parsed, tpm_event_bit_printer *pri
 static const char *
 __tpm_event_efi_bsa_describe(const tpm_parsed_event_t *parsed)
 {
-	static char buffer[1024];
+	static __thread char buffer[1024];
 	char *result;
 
 	if (parsed->efi_bsa_event.efi_application) {
@@ -155,7 +157,10 @@ __tpm_event_efi_bsa_inspect_image(tpm_parsed_event_t *parsed)
         struct efi_bsa_event *evspec = &parsed->efi_bsa_event;
 	char path[PATH_MAX];
 	const char *display_name;
+	pecoff_image_info_t *img;
 	buffer_t *img_data;
+	cache_file_id_t file_id;
+	bool have_file_id = false;
 
 	if (!evspec->efi_application)
 		return false;
@@ -166,16 +171,33 @@ __tpm_event_efi_bsa_inspect_image(tpm_parsed_event_t *parsed)
 	} else
 		display_name = evspec->efi_application;
 
-	img_data = runtime_read_efi_application(evspec->efi_partition, evspec->efi_application);
+	if (runtime_identify_efi_application(evspec->efi_partition, evspec->efi_application, &file_id)) {
+		have_file_id = true;
+		if ((evspec->img_info = authenticode_cache_lookup(&file_id, display_name)) != NULL)
+			return true;
+	}
+
+	img_data = runtime_map_efi_application(evspec->efi_partition, evspec->efi_application);
 	if (img_data == NULL)
 		fatal("Failed to locate EFI application %s\n", display_name);
 
-	/* if successful, this takes ownership of img_data */
-	if (!(evspec->img_info = pecoff_inspect(img_data, display_name))) {
-		buffer_free(img_data);
-		return false;
+	/* Compute everything we need from the image right away, so that
+	 * we do not hold on to the image data for the rest of the run. */
+	if ((img = pecoff_inspect(img_data, display_name)) != NULL
+	 && !pecoff_image_info_drop_data(img)) {
+		pecoff_image_info_free(img);
+		img = NULL;
 	}
 
+	runtime_release_efi_application(img_data);
+
+	if (img == NULL)
+		return false;
+
+	if (have_file_id)
+		authenticode_cache_update(img, &file_id);
+
+	evspec->img_info = img;
 	return true;
 }
 
@@ -227,20 +249,11 @@ __pecoff_rehash_old(tpm_event_log_rehash_ctx_t *ctx, const char *filename)
 static const tpm_evdigest_t *
 __efi_application_rehash_direct(const struct efi_bsa_event *evspec, tpm_event_log_rehash_ctx_t *ctx)
 {
-	const tpm_evdigest_t *md;
-	digest_ctx_t *digest;
-
 	debug("Computing authenticode digest using built-in PECOFF parser\n");
 	if (evspec->img_info == NULL)
 		return NULL;
 
-	digest = digest_ctx_new(ctx->algo);
-
-	md = authenticode_get_digest(evspec->img_info, digest);
-
-	digest_ctx_free(digest);
-
-	return md;
+	return authenticode_get_digest(evspec->img_info, ctx->algo);
 }
 
 static const tpm_evdigest_t *
@@ -291,9 +304,10 @@ __tpm_event_efi_bsa_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *pars
 	}
 
 	/* The next boot can have a different kernel */
-	if (sdb_is_kernel(evspec->efi_application) && ctx->boot_entry) {
-		new_application = ctx->boot_entry->image_path;
-		if (new_application) {
+	if (sdb_is_kernel(evspec->efi_application)) {
+		ctx->consulted |= REHASH_CONSULTED_BOOT_ENTRY;
+
+		if (ctx->boot_entry && (new_application = ctx->boot_entry->image_path) != NULL) {
 			evspec_clone = *evspec;
 			evspec_clone.efi_application = strdup(new_application);
 			evspec = &evspec_clone;
@@ -306,102 +320,6 @@ __tpm_event_efi_bsa_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *pars
 	return __efi_application_rehash_direct(evspec, ctx);
 }
 
-#define EFI_MAX_SIGNATURES	16
-
-typedef struct efi_signature_data {
-	unsigned char		owner[16];
-	unsigned int		len;
-	const unsigned char *	data;
-	unsigned int		raw_len;
-	const unsigned char *	raw_data;
-} efi_signature_data_t;
-
-typedef struct efi_signature_list {
-	unsigned char		type[16];
-	uint32_t		list_size;
-	uint32_t		header_size;
-	uint32_t		signature_size;
-	const unsigned char *	header;
-
-	unsigned int		num_signatures;
-	efi_signature_data_t	signatures[EFI_MAX_SIGNATURES];
-} efi_signature_list_t;
-
-static bool
-__efi_signature_data_parse(buffer_t *bp, unsigned int sig_size, efi_signature_data_t *result)
-{
-	memset(result, 0, sizeof(*result));
-	result->raw_data = buffer_read_pointer(bp);
-	result->raw_len = sig_size;
-	if (!buffer_get(bp, result->owner, sizeof(result->owner)))
-		return false;
-
-	result->data = buffer_read_pointer(bp);
-	result->len = sig_size - 16;
-	if (!buffer_skip(bp, sig_size - 16))
-		return false;
-
-	return true;
-}
-
-static bool
-__efi_signature_list_parse(buffer_t *db_data, unsigned int list_num, efi_signature_list_t *result)
-{
-	unsigned int payload_size, i;
-	buffer_t list;
-
-	memset(result, 0, sizeof(*result));
-
-	debug2("Parsing list %u:\n");
-	hexdump(buffer_read_pointer(db_data), 28, debug2, 8);
-
-	if (!buffer_get(db_data, result->type, sizeof(result->type))
-	 || !buffer_get_u32le(db_data, &result->list_size)
-	 || !buffer_get_u32le(db_data, &result->header_size)
-	 || !buffer_get_u32le(db_data, &result->signature_size))
-		return false;
-
-	if (result->header_size) {
-		if (result->header_size >= result->list_size) {
-			error("%s: list entry header too large (list_size=%u, header_size=%u)\n",
-					__func__, result->list_size, result->header_size);
-			return false;
-		}
-		result->header = buffer_read_pointer(db_data);
-		if (!buffer_skip(db_data, result->header_size))
-			return false;
-	}
-
-	if (result->signature_size == 0) {
-		error("%s: signature list with signature_size 0\n", __func__);
-		return false;
-	}
-
-	/* Compute the size of the signatures[] array */
-	payload_size = result->list_size - 16 - 3 * 4 - result->header_size;
-
-	if (!buffer_get_buffer(db_data, payload_size, &list)) {
-		error("%s: list entry too large (list_size=%u)\n", __func__, result->list_size);
-		return false;
-	}
-
-	result->num_signatures = payload_size / result->signature_size;
-	if (result->num_signatures * result->signature_size != payload_size) {
-		error("%s: entry with odd signatures[] array (%u is not a multiple of sig size %u)\n",
-				__func__, payload_size, result->signature_size);
-		return false;
-	}
-
-	for (i = 0; i < result->num_signatures; ++i) {
-		if (!__efi_signature_data_parse(&list, result->signature_size, &result->signatures[i])) {
-			error("%s: unable to parse signature %u of list %u\n", __func__, i, list_num);
-			return false;
-		}
-	}
-
-	return true;
-}
-
 static buffer_t *
 efi_application_locate_and_check_shim_vendor_cert(const parsed_cert_t *signer)
 {
@@ -445,9 +363,7 @@ buffer_t *
 efi_application_locate_authority_record(const char *db_name, const parsed_cert_t *signer)
 {
 	const char *var_name = NULL;
-	buffer_t *db_data;
-	buffer_t *result = NULL;
-	unsigned int list_num = 0;
+	efi_sigdb_t *db;
 
 	/* This is a special case. The shim does not consult any regular certificate lists
 	 * but checks its built-in vendor cert. */
@@ -470,57 +386,8 @@ efi_application_locate_authority_record(const char *db_name, const parsed_cert_t
 		debug2("  issuer  %s\n", parsed_cert_issuer(signer));
 	}
 
-	if (!(db_data = runtime_read_efi_variable(var_name)))
+	if (!(db = efi_sigdb_get(var_name)))
 		return NULL;
 
-	while (buffer_available(db_data) != 0) {
-		static unsigned char efi_cert_x509_guid[] = {
-			0xa1, 0x59, 0xc0, 0xa5, 0xe4, 0x94, 0xa7, 0x4a,
-			0x87, 0xb5, 0xab, 0x15, 0x5c, 0x2b, 0xf0, 0x72 };
-		efi_signature_list_t sig_list;
-		unsigned int i;
-
-		if (!__efi_signature_list_parse(db_data, list_num, &sig_list)) {
-			error("%s: unable to parse signature list %u in %s\n", __func__, list_num, var_name);
-			goto out;
-		}
-
-		if (memcmp(sig_list.type, efi_cert_x509_guid, 16)) {
-			debug(" %u ignoring signature list with type %s\n", list_num, tpm_event_decode_uuid(sig_list.type));
-			continue;
-		}
-
-		debug2(" %u inspecting X.509 signature list\n", list_num, tpm_event_decode_uuid(sig_list.type));
-		for (i = 0; i < sig_list.num_signatures; ++i) {
-			efi_signature_data_t *sig_data = &sig_list.signatures[i];
-			parsed_cert_t *authority;
-			buffer_t cert_buf;
-
-			buffer_init_read(&cert_buf, (void *) sig_data->data, sig_data->len);
-
-			if (!(authority = cert_parse(&cert_buf))) {
-				error("Unparseable X509 certificate in %s\n", var_name);
-				continue;
-			}
-
-			debug2(" %u.%u: owner %s\n", list_num, i, tpm_event_decode_uuid(sig_data->owner));
-			debug2("    cert subject: %s\n", parsed_cert_subject(authority));
-
-			if (parsed_cert_issued_by(signer, authority)) {
-				debug("Found authority record for %s\n", parsed_cert_subject(authority));
-				result = buffer_alloc_write(sig_data->raw_len);
-				buffer_put(result, sig_data->raw_data, sig_data->raw_len);
-				parsed_cert_free(authority);
-				break;
-			}
-
-			parsed_cert_free(authority);
-		}
-
-		list_num++;
-	}
-
-out:
-	buffer_free(db_data);
-	return result;
+	return efi_sigdb_find_authority(db, signer);
 }
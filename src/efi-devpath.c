@@ -61,7 +61,7 @@ __tpm_event_parse_efi_device_path(efi_device_path_t *path, buffer_t *bp)
 static const char *
 __efi_device_path_type_to_string(unsigned int type, unsigned int subtype)
 {
-	static char retbuf[128];
+	static __thread char retbuf[128];
 	const char *type_string;
 
 	switch (type) {
@@ -126,7 +126,7 @@ __tpm_event_efi_device_path_item_harddisk_uuid(const struct efi_device_path_item
 const char *
 __tpm_event_efi_device_path_item_file_path(const struct efi_device_path_item *item)
 {
-	static char file_path[PATH_MAX];
+	static __thread char file_path[PATH_MAX];
 
 	if (item->type == TPM2_EFI_DEVPATH_TYPE_MEDIA_DEVICE
 	 && item->subtype == TPM2_EFI_DEVPATH_MEDIA_SUBTYPE_FILE_PATH) {
@@ -154,7 +154,7 @@ __tpm_event_efi_device_path_item_file_path(const struct efi_device_path_item *it
 static const char *
 __tpm_event_efi_device_path_item_pnp_name(const struct efi_device_path_item *item)
 {
-	static char name_path[32];
+	static __thread char name_path[32];
 
 	if (item->type == TPM2_EFI_DEVPATH_TYPE_ACPI_DEVICE) {
 		uint32_t pnp_hid, pnp_uid;
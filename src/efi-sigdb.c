@@ -0,0 +1,290 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "oracle.h"
+#include "eventlog.h"
+#include "bufparser.h"
+#include "runtime.h"
+#include "digest.h"
+#include "efi-sigdb.h"
+#include "depend.h"
+#include "util.h"
+
+/*
+ * Signature databases such as db or MokListRT are consulted for every
+ * EFI_VARIABLE_AUTHORITY event. We parse each of them once per run, and
+ * index the X.509 certificates they contain by the hash of their subject
+ * name, so that finding the issuer of a signing certificate does not
+ * require walking (and DER-parsing) the entire database.
+ */
+#define EFI_SIGDB_HASH_SIZE	64
+
+struct efi_sigdb_entry {
+	struct efi_sigdb_entry *hash_next;
+	unsigned long		subject_hash;
+	parsed_cert_t *		cert;
+
+	/* Location of the EFI_SIGNATURE_DATA record (owner GUID + cert) */
+	unsigned int		raw_offset;
+	unsigned int		raw_len;
+};
+
+struct efi_sigdb {
+	struct efi_sigdb *	next;
+	char *			var_name;
+	buffer_t *		data;
+
+	unsigned int		num_entries;
+	struct efi_sigdb_entry *entries;
+	struct efi_sigdb_entry *hash[EFI_SIGDB_HASH_SIZE];
+};
+
+typedef struct efi_signature_list {
+	unsigned char		type[16];
+	uint32_t		list_size;
+	uint32_t		header_size;
+	uint32_t		signature_size;
+	const unsigned char *	header;
+
+	unsigned int		num_signatures;
+	buffer_t		signatures;
+} efi_signature_list_t;
+
+static efi_sigdb_t *		efi_sigdb_list;
+
+static bool
+__efi_signature_list_parse(buffer_t *db_data, unsigned int list_num, efi_signature_list_t *result)
+{
+	unsigned int payload_size;
+
+	memset(result, 0, sizeof(*result));
+
+	debug2("Parsing list %u:\n", list_num);
+	hexdump(buffer_read_pointer(db_data), 28, debug2, 8);
+
+	if (!buffer_get(db_data, result->type, sizeof(result->type))
+	 || !buffer_get_u32le(db_data, &result->list_size)
+	 || !buffer_get_u32le(db_data, &result->header_size)
+	 || !buffer_get_u32le(db_data, &result->signature_size))
+		return false;
+
+	if (result->header_size) {
+		if (result->header_size >= result->list_size) {
+			error("%s: list entry header too large (list_size=%u, header_size=%u)\n",
+					__func__, result->list_size, result->header_size);
+			return false;
+		}
+		result->header = buffer_read_pointer(db_data);
+		if (!buffer_skip(db_data, result->header_size))
+			return false;
+	}
+
+	if (result->signature_size <= 16) {
+		error("%s: signature list with signature_size %u\n", __func__, result->signature_size);
+		return false;
+	}
+
+	if (result->list_size < 16 + 3 * 4 + result->header_size) {
+		error("%s: list entry too small (list_size=%u)\n", __func__, result->list_size);
+		return false;
+	}
+
+	/* Compute the size of the signatures[] array */
+	payload_size = result->list_size - 16 - 3 * 4 - result->header_size;
+
+	if (!buffer_get_buffer(db_data, payload_size, &result->signatures)) {
+		error("%s: list entry too large (list_size=%u)\n", __func__, result->list_size);
+		return false;
+	}
+
+	result->num_signatures = payload_size / result->signature_size;
+	if (result->num_signatures * result->signature_size != payload_size) {
+		error("%s: entry with odd signatures[] array (%u is not a multiple of sig size %u)\n",
+				__func__, payload_size, result->signature_size);
+		return false;
+	}
+
+	return true;
+}
+
+static void
+efi_sigdb_add_entry(efi_sigdb_t *db, parsed_cert_t *cert, const unsigned char *raw_data, unsigned int raw_len)
+{
+	struct efi_sigdb_entry *entry;
+
+	if ((db->num_entries % 16) == 0) {
+		db->entries = realloc(db->entries, (db->num_entries + 16) * sizeof(db->entries[0]));
+		if (db->entries == NULL)
+			fatal("%s: out of memory\n", __func__);
+	}
+
+	entry = &db->entries[db->num_entries++];
+	memset(entry, 0, sizeof(*entry));
+	entry->subject_hash = parsed_cert_subject_hash(cert);
+	entry->cert = cert;
+	entry->raw_offset = raw_data - db->data->data;
+	entry->raw_len = raw_len;
+}
+
+static void
+efi_sigdb_parse(efi_sigdb_t *db)
+{
+	static unsigned char efi_cert_x509_guid[] = {
+		0xa1, 0x59, 0xc0, 0xa5, 0xe4, 0x94, 0xa7, 0x4a,
+		0x87, 0xb5, 0xab, 0x15, 0x5c, 0x2b, 0xf0, 0x72 };
+	buffer_t *db_data = db->data;
+	unsigned int list_num, i;
+
+	for (list_num = 0; buffer_available(db_data) != 0; ++list_num) {
+		efi_signature_list_t sig_list;
+
+		if (!__efi_signature_list_parse(db_data, list_num, &sig_list)) {
+			error("%s: unable to parse signature list %u in %s\n", __func__, list_num, db->var_name);
+			break;
+		}
+
+		if (memcmp(sig_list.type, efi_cert_x509_guid, 16)) {
+			debug(" %u ignoring signature list with type %s\n", list_num, tpm_event_decode_uuid(sig_list.type));
+			continue;
+		}
+
+		debug2(" %u inspecting X.509 signature list\n", list_num);
+		for (i = 0; i < sig_list.num_signatures; ++i) {
+			const unsigned char *raw_data;
+			unsigned char owner[16];
+			parsed_cert_t *cert;
+			buffer_t cert_buf;
+
+			raw_data = buffer_read_pointer(&sig_list.signatures);
+			if (!buffer_get(&sig_list.signatures, owner, sizeof(owner))
+			 || !buffer_get_buffer(&sig_list.signatures, sig_list.signature_size - 16, &cert_buf)) {
+				error("%s: unable to parse signature %u of list %u\n", __func__, i, list_num);
+				break;
+			}
+
+			if (!(cert = cert_parse(&cert_buf))) {
+				error("Unparseable X509 certificate in %s\n", db->var_name);
+				continue;
+			}
+
+			debug2(" %u.%u: owner %s\n", list_num, i, tpm_event_decode_uuid(owner));
+			debug2("    cert subject: %s\n", parsed_cert_subject(cert));
+
+			efi_sigdb_add_entry(db, cert, raw_data, sig_list.signature_size);
+		}
+	}
+
+	/* Build the hash chains only now, as the entries array may have moved
+	 * while we were adding to it. Walk the array backwards so that each
+	 * chain lists its certificates in database order. */
+	for (i = db->num_entries; i-- > 0; ) {
+		struct efi_sigdb_entry *entry = &db->entries[i];
+		unsigned int slot = entry->subject_hash % EFI_SIGDB_HASH_SIZE;
+
+		entry->hash_next = db->hash[slot];
+		db->hash[slot] = entry;
+	}
+
+	debug("%s: found %u X.509 certificates\n", db->var_name, db->num_entries);
+}
+
+/*
+ * Forget all databases loaded so far. They are leaked rather than freed,
+ * because this is called after a fatal error, which may have left one of
+ * them half constructed.
+ */
+void
+efi_sigdb_discard_all(void)
+{
+	efi_sigdb_list = NULL;
+}
+
+/*
+ * Return the signature database stored in the given EFI variable.
+ * The database is loaded and parsed on first use, and kept for the
+ * remainder of the run. Returns NULL if the variable does not exist.
+ *
+ * Every caller depends on the variable, not just the first one; so
+ * record it as a dependency on every lookup, like the runtime does.
+ */
+efi_sigdb_t *
+efi_sigdb_get(const char *var_name)
+{
+	efi_sigdb_t *db;
+
+	for (db = efi_sigdb_list; db; db = db->next) {
+		if (!strcmp(db->var_name, var_name)) {
+			if (db->data == NULL) {
+				dependency_add_efi_variable(var_name, NULL);
+				return NULL;
+			} else {
+				/* Parsing consumed the buffer; rewind a copy */
+				buffer_t data = *db->data;
+
+				data.rpos = 0;
+				dependency_add_efi_variable(var_name, &data);
+				return db;
+			}
+		}
+	}
+
+	db = calloc(1, sizeof(*db));
+	db->var_name = strdup(var_name);
+	db->data = runtime_read_efi_variable(var_name);
+
+	db->next = efi_sigdb_list;
+	efi_sigdb_list = db;
+
+	if (db->data == NULL)
+		return NULL;
+
+	efi_sigdb_parse(db);
+	return db;
+}
+
+/*
+ * Locate the certificate that issued the signer's certificate, and return
+ * a copy of its EFI_SIGNATURE_DATA record, as it would be measured in an
+ * EFI_VARIABLE_AUTHORITY event.
+ */
+buffer_t *
+efi_sigdb_find_authority(const efi_sigdb_t *db, const parsed_cert_t *signer)
+{
+	unsigned long issuer_hash = parsed_cert_issuer_hash(signer);
+	const struct efi_sigdb_entry *entry;
+	buffer_t *result;
+
+	for (entry = db->hash[issuer_hash % EFI_SIGDB_HASH_SIZE]; entry; entry = entry->hash_next) {
+		if (entry->subject_hash != issuer_hash
+		 || !parsed_cert_issued_by(signer, entry->cert))
+			continue;
+
+		debug("Found authority record for %s\n", parsed_cert_subject(entry->cert));
+		result = buffer_alloc_write(entry->raw_len);
+		buffer_put(result, db->data->data + entry->raw_offset, entry->raw_len);
+		return result;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,32 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#ifndef EFI_SIGDB_H
+#define EFI_SIGDB_H
+
+#include "types.h"
+
+typedef struct efi_sigdb	efi_sigdb_t;
+
+extern efi_sigdb_t *		efi_sigdb_get(const char *var_name);
+extern buffer_t *		efi_sigdb_find_authority(const efi_sigdb_t *, const parsed_cert_t *signer);
+extern void			efi_sigdb_discard_all(void);
+
+#endif /* EFI_SIGDB_H */
@@ -29,6 +29,8 @@
 #include "runtime.h"
 #include "digest.h"
 #include "authenticode.h"
+#include "oracle.h"
+#include "cache.h"
 #include "util.h"
 
 
@@ -98,6 +100,128 @@ enum {
 	HASH_STRATEGY_DATA,
 };
 
+/*
+ * What the firmware hashes for a variable event is a property of the
+ * firmware, the event type and the PCR, not of the individual event. So
+ * once we have detected the strategy for one event, we reuse it for all
+ * similar events, and remember it in the cache for later runs on the
+ * same firmware.
+ */
+#define HASH_STRATEGY_CACHE_MAGIC	0x48534331
+#define HASH_STRATEGY_MAX		16
+
+struct efi_variable_hash_strategy {
+	uint32_t		event_type;
+	uint32_t		pcr_index;
+	uint32_t		strategy;
+};
+
+static struct efi_variable_hash_strategy efi_variable_hash_strategies[HASH_STRATEGY_MAX];
+static unsigned int		efi_variable_num_hash_strategies;
+static bool			efi_variable_hash_strategies_loaded;
+
+static void
+efi_variable_hash_strategies_load(void)
+{
+	struct efi_variable_hash_strategy *s;
+	const char *firmware_id;
+	uint32_t magic, count;
+	buffer_t *bp;
+
+	efi_variable_hash_strategies_loaded = true;
+
+	if (!cache_is_enabled() || !(firmware_id = platform_firmware_id()))
+		return;
+
+	if (!(bp = cache_read("hash-strategy", firmware_id)))
+		return;
+
+	if (!buffer_get_u32le(bp, &magic) || magic != HASH_STRATEGY_CACHE_MAGIC
+	 || !buffer_get_u32le(bp, &count) || count > HASH_STRATEGY_MAX)
+		goto bad;
+
+	for (s = efi_variable_hash_strategies; count--; ++s) {
+		if (!buffer_get_u32le(bp, &s->event_type)
+		 || !buffer_get_u32le(bp, &s->pcr_index)
+		 || !buffer_get_u32le(bp, &s->strategy))
+			goto bad;
+
+		if (s->strategy != HASH_STRATEGY_EVENT && s->strategy != HASH_STRATEGY_DATA)
+			goto bad;
+	}
+
+	efi_variable_num_hash_strategies = s - efi_variable_hash_strategies;
+	debug("Loaded %u cached hash strategies for firmware %s\n",
+			efi_variable_num_hash_strategies, firmware_id);
+	buffer_free(bp);
+	return;
+
+bad:
+	debug("Ignoring bad hash strategy cache entry for firmware %s\n", firmware_id);
+	efi_variable_num_hash_strategies = 0;
+	cache_remove("hash-strategy", firmware_id);
+	buffer_free(bp);
+}
+
+static void
+efi_variable_hash_strategies_save(void)
+{
+	const char *firmware_id;
+	unsigned int i;
+	buffer_t *bp;
+
+	if (!cache_is_enabled() || !(firmware_id = platform_firmware_id()))
+		return;
+
+	bp = buffer_alloc_write(8 + efi_variable_num_hash_strategies * 12);
+	buffer_put_u32le(bp, HASH_STRATEGY_CACHE_MAGIC);
+	buffer_put_u32le(bp, efi_variable_num_hash_strategies);
+	for (i = 0; i < efi_variable_num_hash_strategies; ++i) {
+		struct efi_variable_hash_strategy *s = &efi_variable_hash_strategies[i];
+
+		buffer_put_u32le(bp, s->event_type);
+		buffer_put_u32le(bp, s->pcr_index);
+		buffer_put_u32le(bp, s->strategy);
+	}
+
+	cache_write("hash-strategy", firmware_id, bp);
+	buffer_free(bp);
+}
+
+static int
+efi_variable_hash_strategy_lookup(const tpm_event_t *ev)
+{
+	unsigned int i;
+
+	if (!efi_variable_hash_strategies_loaded)
+		efi_variable_hash_strategies_load();
+
+	for (i = 0; i < efi_variable_num_hash_strategies; ++i) {
+		struct efi_variable_hash_strategy *s = &efi_variable_hash_strategies[i];
+
+		if (s->event_type == ev->event_type && s->pcr_index == ev->pcr_index)
+			return s->strategy;
+	}
+
+	return -1;
+}
+
+static void
+efi_variable_hash_strategy_remember(const tpm_event_t *ev, int strategy)
+{
+	struct efi_variable_hash_strategy *s;
+
+	if (efi_variable_num_hash_strategies >= HASH_STRATEGY_MAX)
+		return;
+
+	s = &efi_variable_hash_strategies[efi_variable_num_hash_strategies++];
+	s->event_type = ev->event_type;
+	s->pcr_index = ev->pcr_index;
+	s->strategy = strategy;
+
+	efi_variable_hash_strategies_save();
+}
+
 static buffer_t *
 efi_variable_authority_get_record(const tpm_parsed_event_t *parsed, const char *var_name, tpm_event_log_rehash_ctx_t *ctx)
 {
@@ -120,6 +244,7 @@ efi_variable_authority_get_record(const tpm_parsed_event_t *parsed, const char *
 		return runtime_read_efi_variable(var_name);
 	}
 
+	ctx->consulted |= REHASH_CONSULTED_NEXT_STAGE_IMG;
 	if (ctx->next_stage_img == NULL) {
 		infomsg("Unable to verify signature of a boot service; probably a driver residing in ROM.\n");
 		return EFI_BSA_NOT_FOUND;
@@ -140,6 +265,7 @@ static int
 __tpm_event_efi_variable_detect_hash_strategy(const tpm_event_t *ev, const tpm_parsed_event_t *parsed, const tpm_algo_info_t *algo)
 {
 	const tpm_evdigest_t *md, *old_md;
+	int strategy;
 
 	old_md = tpm_event_get_digest(ev, algo);
 	if (old_md == NULL) {
@@ -147,6 +273,9 @@ __tpm_event_efi_variable_detect_hash_strategy(const tpm_event_t *ev, const tpm_p
 		return -1;
 	}
 
+	if ((strategy = efi_variable_hash_strategy_lookup(ev)) >= 0)
+		return strategy;
+
 	/* UEFI implementations seem to differ in what they hash. Some Dell firmwares
 	 * always seem to hash the entire event. The OVMF firmware, on the other hand,
 	 * hashes the log for EFI_VARIABLE_DRIVER_CONFIG events, and just the data for
@@ -154,12 +283,14 @@ __tpm_event_efi_variable_detect_hash_strategy(const tpm_event_t *ev, const tpm_p
 	md = digest_compute(algo, ev->event_data, ev->event_size);
 	if (digest_equal(old_md, md)) {
 		debug("  Firmware hashed entire event data\n");
+		efi_variable_hash_strategy_remember(ev, HASH_STRATEGY_EVENT);
 		return HASH_STRATEGY_EVENT;
 	}
 
 	md = digest_compute(algo, parsed->efi_variable_event.data, parsed->efi_variable_event.len);
 	if (digest_equal(old_md, md)) {
 		debug("  Firmware hashed variable data\n");
+		efi_variable_hash_strategy_remember(ev, HASH_STRATEGY_DATA);
 		return HASH_STRATEGY_DATA;
 	}
 
@@ -280,7 +411,7 @@ __tpm_event_parse_efi_variable(tpm_event_t *ev, tpm_parsed_event_t *parsed, buff
 const char *
 tpm_efi_variable_event_extract_full_varname(const tpm_parsed_event_t *parsed)
 {
-	static char varname[256];
+	static __thread char varname[256];
 	const struct efi_variable_event *evspec = &parsed->efi_variable_event;
 	const char *shim_rtname;
 
@@ -33,14 +33,44 @@
 #include "digest.h"
 #include "util.h"
 #include "uapi.h"
+#include "depend.h"
 
 #define TPM_EVENT_LOG_MAX_ALGOS		64
 
+/* The event log is read in chunks of this size */
+#define TPM_EVENT_LOG_READ_CHUNK	(256 * 1024)
+
+/* Default size of an arena chunk */
+#define TPM_EVENT_ARENA_CHUNK		(64 * 1024)
+
+/*
+ * All event records (and their parsed representation) are carved out of
+ * an arena that is owned by the log reader. This saves us a few thousand
+ * calls to malloc per log, and lets us release everything in one go.
+ */
+struct tpm_event_arena {
+	struct tpm_event_arena_chunk {
+		struct tpm_event_arena_chunk *next;
+		size_t		size;
+		size_t		used;
+		unsigned char	data[];
+	} *		chunks;
+};
+
 struct tpm_event_log_reader {
-	int			fd;
 	unsigned int		tpm_version;
 	unsigned int		event_count;
 
+	/* The raw log. Events are decoded in place. */
+	unsigned char *		raw_data;
+	buffer_t		buf;
+
+	struct tpm_event_arena	arena;
+
+	/* All events handed out so far, in log order */
+	tpm_event_t *		events;
+	tpm_event_t **		tail;
+
 	struct tpm_event_log_tcg2_info {
 		uint32_t		platform_class;
 		uint8_t			spec_version_major;
@@ -59,49 +89,135 @@ struct tpm_event_log_reader {
 
 
 static bool		__tpm_event_parse_tcg2_info(tpm_event_t *ev, struct tpm_event_log_tcg2_info *info);
+static void		tpm_parsed_event_free(tpm_parsed_event_t *parsed);
+
+
+static void *
+tpm_event_arena_alloc(struct tpm_event_arena *arena, size_t size)
+{
+	struct tpm_event_arena_chunk *chunk;
+	void *p;
+
+	/* Keep everything suitably aligned */
+	size = (size + 15) & ~(size_t) 15;
+
+	chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		size_t chunk_size = TPM_EVENT_ARENA_CHUNK;
+
+		if (size > chunk_size)
+			chunk_size = size;
+
+		chunk = malloc(sizeof(*chunk) + chunk_size);
+		if (chunk == NULL)
+			fatal("out of memory");
+
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
 
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+
+	memset(p, 0, size);
+	return p;
+}
 
 static void
-__read_exactly(int fd, void *vp, unsigned int len)
+tpm_event_arena_destroy(struct tpm_event_arena *arena)
 {
+	struct tpm_event_arena_chunk *chunk;
+
+	while ((chunk = arena->chunks) != NULL) {
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+}
+
+/*
+ * Slurp the entire event log into memory. We cannot rely on fstat here,
+ * because securityfs reports a size of 0 for binary_bios_measurements.
+ */
+static bool
+event_log_read_all(tpm_event_log_reader_t *log, int fd)
+{
+	unsigned char *data = NULL;
+	size_t size = 0, len = 0;
 	int n;
 
-	if ((n = read(fd, vp, len)) < 0)
-		fatal("unable to read from event log: %m\n");
-	if (n != len)
+	do {
+		if (size - len < TPM_EVENT_LOG_READ_CHUNK) {
+			size = size? 2 * size : 4 * TPM_EVENT_LOG_READ_CHUNK;
+			if (!(data = realloc(data, size)))
+				fatal("out of memory");
+		}
+
+		n = read(fd, data + len, size - len);
+		if (n < 0) {
+			error("unable to read from event log: %m\n");
+			free(data);
+			return false;
+		}
+
+		len += n;
+	} while (n != 0);
+
+	if (len > UINT32_MAX)
+		fatal("TPM event log is too large (%lu bytes)\n", (unsigned long) len);
+
+	debug2("Read %lu bytes from TPM event log\n", (unsigned long) len);
+	log->raw_data = data;
+	buffer_init_read(&log->buf, data, len);
+	return true;
+}
+
+static void
+__read_exactly(tpm_event_log_reader_t *log, void *vp, unsigned int len)
+{
+	if (!buffer_get(&log->buf, vp, len))
 		fatal("short read from event log (premature EOF)\n");
 }
 
 static void
-__read_u32le(int fd, uint32_t *vp)
+__read_u32le(tpm_event_log_reader_t *log, uint32_t *vp)
 {
-	__read_exactly(fd, vp, sizeof(*vp));
-	*vp = le32toh(*vp);
+	if (!buffer_get_u32le(&log->buf, vp))
+		fatal("short read from event log (premature EOF)\n");
 }
 
 static void
-__read_u16le(int fd, uint16_t *vp)
+__read_u16le(tpm_event_log_reader_t *log, uint16_t *vp)
 {
-	__read_exactly(fd, vp, sizeof(*vp));
-	*vp = le16toh(*vp);
+	if (!buffer_get_u16le(&log->buf, vp))
+		fatal("short read from event log (premature EOF)\n");
 }
 
 static bool
-__read_u32le_or_eof(int fd, uint32_t *vp)
+__read_u32le_or_eof(tpm_event_log_reader_t *log, uint32_t *vp)
 {
-	int n;
-
-	if ((n = read(fd, vp, 4)) < 0)
-		fatal("unable to read from event log: %m\n");
-	if (n == 0)
+	if (buffer_eof(&log->buf))
 		return false;
 
-	if (n != 4)
-		fatal("short read from event log (premature EOF)\n");
-	*vp = le32toh(*vp);
+	__read_u32le(log, vp);
 	return true;
 }
 
+/*
+ * Return a pointer to the next len bytes of the log, and advance
+ * the read position.
+ */
+static void *
+__read_in_place(tpm_event_log_reader_t *log, unsigned int len)
+{
+	void *p = (void *) buffer_read_pointer(&log->buf);
+
+	if (!buffer_skip(&log->buf, len))
+		fatal("short read from event log (premature EOF)\n");
+	return p;
+}
+
 static const tpm_algo_info_t *
 event_log_get_algo_info(tpm_event_log_reader_t *log, unsigned int algo_id)
 {
@@ -116,25 +232,45 @@ tpm_event_log_reader_t *
 event_log_open(const char *override_path)
 {
 	tpm_event_log_reader_t *log;
+	int fd;
+
+	fd = runtime_open_eventlog(override_path);
+	if (fd < 0)
+		return NULL;
 
 	log = calloc(1, sizeof(*log));
 	log->tpm_version = 1;
-	log->fd = runtime_open_eventlog(override_path);
-	if (log->fd < 0) {
+	log->tail = &log->events;
+
+	if (!event_log_read_all(log, fd)) {
+		close(fd);
 		event_log_close(log);
 		return NULL;
 	}
 
+	close(fd);
 	return log;
 }
 
+/*
+ * Note that this releases all events returned by event_log_read_next(),
+ * including their parsed representation.
+ */
 void
 event_log_close(tpm_event_log_reader_t *log)
 {
-	if (log->fd >= 0) {
-		close(log->fd);
-		log->fd = -1;
+	tpm_event_t *ev;
+
+	for (ev = log->events; ev; ev = ev->next) {
+		if (ev->__parsed)
+			tpm_parsed_event_free(ev->__parsed);
+		if (ev->parse_deps)
+			dependency_list_free(ev->parse_deps);
 	}
+
+	tpm_event_arena_destroy(&log->arena);
+	if (log->raw_data)
+		free(log->raw_data);
 	free(log);
 }
 
@@ -146,28 +282,26 @@ event_log_read_digest(tpm_event_log_reader_t *log, tpm_evdigest_t *dgst, int tpm
 	if (!(algo = event_log_get_algo_info(log, tpm_hash_algo_id)))
 		fatal("Unable to handle event log entry for unknown hash algorithm %u\n", tpm_hash_algo_id);
 
-	__read_exactly(log->fd, dgst->data, algo->digest_size);
+	__read_exactly(log, dgst->data, algo->digest_size);
 
 	dgst->algo = algo;
 	dgst->size = algo->digest_size;
 }
 
 static void
-event_log_resize_pcrs(tpm_event_t *ev, unsigned int count)
+event_log_resize_pcrs(tpm_event_log_reader_t *log, tpm_event_t *ev, unsigned int count)
 {
 	if (count > 32)
 		fatal("Bad number of PCRs in TPM event record (%u)\n", count);
 
-	ev->pcr_values = calloc(count, sizeof(tpm_evdigest_t));
-	if (ev->pcr_values == NULL)
-		fatal("out of memory");
+	ev->pcr_values = tpm_event_arena_alloc(&log->arena, count * sizeof(tpm_evdigest_t));
 	ev->pcr_count = count;
 }
 
 static void
 event_log_read_pcrs_tpm1(tpm_event_log_reader_t *log, tpm_event_t *ev)
 {
-	event_log_resize_pcrs(ev, 1);
+	event_log_resize_pcrs(log, ev, 1);
 	event_log_read_digest(log, &ev->pcr_values[0], TPM2_ALG_SHA1);
 }
 
@@ -176,13 +310,13 @@ event_log_read_pcrs_tpm2(tpm_event_log_reader_t *log, tpm_event_t *ev)
 {
 	uint32_t i, count;
 
-	__read_u32le(log->fd, &count);
-	event_log_resize_pcrs(ev, count);
+	__read_u32le(log, &count);
+	event_log_resize_pcrs(log, ev, count);
 
 	for (i = 0; i < count; ++i) {
 		uint16_t algo_id;
 
-		__read_u16le(log->fd, &algo_id);
+		__read_u16le(log, &algo_id);
 		event_log_read_digest(log, &ev->pcr_values[i], algo_id);
 	}
 }
@@ -203,19 +337,19 @@ tpm_event_t *
 event_log_read_next(tpm_event_log_reader_t *log)
 {
 	tpm_event_t *ev;
-	uint32_t event_size;
+	uint32_t pcr_index, event_size;
 
 again:
-	ev = calloc(1, sizeof(*ev));
-
-	if (!__read_u32le_or_eof(log->fd, &ev->pcr_index)) {
-		free(ev);
+	if (!__read_u32le_or_eof(log, &pcr_index))
 		return NULL;
-	}
 
-	__read_u32le(log->fd, &ev->event_type);
+	ev = tpm_event_arena_alloc(&log->arena, sizeof(*ev));
+	ev->arena = &log->arena;
+	ev->pcr_index = pcr_index;
+
+	__read_u32le(log, &ev->event_type);
 
-	ev->file_offset = lseek(log->fd, 0, SEEK_CUR);
+	ev->file_offset = log->buf.rpos;
 
 	if (log->tpm_version == 1) {
 		event_log_read_pcrs_tpm1(log, ev);
@@ -223,14 +357,12 @@ again:
 		event_log_read_pcrs_tpm2(log, ev);
 	}
 
-	__read_u32le(log->fd, &event_size);
+	__read_u32le(log, &event_size);
 	if (event_size > 1024*1024)
 		fatal("Oversized TPM2 event log entry with %u bytes of data\n", event_size);
 
-	ev->event_data = calloc(1, event_size);
 	ev->event_size = event_size;
-	__read_exactly(log->fd, ev->event_data, event_size);
-
+	ev->event_data = __read_in_place(log, event_size);
 
 	if (ev->event_type == TPM2_EVENT_NO_ACTION && ev->pcr_index == 0 && log->event_count == 0
 	 && ev->event_size >= 16) {
@@ -243,18 +375,19 @@ again:
 				fatal("Unable to parse TCG2 magic event header");
 
 			log->tpm_version = log->tcg2_info.spec_version_major;
-			free(ev);
 			goto again;
 		} else
 		if (!memcmp(signature, "StartupLocality", 16) && ev->event_size == 17) {
 			log->tpm_startup.valid_pcr0_locality = true;
 			log->tpm_startup.pcr0_locality = ((unsigned char *) signature)[16];
-			free(ev);
 			goto again;
 		}
 	}
 
 	ev->event_index = log->event_count++;
+
+	*log->tail = ev;
+	log->tail = &ev->next;
 	return ev;
 }
 
@@ -324,7 +457,7 @@ __tpm_event_parse_tcg2_info(tpm_event_t *ev, struct tpm_event_log_tcg2_info *inf
 const char *
 tpm_event_type_to_string(unsigned int event_type)
 {
-	static char buffer[16];
+	static __thread char buffer[16];
 
 	switch (event_type) {
 	case TPM2_EVENT_PREBOOT_CERT:
@@ -467,22 +600,25 @@ __tpm_event_rehash_efi_variable(const char *var_name, tpm_event_log_rehash_ctx_t
 }
 
 static tpm_parsed_event_t *
-tpm_parsed_event_new(unsigned int event_type)
+tpm_parsed_event_new(tpm_event_t *ev)
 {
 	tpm_parsed_event_t *parsed;
 
-	parsed = calloc(1, sizeof(*parsed));
-	parsed->event_type = event_type;
+	parsed = tpm_event_arena_alloc(ev->arena, sizeof(*parsed));
+	parsed->event_type = ev->event_type;
 	return parsed;
 }
 
+/*
+ * The memory itself belongs to the event arena; all we do here is
+ * release whatever the parser attached to the record.
+ */
 static void
 tpm_parsed_event_free(tpm_parsed_event_t *parsed)
 {
 	if (parsed->destroy)
 		parsed->destroy(parsed);
 	memset(parsed, 0, sizeof(*parsed));
-	free(parsed);
 }
 
 const char *
@@ -532,7 +668,7 @@ tpm_parsed_event_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *parsed,
 const char *
 tpm_event_decode_uuid(const unsigned char *data)
 {
-	static char uuid[64];
+	static __thread char uuid[64];
 	uint32_t w0;
 	uint16_t hw0, hw1;
 
@@ -561,7 +697,7 @@ __tpm_event_grub_file_destroy(tpm_parsed_event_t *parsed)
 const char *
 __tpm_event_grub_file_describe(const tpm_parsed_event_t *parsed)
 {
-	static char buffer[1024];
+	static __thread char buffer[1024];
 
 	if (parsed->grub_file.device == NULL)
 		snprintf(buffer, sizeof(buffer), "grub2 file load from %s", parsed->grub_file.path);
@@ -640,7 +776,7 @@ __tpm_event_grub_command_destroy(tpm_parsed_event_t *parsed)
 static const char *
 __tpm_event_grub_command_describe(const tpm_parsed_event_t *parsed)
 {
-	static char buffer[128];
+	static __thread char buffer[128];
 
 	if (parsed->event_subtype == GRUB_EVENT_COMMAND)
 		snprintf(buffer, sizeof(buffer), "grub2 command \"%s\"", parsed->grub_command.string);
@@ -719,7 +855,7 @@ __tpm_event_shim_destroy(tpm_parsed_event_t *parsed)
 static const char *
 __tpm_event_shim_describe(const tpm_parsed_event_t *parsed)
 {
-	static char buffer[64];
+	static __thread char buffer[64];
 
 	snprintf(buffer, sizeof(buffer), "shim loader %s event", parsed->shim_event.string);
 	return buffer;
@@ -771,7 +907,7 @@ __tpm_event_systemd_destroy(tpm_parsed_event_t *parsed)
 static const char *
 __tpm_event_systemd_describe(const tpm_parsed_event_t *parsed)
 {
-	static char buffer[1024];
+	static __thread char buffer[1024];
 	char data[768];
 	unsigned int len;
 
@@ -794,6 +930,8 @@ __tpm_event_systemd_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *pars
 	char initrd_utf16[4096];
 	unsigned int len;
 
+	ctx->consulted |= REHASH_CONSULTED_BOOT_ENTRY;
+
 	/* If no --next-kernel option was given, do not rehash anything */
 	if (boot_entry == NULL)
 		return tpm_event_get_digest(ev, ctx->algo);
@@ -865,6 +1003,8 @@ __tpm_event_tag_initrd_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *p
 {
 	const uapi_boot_entry_t *boot_entry = ctx->boot_entry;
 
+	ctx->consulted |= REHASH_CONSULTED_BOOT_ENTRY;
+
 	/* If no --next-kernel option was given, do not rehash anything */
 	if (boot_entry == NULL)
 		return tpm_event_get_digest(ev, ctx->algo);
@@ -981,7 +1121,7 @@ tpm_event_parse(tpm_event_t *ev, tpm_event_log_scan_ctx_t *ctx)
 	if (!ev->__parsed) {
 		tpm_parsed_event_t *parsed;
 
-		parsed = tpm_parsed_event_new(ev->event_type);
+		parsed = tpm_parsed_event_new(ev);
 		if (__tpm_event_parse(ev, parsed, ctx))
 			ev->__parsed = parsed;
 		else
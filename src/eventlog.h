@@ -42,6 +42,10 @@ typedef struct tpm_event {
 
 	/* set by the predictor during pre-scan */
 	int			rehash_strategy;
+	dependency_list_t *	parse_deps;
+
+	/* the arena this event (and its parsed form) was allocated from */
+	struct tpm_event_arena *arena;
 } tpm_event_t;
 
 typedef void			tpm_event_bit_printer(const char *, ...);
@@ -203,8 +207,15 @@ typedef struct tpm_event_log_rehash_ctx {
 
 	/* This get set when the user specifies --next-kernel */
 	uapi_boot_entry_t *	boot_entry;
+
+	/* Rehash functions set these bits when their result depends on
+	 * next_stage_img or boot_entry, respectively. */
+	unsigned int		consulted;
 } tpm_event_log_rehash_ctx_t;
 
+#define REHASH_CONSULTED_NEXT_STAGE_IMG	0x0001
+#define REHASH_CONSULTED_BOOT_ENTRY	0x0002
+
 #define GRUB_COMMAND_ARGV_MAX	32
 
 /*
@@ -0,0 +1,573 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+/*
+ * A minimal read-only FAT12/16/32 reader, so that we can read EFI
+ * applications from the ESP without having to mount it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "fat.h"
+#include "runtime.h"
+#include "bufparser.h"
+#include "depend.h"
+#include "util.h"
+
+#define FAT_DIRENT_SIZE		32
+#define FAT_ATTR_LFN		0x0f
+#define FAT_LFN_LAST		0x40
+#define FAT_LFN_MAX_SLOTS	20
+#define FAT_LFN_CHARS		13
+
+/* Upper bound for a single read when following a cluster chain */
+#define FAT_MAX_READ		(1024 * 1024)
+
+struct fat_volume {
+	char *			device;
+	block_dev_io_t *	io;
+
+	unsigned int		type;		/* 12, 16 or 32 */
+	unsigned int		bytes_per_sector;
+	unsigned int		cluster_size;
+	uint32_t		cluster_count;
+
+	uint64_t		root_dir_offset;	/* FAT12/16 only */
+	unsigned int		root_dir_size;
+	uint32_t		root_cluster;		/* FAT32 only */
+	uint64_t		data_offset;
+
+	/* We read the entire (first) FAT once, and keep it */
+	buffer_t *		fat;
+};
+
+/*
+ * We only read EFI applications through this, and those are recorded as
+ * dependencies by their identity. Recording every block of the FAT, the
+ * directories and the files themselves would make checking a cached entry
+ * as expensive as reading the whole boot chain, and any write to the ESP
+ * would invalidate all of them.
+ */
+static buffer_t *
+fat_read(fat_volume_t *vol, uint64_t offset, unsigned int size)
+{
+	dependency_list_t *saved;
+	buffer_t *bp;
+
+	/* Offsets and sizes are multiples of the FAT sector size, which
+	 * in turn is a multiple of the block device sector size. */
+	saved = dependency_record_start(NULL);
+	bp = runtime_blockdev_read_lba(vol->io,
+			runtime_blockdev_bytes_to_sectors(vol->io, offset),
+			runtime_blockdev_bytes_to_sectors(vol->io, size));
+	dependency_record_stop(saved);
+
+	return bp;
+}
+
+static inline uint16_t
+__le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t
+__le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+fat_volume_t *
+fat_volume_open(const char *device)
+{
+	unsigned int sectors_per_cluster, reserved_sectors, num_fats, root_entries;
+	uint32_t total_sectors, fat_sectors, data_sectors;
+	fat_volume_t *vol;
+	const unsigned char *bs;
+	buffer_t *bp = NULL;
+
+	vol = calloc(1, sizeof(*vol));
+	assign_string(&vol->device, device);
+
+	if (!(vol->io = runtime_blockdev_open(device))) {
+		debug("%s: unable to open %s: %m\n", __func__, device);
+		goto failed;
+	}
+
+	if (!(bp = runtime_blockdev_read_lba(vol->io, 0, 1)))
+		goto failed;
+
+	bs = buffer_read_pointer(bp);
+	if (buffer_available(bp) < 512 || bs[510] != 0x55 || bs[511] != 0xAA)
+		goto bad_boot_sector;
+
+	vol->bytes_per_sector = __le16(bs + 11);
+	sectors_per_cluster = bs[13];
+	reserved_sectors = __le16(bs + 14);
+	num_fats = bs[16];
+	root_entries = __le16(bs + 17);
+	total_sectors = __le16(bs + 19);
+	fat_sectors = __le16(bs + 22);
+
+	if (total_sectors == 0)
+		total_sectors = __le32(bs + 32);
+	if (fat_sectors == 0)
+		fat_sectors = __le32(bs + 36);
+
+	if (vol->bytes_per_sector < 512 || vol->bytes_per_sector > 4096
+	 || (vol->bytes_per_sector & (vol->bytes_per_sector - 1))
+	 || sectors_per_cluster == 0
+	 || (sectors_per_cluster & (sectors_per_cluster - 1))
+	 || num_fats == 0 || fat_sectors == 0 || reserved_sectors == 0)
+		goto bad_boot_sector;
+
+	vol->cluster_size = vol->bytes_per_sector * sectors_per_cluster;
+	vol->root_dir_offset = (uint64_t) (reserved_sectors + num_fats * fat_sectors) * vol->bytes_per_sector;
+	vol->root_dir_size = (root_entries * FAT_DIRENT_SIZE + vol->bytes_per_sector - 1) & ~(vol->bytes_per_sector - 1);
+	vol->data_offset = vol->root_dir_offset + vol->root_dir_size;
+
+	data_sectors = total_sectors - (vol->data_offset / vol->bytes_per_sector);
+	if (data_sectors > total_sectors)
+		goto bad_boot_sector;
+
+	vol->cluster_count = data_sectors / sectors_per_cluster;
+	if (vol->cluster_count < 4085)
+		vol->type = 12;
+	else if (vol->cluster_count < 65525)
+		vol->type = 16;
+	else
+		vol->type = 32;
+
+	if (vol->type == 32) {
+		if (root_entries != 0)
+			goto bad_boot_sector;
+		vol->root_cluster = __le32(bs + 44);
+	}
+
+	debug("%s: FAT%u file system, %u clusters of %u bytes\n",
+			device, vol->type, vol->cluster_count, vol->cluster_size);
+
+	if (!(vol->fat = fat_read(vol, (uint64_t) reserved_sectors * vol->bytes_per_sector,
+					fat_sectors * vol->bytes_per_sector)))
+		goto failed;
+
+	buffer_free(bp);
+	return vol;
+
+bad_boot_sector:
+	debug("%s: no FAT file system\n", device);
+
+failed:
+	buffer_free(bp);
+	fat_volume_close(vol);
+	return NULL;
+}
+
+void
+fat_volume_close(fat_volume_t *vol)
+{
+	if (vol->io)
+		runtime_blockdev_close(vol->io);
+	buffer_free(vol->fat);
+	drop_string(&vol->device);
+	free(vol);
+}
+
+/*
+ * Returns 0 for an end-of-chain marker or an invalid entry
+ */
+static uint32_t
+fat_next_cluster(const fat_volume_t *vol, uint32_t cluster)
+{
+	const unsigned char *fat = vol->fat->data;
+	unsigned int fat_size = vol->fat->wpos;
+	uint32_t next, offset;
+
+	if (cluster < 2 || cluster >= vol->cluster_count + 2)
+		return 0;
+
+	switch (vol->type) {
+	case 12:
+		offset = cluster + cluster / 2;
+		if (offset + 2 > fat_size)
+			return 0;
+		next = __le16(fat + offset);
+		next = (cluster & 1)? (next >> 4) : (next & 0xFFF);
+		if (next >= 0xFF7)
+			return 0;
+		break;
+
+	case 16:
+		offset = 2 * cluster;
+		if (offset + 2 > fat_size)
+			return 0;
+		next = __le16(fat + offset);
+		if (next >= 0xFFF7)
+			return 0;
+		break;
+
+	default:
+		offset = 4 * cluster;
+		if (offset + 4 > fat_size)
+			return 0;
+		next = __le32(fat + offset) & 0x0FFFFFFF;
+		if (next >= 0x0FFFFFF7)
+			return 0;
+		break;
+	}
+
+	if (next < 2 || next >= vol->cluster_count + 2)
+		return 0;
+	return next;
+}
+
+static inline uint64_t
+fat_cluster_offset(const fat_volume_t *vol, uint32_t cluster)
+{
+	return vol->data_offset + (uint64_t) (cluster - 2) * vol->cluster_size;
+}
+
+/*
+ * Read up to max_size bytes following the cluster chain. Runs of
+ * adjacent clusters are read with a single request.
+ */
+static bool
+fat_read_chain(fat_volume_t *vol, uint32_t cluster, unsigned int max_size, buffer_t *result)
+{
+	unsigned int max_clusters = vol->cluster_count;
+
+	while (cluster && max_size) {
+		uint32_t first = cluster, next;
+		unsigned int run = 1, count, len;
+		buffer_t *bp;
+
+		next = fat_next_cluster(vol, cluster);
+		while (next == cluster + 1
+		    && run * vol->cluster_size < max_size
+		    && run * vol->cluster_size < FAT_MAX_READ) {
+			cluster = next;
+			next = fat_next_cluster(vol, cluster);
+			run++;
+		}
+		cluster = next;
+
+		/* Guard against loops in the cluster chain */
+		if (run > max_clusters) {
+			error("%s: cluster chain too long\n", vol->device);
+			return false;
+		}
+		max_clusters -= run;
+
+		len = run * vol->cluster_size;
+		if (!(bp = fat_read(vol, fat_cluster_offset(vol, first), len)))
+			return false;
+
+		count = len;
+		if (count > max_size)
+			count = max_size;
+		if (!buffer_put(result, bp->data, count)) {
+			buffer_free(bp);
+			return false;
+		}
+		buffer_free(bp);
+		max_size -= count;
+	}
+
+	return max_size == 0;
+}
+
+static buffer_t *
+fat_read_directory(fat_volume_t *vol, uint32_t cluster)
+{
+	unsigned int size = 0;
+	buffer_t *result;
+	uint32_t c;
+
+	/* The root directory of FAT12/16 lives at a fixed location */
+	if (cluster == 0) {
+		if (vol->type == 32)
+			cluster = vol->root_cluster;
+		else
+			return fat_read(vol, vol->root_dir_offset, vol->root_dir_size);
+	}
+
+	for (c = cluster; c && size < 0x200000; c = fat_next_cluster(vol, c))
+		size += vol->cluster_size;
+
+	result = buffer_alloc_write(size);
+	if (!fat_read_chain(vol, cluster, size, result)) {
+		error("%s: unable to read directory at cluster %u\n", vol->device, cluster);
+		buffer_free(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+static unsigned char
+fat_short_name_checksum(const unsigned char *name)
+{
+	unsigned char sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < 11; ++i)
+		sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+	return sum;
+}
+
+static void
+fat_short_name(const unsigned char *entry, char *name)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < 8 && entry[i] != ' '; ++i)
+		name[n++] = entry[i];
+	if (n && name[0] == 0x05)
+		name[0] = 0xE5;
+
+	if (entry[8] != ' ') {
+		name[n++] = '.';
+		for (i = 8; i < 11 && entry[i] != ' '; ++i)
+			name[n++] = entry[i];
+	}
+	name[n] = '\0';
+}
+
+/*
+ * Convert the UCS-2 long name to UTF-8
+ */
+static bool
+fat_long_name(const uint16_t *lfn, unsigned int len, char *name, unsigned int size)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < len && lfn[i] != 0; ++i) {
+		uint32_t cp = lfn[i];
+
+		if (cp >= 0xD800 && cp < 0xDC00 && i + 1 < len
+		 && lfn[i + 1] >= 0xDC00 && lfn[i + 1] < 0xE000) {
+			cp = 0x10000 + ((cp - 0xD800) << 10) + (lfn[i + 1] - 0xDC00);
+			i++;
+		}
+
+		if (n + 5 > size)
+			return false;
+
+		if (cp < 0x80) {
+			name[n++] = cp;
+		} else if (cp < 0x800) {
+			name[n++] = 0xC0 | (cp >> 6);
+			name[n++] = 0x80 | (cp & 0x3F);
+		} else if (cp < 0x10000) {
+			name[n++] = 0xE0 | (cp >> 12);
+			name[n++] = 0x80 | ((cp >> 6) & 0x3F);
+			name[n++] = 0x80 | (cp & 0x3F);
+		} else {
+			name[n++] = 0xF0 | (cp >> 18);
+			name[n++] = 0x80 | ((cp >> 12) & 0x3F);
+			name[n++] = 0x80 | ((cp >> 6) & 0x3F);
+			name[n++] = 0x80 | (cp & 0x3F);
+		}
+	}
+
+	name[n] = '\0';
+	return true;
+}
+
+static bool
+fat_directory_lookup(fat_volume_t *vol, uint32_t dir_cluster, const char *wanted, fat_file_info_t *info)
+{
+	static const unsigned int lfn_offsets[FAT_LFN_CHARS] = {
+		1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30
+	};
+	uint16_t lfn[FAT_LFN_MAX_SLOTS * FAT_LFN_CHARS];
+	unsigned int lfn_slots = 0;
+	unsigned char lfn_checksum = 0;
+	bool found = false;
+	buffer_t *dir;
+
+	if (!(dir = fat_read_directory(vol, dir_cluster)))
+		return false;
+
+	while (buffer_available(dir) >= FAT_DIRENT_SIZE) {
+		const unsigned char *entry = buffer_read_pointer(dir);
+		char name[4 * FAT_LFN_MAX_SLOTS * FAT_LFN_CHARS + 1];
+
+		buffer_skip(dir, FAT_DIRENT_SIZE);
+
+		/* end of directory */
+		if (entry[0] == 0x00)
+			break;
+
+		/* deleted entry */
+		if (entry[0] == 0xE5) {
+			lfn_slots = 0;
+			continue;
+		}
+
+		if (entry[11] == FAT_ATTR_LFN) {
+			unsigned int seq = entry[0] & 0x1F, i;
+
+			if (seq == 0 || seq > FAT_LFN_MAX_SLOTS) {
+				lfn_slots = 0;
+				continue;
+			}
+
+			/* The LFN slots come in reverse order, starting with the last one */
+			if (entry[0] & FAT_LFN_LAST) {
+				lfn_slots = seq;
+				lfn_checksum = entry[13];
+				memset(lfn, 0, sizeof(lfn));
+			} else
+			if (lfn_slots == 0 || entry[13] != lfn_checksum) {
+				lfn_slots = 0;
+				continue;
+			}
+
+			for (i = 0; i < FAT_LFN_CHARS; ++i) {
+				uint16_t c = __le16(entry + lfn_offsets[i]);
+
+				lfn[(seq - 1) * FAT_LFN_CHARS + i] = (c == 0xFFFF)? 0 : c;
+			}
+			continue;
+		}
+
+		if (entry[11] & FAT_ATTR_VOLUME_ID) {
+			lfn_slots = 0;
+			continue;
+		}
+
+		if (lfn_slots && fat_short_name_checksum(entry) == lfn_checksum
+		 && fat_long_name(lfn, lfn_slots * FAT_LFN_CHARS, name, sizeof(name))
+		 && !strcasecmp(name, wanted)) {
+			found = true;
+		} else {
+			fat_short_name(entry, name);
+			found = !strcasecmp(name, wanted);
+		}
+		lfn_slots = 0;
+
+		if (found) {
+			memset(info, 0, sizeof(*info));
+			info->attr = entry[11];
+			info->first_cluster = __le16(entry + 26);
+			if (vol->type == 32)
+				info->first_cluster |= (uint32_t) __le16(entry + 20) << 16;
+			info->size = __le32(entry + 28);
+			info->mtime = __le32(entry + 22);
+			info->ctime = __le32(entry + 14);
+			break;
+		}
+	}
+
+	buffer_free(dir);
+	return found;
+}
+
+/*
+ * Look up a file given its path relative to the root of the file system.
+ * Both / and \ are accepted as separators; names are compared case-insensitively.
+ */
+bool
+fat_volume_lookup(fat_volume_t *vol, const char *path, fat_file_info_t *info)
+{
+	char *copy, *name, *saveptr = NULL;
+	uint32_t dir_cluster = 0;
+	bool is_file = false, ok = true;
+
+	copy = strdup(path);
+	for (name = strtok_r(copy, "/\\", &saveptr); name && ok; name = strtok_r(NULL, "/\\", &saveptr)) {
+		if (is_file || !fat_directory_lookup(vol, dir_cluster, name, info)) {
+			debug("%s: %s not found\n", vol->device, path);
+			ok = false;
+		} else
+		if (info->attr & FAT_ATTR_DIRECTORY)
+			dir_cluster = info->first_cluster;
+		else
+			is_file = true;
+	}
+	free(copy);
+
+	return ok && is_file;
+}
+
+/*
+ * Read just the first and the last cluster of a file. For a PE image, these
+ * hold the headers and the signature, so this is a cheap way of telling
+ * whether it was rewritten, which size and time stamps alone may not reveal.
+ */
+buffer_t *
+fat_volume_read_file_ends(fat_volume_t *vol, const fat_file_info_t *info)
+{
+	uint32_t cluster = info->first_cluster;
+	unsigned int i, last, count;
+	buffer_t *result, *bp;
+
+	result = buffer_alloc_write(2 * vol->cluster_size);
+	if (info->size == 0)
+		return result;
+
+	count = info->size;
+	if (count > vol->cluster_size)
+		count = vol->cluster_size;
+	if (!(bp = fat_read(vol, fat_cluster_offset(vol, cluster), vol->cluster_size)))
+		goto failed;
+	buffer_put(result, bp->data, count);
+	buffer_free(bp);
+
+	last = (info->size - 1) / vol->cluster_size;
+	if (last == 0)
+		return result;
+
+	for (i = 0; i < last && cluster; ++i)
+		cluster = fat_next_cluster(vol, cluster);
+	if (cluster == 0)
+		goto failed;
+
+	count = info->size - last * vol->cluster_size;
+	if (!(bp = fat_read(vol, fat_cluster_offset(vol, cluster), vol->cluster_size)))
+		goto failed;
+	buffer_put(result, bp->data, count);
+	buffer_free(bp);
+	return result;
+
+failed:
+	error("%s: unable to read file data\n", vol->device);
+	buffer_free(result);
+	return NULL;
+}
+
+buffer_t *
+fat_volume_read_file(fat_volume_t *vol, const fat_file_info_t *info)
+{
+	buffer_t *result;
+
+	result = buffer_alloc_mapped(info->size);
+	if (info->size && !fat_read_chain(vol, info->first_cluster, info->size, result)) {
+		error("%s: unable to read file data\n", vol->device);
+		buffer_unmap(result);
+		return NULL;
+	}
+
+	return result;
+}
@@ -0,0 +1,47 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#ifndef FAT_H
+#define FAT_H
+
+#include "types.h"
+
+typedef struct fat_volume	fat_volume_t;
+
+typedef struct fat_file_info {
+	unsigned int		attr;
+	uint32_t		first_cluster;
+	uint32_t		size;
+
+	/* DOS date and time, date in the upper 16 bits */
+	uint32_t		mtime;
+	uint32_t		ctime;
+} fat_file_info_t;
+
+#define FAT_ATTR_VOLUME_ID	0x08
+#define FAT_ATTR_DIRECTORY	0x10
+
+extern fat_volume_t *		fat_volume_open(const char *device);
+extern void			fat_volume_close(fat_volume_t *);
+extern bool			fat_volume_lookup(fat_volume_t *, const char *path, fat_file_info_t *);
+extern buffer_t *		fat_volume_read_file(fat_volume_t *, const fat_file_info_t *);
+extern buffer_t *		fat_volume_read_file_ends(fat_volume_t *, const fat_file_info_t *);
+
+#endif /* FAT_H */
@@ -0,0 +1,317 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libpcroracle.h"
+#include "predictor.h"
+#include "util.h"
+#include "pcr.h"
+#include "digest.h"
+#include "store.h"
+#include "depend.h"
+#include "runtime.h"
+#include "efi-sigdb.h"
+
+struct pcr_oracle_ctx {
+	char *			algorithms;
+	char *			eventlog_path;
+	char *			boot_entry;
+	char *			stop_event;
+	bool			stop_after;
+
+	char			error[1024];
+};
+
+/*
+ * The predictor relies on a number of process wide caches, which are not
+ * safe to use from several threads at once.
+ */
+static pthread_mutex_t		libpcroracle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+pcr_oracle_ctx_t *
+pcr_oracle_ctx_new(void)
+{
+	return calloc(1, sizeof(pcr_oracle_ctx_t));
+}
+
+void
+pcr_oracle_ctx_free(pcr_oracle_ctx_t *ctx)
+{
+	drop_string(&ctx->algorithms);
+	drop_string(&ctx->eventlog_path);
+	drop_string(&ctx->boot_entry);
+	drop_string(&ctx->stop_event);
+	free(ctx);
+}
+
+void
+pcr_oracle_ctx_set_algorithm(pcr_oracle_ctx_t *ctx, const char *algo_list)
+{
+	assign_string(&ctx->algorithms, algo_list);
+}
+
+void
+pcr_oracle_ctx_set_eventlog(pcr_oracle_ctx_t *ctx, const char *path)
+{
+	assign_string(&ctx->eventlog_path, path);
+}
+
+void
+pcr_oracle_ctx_set_boot_entry(pcr_oracle_ctx_t *ctx, const char *id)
+{
+	assign_string(&ctx->boot_entry, id);
+}
+
+void
+pcr_oracle_ctx_set_stop_event(pcr_oracle_ctx_t *ctx, const char *event_desc, bool after)
+{
+	assign_string(&ctx->stop_event, event_desc);
+	ctx->stop_after = after;
+}
+
+const char *
+pcr_oracle_ctx_get_error(const pcr_oracle_ctx_t *ctx)
+{
+	return ctx->error;
+}
+
+static void
+pcr_oracle_set_error(pcr_oracle_ctx_t *ctx, const char *msg)
+{
+	snprintf(ctx->error, sizeof(ctx->error), "%s", msg);
+	ctx->error[strcspn(ctx->error, "\n")] = '\0';
+}
+
+/*
+ * Every call into the library takes the lock, and sets a trap for fatal
+ * errors. Anything allocated before a fatal error is lost, but the caller
+ * gets an error return rather than having its process terminated. The
+ * process wide caches are discarded after such an error, so the next
+ * call works from a clean slate.
+ */
+static void
+pcr_oracle_enter(pcr_oracle_ctx_t *ctx, fatal_trap_t *trap)
+{
+	pthread_mutex_lock(&libpcroracle_lock);
+
+	ctx->error[0] = '\0';
+	trap->message[0] = '\0';
+	trap->prev = fatal_trap;
+	fatal_trap = trap;
+}
+
+static void
+pcr_oracle_leave(pcr_oracle_ctx_t *ctx, fatal_trap_t *trap, struct predictor *pred)
+{
+	fatal_trap = trap->prev;
+
+	if (trap->message[0]) {
+		pcr_oracle_set_error(ctx, trap->message);
+
+		/* We may have bailed out while recording dependencies, or
+		 * while filling any of the process wide caches. Start over
+		 * with empty caches rather than trust what's in them. */
+		dependency_record_stop(NULL);
+		runtime_discard_caches();
+		predictor_discard_system_eventlog();
+		efi_sigdb_discard_all();
+	} else if (pred != NULL) {
+		predictor_free(pred);
+	}
+
+	pthread_mutex_unlock(&libpcroracle_lock);
+}
+
+static unsigned int
+pcr_oracle_get_algorithms(const pcr_oracle_ctx_t *ctx, const tpm_algo_info_t **algos)
+{
+	char *copy, *name, *saveptr = NULL;
+	unsigned int count = 0;
+
+	if (ctx->algorithms == NULL) {
+		algos[0] = digest_by_name("sha256");
+		return 1;
+	}
+
+	copy = strdup(ctx->algorithms);
+	for (name = strtok_r(copy, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+		if (count >= PREDICTOR_MAX_BANKS)
+			fatal("Too many hash algorithms (at most %u are supported)\n", PREDICTOR_MAX_BANKS);
+		if (!(algos[count++] = digest_by_name(name)))
+			fatal("Unsupported hash algorithm \"%s\"\n", name);
+	}
+	free(copy);
+
+	if (count == 0)
+		fatal("No hash algorithm given\n");
+	return count;
+}
+
+/*
+ * Predict the PCR values from the event log, just like
+ * "pcr-oracle --from eventlog predict <pcr-selection>" would, including
+ * the use of the prediction cache.
+ */
+static struct predictor *
+pcr_oracle_run_predictor(pcr_oracle_ctx_t *ctx, const char *pcr_spec)
+{
+	const tpm_algo_info_t *algos[PREDICTOR_MAX_BANKS];
+	tpm_pcr_selection_t *pcr_selection;
+	unsigned int num_algos;
+	struct predictor *pred;
+	char *cache_key;
+
+	num_algos = pcr_oracle_get_algorithms(ctx, algos);
+
+	if (!(pcr_selection = pcr_selection_new(algos[0]->openssl_name, pcr_spec)))
+		fatal("Invalid PCR selection \"%s\"\n", pcr_spec);
+
+	pred = predictor_new(pcr_selection, num_algos, algos, "eventlog",
+			ctx->eventlog_path, NULL, ctx->boot_entry);
+	pcr_selection_free(pcr_selection);
+
+	if (ctx->stop_event)
+		predictor_set_stop_event(pred, ctx->stop_event, ctx->stop_after);
+
+	cache_key = predictor_cache_key(pred, 0, NULL);
+	if (cache_key == NULL || !predictor_cache_load(pred, cache_key, NULL)) {
+		dependency_list_t *deps = NULL, *outer;
+		bool okay;
+
+		if (cache_key)
+			deps = dependency_list_new();
+
+		outer = dependency_record_start(deps);
+		okay = predictor_update_all(pred, 0, NULL);
+		dependency_record_stop(outer);
+
+		if (okay && deps)
+			predictor_cache_save(pred, cache_key, deps);
+		if (deps)
+			dependency_list_free(deps);
+
+		if (!okay) {
+			drop_string(&cache_key);
+			predictor_free(pred);
+			return NULL;
+		}
+	}
+	drop_string(&cache_key);
+
+	return pred;
+}
+
+static void
+pcr_oracle_copy_values(const struct predictor *pred, pcr_oracle_value_t **values_ret, unsigned int *count_ret)
+{
+	const tpm_pcr_bank_t *bank;
+	pcr_oracle_value_t *values;
+	unsigned int i, count = 0, pcr_index;
+
+	values = calloc(PREDICTOR_MAX_BANKS * PCR_BANK_REGISTER_MAX, sizeof(values[0]));
+	for (i = 0; (bank = predictor_get_bank(pred, i)) != NULL; ++i) {
+		for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
+			const tpm_evdigest_t *md = &bank->pcr[pcr_index];
+			pcr_oracle_value_t *v;
+
+			if (!pcr_bank_register_is_valid(bank, pcr_index))
+				continue;
+
+			if (md->size > sizeof(v->data))
+				fatal("%s: digest too large for %s\n", __func__, bank->algo_name);
+
+			v = &values[count++];
+			v->pcr_index = pcr_index;
+			snprintf(v->algo_name, sizeof(v->algo_name), "%s", bank->algo_name);
+			v->size = md->size;
+			memcpy(v->data, md->data, md->size);
+		}
+	}
+
+	*values_ret = values;
+	*count_ret = count;
+}
+
+bool
+pcr_oracle_predict(pcr_oracle_ctx_t *ctx, const char *pcr_spec,
+		pcr_oracle_value_t **values_ret, unsigned int *count_ret)
+{
+	struct predictor * volatile pred = NULL;
+	volatile bool ok = false;
+	fatal_trap_t trap;
+
+	pcr_oracle_enter(ctx, &trap);
+	if (setjmp(trap.env) == 0) {
+		if ((pred = pcr_oracle_run_predictor(ctx, pcr_spec)) != NULL) {
+			pcr_oracle_copy_values(pred, values_ret, count_ret);
+			ok = true;
+		} else {
+			pcr_oracle_set_error(ctx, "Unable to predict PCR values");
+		}
+	}
+	pcr_oracle_leave(ctx, &trap, pred);
+
+	return ok;
+}
+
+bool
+pcr_oracle_sign_policy(pcr_oracle_ctx_t *ctx, const char *pcr_spec,
+		const char *target_name, const char *private_key_path,
+		const char *input_path, const char *output_path,
+		const char *policy_name)
+{
+	struct predictor * volatile pred = NULL;
+	stored_key_t * volatile private_key = NULL;
+	volatile bool ok = false;
+	const target_platform_t *target;
+	fatal_trap_t trap;
+
+	pcr_oracle_enter(ctx, &trap);
+	if (setjmp(trap.env) == 0) {
+		if (target_name == NULL)
+			target_name = "tpm2.0";
+		if ((target = pcr_get_target_platform(target_name)) == NULL)
+			fatal("Unsupported target platform %s\n", target_name);
+
+		private_key = stored_key_new_private(STORED_KEY_FMT_PEM, private_key_path);
+
+		if ((pred = pcr_oracle_run_predictor(ctx, pcr_spec)) == NULL)
+			pcr_oracle_set_error(ctx, "Unable to predict PCR values");
+		else
+		if (!pcr_policy_sign(target, predictor_get_bank(pred, 0), private_key,
+					input_path, output_path, policy_name))
+			pcr_oracle_set_error(ctx, "Unable to sign PCR policy");
+		else
+			ok = true;
+	}
+	pcr_oracle_leave(ctx, &trap, pred);
+
+	if (private_key)
+		stored_key_free(private_key);
+	return ok;
+}
+
+void
+pcr_oracle_values_free(pcr_oracle_value_t *values)
+{
+	free(values);
+}
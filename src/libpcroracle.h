@@ -0,0 +1,77 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#ifndef LIBPCRORACLE_H
+#define LIBPCRORACLE_H
+
+/*
+ * This is the interface for programs that want to embed PCR prediction,
+ * rather than run pcr-oracle for every request. It does not pull in any
+ * of pcr-oracle's internal headers.
+ *
+ * All functions can be called from several threads, using one context per
+ * thread (or several). Results are owned by the caller; on failure, a
+ * description of the problem can be obtained using pcr_oracle_ctx_get_error().
+ *
+ * Note that predictions are computed one at a time. The library keeps a
+ * number of process wide caches (the system's event log and the events
+ * parsed from it, EFI variables, file digests), and threads calling into it
+ * concurrently take turns using these. After a call fails, these caches
+ * are discarded, so the next call starts over with the system's current
+ * state.
+ *
+ * Errors deep inside the predictor abort the call rather than unwind it.
+ * Cached EFI variables, file digests, mapped EFI applications and open
+ * partitions are released when that happens, but other memory allocated
+ * by the failed call is leaked, including the event log and signature
+ * databases it may have been parsing. A program that expects many calls
+ * to fail should not keep the library loaded indefinitely.
+ */
+
+#include <stdbool.h>
+
+#define PCR_ORACLE_MAX_DIGEST_SIZE	64
+
+typedef struct pcr_oracle_ctx	pcr_oracle_ctx_t;
+
+typedef struct pcr_oracle_value {
+	unsigned int		pcr_index;
+	char			algo_name[16];
+	unsigned int		size;
+	unsigned char		data[PCR_ORACLE_MAX_DIGEST_SIZE];
+} pcr_oracle_value_t;
+
+extern pcr_oracle_ctx_t *	pcr_oracle_ctx_new(void);
+extern void			pcr_oracle_ctx_free(pcr_oracle_ctx_t *);
+extern void			pcr_oracle_ctx_set_algorithm(pcr_oracle_ctx_t *, const char *algo_list);
+extern void			pcr_oracle_ctx_set_eventlog(pcr_oracle_ctx_t *, const char *path);
+extern void			pcr_oracle_ctx_set_boot_entry(pcr_oracle_ctx_t *, const char *id);
+extern void			pcr_oracle_ctx_set_stop_event(pcr_oracle_ctx_t *, const char *event_desc, bool after);
+extern const char *		pcr_oracle_ctx_get_error(const pcr_oracle_ctx_t *);
+
+extern bool			pcr_oracle_predict(pcr_oracle_ctx_t *, const char *pcr_selection,
+					pcr_oracle_value_t **values_ret, unsigned int *count_ret);
+extern bool			pcr_oracle_sign_policy(pcr_oracle_ctx_t *, const char *pcr_selection,
+					const char *target_platform, const char *private_key_path,
+					const char *input_path, const char *output_path,
+					const char *policy_name);
+extern void			pcr_oracle_values_free(pcr_oracle_value_t *);
+
+#endif /* LIBPCRORACLE_H */
@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <assert.h>
+#include <sys/wait.h>
 
 #include "oracle.h"
 #include "util.h"
@@ -32,52 +34,34 @@
 #include "pcr.h"
 #include "digest.h"
 #include "rsa.h"
+#include "authenticode.h"
 #include "store.h"
 #include "testcase.h"
 #include "sd-boot.h"
+#include "cache.h"
+#include "depend.h"
+#include "predictor.h"
+#include "watch.h"
+#include "serve.h"
+#include "batch.h"
+#include "tpm.h"
 
 enum {
 	ACTION_NONE,
 	ACTION_PREDICT,
 	ACTION_CREATE_AUTH_POLICY,
 	ACTION_STORE_PUBLIC_KEY,
+	ACTION_EXPORT_SRK,
 	ACTION_SEAL,
 	ACTION_UNSEAL,
 	ACTION_SIGN,
 	ACTION_SELFTEST,
 	ACTION_RSATEST,
+	ACTION_ECCTEST,
+	ACTION_WATCH,
+	ACTION_SERVE,
 };
 
-enum {
-	STOP_EVENT_NONE,
-	STOP_EVENT_GRUB_COMMAND,
-	STOP_EVENT_GRUB_FILE,
-};
-
-struct predictor {
-	uint32_t		pcr_mask;
-	const char *		initial_source;
-
-	const char *		tpm_event_log_path;
-	const char *		boot_entry_id;
-
-	const char *		algo;
-	const tpm_algo_info_t *	algo_info;
-
-	tpm_event_t *		event_log;
-	struct {
-		int		type;
-		bool		after;
-		char *		value;
-	} stop_event;
-
-	void			(*report_fn)(struct predictor *, unsigned int);
-
-	tpm_pcr_bank_t		prediction;
-};
-
-#define GRUB_PCR_SNAPSHOT_PATH	"/sys/firmware/efi/efivars/GrubPcrSnapshot-7ce323f2-b841-4d30-a0e9-5474a76c9a3f"
-
 enum {
 	OPT_FROM = 256,
 	OPT_USE_PESIGN,
@@ -101,6 +85,17 @@ enum {
 	OPT_POLICY_FORMAT,
 	OPT_TARGET_PLATFORM,
 	OPT_BOOT_ENTRY,
+	OPT_JOBS,
+	OPT_NO_CACHE,
+	OPT_DEPENDENCIES,
+	OPT_SOCKET,
+	OPT_BATCH,
+	OPT_TPM_CROSS_CHECK,
+	OPT_PERSISTENT_SRK,
+	OPT_CREATE_SRK,
+	OPT_SRK_TYPE,
+	OPT_SEAL_MANIFEST,
+	OPT_SRK_PUBLIC,
 };
 
 static struct option options[] = {
@@ -118,6 +113,17 @@ static struct option options[] = {
 	{ "verify",		required_argument,	0,	OPT_VERIFY },
 	{ "use-pesign",		no_argument,		0,	OPT_USE_PESIGN },
 	{ "boot-entry",		required_argument,	0,	OPT_BOOT_ENTRY },
+	{ "jobs",		required_argument,	0,	OPT_JOBS },
+	{ "no-cache",		no_argument,		0,	OPT_NO_CACHE },
+	{ "dependencies",	required_argument,	0,	OPT_DEPENDENCIES },
+	{ "socket",		required_argument,	0,	OPT_SOCKET },
+	{ "batch",		required_argument,	0,	OPT_BATCH },
+	{ "tpm-cross-check",	no_argument,		0,	OPT_TPM_CROSS_CHECK },
+	{ "persistent-srk",	optional_argument,	0,	OPT_PERSISTENT_SRK },
+	{ "create-srk",		no_argument,		0,	OPT_CREATE_SRK },
+	{ "srk-type",		required_argument,	0,	OPT_SRK_TYPE },
+	{ "seal-manifest",	required_argument,	0,	OPT_SEAL_MANIFEST },
+	{ "srk-public",		required_argument,	0,	OPT_SRK_PUBLIC },
 	{ "create-testcase",	required_argument,	0,	OPT_CREATE_TESTCASE },
 	{ "replay-testcase",	required_argument,	0,	OPT_REPLAY_TESTCASE },
 
@@ -138,13 +144,6 @@ static struct option options[] = {
 	{ NULL }
 };
 
-unsigned int opt_debug	= 0;
-unsigned int opt_use_pesign = 0;
-
-static void	predictor_report_plain(struct predictor *pred, unsigned int pcr_index);
-static void	predictor_report_tpm2_tools(struct predictor *pred, unsigned int pcr_index);
-static void	predictor_report_binary(struct predictor *pred, unsigned int pcr_index);
-
 static void
 usage(int exitval, const char *msg)
 {
@@ -158,7 +157,9 @@ usage(int exitval, const char *msg)
 		"The following options are recognized:\n"
 		"  --from SOURCE          Initialize PCR predictor from indicated source (see below)\n"
 		"  -A name, --algorithm name\n"
-		"                         Use hash algorithm <name>. Defaults to sha256\n"
+		"                         Use hash algorithm <name>. Defaults to sha256. When predicting,\n"
+		"                         this can be a comma separated list (eg sha1,sha256) to predict\n"
+		"                         several PCR banks at once.\n"
 		"  -F name, --output-format name\n"
 		"                         Specify how to display the resulting PCR values. The default is \"plain\",\n"
 		"                         which just prints the value as a hex string. When using \"tpm2-tools\", the\n"
@@ -177,6 +178,23 @@ usage(int exitval, const char *msg)
 		"  --verify SOURCE        After applying all updates, compare the prediction against the given SOURCE (see below).\n"
 		"  --tpm-eventlog PATH\n"
 		"                         Specify a different TPM event log to process.\n"
+		"  --jobs N               Use up to N worker processes when re-hashing event log entries.\n"
+		"  --no-cache             Do not use the cache of digests and predictions in " PCR_ORACLE_CACHE_DIR ".\n"
+		"  --dependencies FILE    Write a JSON list of all files, EFI variables etc the prediction was derived from.\n"
+		"  --socket PATH          The unix socket to listen on in serve mode (default " PCR_ORACLE_SOCKET_PATH ").\n"
+		"  --batch FILE           Run the pcr-oracle commands listed in FILE (one per line, \"-\" for stdin)\n"
+		"                         in a single process.\n"
+		"  --tpm-cross-check      Compute policy digests on the TPM as well, and check that they match.\n"
+		"  --persistent-srk[=HANDLE]\n"
+		"                         Use the SRK stored at the given persistent handle (default 0x81000001)\n"
+		"                         rather than deriving it when sealing or unsealing.\n"
+		"  --create-srk           Create the persistent SRK if it does not exist yet.\n"
+		"  --srk-type TYPE        The type of SRK to use when sealing or unsealing, rsa (default) or ecc.\n"
+		"  --seal-manifest FILE   Seal the secrets listed in FILE (one input and output file per line)\n"
+		"                         using the same SRK and policy. Alternatively, seal-secret accepts several\n"
+		"                         --input/--output pairs.\n"
+		"  --srk-public FILE      When sealing, do not use the local TPM. Instead, create a sealed object that\n"
+		"                         the TPM owning the SRK in FILE can import (see export-srk).\n"
 		"\n"
 		"The pcr-index argument can be one or more PCR indices or index ranges, separated by comma.\n"
 		"Using \"all\" selects all applicable PCR registers.\n"
@@ -199,826 +217,286 @@ usage(int exitval, const char *msg)
 	exit(exitval);
 }
 
-static void
-pcr_bank_load_initial_values(tpm_pcr_bank_t *bank, unsigned int pcr_mask, const tpm_algo_info_t *algo_info, const char *source)
-{
-	pcr_bank_initialize(bank, pcr_mask, algo_info);
-	if (!strcmp(source, "zero")
-	 || !strcmp(source, "eventlog"))
-		pcr_bank_init_from_zero(bank);
-	else if (!strcmp(source, "current"))
-		pcr_bank_init_from_current(bank);
-	else if (!strcmp(source, "snapshot"))
-		pcr_bank_init_from_snapshot(bank, GRUB_PCR_SNAPSHOT_PATH);
-	else
-		fatal("don't know how to load PCR bank with initial values: unsupported source \"%s\"\n", source);
-}
-
-static inline tpm_evdigest_t *
-predictor_get_pcr_state(struct predictor *pred, unsigned int index, const char *algo)
+static const char *
+next_argument(int argc, char **argv)
 {
-	return pcr_bank_get_register(&pred->prediction, index, algo);
+	if (optind >= argc)
+		usage(1, "Missing argument(s)");
+	return argv[optind++];
 }
 
 static void
-predictor_load_eventlog(struct predictor *pred)
-{
-	tpm_event_log_reader_t *log;
-	tpm_event_t *ev, **tail;
-	uint8_t pcr0_locality;
-
-	log = event_log_open(pred->tpm_event_log_path);
-	if (log == NULL)
-		fatal("Failed to open TPM event log, giving up.\n");
-
-	tail = &pred->event_log;
-	while ((ev = event_log_read_next(log)) != NULL) {
-		*tail = ev;
-		tail = &ev->next;
-	}
-
-	if (event_log_get_locality(log, 0, &pcr0_locality))
-		pcr_bank_set_locality(&pred->prediction, 0, pcr0_locality);
-
-	/* We check the TPM version after processing the log. Version info for TPMv2
-	 * is usually hidden in the first event. */
-	if (event_log_get_tpm_version(log) != 2) {
-		warning("Encountered TPM event log apparently generated by a TPMv%u device\n",
-				event_log_get_tpm_version(log));
-		warning("Things will most likely fail\n");
-	}
-
-	debug("Successfully read %u events from TPM event log\n", event_log_get_event_count(log));
-	event_log_close(log);
-}
-
-static struct predictor *
-predictor_new(const tpm_pcr_selection_t *pcr_selection, const char *source,
-		const char *tpm_eventlog_path,
-		const char *output_format,
-		const char *boot_entry_id)
-{
-	struct predictor *pred;
-
-	if (source == NULL)
-		source = "zero";
-
-	pred = calloc(1, sizeof(*pred));
-	pred->pcr_mask = pcr_selection->pcr_mask;
-	pred->initial_source = source;
-	pred->boot_entry_id = boot_entry_id;
-
-	pred->algo = pcr_selection->algo_info->openssl_name;
-	pred->algo_info = pcr_selection->algo_info;
-
-	if (!output_format || !strcasecmp(output_format, "plain"))
-		pred->report_fn = predictor_report_plain;
-	else
-	if (!strcasecmp(output_format, "tpm2-tools"))
-		pred->report_fn = predictor_report_tpm2_tools;
-	else
-	if (!strcasecmp(output_format, "binary"))
-		pred->report_fn = predictor_report_binary;
-	else
-		fatal("Unsupported output format \"%s\"\n", output_format);
-
-	debug("Initializing predictor for %s:%s from %s\n", pred->algo, print_pcr_mask(pred->pcr_mask), source);
-	pcr_bank_load_initial_values(&pred->prediction,
-			pcr_selection->pcr_mask,
-			pcr_selection->algo_info,
-			source);
-
-	if (!strcmp(source, "eventlog")) {
-		pred->tpm_event_log_path = tpm_eventlog_path;
-		predictor_load_eventlog(pred);
-	}
-
-	debug("Created new predictor\n");
-	return pred;
-}
-
-static bool
-__stop_event_parse(char *event_spec, char **name_p, char **value_p)
+end_arguments(int argc, char **argv)
 {
-	char *s;
-
-	if (!(s = strchr(event_spec, '='))) {
-		*name_p = event_spec;
-		*value_p = NULL;
-		return true;
-	}
-
-	*s++ = '\0';
-	if (*event_spec == '\0')
-		return false;
-
-	*name_p = event_spec;
-	*value_p = s;
-	return true;
+	if (optind < argc)
+		usage(1, "Excess argument(s)");
 }
 
-static void
-predictor_set_stop_event(struct predictor *pred, const char *event_desc, bool after)
+static int
+get_action_argument(int argc, char **argv)
 {
-	char *copy, *name, *value;
-
-	copy = strdup(event_desc);
-	if (!__stop_event_parse(copy, &name, &value))
-		fatal("Cannot parse stop event \"%s\"\n", event_desc);
-
-	if (!strcmp(name, "grub-command")) {
-		pred->stop_event.type = STOP_EVENT_GRUB_COMMAND;
-	} else
-	if (!strcmp(name, "grub-file")) {
-		pred->stop_event.type = STOP_EVENT_GRUB_FILE;
-	} else {
-		fatal("Unsupported event type \"%s\" in stop event \"%s\"\n", name, event_desc);
-	}
+	static struct act {
+		const char *	name;
+		int		value;
+	} actions[] = {
+		{ "predict",			ACTION_PREDICT	},
+		{ "create-authorized-policy",	ACTION_CREATE_AUTH_POLICY	},
+		{ "store-public-key",		ACTION_STORE_PUBLIC_KEY	 },
+		{ "export-srk",			ACTION_EXPORT_SRK	},
+		{ "seal-secret",		ACTION_SEAL	},
+		{ "unseal-secret",		ACTION_UNSEAL	},
+		{ "sign",			ACTION_SIGN	},
+		{ "self-test",			ACTION_SELFTEST	},
+		{ "rsa-test",			ACTION_RSATEST	},
+		{ "ecc-test",			ACTION_ECCTEST	},
+		{ "watch",			ACTION_WATCH	},
+		{ "serve",			ACTION_SERVE	},
 
-	pred->stop_event.value = strdup(value);
-	pred->stop_event.after = after;
-	free(copy);
-}
+		{ NULL, 0 },
+	};
+	unsigned int i;
+	const char *word;
 
-static void
-pcr_bank_extend_register(tpm_pcr_bank_t *bank, unsigned int pcr_index, const tpm_evdigest_t *d)
-{
-	tpm_evdigest_t *pcr;
-	digest_ctx_t *dctx;
+	word = next_argument(argc, argv);
 
-	if (!pcr_bank_register_is_valid(bank, pcr_index)) {
-		error("Unable to extend PCR %s:%u: register was not initialized\n",
-				bank->algo_name, pcr_index);
-		return;
+	for (i = 0; actions[i].name; ++i) {
+		if (!strcmp(actions[i].name, word))
+			return actions[i].value;
 	}
 
-	pcr = &bank->pcr[pcr_index];
-	if (pcr->algo != d->algo)
-		fatal("Cannot update PCR %u: algorithm mismatch\n", pcr_index);
-
-	dctx = digest_ctx_new(pcr->algo);
-	digest_ctx_update(dctx, pcr->data, pcr->size);
-	digest_ctx_update(dctx, d->data, d->size);
-	digest_ctx_final(dctx, pcr);
-	digest_ctx_free(dctx);
-}
-
-static void
-predictor_extend_hash(struct predictor *pred, unsigned int pcr_index, const tpm_evdigest_t *d)
-{
-	pcr_bank_extend_register(&pred->prediction, pcr_index, d);
-}
-
-static const tpm_evdigest_t *
-predictor_compute_digest(struct predictor *pred, const void *data, unsigned int size)
-{
-	return digest_compute(pred->algo_info, data, size);
-}
-
-static const tpm_evdigest_t *
-predictor_compute_file_digest(struct predictor *pred, const char *filename, int flags)
-{
-	const tpm_evdigest_t *md;
-	buffer_t *buffer;
-
-	buffer = runtime_read_file(filename, flags);
-
-	md = predictor_compute_digest(pred,
-			buffer_read_pointer(buffer),
-			buffer_available(buffer));
-	buffer_free(buffer);
-
-	return md;
-}
-
-static void
-predictor_update_string(struct predictor *pred, unsigned int pcr_index, const char *value)
-{
-	const tpm_evdigest_t *md;
-
-	debug("Extending PCR %u with string \"%s\"\n", pcr_index, value);
-	md = predictor_compute_digest(pred, value, strlen(value));
-	predictor_extend_hash(pred, pcr_index, md);
-}
-
-static void
-predictor_update_file(struct predictor *pred, unsigned int pcr_index, const char *filename)
-{
-	const tpm_evdigest_t *md;
-
-	md = predictor_compute_file_digest(pred, filename, 0);
-	predictor_extend_hash(pred, pcr_index, md);
-}
-
-static bool
-__check_stop_event(tpm_event_t *ev, int type, const char *value, tpm_event_log_scan_ctx_t *ctx)
-{
-	const char *grub_arg = NULL;
-	const char *grub_cmd = NULL;
-	tpm_parsed_event_t *parsed;
-
-	switch (type) {
-	case STOP_EVENT_NONE:
-		return false;
-
-	case STOP_EVENT_GRUB_COMMAND:
-		if (ev->pcr_index != 8
-		 || ev->event_type != TPM2_EVENT_IPL)
-			return false;
-
-		if (!(parsed = tpm_event_parse(ev, ctx)))
-			return false;
-
-		if (parsed->event_subtype != GRUB_EVENT_COMMAND)
-			return false;
-
-		if (!(grub_arg = parsed->grub_command.argv[0]))
-			return false;
-
-		grub_cmd = grub_arg;
-		while (grub_cmd != NULL && !isalpha(*grub_cmd))
-			grub_cmd++;
-
-		return !strcmp(grub_cmd, value);
-
-	case STOP_EVENT_GRUB_FILE:
-		if (ev->pcr_index != 9
-		 || ev->event_type != TPM2_EVENT_IPL)
-			return false;
-
-		if (!(parsed = tpm_event_parse(ev, ctx)))
-			return false;
-
-		if (parsed->event_subtype != GRUB_EVENT_FILE)
-			return false;
-
-		if (!(grub_arg = parsed->grub_file.path)) {
-			return false;
-		} else {
-			unsigned int match_len = strlen(value);
-			unsigned int path_len = strlen(grub_arg);
-
-			if (path_len > match_len
-			 && grub_arg[path_len - match_len - 1] == '/'
-			 && !strcmp(value, grub_arg + path_len - match_len)) {
-				debug("grub file path \"%s\" matched \"%s\"\n",
-						grub_arg, value);
-				return true;
-			}
-		}
-
-		return !strcmp(grub_arg, value);
+	/* Backward compat: predict and display */
+	if (pcr_selection_valid_string(word)) {
+		optind -= 1;
+		return ACTION_PREDICT;
 	}
 
-	return false;
+	error("Unknown action \"%s\"\n", word);
+	usage(1, NULL);
+	return ACTION_NONE;
 }
 
 /*
- * Scan ahead to a future event that will help us understand the current one.
+ * Parse a comma separated list of hash algorithms, as in "sha1,sha256"
  */
-
-/*
- * Lookahead: when processing the GPT event, we need to know which hard disk
- * we're talking about.
- */
-static void
-__predictor_lookahead_efi_partition(tpm_event_t *ev, tpm_event_log_rehash_ctx_t *ctx)
+static unsigned int
+parse_algorithm_list(const char *list, const tpm_algo_info_t **algos, unsigned int max)
 {
-	struct efi_gpt_event *gpt = &ev->__parsed->efi_gpt_event;
+	char *copy, *name;
+	unsigned int count = 0;
 
-	while ((ev = ev->next) != NULL) {
-		tpm_parsed_event_t *parsed;
+	copy = strdup(list);
+	for (name = strtok(copy, ","); name; name = strtok(NULL, ",")) {
+		const tpm_algo_info_t *algo_info;
+		unsigned int i;
 
-		if (ev->event_type != TPM2_EFI_BOOT_SERVICES_APPLICATION)
-			continue;
+		if (!(algo_info = digest_by_name(name)))
+			fatal("Hash algorithm \"%s\" not supported\n", name);
 
-		/* BSA events have already been parsed during the pre-scan */
-		if (!(parsed = ev->__parsed))
+		for (i = 0; i < count && algos[i] != algo_info; ++i)
+			;
+		if (i < count)
 			continue;
 
-		assign_string(&gpt->efi_partition, parsed->efi_bsa_event.efi_partition);
-		return;
+		if (count >= max)
+			fatal("Too many hash algorithms in \"%s\"\n", list);
+		algos[count++] = algo_info;
 	}
-}
-
-/*
- * Lookahead: when processing the BSA event that loads the shim loader, scan ahead
- * to the next BSA event (which is probably grub getting loaded).
- * We need this in order to process the "Shim" pseudo variable event that the
- * shim loader produces when verifying the authenticode signature.
- */
-static void
-__predictor_lookahead_shim_loaded(tpm_event_t *ev, tpm_event_log_rehash_ctx_t *ctx)
-{
-	tpm_parsed_event_t *parsed;
-
-	while ((ev = ev->next) != NULL) {
-		if (ev->event_type != TPM2_EFI_BOOT_SERVICES_APPLICATION)
-			continue;
-
-		/* BSA events have already been parsed during the pre-scan */
-		if (!(parsed = ev->__parsed))
-			continue;
-
-		if (!parsed->efi_bsa_event.img_info)
-			continue;
+	free(copy);
 
-		debug("Inspecting EFI application %s(%s)\n",
-				parsed->efi_bsa_event.efi_partition,
-				parsed->efi_bsa_event.efi_application);
-		ctx->next_stage_img = parsed->efi_bsa_event.img_info;
-
-#ifdef TESTING_ONLY
-		if (ctx->next_stage_img) {
-			parsed_cert_t *signer;
-			buffer_t *record;
-
-			signer = efi_application_extract_signer(parsed);
-			if (signer != NULL) {
-				debug("Application was signed by %s\n", parsed_cert_subject(signer));
-				record = efi_application_locate_authority_record("shim-vendor-cert", signer);
-				buffer_free(record);
-			}
-		}
-#endif
+	if (count == 0)
+		fatal("Empty list of hash algorithms\n");
 
-		return;
-	}
+	return count;
 }
 
-static bool
-int_list_contains(const int *list, unsigned int value)
-{
-	while (*list != -1) {
-		if (*list++ == value)
-			return true;
-	}
-	return false;
-}
-
-static int
-predictor_get_event_strategy(unsigned int event_type)
+static tpm_pcr_selection_t *
+get_pcr_selection_argument(int argc, char ** argv, const char *algo_name)
 {
-	static int rehash_types[] = {
-		TPM2_EFI_BOOT_SERVICES_APPLICATION,
-		TPM2_EFI_BOOT_SERVICES_DRIVER,
-		TPM2_EFI_VARIABLE_BOOT,
-		TPM2_EFI_VARIABLE_AUTHORITY,
-		TPM2_EFI_VARIABLE_DRIVER_CONFIG,
-
-		/* IPL: used by grub2 for PCR 8 and PCR9 */
-		TPM2_EVENT_IPL,
-
-		/* EVENT_TAG: used by the kernel for PCR9, to measure the cmdline and initrd */
-		TPM2_EVENT_EVENT_TAG,
-
-		/*
-		 * EFI_GPT_EVENT: used in updates of PCR5, seems to be a hash of several GPT headers.
-		 *	We should probably rebuild in case someone changed the partitioning.
-		 *	However, not needed as long as we don't seal against PCR5.
-		 */
-		TPM2_EFI_GPT_EVENT,
-
-		-1,
-	};
-	static int copy_types[] = {
-		TPM2_EVENT_S_CRTM_CONTENTS,
-		TPM2_EVENT_S_CRTM_VERSION,
-		TPM2_EFI_PLATFORM_FIRMWARE_BLOB,
-		TPM2_EFI_PLATFORM_FIRMWARE_BLOB2,
-		TPM2_EVENT_SEPARATOR,
-		TPM2_EVENT_POST_CODE,
-		TPM2_EFI_HANDOFF_TABLES,
-		TPM2_EFI_HANDOFF_TABLES2,
-		TPM2_EFI_ACTION,
-		TPM2_EVENT_ACTION,
-		TPM2_EVENT_NONHOST_CODE,
-		TPM2_EVENT_NONHOST_CONFIG,
-		TPM2_EVENT_NONHOST_INFO,
-		TPM2_EVENT_PLATFORM_CONFIG_FLAGS,
-
-		-1
-	};
+	tpm_pcr_selection_t *pcr_selection;
+	const char *word;
 
-	if (event_type == TPM2_EVENT_NO_ACTION)
-		return EVENT_STRATEGY_NO_ACTION;
+	word = next_argument(argc, argv);
+	if ((pcr_selection = pcr_selection_new(algo_name, word)) == NULL)
+		usage(1, NULL);
 
-	if (int_list_contains(rehash_types, event_type))
-		return EVENT_STRATEGY_PARSE_REHASH;
-	if (int_list_contains(copy_types, event_type))
-		return EVENT_STRATEGY_COPY;
+	if ((pcr_selection->pcr_mask & (1 << 10)) && ima_is_active()) {
+		infomsg("Excluding PCR 10 from prediction (used by IMA)\n");
+		pcr_selection->pcr_mask &= ~(1 << 10);
+	}
 
-	return EVENT_STRATEGY_PARSE_NONE;
+	return pcr_selection;
 }
 
 /*
- * During the pre-scan, we propagate EFI partition information from one BSA event
- * to the next.
+ * seal-secret can seal several secrets at once, using the same SRK and policy.
+ * They are given either as several --input/--output pairs, or as a manifest
+ * file listing one input and one output file per line.
  */
-static void
-predictor_pre_scan_eventlog(struct predictor *pred, tpm_event_t **stop_event_p)
-{
-	tpm_event_log_scan_ctx_t scan_ctx;
-	tpm_event_t *ev;
-
-	*stop_event_p = NULL;
-
-	tpm_event_log_scan_ctx_init(&scan_ctx);
-	for (ev = pred->event_log; ev; ev = ev->next) {
-		ev->rehash_strategy = predictor_get_event_strategy(ev->event_type);
-		/* debug("%s -> %d\n", tpm_event_type_to_string(ev->event_type), ev->rehash_strategy); */
-
-		if (ev->rehash_strategy == EVENT_STRATEGY_PARSE_REHASH) {
-			if (!tpm_event_parse(ev, &scan_ctx)) {
-				/* Provide better error logging */
-				error("Unable to parse %s event from TPM log\n", tpm_event_type_to_string(ev->event_type));
-				if (opt_debug)
-					__tpm_event_print(ev, debug);
-				fatal("Aborting.\n");
-			}
-		}
+#define SEAL_MAX_OPTIONS	64
 
-		if (__check_stop_event(ev, pred->stop_event.type, pred->stop_event.value, &scan_ctx)) {
-			*stop_event_p = ev;
-			break;
-		}
-	}
-	tpm_event_log_scan_ctx_destroy(&scan_ctx);
-}
+typedef struct seal_list {
+	unsigned int		count;
+	char **			input_paths;
+	char **			output_paths;
+} seal_list_t;
 
-static bool
-predictor_update_eventlog(struct predictor *pred)
+static void
+seal_list_add(seal_list_t *list, const char *input_path, const char *output_path)
 {
-	tpm_event_log_rehash_ctx_t rehash_ctx;
-	tpm_event_t *ev, *stop_event = NULL;
-	bool okay = true;
-
-	predictor_pre_scan_eventlog(pred, &stop_event);
-
-	tpm_event_log_rehash_ctx_init(&rehash_ctx, pred->algo_info);
-	rehash_ctx.use_pesign = opt_use_pesign;
-
-	/* The argument given to --next-kernel will be either "auto" or the
-	 * systemd ID of the next kernel entry to be booted.
-	 * FIXME: we should probably hide this behind a target_platform function.
-	 */
-	if (pred->boot_entry_id != NULL
-	 && !(rehash_ctx.boot_entry = sdb_identify_boot_entry(pred->boot_entry_id)))
-		fatal("unable to identify next kernel \"%s\"\n", pred->boot_entry_id);
-
-	for (ev = pred->event_log; ev; ev = ev->next) {
-		tpm_evdigest_t *pcr;
-		bool stop = false;
-
-		stop = (ev == stop_event);
-		if (stop && !pred->stop_event.after) {
-			debug("Stopped processing event log before indicated event\n");
-			break;
-		}
-
-		pcr = predictor_get_pcr_state(pred, ev->pcr_index, NULL);
-		if (pcr != NULL) {
-			tpm_parsed_event_t *parsed;
-			const tpm_evdigest_t *old_digest, *new_digest;
-			const char *description = NULL;
-
-			debug("\n");
-			__tpm_event_print(ev, debug);
-
-			if (!(old_digest = tpm_event_get_digest(ev, pred->algo_info)))
-				fatal("Event log lacks a hash for digest algorithm %s\n", pred->algo);
-
-			if (false) {
-				const tpm_evdigest_t *tmp_digest;
-
-				tmp_digest = digest_compute(pred->algo_info, ev->event_data, ev->event_size);
-				if (!tmp_digest) {
-					debug("cannot compute digest for event data\n");
-				} else if (!digest_equal(old_digest, tmp_digest)) {
-					debug("firmware did more than just hash the event data\n");
-					debug("  Old digest: %s\n", digest_print(old_digest));
-					debug("  New digest: %s\n", digest_print(tmp_digest));
-				}
-			}
-
-			/* By the time we encounter the GPT event, we usually haven't seen any
-			 * BOOT_SERVICES event that would tell us which partition we're booting
-			 * from.
-			 * Scan ahead to the first BSA event to extract the EFI partition.
-			 */
-			if (ev->event_type == TPM2_EFI_GPT_EVENT)
-				__predictor_lookahead_efi_partition(ev, &rehash_ctx);
-
-			/* The shim loader emits an event that tells us which certificate it
-			 * used to verify the second stage loader. We try to predict that
-			 * by checking the second stage loader's authenticode sig.
-			 */
-			if (ev->event_type == TPM2_EFI_BOOT_SERVICES_APPLICATION)
-				__predictor_lookahead_shim_loaded(ev, &rehash_ctx);
-
-			switch (ev->rehash_strategy) {
-			case EVENT_STRATEGY_PARSE_REHASH:
-				/* Event already parsed in pre-scan */
-				parsed = ev->__parsed;
-
-				new_digest = tpm_parsed_event_rehash(ev, parsed, &rehash_ctx);
-				description = tpm_parsed_event_describe(parsed);
-				break;
-
-			case EVENT_STRATEGY_COPY:
-				new_digest = old_digest;
-				break;
-
-			case EVENT_STRATEGY_NO_ACTION:
-				goto no_action;
-
-			default:
-				debug("Encountered unexpected event type %s\n",
-						tpm_event_type_to_string(ev->event_type));
-				new_digest = old_digest;
-			}
-
-			if (new_digest == NULL) {
-				error("Failed to re-hash event %u type %s\n",
-						ev->event_index,
-						tpm_event_type_to_string(ev->event_type));
-				new_digest = old_digest;
-				okay = false;
-			}
-
-			if (opt_debug && new_digest != old_digest) {
-				if (new_digest->size == old_digest->size
-				 && !memcmp(new_digest->data, old_digest->data, old_digest->size)) {
-					debug("Digest for %s did not change\n", description);
-				} else {
-					debug("Digest for %s changed\n", description);
-					debug("  Old digest: %s\n", digest_print(old_digest));
-					debug("  New digest: %s\n", digest_print(new_digest));
-				}
-			}
-
-			predictor_extend_hash(pred, ev->pcr_index, new_digest);
-		}
-
-no_action:
-		if (stop) {
-			debug("Stopped processing event log after indicated event\n");
-			break;
-		}
-	}
-
-	tpm_event_log_rehash_ctx_destroy(&rehash_ctx);
-	return okay;
+	list->input_paths = realloc(list->input_paths, (list->count + 1) * sizeof(char *));
+	list->output_paths = realloc(list->output_paths, (list->count + 1) * sizeof(char *));
+	list->input_paths[list->count] = input_path? strdup(input_path) : NULL;
+	list->output_paths[list->count] = output_path? strdup(output_path) : NULL;
+	list->count++;
 }
 
-static const char *
-get_next_arg(int *index_p, int argc, char **argv)
+static void
+seal_list_destroy(seal_list_t *list)
 {
-	int i = *index_p;
+	unsigned int i;
 
-	if (i >= argc)
-		usage(1, "Missing argument\n");
-	*index_p += 1;
-	return argv[i];
+	for (i = 0; i < list->count; ++i) {
+		drop_string(&list->input_paths[i]);
+		drop_string(&list->output_paths[i]);
+	}
+	free(list->input_paths);
+	free(list->output_paths);
+	memset(list, 0, sizeof(*list));
 }
 
 static bool
-predictor_update_all(struct predictor *pred, int argc, char **argv)
+seal_list_read_manifest(seal_list_t *list, const char *path)
 {
-	int i = 0, pcr_index = -1;
-
-	if (!strcmp(pred->initial_source, "eventlog")) {
-		if (!predictor_update_eventlog(pred))
-			return false;
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned int lineno = 0;
+	bool ok = true;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		error("Unable to open seal manifest %s: %m\n", path);
+		return false;
 	}
 
-	/* If the mask contains exactly one PCR, default pcr_index to that */
-	if (!(pred->pcr_mask & (pred->pcr_mask - 1))) {
-		unsigned int mask = pred->pcr_mask;
+	while (getline(&line, &line_size, fp) >= 0) {
+		const char *errmsg = "expected an input and an output file";
+		char *words[3];
+		int count;
 
-		/* integer log2 */
-		for (pcr_index = 0; !(mask & 1); pcr_index++)
-			mask >>= 1;
-	}
-
-	while (i < argc) {
-		const char *type, *arg;
+		lineno++;
 
-		type = get_next_arg(&i, argc, argv);
-		if (isdigit(*type)) {
-			if (!parse_pcr_index(type, (unsigned int *) &pcr_index))
-				fatal("unable to parse PCR index \"%s\"\n", type);
-			type = get_next_arg(&i, argc, argv);
-		}
-
-		if (!strcmp(type, "eventlog")) {
-			/* do the event log dance */
+		/* Same syntax as batch files */
+		count = batch_split_line(line, words, 3, &errmsg);
+		if (count == 0)
 			continue;
+		if (count != 2) {
+			error("%s:%u: %s\n", path, lineno, errmsg);
+			ok = false;
+			break;
 		}
-
-		arg = get_next_arg(&i, argc, argv);
-		if (pcr_index < 0) {
-			fprintf(stderr, "Unable to infer which PCR to update for %s %s\n", type, arg);
-			usage(1, NULL);
-		}
-
-		if (!strcmp(type, "string")) {
-			predictor_update_string(pred, pcr_index, arg);
-		} else
-		if (!strcmp(type, "file")) {
-			predictor_update_file(pred, pcr_index, arg);
-		} else {
-			fprintf(stderr, "Unsupported keyword \"%s\" while trying to update predictor\n", type);
-			usage(1, NULL);
-		}
+		seal_list_add(list, words[0], words[1]);
 	}
 
-	return true;
-}
-
-static unsigned int
-predictor_verify(struct predictor *pred, const char *source)
-{
-	tpm_pcr_bank_t actual;
-	unsigned int pcr_index;
-	unsigned int num_mismatches = 0;
-
-	printf("Verifying predicted state versus \"%s\"\n", source);
-	pcr_bank_load_initial_values(&actual, pred->pcr_mask, pred->algo_info, source);
-
-	/* Now compare the digests */
-	for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
-		tpm_evdigest_t *md_predicted, *md_actual;
-
-		md_predicted = pcr_bank_get_register(&pred->prediction, pcr_index, NULL);
-		if (md_predicted == NULL)
-			continue;
-
-		if (!pcr_bank_register_is_valid(&actual, pcr_index)) {
-			md_actual = NULL;
-		} else {
-			md_actual = pcr_bank_get_register(&actual, pcr_index, NULL);
-		}
-
-		if (md_actual == NULL) {
-			/* quietly skip any PCRs we never extended.
-			 * This happens when the PCR mask was "all" */
-			if (digest_is_zero(md_predicted))
-				continue;
-
-			debug("PCR %u not present in %s\n", pcr_index, source);
-			printf("%s:%u %s MISSING\n", pred->algo, pcr_index, digest_print_value(md_predicted));
-			num_mismatches += 1;
-			continue;
-		}
-
-		if (digest_equal(md_predicted, md_actual)) {
-			printf("%s:%u %s OK\n", pred->algo, pcr_index, digest_print_value(md_predicted));
-		} else {
-			printf("%s:%u %s MISMATCH", pred->algo, pcr_index, digest_print_value(md_predicted));
-			printf("; actual=%s\n", digest_print_value(md_actual));
-			num_mismatches += 1;
-		}
+	if (ok && list->count == 0) {
+		error("%s: no secrets to seal\n", path);
+		ok = false;
 	}
 
-	if (num_mismatches)
-		error("Found %u mismatches\n", num_mismatches);
-	return num_mismatches;
+	free(line);
+	fclose(fp);
+	return ok;
 }
 
-static void
-predictor_report(struct predictor *pred)
-{
-	const tpm_pcr_bank_t *bank = &pred->prediction;
-	unsigned int pcr_index;
-
-	for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
-		if (pcr_bank_register_is_valid(bank, pcr_index))
-			pred->report_fn(pred, pcr_index);
-	}
-}
+/*
+ * In serve mode, warm up what every request would otherwise have to set up
+ * on its own, then hand over to the server loop. Requests are executed by
+ * processes forked off this one, which run pcr_oracle_main() again.
+ *
+ * We deliberately do not keep EFI variables or signature databases around,
+ * as they can change at any time (think dbx updates).
+ *
+ * Nor do we open the TPM here. Each worker gets a connection of its own, so
+ * that when it exits (or dies half way through), the resource manager
+ * flushes whatever transient objects and sessions it left behind.
+ */
+static int	pcr_oracle_main(int argc, char **argv);
+static bool	pcr_oracle_in_server;
 
-static void
-predictor_report_plain(struct predictor *pred, unsigned int pcr_index)
+static int
+pcr_oracle_serve_command(int argc, char **argv)
 {
-	unsigned int i;
-	tpm_evdigest_t *pcr;
-
-	if (!(pcr = predictor_get_pcr_state(pred, pcr_index, NULL)))
-		return;
-
-	printf("%s:%u ", pred->algo, pcr_index);
-	for (i = 0; i < pcr->size; i++)
-		printf("%02x", pcr->data[i]);
-	printf("\n");
+	pcr_oracle_in_server = true;
+	return pcr_oracle_main(argc, argv);
 }
 
-static void
-predictor_report_tpm2_tools(struct predictor *pred, unsigned int pcr_index)
+static int
+pcr_oracle_serve(const char *socket_path)
 {
-	unsigned int i;
-	tpm_evdigest_t *pcr;
+	if (socket_path == NULL)
+		socket_path = PCR_ORACLE_SOCKET_PATH;
 
-	if (!(pcr = predictor_get_pcr_state(pred, pcr_index, NULL)))
-		return;
+	if (!predictor_read_system_eventlog())
+		warning("Unable to read TPM event log\n");
 
-	printf("  %-2d: 0x", pcr_index);
-	for (i = 0; i < pcr->size; i++)
-		printf("%02X", pcr->data[i]);
-	printf("\n");
-}
-
-static void
-predictor_report_binary(struct predictor *pred, unsigned int pcr_index)
-{
-	tpm_evdigest_t *pcr;
+	tss_serialize_access();
 
-	if (!(pcr = predictor_get_pcr_state(pred, pcr_index, NULL)))
-		return;
-	if (fwrite(pcr->data, pcr->size, 1, stdout) != 1)
-		fatal("failed to write hash to stdout");
+	return serve_loop(socket_path, pcr_oracle_serve_command);
 }
 
-static const char *
-next_argument(int argc, char **argv)
-{
-	if (optind >= argc)
-		usage(1, "Missing argument(s)");
-	return argv[optind++];
-}
-
-static void
-end_arguments(int argc, char **argv)
-{
-	if (optind < argc)
-		usage(1, "Excess argument(s)");
-}
+/*
+ * In batch mode, all commands run in this process, so that they share the
+ * event log and what we parsed from it, the private key, the TPM context
+ * and the SRK. Options given on the command line along with --batch apply
+ * to all commands; each command starts out with these.
+ */
+static bool	pcr_oracle_in_batch;
+static bool	pcr_oracle_batch_tpm_check;
+static uint32_t	pcr_oracle_batch_srk_handle;
+static bool	pcr_oracle_batch_srk_create;
 
 static int
-get_action_argument(int argc, char **argv)
+pcr_oracle_batch_command(int argc, char **argv)
 {
-	static struct act {
-		const char *	name;
-		int		value;
-	} actions[] = {
-		{ "predict",			ACTION_PREDICT	},
-		{ "create-authorized-policy",	ACTION_CREATE_AUTH_POLICY	},
-		{ "store-public-key",		ACTION_STORE_PUBLIC_KEY	 },
-		{ "seal-secret",		ACTION_SEAL	},
-		{ "unseal-secret",		ACTION_UNSEAL	},
-		{ "sign",			ACTION_SIGN	},
-		{ "self-test",			ACTION_SELFTEST	},
-		{ "rsa-test",			ACTION_RSATEST	},
-
-		{ NULL, 0 },
-	};
-	unsigned int i;
-	const char *word;
-
-	word = next_argument(argc, argv);
-
-	for (i = 0; actions[i].name; ++i) {
-		if (!strcmp(actions[i].name, word))
-			return actions[i].value;
-	}
-
-	/* Backward compat: predict and display */
-	if (pcr_selection_valid_string(word)) {
-		optind -= 1;
-		return ACTION_PREDICT;
-	}
-
-	error("Unknown action \"%s\"\n", word);
-	usage(1, NULL);
-	return ACTION_NONE;
+	unsigned int saved_debug = opt_debug;
+	unsigned int saved_use_pesign = opt_use_pesign;
+	bool saved_cache_enabled = cache_is_enabled();
+	int exit_code;
+
+	exit_code = pcr_oracle_main(argc, argv);
+
+	opt_debug = saved_debug;
+	opt_use_pesign = saved_use_pesign;
+	cache_set_enabled(saved_cache_enabled);
+	pcr_policy_set_tpm_check(pcr_oracle_batch_tpm_check);
+	pcr_policy_set_srk_handle(pcr_oracle_batch_srk_handle, pcr_oracle_batch_srk_create);
+	return exit_code;
 }
 
-static tpm_pcr_selection_t *
-get_pcr_selection_argument(int argc, char ** argv, const char *algo_name)
+static int
+pcr_oracle_batch(const char *path, bool tpm_check)
 {
-	tpm_pcr_selection_t *pcr_selection;
-	const char *word;
+	int exit_code;
 
-	word = next_argument(argc, argv);
-	if ((pcr_selection = pcr_selection_new(algo_name, word)) == NULL)
-		usage(1, NULL);
+	pcr_oracle_in_batch = true;
+	pcr_oracle_batch_tpm_check = tpm_check;
+	pcr_policy_get_srk_handle(&pcr_oracle_batch_srk_handle, &pcr_oracle_batch_srk_create);
+	pcr_policy_keep_srk(true);
 
-	if ((pcr_selection->pcr_mask & (1 << 10)) && ima_is_active()) {
-		infomsg("Excluding PCR 10 from prediction (used by IMA)\n");
-		pcr_selection->pcr_mask &= ~(1 << 10);
-	}
+	exit_code = batch_run(path, pcr_oracle_batch_command);
 
-	return pcr_selection;
+	pcr_policy_keep_srk(false);
+	pcr_oracle_in_batch = false;
+	return exit_code;
 }
 
-int
-main(int argc, char **argv)
+static int
+pcr_oracle_main(int argc, char **argv)
 {
 	struct predictor *pred;
 	int action = ACTION_NONE;
 	tpm_pcr_selection_t *pcr_selection = NULL;
 	char *opt_from = NULL;
-	char *opt_algo = NULL;
+	const char *opt_algo = NULL;
 	char *opt_output_format = NULL;
 	char *opt_stop_event = NULL;
 	char *opt_eventlog_path = NULL;
@@ -1028,18 +506,39 @@ main(int argc, char **argv)
 	char *opt_replay_testcase = NULL;
 	char *opt_input = NULL;
 	char *opt_output = NULL;
+	char *opt_inputs[SEAL_MAX_OPTIONS];
+	char *opt_outputs[SEAL_MAX_OPTIONS];
+	unsigned int num_inputs = 0, num_outputs = 0;
+	char *opt_seal_manifest = NULL;
+	seal_list_t seal_list = { 0 };
+	char *opt_dependencies = NULL;
+	char *opt_socket = NULL;
+	char *opt_batch = NULL;
+	bool opt_tpm_cross_check = false;
+	bool opt_persistent_srk = false;
+	bool opt_create_srk = false;
+	uint32_t srk_handle = PCR_SRK_PERSISTENT_HANDLE;
 	char *opt_authorized_policy = NULL;
 	char *opt_pcr_policy = NULL;
 	stored_key_t *opt_rsa_private_key = NULL;
 	stored_key_t *opt_rsa_public_key = NULL;
 	bool opt_rsa_generate = false;
 	char *opt_rsa_bits = NULL;
+	char *opt_srk_type = NULL;
+	stored_key_t *opt_srk_public = NULL;
 	char *opt_policy_name = NULL;
 	char *opt_target_platform = NULL;
 	char *opt_boot_entry = NULL;
 	const target_platform_t *target;
 	unsigned int action_flags = 0;
 	unsigned int rsa_bits = 2048;
+	unsigned int opt_jobs = 1;
+	const tpm_algo_info_t *algos[PREDICTOR_MAX_BANKS];
+	unsigned int num_algos = 0;
+	char *cache_key;
+	dependency_list_t *deps = NULL;
+	int watch_fd = -1;
+	char *end;
 	int c, exit_code = 0;
 
 	while ((c = getopt_long(argc, argv, "dhA:CF:LSZ", options, NULL)) != EOF) {
@@ -1089,6 +588,44 @@ main(int argc, char **argv)
 		case OPT_VERIFY:
 			opt_verify = optarg;
 			break;
+		case OPT_JOBS:
+			opt_jobs = strtoul(optarg, &end, 0);
+			if (*end || opt_jobs == 0)
+				fatal("Invalid argument to --jobs: \"%s\"\n", optarg);
+			break;
+		case OPT_NO_CACHE:
+			cache_set_enabled(false);
+			break;
+		case OPT_DEPENDENCIES:
+			opt_dependencies = optarg;
+			break;
+		case OPT_SOCKET:
+			opt_socket = optarg;
+			break;
+		case OPT_BATCH:
+			opt_batch = optarg;
+			break;
+		case OPT_TPM_CROSS_CHECK:
+			opt_tpm_cross_check = true;
+			break;
+		case OPT_PERSISTENT_SRK:
+			opt_persistent_srk = true;
+			if (optarg) {
+				srk_handle = strtoul(optarg, &end, 16);
+				if (*end || (srk_handle >> 24) != 0x81)
+					fatal("Invalid persistent SRK handle \"%s\"\n", optarg);
+			}
+			break;
+		case OPT_CREATE_SRK:
+			opt_create_srk = true;
+			break;
+		case OPT_SRK_TYPE:
+			opt_srk_type = optarg;
+			break;
+		case OPT_SRK_PUBLIC:
+			/* The SRK public key uses native TPM format */
+			opt_srk_public = stored_key_new_public(STORED_KEY_FMT_NATIVE, optarg);
+			break;
 		case OPT_CREATE_TESTCASE:
 			opt_create_testcase = optarg;
 			break;
@@ -1110,10 +647,17 @@ main(int argc, char **argv)
 			opt_rsa_bits = optarg;
 			break;
 		case OPT_INPUT:
-			opt_input = optarg;
+			if (num_inputs >= SEAL_MAX_OPTIONS)
+				fatal("Too many --input options\n");
+			opt_inputs[num_inputs++] = opt_input = optarg;
 			break;
 		case OPT_OUTPUT:
-			opt_output = optarg;
+			if (num_outputs >= SEAL_MAX_OPTIONS)
+				fatal("Too many --output options\n");
+			opt_outputs[num_outputs++] = opt_output = optarg;
+			break;
+		case OPT_SEAL_MANIFEST:
+			opt_seal_manifest = optarg;
 			break;
 		case OPT_AUTHORIZED_POLICY:
 			opt_authorized_policy = optarg;
@@ -1142,17 +686,65 @@ main(int argc, char **argv)
 		}
 	}
 
+	if (opt_tpm_cross_check)
+		pcr_policy_set_tpm_check(true);
+
+	if (opt_create_srk && !opt_persistent_srk)
+		usage(1, "The --create-srk option requires --persistent-srk\n");
+	if (opt_persistent_srk)
+		pcr_policy_set_srk_handle(srk_handle, opt_create_srk);
+
+	if (opt_batch) {
+		if (pcr_oracle_in_batch)
+			fatal("--batch cannot be used inside a batch\n");
+		end_arguments(argc, argv);
+		return pcr_oracle_batch(opt_batch, opt_tpm_cross_check);
+	}
+
 	action = get_action_argument(argc, argv);
 
+	if (pcr_oracle_in_batch) {
+		if (action == ACTION_WATCH || action == ACTION_SERVE)
+			fatal("The watch and serve actions cannot be used inside a batch\n");
+		if (opt_create_testcase || opt_replay_testcase)
+			fatal("--create-testcase and --replay-testcase cannot be used inside a batch\n");
+	}
+
+	if (pcr_oracle_in_server) {
+		if (action == ACTION_WATCH || action == ACTION_SERVE)
+			fatal("The watch and serve actions cannot be requested from a server\n");
+		if (opt_create_testcase || opt_replay_testcase)
+			fatal("--create-testcase and --replay-testcase cannot be requested from a server\n");
+	}
+
+	if (opt_algo && strchr(opt_algo, ',')) {
+		if (action != ACTION_PREDICT)
+			usage(1, "More than one hash algorithm is supported only when predicting PCR values\n");
+
+		num_algos = parse_algorithm_list(opt_algo, algos, PREDICTOR_MAX_BANKS);
+		opt_algo = algos[0]->openssl_name;
+	}
+
 	if (opt_replay_testcase && opt_create_testcase)
 		fatal("--create-testcase and --replay-testcase are mutually exclusive\n");
 
 	if (opt_replay_testcase)
 		runtime_replay_testcase(testcase_alloc(opt_replay_testcase));
 
-	if (opt_create_testcase)
+	/* An event log read earlier in this process would bypass
+	 * testcase recording and playback */
+	if (opt_replay_testcase || opt_create_testcase)
+		predictor_set_share_event_log(false);
+
+	if (opt_create_testcase) {
 		runtime_record_testcase(testcase_alloc(opt_create_testcase));
 
+		/* Worker processes would all write to the same recording */
+		if (opt_jobs > 1)
+			warning("Ignoring --jobs option when creating a testcase\n");
+		opt_jobs = 1;
+	}
+
 	if (opt_rsa_bits) {
 		if (strcmp(opt_rsa_bits, "2048") == 0)
 			rsa_bits = 2048;
@@ -1186,6 +778,12 @@ main(int argc, char **argv)
 		end_arguments(argc, argv);
 		break;
 
+	case ACTION_EXPORT_SRK:
+		if (opt_output == NULL)
+			usage(1, "You need to specify the --output option when exporting the SRK\n");
+		end_arguments(argc, argv);
+		break;
+
 	case ACTION_CREATE_AUTH_POLICY:
 		if (opt_input != NULL)
 			warning("Ignoring --input option when creating authorized policy\n");
@@ -1201,6 +799,25 @@ main(int argc, char **argv)
 		if (opt_authorized_policy == NULL)
 			pcr_selection = get_pcr_selection_argument(argc, argv, opt_algo);
 		end_arguments(argc, argv);
+
+		if (opt_seal_manifest) {
+			if (num_inputs || num_outputs)
+				usage(1, "The --seal-manifest option cannot be combined with --input or --output\n");
+			if (!seal_list_read_manifest(&seal_list, opt_seal_manifest)) {
+				seal_list_destroy(&seal_list);
+				return 1;
+			}
+		} else
+		if (num_inputs <= 1 && num_outputs <= 1) {
+			seal_list_add(&seal_list, opt_input, opt_output);
+		} else {
+			unsigned int i;
+
+			if (num_inputs != num_outputs)
+				usage(1, "When sealing several secrets, specify the same number of --input and --output options\n");
+			for (i = 0; i < num_inputs; ++i)
+				seal_list_add(&seal_list, opt_inputs[i], opt_outputs[i]);
+		}
 		break;
 
 	case ACTION_UNSEAL:
@@ -1222,6 +839,7 @@ main(int argc, char **argv)
 		break;
 
 	case ACTION_SIGN:
+	case ACTION_WATCH:
 		if (opt_rsa_private_key == NULL)
 			usage(1, "You need to specify the --private-key option when signing a policy\n");
 		if (opt_output == NULL)
@@ -1236,6 +854,11 @@ main(int argc, char **argv)
 		break;
 
 	case ACTION_RSATEST:
+	case ACTION_ECCTEST:
+		end_arguments(argc, argv);
+		break;
+
+	case ACTION_SERVE:
 		end_arguments(argc, argv);
 		break;
 
@@ -1269,7 +892,27 @@ main(int argc, char **argv)
 		}
 	}
 
+	if (action == ACTION_ECCTEST) {
+		if (tpm_ecc_curve_test(TPM2_ECC_NIST_P256)) {
+			infomsg("ECC NIST P-256 supported\n");
+			return 0;
+		} else {
+			infomsg("ECC NIST P-256 unsupported\n");
+			return 1;
+		}
+	}
+
 	set_srk_rsa_bits (rsa_bits);
+	if (!set_srk_type(opt_srk_type))
+		fatal("Unsupported SRK type: %s\n", opt_srk_type);
+
+	if (opt_srk_public && action != ACTION_SEAL)
+		warning("Ignoring --srk-public option\n");
+	if (!pcr_policy_set_srk_public(action == ACTION_SEAL? opt_srk_public : NULL))
+		return 1;
+
+	if (action == ACTION_SERVE)
+		return pcr_oracle_serve(opt_socket);
 
 	if (action == ACTION_SELFTEST) {
 		if (!tpm_selftest(true))
@@ -1291,13 +934,22 @@ main(int argc, char **argv)
 		return 0;
 	}
 
+	if (action == ACTION_EXPORT_SRK) {
+		if (!pcr_store_srk_public(stored_key_new_public(STORED_KEY_FMT_NATIVE, opt_output)))
+			return 1;
+		infomsg("SRK public key written to %s\n", opt_output);
+		return 0;
+	}
+
 	/* When sealing a secret against an authorized policy, there's no need to
 	 * mess around with PCR values. That's the beauty of it... */
 	if (action == ACTION_SEAL && opt_authorized_policy) {
-		if (!pcr_authorized_policy_seal_secret(target, opt_authorized_policy, opt_input, opt_output))
-			return 1;
+		bool ok;
 
-		return 0;
+		ok = pcr_authorized_policy_seal_secret(target, opt_authorized_policy,
+				seal_list.count, seal_list.input_paths, seal_list.output_paths);
+		seal_list_destroy(&seal_list);
+		return ok? 0 : 1;
 	}
 
 	if (action == ACTION_UNSEAL) {
@@ -1314,14 +966,50 @@ main(int argc, char **argv)
 	if (pcr_selection == NULL)
 		fatal("BUG: action %u should have parsed a PCR selection argument", action);
 
-	pred = predictor_new(pcr_selection, opt_from, opt_eventlog_path,
+	/* In watch mode, the parent process never gets past this point. Each
+	 * round of predicting and signing happens in a child process that
+	 * reports what the prediction depended on through watch_fd. */
+	if (action == ACTION_WATCH) {
+		watch_fd = watch_loop(WATCH_DEBOUNCE_SECONDS);
+		action = ACTION_SIGN;
+	}
+
+	pred = predictor_new(pcr_selection, num_algos, algos, opt_from, opt_eventlog_path,
 			opt_output_format, opt_boot_entry);
 
 	if (opt_stop_event)
 		predictor_set_stop_event(pred, opt_stop_event, !opt_stop_before);
 
-	if (!predictor_update_all(pred, argc - optind, argv + optind))
+	predictor_set_jobs(pred, opt_jobs);
+
+	cache_key = predictor_cache_key(pred, argc - optind, argv + optind);
+	if (cache_key == NULL || !predictor_cache_load(pred, cache_key, &deps)) {
+		dependency_list_t *outer;
+		bool okay;
+
+		if (cache_key || opt_dependencies || watch_fd >= 0)
+			deps = dependency_list_new();
+
+		outer = dependency_record_start(deps);
+		okay = predictor_update_all(pred, argc - optind, argv + optind);
+		dependency_record_stop(outer);
+
+		if (!okay)
+			return 1;
+
+		if (deps && cache_key)
+			predictor_cache_save(pred, cache_key, deps);
+	}
+	drop_string(&cache_key);
+
+	if (opt_dependencies && !dependency_list_write_manifest(deps, opt_dependencies))
 		return 1;
+	if (watch_fd >= 0) {
+		watch_report_dependencies(watch_fd, deps);
+		close(watch_fd);
+	}
+	if (deps)
+		dependency_list_free(deps);
 
 	if (action == ACTION_PREDICT) {
 		if (opt_verify)
@@ -1330,13 +1018,39 @@ main(int argc, char **argv)
 			predictor_report(pred);
 	} else
 	if (action == ACTION_SEAL) {
-		if (!pcr_seal_secret(target, &pred->prediction, opt_input, opt_output))
+		bool ok;
+
+		ok = pcr_seal_secret(target, predictor_get_bank(pred, 0),
+				seal_list.count, seal_list.input_paths, seal_list.output_paths);
+		seal_list_destroy(&seal_list);
+		if (!ok)
 			return 1;
 	} else
 	if (action == ACTION_SIGN) {
-		if (!pcr_policy_sign(target, &pred->prediction, opt_rsa_private_key, opt_input, opt_output, opt_policy_name))
+		char *sign_key;
+
+		sign_key = predictor_signed_policy_key(pred, opt_target_platform, opt_rsa_private_key,
+				opt_input, opt_output, opt_policy_name);
+		if (sign_key && predictor_signed_policy_is_current(sign_key, opt_output)) {
+			infomsg("Signed PCR policy in %s is up to date\n", opt_output);
+			free(sign_key);
+			return exit_code;
+		}
+
+		if (!pcr_policy_sign(target, predictor_get_bank(pred, 0), opt_rsa_private_key, opt_input, opt_output, opt_policy_name))
 			return 1;
+
+		if (sign_key) {
+			predictor_signed_policy_update(sign_key, opt_output);
+			free(sign_key);
+		}
 	}
 
 	return exit_code;
 }
+
+int
+main(int argc, char **argv)
+{
+	return pcr_oracle_main(argc, argv);
+}
@@ -38,8 +38,10 @@
 #include "rsa.h"
 #include "bufparser.h"
 #include "tpm.h"
+#include "cache.h"
 #include "config.h"
 #include "tpm2key.h"
+#include "duplicate.h"
 #include "sd-boot.h"
 
 struct target_platform {
@@ -50,6 +52,11 @@ struct target_platform {
 					const TPML_PCR_SELECTION *pcr_sel,
 					const TPM2B_PRIVATE *sealed_private,
 					const TPM2B_PUBLIC *sealed_public);
+	bool		(*write_importable_secret)(const char *pathname,
+					const TPML_PCR_SELECTION *pcr_sel,
+					const TPM2B_PRIVATE *duplicate,
+					const TPM2B_PUBLIC *sealed_public,
+					const TPM2B_ENCRYPTED_SECRET *encrypted_seed);
 	bool		(*write_signed_policy)(const char *input_path, const char *output_path,
 					const char *policy_name,
 					const tpm_pcr_bank_t *bank,
@@ -62,7 +69,7 @@ struct target_platform {
 					const stored_key_t *public_key_file);
 };
 
-static TPM2B_PUBLIC SRK_template = {
+static TPM2B_PUBLIC SRK_rsa_template = {
 	.size = sizeof(TPMT_PUBLIC),
 	.publicArea = {
 		.type = TPM2_ALG_RSA,
@@ -87,6 +94,35 @@ static TPM2B_PUBLIC SRK_template = {
 	}
 };
 
+/* The ECC NIST P-256 SRK template from the TCG provisioning guidance.
+ * Deriving it is much faster than deriving an RSA key. */
+static const TPM2B_PUBLIC SRK_ecc_template = {
+	.size = sizeof(TPMT_PUBLIC),
+	.publicArea = {
+		.type = TPM2_ALG_ECC,
+		.nameAlg = TPM2_ALG_SHA256,
+		.objectAttributes = TPMA_OBJECT_RESTRICTED|TPMA_OBJECT_DECRYPT \
+			|TPMA_OBJECT_FIXEDTPM|TPMA_OBJECT_FIXEDPARENT \
+			|TPMA_OBJECT_SENSITIVEDATAORIGIN|TPMA_OBJECT_USERWITHAUTH \
+			|TPMA_OBJECT_NODA,
+		.parameters = {
+			.eccDetail = {
+				.symmetric = {
+					.algorithm = TPM2_ALG_AES,
+					.keyBits = { .sym = 128 },
+					.mode = { .sym = TPM2_ALG_CFB },
+				},
+				.scheme = { TPM2_ALG_NULL },
+				.curveID = TPM2_ECC_NIST_P256,
+				.kdf = { TPM2_ALG_NULL },
+			}
+		}
+	}
+};
+
+static const TPM2B_PUBLIC *	SRK_template = &SRK_rsa_template;
+static bool			srk_type_explicit;
+
 static const TPM2B_PUBLIC seal_public_template = {
             .size = sizeof(TPMT_PUBLIC),
             .publicArea = {
@@ -109,7 +145,38 @@ static const TPM2B_PUBLIC seal_public_template = {
 void
 set_srk_rsa_bits (const unsigned int rsa_bits)
 {
-	SRK_template.publicArea.parameters.rsaDetail.keyBits = rsa_bits;
+	SRK_rsa_template.publicArea.parameters.rsaDetail.keyBits = rsa_bits;
+}
+
+/*
+ * Select the type of SRK to use; NULL selects the default (RSA)
+ */
+bool
+set_srk_type(const char *name)
+{
+	if (name == NULL || !strcmp(name, "rsa")) {
+		SRK_template = &SRK_rsa_template;
+	} else
+	if (!strcmp(name, "ecc")) {
+		SRK_template = &SRK_ecc_template;
+	} else {
+		return false;
+	}
+
+	srk_type_explicit = (name != NULL);
+	return true;
+}
+
+static const char *
+srk_template_id(const TPM2B_PUBLIC *tmpl)
+{
+	static __thread char id[32];
+
+	if (tmpl->publicArea.type == TPM2_ALG_ECC)
+		return "ecc-p256";
+
+	snprintf(id, sizeof(id), "rsa%u", tmpl->publicArea.parameters.rsaDetail.keyBits);
+	return id;
 }
 
 static inline const tpm_evdigest_t *
@@ -262,7 +329,8 @@ write_signature(const char *path, const TPMT_SIGNATURE *s)
 	if (!tss_check_error(rc, "Tss2_MU_TPMT_SIGNATURE_Marshal failed"))
 		goto cleanup;
 
-	ok = runtime_write_file(path, bp);
+	/* The signed policy may be rewritten by "watch" while others read it */
+	ok = buffer_write_file_ext(path, bp, RUNTIME_WRITE_ATOMIC);
 
 cleanup:
 	buffer_free(bp);
@@ -513,7 +581,7 @@ cleanup:
 }
 
 static TPM2B_DIGEST *
-__pcr_policy_make(ESYS_CONTEXT *esys_context, const tpm_pcr_bank_t *bank)
+__pcr_policy_make_tpm(ESYS_CONTEXT *esys_context, const tpm_pcr_bank_t *bank)
 {
 	TPML_PCR_SELECTION pcrSel;
 	TPM2B_DIGEST *pcrDigest = NULL;
@@ -535,6 +603,136 @@ __pcr_policy_make(ESYS_CONTEXT *esys_context, const tpm_pcr_bank_t *bank)
 	return result;
 }
 
+/*
+ * Policy digests do not need a TPM; we can compute them just like the TPM
+ * does in a trial session. Each policy command updates the digest as
+ *
+ *	policyDigest := H(policyDigest || command code || command specific data)
+ *
+ * where H is the session's hash algorithm (always SHA256 for us), and the
+ * initial policyDigest is all zeros.
+ *
+ * When asked to, we still compute the digests on the TPM as well, and
+ * compare the results.
+ */
+static bool	pcr_policy_tpm_check = false;
+
+void
+pcr_policy_set_tpm_check(bool enable)
+{
+	pcr_policy_tpm_check = enable;
+}
+
+static TPM2B_DIGEST *
+__policy_digest_new(void)
+{
+	TPM2B_DIGEST *policy;
+
+	policy = calloc(1, sizeof(*policy));
+	policy->size = digest_by_tpm_alg(TPM2_ALG_SHA256)->digest_size;
+	return policy;
+}
+
+static void
+__policy_digest_update(TPM2B_DIGEST *policy, const void *data, size_t len)
+{
+	digest_ctx_t *ctx;
+	tpm_evdigest_t md;
+
+	ctx = digest_ctx_new(digest_by_tpm_alg(TPM2_ALG_SHA256));
+	digest_ctx_update(ctx, policy->buffer, policy->size);
+	if (len)
+		digest_ctx_update(ctx, data, len);
+	digest_ctx_final(ctx, &md);
+	digest_ctx_free(ctx);
+
+	assert(md.size <= sizeof(policy->buffer));
+	policy->size = md.size;
+	memcpy(policy->buffer, md.data, md.size);
+}
+
+static bool
+__policy_digest_check(const TPM2B_DIGEST *soft, const TPM2B_DIGEST *tpm, const char *what)
+{
+	if (tpm == NULL) {
+		error("Unable to compute %s digest on the TPM\n", what);
+		return false;
+	}
+
+	if (soft->size != tpm->size || memcmp(soft->buffer, tpm->buffer, soft->size)) {
+		error("%s digest computed in software does not match the one computed by the TPM\n", what);
+		return false;
+	}
+
+	debug("%s digest matches the one computed by the TPM\n", what);
+	return true;
+}
+
+static TPM2B_DIGEST *
+__pcr_policy_make_soft(const tpm_pcr_bank_t *bank)
+{
+	uint8_t data[sizeof(TPM2_CC) + sizeof(TPML_PCR_SELECTION) + sizeof(TPMU_HA)];
+	TPML_PCR_SELECTION pcr_sel;
+	tpm_evdigest_t pcr_digest;
+	TPM2B_DIGEST *policy;
+	digest_ctx_t *ctx;
+	size_t len = 0;
+	unsigned int i;
+	TSS2_RC rc;
+
+	/* The PCR composite digest is the hash of all selected PCR values,
+	 * in ascending order of their indices. */
+	memset(&pcr_sel, 0, sizeof(pcr_sel));
+	ctx = digest_ctx_new(bank->algo_info);
+	for (i = 0; i < PCR_BANK_REGISTER_MAX; ++i) {
+		const tpm_evdigest_t *d;
+
+		if (!pcr_bank_register_is_valid(bank, i))
+			continue;
+		d = &bank->pcr[i];
+
+		digest_ctx_update(ctx, d->data, d->size);
+		__pcr_selection_add(&pcr_sel, bank->algo_info->tcg_id, i);
+	}
+	digest_ctx_final(ctx, &pcr_digest);
+	digest_ctx_free(ctx);
+
+	rc = Tss2_MU_TPM2_CC_Marshal(TPM2_CC_PolicyPCR, data, sizeof(data), &len);
+	if (rc == TSS2_RC_SUCCESS)
+		rc = Tss2_MU_TPML_PCR_SELECTION_Marshal(&pcr_sel, data, sizeof(data), &len);
+	if (!tss_check_error(rc, "Unable to marshal PolicyPCR arguments"))
+		return NULL;
+
+	assert(len + pcr_digest.size <= sizeof(data));
+	memcpy(data + len, pcr_digest.data, pcr_digest.size);
+	len += pcr_digest.size;
+
+	policy = __policy_digest_new();
+	__policy_digest_update(policy, data, len);
+	return policy;
+}
+
+static TPM2B_DIGEST *
+__pcr_policy_make(const tpm_pcr_bank_t *bank)
+{
+	TPM2B_DIGEST *result, *check;
+
+	if (!(result = __pcr_policy_make_soft(bank)))
+		return NULL;
+
+	if (pcr_policy_tpm_check) {
+		check = __pcr_policy_make_tpm(tss_esys_context(), bank);
+		if (!__policy_digest_check(result, check, "PolicyPCR")) {
+			free(result);
+			result = NULL;
+		}
+		if (check)
+			free(check);
+	}
+
+	return result;
+}
+
 static bool
 esys_create_authorized_policy(ESYS_CONTEXT *esys_context,
 			TPM2B_DIGEST *pcrPolicy, const TPM2B_PUBLIC *pubKey,
@@ -597,6 +795,66 @@ out:
 	return okay;
 }
 
+/*
+ * PolicyAuthorize resets the policy digest, and then updates it twice:
+ * first with the command code and the name of the signing key, then with
+ * the policy reference (which is empty in our case). Note that the PCR
+ * policy being authorized does not enter the digest at all.
+ */
+static bool
+__pcr_policy_create_authorized_soft(const TPM2B_PUBLIC *pub_key, TPM2B_DIGEST **authorized_policy)
+{
+	uint8_t data[sizeof(TPM2_CC) + sizeof(TPMU_NAME)];
+	TPM2B_NAME key_name;
+	TPM2B_DIGEST *policy;
+	size_t len = 0;
+	TSS2_RC rc;
+
+	if (!tss_public_name(pub_key, &key_name))
+		return false;
+
+	rc = Tss2_MU_TPM2_CC_Marshal(TPM2_CC_PolicyAuthorize, data, sizeof(data), &len);
+	if (!tss_check_error(rc, "Unable to marshal PolicyAuthorize arguments"))
+		return false;
+
+	memcpy(data + len, key_name.name, key_name.size);
+	len += key_name.size;
+
+	policy = __policy_digest_new();
+	__policy_digest_update(policy, data, len);
+	__policy_digest_update(policy, NULL, 0);
+
+	*authorized_policy = policy;
+	return true;
+}
+
+static bool
+__pcr_policy_create_authorized_digest(TPM2B_DIGEST *pcr_policy, const TPM2B_PUBLIC *pub_key,
+			TPM2B_DIGEST **authorized_policy)
+{
+	TPM2B_DIGEST *check = NULL;
+	bool okay;
+
+	if (!__pcr_policy_create_authorized_soft(pub_key, authorized_policy))
+		return false;
+
+	if (!pcr_policy_tpm_check)
+		return true;
+
+	if (!esys_create_authorized_policy(tss_esys_context(), pcr_policy, pub_key, &check))
+		check = NULL;
+
+	okay = __policy_digest_check(*authorized_policy, check, "PolicyAuthorize");
+	if (check)
+		free(check);
+
+	if (!okay) {
+		free(*authorized_policy);
+		*authorized_policy = NULL;
+	}
+	return okay;
+}
+
 static bool
 esys_create_primary(ESYS_CONTEXT *esys_context, ESYS_TR *handle_ret)
 {
@@ -608,7 +866,7 @@ esys_create_primary(ESYS_CONTEXT *esys_context, ESYS_TR *handle_ret)
 	t0 = timing_begin();
 	rc = Esys_CreatePrimary(esys_context, ESYS_TR_RH_OWNER,
 			ESYS_TR_PASSWORD,
-			ESYS_TR_NONE, ESYS_TR_NONE, &in_sensitive, &SRK_template,
+			ESYS_TR_NONE, ESYS_TR_NONE, &in_sensitive, SRK_template,
 			NULL, &creation_pcr, handle_ret,
 			NULL, NULL,
 			NULL, NULL);
@@ -616,10 +874,357 @@ esys_create_primary(ESYS_CONTEXT *esys_context, ESYS_TR *handle_ret)
 	if (!tss_check_error(rc, "Esys_CreatePrimary failed"))
 		return false;
 
-	debug("took %.3f sec to create SRK\n", timing_since(t0));
+	debug("took %.3f sec to create %s SRK\n", timing_since(t0), srk_template_id(SRK_template));
+	return true;
+}
+
+/*
+ * By default, we derive the SRK from the owner seed using CreatePrimary.
+ * Alternatively, the caller can ask us to use the SRK stored at a persistent
+ * handle (the TCG recommends 0x81000001), and to create it there if it
+ * does not exist yet.
+ */
+static TPM2_HANDLE	srk_persistent_handle;
+static bool		srk_persistent_create;
+
+void
+pcr_policy_set_srk_handle(uint32_t handle, bool create)
+{
+	srk_persistent_handle = handle;
+	srk_persistent_create = create;
+}
+
+void
+pcr_policy_get_srk_handle(uint32_t *handle, bool *create)
+{
+	*handle = srk_persistent_handle;
+	*create = srk_persistent_create;
+}
+
+/*
+ * The parent handle to record in tpm2key files
+ */
+static TPM2_HANDLE
+pcr_policy_srk_parent(void)
+{
+	if (srk_persistent_handle)
+		return srk_persistent_handle;
+	return TPM2_RH_OWNER;
+}
+
+static inline bool
+tpm2_handle_is_persistent(TPM2_HANDLE handle)
+{
+	return (handle >> TPM2_HR_SHIFT) == TPM2_HT_PERSISTENT;
+}
+
+static bool
+srk_public_matches_template(const TPMT_PUBLIC *pub)
+{
+	const TPMT_PUBLIC *tmpl = &SRK_template->publicArea;
+
+	if (pub->type != tmpl->type
+	 || pub->nameAlg != tmpl->nameAlg
+	 || pub->objectAttributes != tmpl->objectAttributes)
+		return false;
+
+	if (tmpl->type == TPM2_ALG_ECC)
+		return pub->parameters.eccDetail.curveID == tmpl->parameters.eccDetail.curveID
+		    && pub->parameters.eccDetail.kdf.scheme == tmpl->parameters.eccDetail.kdf.scheme
+		    && !memcmp(&pub->parameters.eccDetail.symmetric, &tmpl->parameters.eccDetail.symmetric,
+				    sizeof(tmpl->parameters.eccDetail.symmetric));
+
+	return pub->parameters.rsaDetail.keyBits == tmpl->parameters.rsaDetail.keyBits
+	    && pub->parameters.rsaDetail.exponent == tmpl->parameters.rsaDetail.exponent
+	    && !memcmp(&pub->parameters.rsaDetail.symmetric, &tmpl->parameters.rsaDetail.symmetric,
+			    sizeof(tmpl->parameters.rsaDetail.symmetric));
+}
+
+/*
+ * Make sure the object we're about to use as the SRK is what we think it is.
+ * A persistent SRK only needs to be a storage key; if it was created by someone
+ * else from a different template, anything we seal can only be unsealed using
+ * this persistent key.
+ */
+static bool
+esys_check_srk(ESYS_CONTEXT *esys_context, ESYS_TR handle, TPM2_HANDLE persistent)
+{
+	const TPMA_OBJECT storage_attrs = TPMA_OBJECT_RESTRICTED|TPMA_OBJECT_DECRYPT|TPMA_OBJECT_SIGN_ENCRYPT;
+	TPM2B_PUBLIC *public = NULL;
+	bool okay = false;
+	TPM2_RC rc;
+
+	rc = Esys_ReadPublic(esys_context, handle,
+			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+			&public, NULL, NULL);
+	if (!tss_check_error(rc, "Esys_ReadPublic failed"))
+		return false;
+
+	if (srk_public_matches_template(&public->publicArea)) {
+		okay = true;
+	} else
+	if (persistent == 0) {
+		debug("Cached SRK does not match the SRK template\n");
+	} else
+	if (srk_type_explicit && public->publicArea.type != SRK_template->publicArea.type) {
+		error("Persistent SRK 0x%08x is not of the requested type\n", persistent);
+	} else
+	if ((public->publicArea.objectAttributes & storage_attrs) != (TPMA_OBJECT_RESTRICTED|TPMA_OBJECT_DECRYPT)) {
+		error("Persistent object 0x%08x is not a storage key\n", persistent);
+	} else {
+		debug("Persistent SRK 0x%08x was not created from our SRK template\n", persistent);
+		okay = true;
+	}
+
+	free(public);
+	return okay;
+}
+
+static bool
+esys_persistent_handle_exists(ESYS_CONTEXT *esys_context, TPM2_HANDLE persistent, bool *exists)
+{
+	TPMS_CAPABILITY_DATA *cap_data = NULL;
+	TPMI_YES_NO more_data;
+	TPM2_RC rc;
+
+	rc = Esys_GetCapability(esys_context,
+			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+			TPM2_CAP_HANDLES, persistent, 1,
+			&more_data, &cap_data);
+	if (!tss_check_error(rc, "Esys_GetCapability failed"))
+		return false;
+
+	*exists = cap_data->data.handles.count > 0
+		&& cap_data->data.handles.handle[0] == persistent;
+	free(cap_data);
+	return true;
+}
+
+static bool
+esys_get_persistent_srk(ESYS_CONTEXT *esys_context, TPM2_HANDLE persistent, bool create, ESYS_TR *handle_ret)
+{
+	ESYS_TR transient_handle = ESYS_TR_NONE;
+	bool exists;
+	TPM2_RC rc;
+
+	if (!esys_persistent_handle_exists(esys_context, persistent, &exists))
+		return false;
+
+	if (exists) {
+		rc = Esys_TR_FromTPMPublic(esys_context, persistent,
+				ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+				handle_ret);
+		if (!tss_check_error(rc, "Esys_TR_FromTPMPublic failed"))
+			return false;
+
+		if (!esys_check_srk(esys_context, *handle_ret, persistent)) {
+			Esys_TR_Close(esys_context, handle_ret);
+			return false;
+		}
+		return true;
+	}
+
+	if (!create) {
+		error("No SRK found at persistent handle 0x%08x\n", persistent);
+		return false;
+	}
+
+	if (!esys_create_primary(esys_context, &transient_handle))
+		return false;
+
+	rc = Esys_EvictControl(esys_context, ESYS_TR_RH_OWNER, transient_handle,
+			ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+			persistent, handle_ret);
+	esys_flush_context(esys_context, &transient_handle);
+
+	if (!tss_check_error(rc, "Esys_EvictControl failed"))
+		return false;
+
+	infomsg("Created persistent SRK at handle 0x%08x\n", persistent);
 	return true;
 }
 
+/*
+ * Deriving an RSA primary key can take many seconds, while loading a saved
+ * context takes a few milliseconds. So we keep the context of the SRK in
+ * the cache. The blob is protected by the TPM; if it can no longer be loaded
+ * (eg because the owner hierarchy was cleared), we simply create the SRK again.
+ */
+#define SRK_CONTEXT_CACHE_TYPE	"srk-context"
+
+static const char *
+srk_context_cache_key(void)
+{
+	return srk_template_id(SRK_template);
+}
+
+static bool
+esys_load_srk_context(ESYS_CONTEXT *esys_context, ESYS_TR *handle_ret)
+{
+	TPMS_CONTEXT context;
+	buffer_t *bp;
+	TPM2_RC rc;
+
+	if (!(bp = cache_read(SRK_CONTEXT_CACHE_TYPE, srk_context_cache_key())))
+		return false;
+
+	memset(&context, 0, sizeof(context));
+	rc = Tss2_MU_TPMS_CONTEXT_Unmarshal(bp->data, bp->wpos, &bp->rpos, &context);
+	buffer_free(bp);
+
+	if (rc != TSS2_RC_SUCCESS) {
+		debug("Unable to parse cached SRK context: %s\n", Tss2_RC_Decode(rc));
+		goto discard;
+	}
+
+	rc = Esys_ContextLoad(esys_context, &context, handle_ret);
+	if (rc != TSS2_RC_SUCCESS) {
+		debug("Unable to load cached SRK context: %s\n", Tss2_RC_Decode(rc));
+		goto discard;
+	}
+
+	if (!esys_check_srk(esys_context, *handle_ret, 0)) {
+		esys_flush_context(esys_context, handle_ret);
+		goto discard;
+	}
+
+	return true;
+
+discard:
+	cache_remove(SRK_CONTEXT_CACHE_TYPE, srk_context_cache_key());
+	return false;
+}
+
+static void
+esys_save_srk_context(ESYS_CONTEXT *esys_context, ESYS_TR handle)
+{
+	TPMS_CONTEXT *context = NULL;
+	buffer_t *bp;
+	TPM2_RC rc;
+
+	if (!cache_is_enabled())
+		return;
+
+	rc = Esys_ContextSave(esys_context, handle, &context);
+	if (rc != TSS2_RC_SUCCESS) {
+		debug("Unable to save SRK context: %s\n", Tss2_RC_Decode(rc));
+		return;
+	}
+
+	bp = buffer_alloc_write(sizeof(*context));
+	rc = Tss2_MU_TPMS_CONTEXT_Marshal(context, bp->data, bp->size, &bp->wpos);
+	if (rc == TSS2_RC_SUCCESS)
+		cache_write(SRK_CONTEXT_CACHE_TYPE, srk_context_cache_key(), bp);
+
+	buffer_free(bp);
+	free(context);
+}
+
+static bool
+esys_get_transient_srk(ESYS_CONTEXT *esys_context, ESYS_TR *handle_ret)
+{
+	double t0 = timing_begin();
+
+	if (esys_load_srk_context(esys_context, handle_ret)) {
+		debug("took %.3f sec to load SRK context\n", timing_since(t0));
+		return true;
+	}
+
+	if (!esys_create_primary(esys_context, handle_ret))
+		return false;
+
+	esys_save_srk_context(esys_context, *handle_ret);
+	return true;
+}
+
+/*
+ * A transient SRK must be flushed when we're done; for a persistent one,
+ * we just release the ESYS_TR.
+ */
+static void
+esys_release_srk(ESYS_CONTEXT *esys_context, ESYS_TR *handle_p, TPM2_HANDLE persistent)
+{
+	if (*handle_p == ESYS_TR_NONE)
+		return;
+
+	if (persistent)
+		Esys_TR_Close(esys_context, handle_p);
+	else
+		esys_flush_context(esys_context, handle_p);
+	*handle_p = ESYS_TR_NONE;
+}
+
+/*
+ * Normally, every operation gets the SRK and releases it when done.
+ * When running several actions in one process (see --batch), getting
+ * the SRK over and over is a waste of time; in this case we get it
+ * once, and keep it until pcr_policy_keep_srk(false) is called.
+ */
+static bool		srk_keep;
+static ESYS_TR		srk_kept_handle = ESYS_TR_NONE;
+static char		srk_kept_id[32];
+static TPM2_HANDLE	srk_kept_persistent;
+
+static bool
+__esys_get_srk(ESYS_CONTEXT *esys_context, TPM2_HANDLE persistent, ESYS_TR *handle_ret)
+{
+	const char *id = srk_template_id(SRK_template);
+	bool okay;
+
+	if (srk_keep && srk_kept_handle != ESYS_TR_NONE) {
+		if (srk_kept_persistent == persistent
+		 && (persistent || !strcmp(srk_kept_id, id))) {
+			*handle_ret = srk_kept_handle;
+			return true;
+		}
+		esys_release_srk(esys_context, &srk_kept_handle, srk_kept_persistent);
+	}
+
+	if (persistent)
+		okay = esys_get_persistent_srk(esys_context, persistent, srk_persistent_create, handle_ret);
+	else
+		okay = esys_get_transient_srk(esys_context, handle_ret);
+	if (!okay)
+		return false;
+
+	if (srk_keep) {
+		srk_kept_handle = *handle_ret;
+		snprintf(srk_kept_id, sizeof(srk_kept_id), "%s", id);
+		srk_kept_persistent = persistent;
+	}
+	return true;
+}
+
+static void
+__esys_put_srk(ESYS_CONTEXT *esys_context, TPM2_HANDLE persistent, ESYS_TR *handle_p)
+{
+	if (*handle_p != ESYS_TR_NONE && *handle_p == srk_kept_handle) {
+		*handle_p = ESYS_TR_NONE;
+		return;
+	}
+	esys_release_srk(esys_context, handle_p, persistent);
+}
+
+static bool
+esys_get_srk(ESYS_CONTEXT *esys_context, ESYS_TR *handle_ret)
+{
+	return __esys_get_srk(esys_context, srk_persistent_handle, handle_ret);
+}
+
+static void
+esys_put_srk(ESYS_CONTEXT *esys_context, ESYS_TR *handle_p)
+{
+	__esys_put_srk(esys_context, srk_persistent_handle, handle_p);
+}
+
+void
+pcr_policy_keep_srk(bool keep)
+{
+	srk_keep = keep;
+	if (!keep && srk_kept_handle != ESYS_TR_NONE)
+		esys_release_srk(tss_esys_context(), &srk_kept_handle, srk_kept_persistent);
+}
+
 static bool
 esys_create(ESYS_CONTEXT *esys_context,
 		ESYS_TR srk_handle, TPM2B_DIGEST *authorized_policy, TPM2B_SENSITIVE_DATA *secret,
@@ -649,24 +1254,18 @@ esys_create(ESYS_CONTEXT *esys_context,
 }
 
 static bool
-esys_seal_secret(const target_platform_t *platform, ESYS_CONTEXT *esys_context,
-		 TPM2B_DIGEST *policy, const TPML_PCR_SELECTION *pcr_sel,
+esys_seal_one_secret(const target_platform_t *platform, ESYS_CONTEXT *esys_context,
+		 ESYS_TR srk_handle, TPM2B_DIGEST *policy, const TPML_PCR_SELECTION *pcr_sel,
 		 const char *input_path, const char *output_path)
 {
 	TPM2B_SENSITIVE_DATA *secret = NULL;
 	TPM2B_PRIVATE *sealed_private = NULL;
 	TPM2B_PUBLIC *sealed_public = NULL;
-	ESYS_TR srk_handle = ESYS_TR_NONE;
 	bool ok = false;
 
 	if (!(secret = read_secret(input_path)))
 		goto cleanup;
 
-	/* On my machine, the TPM needs 20 seconds to derive the SRK in CreatePrimary */
-	infomsg("Sealing secret - this may take a moment\n");
-	if (!esys_create_primary(esys_context, &srk_handle))
-		goto cleanup;
-
 	if (!esys_create(esys_context, srk_handle, policy, secret, &sealed_private, &sealed_public))
 		goto cleanup;
 
@@ -682,10 +1281,119 @@ cleanup:
 	if (secret)
 		free_secret(secret);
 
-	esys_flush_context(esys_context, &srk_handle);
+	return ok;
+}
+
+/*
+ * Seal one or more secrets to the same policy. The SRK is set up only
+ * once, and we stop at the first secret that cannot be sealed.
+ */
+static bool
+esys_seal_secret(const target_platform_t *platform, ESYS_CONTEXT *esys_context,
+		 TPM2B_DIGEST *policy, const TPML_PCR_SELECTION *pcr_sel,
+		 unsigned int count, char * const *input_paths, char * const *output_paths)
+{
+	ESYS_TR srk_handle = ESYS_TR_NONE;
+	unsigned int i;
+	bool ok = false;
+
+	/* On my machine, the TPM needs 20 seconds to derive the SRK in CreatePrimary */
+	infomsg("Sealing %s - this may take a moment\n", (count == 1)? "secret" : "secrets");
+	if (!esys_get_srk(esys_context, &srk_handle))
+		goto cleanup;
+
+	for (i = 0; i < count; ++i) {
+		if (!esys_seal_one_secret(platform, esys_context, srk_handle, policy, pcr_sel,
+					input_paths[i], output_paths[i]))
+			goto cleanup;
+	}
+	ok = true;
+
+cleanup:
+	esys_put_srk(esys_context, &srk_handle);
+	return ok;
+}
+
+/*
+ * When sealing for a different machine, we do not talk to a TPM at all. All we
+ * have is the public portion of the target's SRK, and we create objects that the
+ * target's TPM turns into regular sealed objects using TPM2_Import.
+ */
+static TPM2B_PUBLIC *	srk_offline_public;
+
+bool
+pcr_policy_set_srk_public(const stored_key_t *srk_public_file)
+{
+	TPM2B_PUBLIC *pub = NULL;
+
+	if (srk_public_file && !(pub = stored_key_read_native_public(srk_public_file)))
+		return false;
+
+	if (srk_offline_public)
+		free(srk_offline_public);
+	srk_offline_public = pub;
+	return true;
+}
+
+static bool
+offline_seal_one_secret(const target_platform_t *platform, const TPM2B_PUBLIC *srk_public,
+		 const TPM2B_DIGEST *policy, const TPML_PCR_SELECTION *pcr_sel,
+		 const char *input_path, const char *output_path)
+{
+	TPM2B_SENSITIVE_DATA *secret = NULL;
+	TPM2B_ENCRYPTED_SECRET encrypted_seed;
+	TPM2B_PUBLIC sealed_public;
+	TPM2B_PRIVATE duplicate;
+	bool ok = false;
+
+	if (!(secret = read_secret(input_path)))
+		return false;
+
+	if (tpm_duplicate_sealed_secret(srk_public, policy, secret,
+				&sealed_public, &duplicate, &encrypted_seed)) {
+		ok = platform->write_importable_secret(output_path, pcr_sel,
+				&duplicate, &sealed_public, &encrypted_seed);
+		if (ok)
+			infomsg("Importable sealed secret written to %s\n", output_path?: "(standard output)");
+	}
+
+	free_secret(secret);
 	return ok;
 }
 
+static bool
+offline_seal_secret(const target_platform_t *platform, const TPM2B_PUBLIC *srk_public,
+		 const TPM2B_DIGEST *policy, const TPML_PCR_SELECTION *pcr_sel,
+		 unsigned int count, char * const *input_paths, char * const *output_paths)
+{
+	unsigned int i;
+
+	if (!platform->write_importable_secret) {
+		error("target platform %s does not support importable sealed secrets\n", platform->name);
+		return false;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (!offline_seal_one_secret(platform, srk_public, policy, pcr_sel,
+					input_paths[i], output_paths[i]))
+			return false;
+	}
+	return true;
+}
+
+static bool
+__pcr_seal_secret(const target_platform_t *platform,
+		 TPM2B_DIGEST *policy, const TPML_PCR_SELECTION *pcr_sel,
+		 unsigned int count, char * const *input_paths, char * const *output_paths)
+{
+	if (srk_offline_public)
+		return offline_seal_secret(platform, srk_offline_public, policy, pcr_sel,
+				count, input_paths, output_paths);
+
+	return esys_seal_secret(platform, tss_esys_context(), policy, pcr_sel,
+			count, input_paths, output_paths);
+}
+
 static bool
 esys_unseal_pcr_policy(ESYS_CONTEXT *esys_context,
 		const tpm_pcr_bank_t *bank,
@@ -700,7 +1408,7 @@ esys_unseal_pcr_policy(ESYS_CONTEXT *esys_context,
 	bool okay = false;
 
 	pcr_bank_to_selection(&pcrs, bank);
-	if (!esys_create_primary(esys_context, &primary_handle))
+	if (!esys_get_srk(esys_context, &primary_handle))
 		goto cleanup;
 
 	rc = Esys_Load(esys_context, primary_handle,
@@ -732,7 +1440,7 @@ esys_unseal_pcr_policy(ESYS_CONTEXT *esys_context,
 
 cleanup:
 	esys_flush_context(esys_context, &session_handle);
-	esys_flush_context(esys_context, &primary_handle);
+	esys_put_srk(esys_context, &primary_handle);
 	esys_flush_context(esys_context, &sealed_object_handle);
 	return okay;
 }
@@ -775,7 +1483,7 @@ esys_unseal_authorized(ESYS_CONTEXT *esys_context,
 	if (!tss_check_error(rc, "Esys_TR_GetName failed"))
 		goto cleanup;
 
-	if (!esys_create_primary(esys_context, &primary_handle))
+	if (!esys_get_srk(esys_context, &primary_handle))
 		goto cleanup;
 
 	rc = Esys_Load(esys_context, primary_handle,
@@ -842,7 +1550,7 @@ cleanup:
 		free(pcr_policy_hash);
 	esys_flush_context(esys_context, &pub_key_handle);
 	esys_flush_context(esys_context, &session_handle);
-	esys_flush_context(esys_context, &primary_handle);
+	esys_put_srk(esys_context, &primary_handle);
 	esys_flush_context(esys_context, &sealed_object_handle);
 	return okay;
 }
@@ -876,7 +1584,7 @@ __pcr_policy_sign(const tpm_rsa_key_t *rsa_key, const TPM2B_DIGEST *authorized_p
 }
 
 static bool
-__pcr_policy_create_authorized(ESYS_CONTEXT *esys_context, const tpm_pcr_selection_t *pcr_selection,
+__pcr_policy_create_authorized(const tpm_pcr_selection_t *pcr_selection,
 				const stored_key_t *private_key_file,
 				TPM2B_DIGEST **ret_digest_p)
 {
@@ -892,10 +1600,10 @@ __pcr_policy_create_authorized(ESYS_CONTEXT *esys_context, const tpm_pcr_selecti
 	 * interested in. */
 	pcr_bank_initialize(&zero_bank, pcr_selection->pcr_mask, pcr_selection->algo_info);
 	pcr_bank_init_from_zero(&zero_bank);
-	if (!(pcr_policy = __pcr_policy_make(esys_context, &zero_bank)))
+	if (!(pcr_policy = __pcr_policy_make(&zero_bank)))
 		goto out;
 
-	okay = esys_create_authorized_policy(esys_context, pcr_policy, pub_key, ret_digest_p);
+	okay = __pcr_policy_create_authorized_digest(pcr_policy, pub_key, ret_digest_p);
 
 out:
 	if (pcr_policy)
@@ -1011,23 +1719,50 @@ pcr_store_public_key(const stored_key_t *private_key_file, const stored_key_t *p
 	return okay;
 }
 
+/*
+ * Store the public portion of this machine's SRK, so that secrets can be sealed
+ * for this machine elsewhere (using --srk-public).
+ */
 bool
-pcr_seal_secret(const target_platform_t *platform, const tpm_pcr_bank_t *bank,
-		const char *input_path, const char *output_path)
+pcr_store_srk_public(const stored_key_t *srk_public_file)
 {
 	ESYS_CONTEXT *esys_context = tss_esys_context();
+	ESYS_TR srk_handle = ESYS_TR_NONE;
+	TPM2B_PUBLIC *srk_public = NULL;
+	TPM2_RC rc;
+	bool okay = false;
+
+	if (!esys_get_srk(esys_context, &srk_handle))
+		return false;
+
+	rc = Esys_ReadPublic(esys_context, srk_handle,
+			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+			&srk_public, NULL, NULL);
+	if (tss_check_error(rc, "Esys_ReadPublic failed"))
+		okay = stored_key_write_native_public(srk_public_file, srk_public);
+
+	if (srk_public)
+		free(srk_public);
+	esys_put_srk(esys_context, &srk_handle);
+	return okay;
+}
+
+bool
+pcr_seal_secret(const target_platform_t *platform, const tpm_pcr_bank_t *bank,
+		unsigned int count, char * const *input_paths, char * const *output_paths)
+{
 	TPM2B_DIGEST *pcr_policy = NULL;
 	TPML_PCR_SELECTION pcr_sel;
 	bool ok = false;
 
-	if (!(pcr_policy = __pcr_policy_make(esys_context, bank)))
+	if (!(pcr_policy = __pcr_policy_make(bank)))
 		return false;
 
 	if (!pcr_bank_to_selection(&pcr_sel, bank))
 		return false;
 
-	ok = esys_seal_secret(platform, esys_context, pcr_policy, &pcr_sel,
-			      input_path, output_path);
+	ok = __pcr_seal_secret(platform, pcr_policy, &pcr_sel,
+			      count, input_paths, output_paths);
 
 	free(pcr_policy);
 	return ok;
@@ -1072,11 +1807,10 @@ cleanup:
 bool
 pcr_authorized_policy_create(const tpm_pcr_selection_t *pcr_selection, const stored_key_t *private_key_file, const char *output_path)
 {
-	ESYS_CONTEXT *esys_context = tss_esys_context();
 	TPM2B_DIGEST *authorized_policy = NULL;
 	bool ok;
 
-	ok = __pcr_policy_create_authorized(esys_context, pcr_selection, private_key_file, &authorized_policy);
+	ok = __pcr_policy_create_authorized(pcr_selection, private_key_file, &authorized_policy);
 	if (ok && write_digest(output_path, authorized_policy))
 		infomsg("Authorized policy written to %s\n", output_path?: "(standard output)");
 
@@ -1088,17 +1822,16 @@ pcr_authorized_policy_create(const tpm_pcr_selection_t *pcr_selection, const sto
 
 bool
 pcr_authorized_policy_seal_secret(const target_platform_t *platform, const char *authpolicy_path,
-				  const char *input_path, const char *output_path)
+				  unsigned int count, char * const *input_paths, char * const *output_paths)
 {
-	ESYS_CONTEXT *esys_context = tss_esys_context();
 	TPM2B_DIGEST *authorized_policy = NULL;
 	bool ok = false;
 
 	if (!(authorized_policy = read_digest(authpolicy_path)))
 		return false;
 
-	ok = esys_seal_secret(platform, esys_context, authorized_policy, NULL,
-			      input_path, output_path);
+	ok = __pcr_seal_secret(platform, authorized_policy, NULL,
+			      count, input_paths, output_paths);
 	free(authorized_policy);
 	return ok;
 }
@@ -1123,7 +1856,7 @@ old_pcr_authorized_policy_seal_secret(const char *authpolicy_path, const char *i
 	/* On my machine, the TPM needs 20 seconds to derive the SRK in CreatePrimary */
 	infomsg("Sealing secret - this may take a moment\n");
 
-	if (!esys_create_primary(esys_context, &srk_handle))
+	if (!esys_get_srk(esys_context, &srk_handle))
 		goto cleanup;
 
 	if (!esys_create(esys_context, srk_handle, authorized_policy, secret, &sealed_private, &sealed_public))
@@ -1144,7 +1877,7 @@ cleanup:
 	if (secret)
 		free_secret(secret);
 
-	esys_flush_context(esys_context, &srk_handle);
+	esys_put_srk(esys_context, &srk_handle);
 	return ok;
 }
 
@@ -1158,7 +1891,6 @@ pcr_policy_sign(const target_platform_t *platform, const tpm_pcr_bank_t *bank,
 		const stored_key_t *private_key_file,
 		const char *input_path, const char *output_path, const char *policy_name)
 {
-	ESYS_CONTEXT *esys_context = tss_esys_context();
 	TPM2B_DIGEST *pcr_policy = NULL;
 	tpm_rsa_key_t *rsa_key = NULL;
 	TPM2B_PUBLIC *pub_key = NULL;
@@ -1173,7 +1905,7 @@ pcr_policy_sign(const target_platform_t *platform, const tpm_pcr_bank_t *bank,
 	if (!(rsa_key = stored_key_read_rsa_private(private_key_file)))
 		goto out;
 
-	if (!(pcr_policy = __pcr_policy_make(esys_context, bank)))
+	if (!(pcr_policy = __pcr_policy_make(bank)))
 		goto out;
 
 	if (!__pcr_policy_sign(rsa_key, pcr_policy, &signed_policy))
@@ -1445,6 +2177,99 @@ cleanup:
 	return okay;
 }
 
+/*
+ * Load a sealed object. If we're given an import seed, the private portion is
+ * a duplicate created by pcr-oracle --srk-public, and needs to go through
+ * TPM2_Import first. The imported private portion is returned to the caller.
+ */
+static TPM2_RC
+esys_import_and_load(ESYS_CONTEXT *esys_context, ESYS_TR parent_handle,
+		const TPM2B_PRIVATE *priv, const TPM2B_PUBLIC *pub,
+		const TPM2B_ENCRYPTED_SECRET *import_seed, TPM2B_PRIVATE **imported_ret,
+		ESYS_TR *sealed_object_handle)
+{
+	TPM2B_DATA no_encryption_key = { .size = 0 };
+	TPMT_SYM_DEF_OBJECT no_inner_wrapper = { .algorithm = TPM2_ALG_NULL };
+	TPM2B_PRIVATE *imported = NULL;
+	TPM2_RC rc;
+
+	if (import_seed) {
+		rc = Esys_Import(esys_context, parent_handle,
+			ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+			&no_encryption_key, pub, priv, import_seed,
+			&no_inner_wrapper, &imported);
+		if (rc != TSS2_RC_SUCCESS)
+			return rc;
+		priv = imported;
+	}
+
+	rc = Esys_Load(esys_context, parent_handle,
+		ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+		priv, pub, sealed_object_handle);
+
+	if (rc == TSS2_RC_SUCCESS && imported)
+		*imported_ret = imported;
+	else if (imported)
+		free(imported);
+	return rc;
+}
+
+/*
+ * A tpm2key file that names the owner hierarchy as its parent does not tell
+ * us which template the SRK was derived from. Unless the SRK type was given
+ * explicitly, try the default RSA SRK first, and the ECC SRK next.
+ */
+static bool
+tpm2key_load_sealed_object(ESYS_CONTEXT *esys_context, TPM2_HANDLE persistent,
+		const TPM2B_PRIVATE *priv, const TPM2B_PUBLIC *pub,
+		const TPM2B_ENCRYPTED_SECRET *import_seed, TPM2B_PRIVATE **imported_ret,
+		ESYS_TR *primary_handle, ESYS_TR *sealed_object_handle)
+{
+	const char *errmsg = import_seed? "Unable to import sealed object" : "Esys_Load failed";
+	const TPM2B_PUBLIC *saved_template = SRK_template;
+	TPM2_RC rc;
+	bool okay = false;
+
+	if (!__esys_get_srk(esys_context, persistent, primary_handle))
+		return false;
+
+	rc = esys_import_and_load(esys_context, *primary_handle, priv, pub,
+			import_seed, imported_ret, sealed_object_handle);
+	if (rc == TSS2_RC_SUCCESS || persistent || srk_type_explicit)
+		return tss_check_error(rc, errmsg);
+
+	debug("Unable to load sealed object using the %s SRK, trying the ECC SRK\n",
+			srk_template_id(SRK_template));
+	__esys_put_srk(esys_context, persistent, primary_handle);
+
+	SRK_template = &SRK_ecc_template;
+	if (__esys_get_srk(esys_context, persistent, primary_handle)) {
+		rc = esys_import_and_load(esys_context, *primary_handle, priv, pub,
+				import_seed, imported_ret, sealed_object_handle);
+		okay = tss_check_error(rc, errmsg);
+	}
+	SRK_template = saved_template;
+
+	return okay;
+}
+
+/*
+ * Once an importable key has been unsealed successfully, replace it with the
+ * imported object, so that we do not need to go through TPM2_Import again.
+ * This is best effort; the key file may well live on read-only storage.
+ */
+static void
+tpm2key_update_imported(const char *path, TSSPRIVKEY *tpm2key, const TPM2B_PRIVATE *imported)
+{
+	if (!tpm2key_set_imported(tpm2key, imported)
+	 || !tpm2key_write_file(path, tpm2key, RUNTIME_WRITE_ATOMIC | RUNTIME_WRITE_NOFAIL)) {
+		warning("Unable to update %s with the imported key\n", path);
+		return;
+	}
+
+	infomsg("Updated %s with the imported key\n", path);
+}
+
 /* Unseal the key in TPM 2.0 Key File format */
 static bool
 tpm2key_unseal_secret(const char *input_path, const char *output_path,
@@ -1460,12 +2285,36 @@ tpm2key_unseal_secret(const char *input_path, const char *output_path,
 	ESYS_TR primary_handle = ESYS_TR_NONE;
 	ESYS_TR sealed_object_handle = ESYS_TR_NONE;
 	TPM2B_SENSITIVE_DATA *unsealed = NULL;
+	TPM2B_ENCRYPTED_SECRET import_seed;
+	TPM2B_PRIVATE *imported = NULL;
+	TPM2_HANDLE parent, persistent = 0;
 	TPM2_RC rc;
-	bool okay = false;
+	bool importable, okay = false;
 
 	if (!tpm2key_read_file(input_path, &tpm2key))
 		return false;
 
+	importable = tpm2key_is_importable(tpm2key);
+	if (importable && !tpm2key_get_import_secret(tpm2key, &import_seed)) {
+		error("%s: unable to parse import seed\n", input_path);
+		goto cleanup;
+	}
+
+	/* Keys sealed under the SRK derived from the standard template name the owner
+	 * hierarchy as their parent. If we were given a persistent SRK, we assume
+	 * it was created from the same template, and use it instead of deriving
+	 * the SRK again. */
+	parent = ASN1_INTEGER_get(tpm2key->parent);
+	if (tpm2_handle_is_persistent(parent)) {
+		persistent = parent;
+	} else
+	if (parent == TPM2_RH_OWNER) {
+		persistent = srk_persistent_handle;
+	} else {
+		error("%s: unsupported parent handle 0x%08x\n", input_path, parent);
+		goto cleanup;
+	}
+
 	buffer_init_read(&buf, tpm2key->pubkey->data, tpm2key->pubkey->length);
 	rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(buf.data, buf.size, &buf.rpos, &pub);
 	if (rc != TSS2_RC_SUCCESS)
@@ -1476,13 +2325,9 @@ tpm2key_unseal_secret(const char *input_path, const char *output_path,
 	if (rc != TSS2_RC_SUCCESS)
 		goto cleanup;
 
-	if (!esys_create_primary(esys_context, &primary_handle))
-		goto cleanup;
-
-	rc = Esys_Load(esys_context, primary_handle,
-		ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
-		&priv, &pub, &sealed_object_handle);
-	if (!tss_check_error(rc, "Esys_Load failed"))
+	if (!tpm2key_load_sealed_object(esys_context, persistent, &priv, &pub,
+				importable? &import_seed : NULL, &imported,
+				&primary_handle, &sealed_object_handle))
 		goto cleanup;
 
 	if (tpm2key->authPolicy) {
@@ -1512,13 +2357,18 @@ tpm2key_unseal_secret(const char *input_path, const char *output_path,
 		buffer_free(bp);
 	}
 
+	if (okay && imported)
+		tpm2key_update_imported(input_path, tpm2key, imported);
+
 cleanup:
 	if (tpm2key)
 		TSSPRIVKEY_free(tpm2key);
 	if (unsealed)
 		free_secret(unsealed);
+	if (imported)
+		free(imported);
 
-	esys_flush_context(esys_context, &primary_handle);
+	__esys_put_srk(esys_context, persistent, &primary_handle);
 	esys_flush_context(esys_context, &sealed_object_handle);
 
 	return okay;
@@ -1592,13 +2442,40 @@ tpm2key_write_sealed_secret(const char *pathname,
 	TSSPRIVKEY *tpm2key = NULL;
 	bool ok = false;
 
-	if (!tpm2key_basekey(&tpm2key, TPM2_RH_OWNER, sealed_public, sealed_private))
+	if (!tpm2key_basekey(&tpm2key, pcr_policy_srk_parent(), sealed_public, sealed_private))
+		goto cleanup;
+
+	if (pcr_sel && !tpm2key_add_policy_policypcr(tpm2key, pcr_sel))
+		goto cleanup;
+
+	ok = tpm2key_write_file(pathname, tpm2key, 0);
+
+cleanup:
+	if (tpm2key)
+		TSSPRIVKEY_free(tpm2key);
+	return ok;
+}
+
+static bool
+tpm2key_write_importable_secret(const char *pathname,
+					const TPML_PCR_SELECTION *pcr_sel,
+					const TPM2B_PRIVATE *duplicate,
+					const TPM2B_PUBLIC *sealed_public,
+					const TPM2B_ENCRYPTED_SECRET *encrypted_seed)
+{
+	TSSPRIVKEY *tpm2key = NULL;
+	bool ok = false;
+
+	if (!tpm2key_basekey(&tpm2key, pcr_policy_srk_parent(), sealed_public, duplicate))
+		goto cleanup;
+
+	if (!tpm2key_add_import_secret(tpm2key, encrypted_seed))
 		goto cleanup;
 
 	if (pcr_sel && !tpm2key_add_policy_policypcr(tpm2key, pcr_sel))
 		goto cleanup;
 
-	ok = tpm2key_write_file(pathname, tpm2key);
+	ok = tpm2key_write_file(pathname, tpm2key, 0);
 
 cleanup:
 	if (tpm2key)
@@ -1639,7 +2516,7 @@ tpm2key_write_signed_policy(const char *input_path, const char *output_path,
 	if (!tpm2key_add_authpolicy_policyauthorize(tpm2key, policy_name, &pcr_sel, pub_key, signed_policy, false))
 		goto out;
 
-	okay = tpm2key_write_file(output_path, tpm2key);
+	okay = tpm2key_write_file(output_path, tpm2key, RUNTIME_WRITE_ATOMIC);
 
 out:
 	if (pub_key)
@@ -1699,6 +2576,7 @@ static target_platform_t	target_platforms[] = {
 		.name			= "tpm2.0",
 		.unseal_flags		= PLATFORM_NEED_INPUT_FILE | PLATFORM_NEED_OUTPUT_FILE,
 		.write_sealed_secret	= tpm2key_write_sealed_secret,
+		.write_importable_secret = tpm2key_write_importable_secret,
 		.write_signed_policy	= tpm2key_write_signed_policy,
 		.unseal_secret		= tpm2key_unseal_secret,
 	},
@@ -1706,6 +2584,7 @@ static target_platform_t	target_platforms[] = {
 		.name			= "systemd",
 		.unseal_flags		= PLATFORM_NEED_INPUT_FILE | PLATFORM_NEED_OUTPUT_FILE,
 		.write_sealed_secret	= tpm2key_write_sealed_secret,
+		.write_importable_secret = tpm2key_write_importable_secret,
 		.write_signed_policy	= systemd_write_signed_policy,
 	},
 	{ NULL }
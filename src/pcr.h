@@ -26,6 +26,9 @@
 
 #define PCR_BANK_REGISTER_MAX	24
 
+/* The persistent handle recommended by the TCG for the SRK */
+#define PCR_SRK_PERSISTENT_HANDLE	0x81000001
+
 typedef struct tpm_pcr_bank {
 	uint32_t		pcr_mask;
 	uint32_t		valid_mask;
@@ -40,6 +43,12 @@ typedef struct tpm_pcr_selection {
 } tpm_pcr_selection_t;
 
 extern void		set_srk_rsa_bits (const unsigned int rsa_bits);
+extern bool		set_srk_type(const char *name);
+extern void		pcr_policy_keep_srk(bool);
+extern void		pcr_policy_set_tpm_check(bool);
+extern void		pcr_policy_set_srk_handle(uint32_t handle, bool create);
+extern void		pcr_policy_get_srk_handle(uint32_t *handle, bool *create);
+extern bool		pcr_policy_set_srk_public(const stored_key_t *srk_public_file);
 extern void		pcr_bank_initialize(tpm_pcr_bank_t *bank, unsigned int pcr_mask, const tpm_algo_info_t *algo);
 extern bool		pcr_bank_wants_pcr(tpm_pcr_bank_t *bank, unsigned int index);
 extern void		pcr_bank_mark_valid(tpm_pcr_bank_t *bank, unsigned int index);
@@ -61,15 +70,17 @@ extern bool		pcr_authorized_policy_create(const tpm_pcr_selection_t *pcr_selecti
 				const char *output_path);
 extern bool		pcr_store_public_key(const stored_key_t *private_key_file,
 				const stored_key_t *public_key_file);
+extern bool		pcr_store_srk_public(const stored_key_t *srk_public_file);
 extern bool		pcr_policy_sign(const target_platform_t *platform, const tpm_pcr_bank_t *bank,
 				const stored_key_t *private_key_file,
 				const char *input_path,
 				const char *output_path, const char *policy_name);
 extern bool		pcr_authorized_policy_seal_secret(const target_platform_t *platform,
-				const char *authorized_policy, const char *input_path,
-				const char *output_path);
+				const char *authorized_policy, unsigned int count,
+				char * const *input_paths, char * const *output_paths);
 extern bool		pcr_seal_secret(const target_platform_t *, const tpm_pcr_bank_t *bank,
-				const char *input_path, const char *output_path);
+				unsigned int count, char * const *input_paths,
+				char * const *output_paths);
 extern bool		pcr_unseal_secret(const target_platform_t *,
 				const tpm_pcr_selection_t *pcr_selection,
 				const char *signed_policy_path,
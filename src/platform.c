@@ -21,9 +21,14 @@
 #include <sys/utsname.h>
 #include <limits.h>
 #include <dirent.h>
+#include <stdio.h>
+#include <string.h>
 #include "oracle.h"
 #include "util.h"
 #include "runtime.h"
+#include "bufparser.h"
+#include "digest.h"
+#include "depend.h"
 
 #define PLATFORM_EFI_INSTALLDIR		"/usr/share/efi"
 
@@ -46,6 +51,7 @@ platform_read_shim_vendor_cert(void)
 	 * shim-$OS.der in the same directory.
 	 */
 	snprintf(path, sizeof(path), "%s/%s/shim.efi", PLATFORM_EFI_INSTALLDIR, uts.machine);
+	dependency_add_file(path);
 	if (realpath(path, rpath) == NULL) {
 		error("%s: %\n", path);
 		return NULL;
@@ -60,3 +66,54 @@ platform_read_shim_vendor_cert(void)
 	strcpy(rpath + len - 4, ".der");
 	return runtime_read_file(rpath, 0);
 }
+
+/*
+ * Return a string identifying the firmware we're running on, suitable as
+ * a cache key. Whenever the firmware gets updated, this will change.
+ */
+const char *
+platform_firmware_id(void)
+{
+	static const char *dmi_attrs[] = {
+		"bios_vendor", "bios_version", "bios_date",
+		"sys_vendor", "product_name", "board_name",
+		NULL
+	};
+	static char *firmware_id;
+	static bool probed = false;
+	const tpm_evdigest_t *md;
+	unsigned int i, found = 0;
+	buffer_t *id;
+
+	if (probed)
+		return firmware_id;
+	probed = true;
+
+	id = buffer_alloc_write(4096);
+	for (i = 0; dmi_attrs[i]; ++i) {
+		char path[PATH_MAX];
+		buffer_t *value;
+
+		snprintf(path, sizeof(path), "/sys/class/dmi/id/%s", dmi_attrs[i]);
+		value = runtime_read_file(path, RUNTIME_SHORT_READ_OKAY | RUNTIME_MISSING_FILE_OKAY);
+		if (value == NULL)
+			continue;
+
+		if (buffer_available(value) <= buffer_tailroom(id))
+			buffer_put(id, buffer_read_pointer(value), buffer_available(value));
+		buffer_free(value);
+		found++;
+	}
+
+	if (found) {
+		md = digest_compute(digest_by_name("sha256"), buffer_read_pointer(id), buffer_available(id));
+		if (md)
+			firmware_id = strdup(digest_print_value(md));
+	}
+
+	buffer_free(id);
+
+	if (firmware_id == NULL)
+		debug("Unable to identify platform firmware\n");
+	return firmware_id;
+}
@@ -0,0 +1,2140 @@
+/*
+ *   Copyright (C) 2022, 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "oracle.h"
+#include "predictor.h"
+#include "util.h"
+#include "eventlog.h"
+#include "bufparser.h"
+#include "runtime.h"
+#include "pcr.h"
+#include "digest.h"
+#include "authenticode.h"
+#include "store.h"
+#include "testcase.h"
+#include "sd-boot.h"
+#include "cache.h"
+#include "depend.h"
+
+enum {
+	STOP_EVENT_NONE,
+	STOP_EVENT_GRUB_COMMAND,
+	STOP_EVENT_GRUB_FILE,
+};
+
+struct predictor {
+	uint32_t		pcr_mask;
+	const char *		initial_source;
+
+	const char *		tpm_event_log_path;
+	const char *		boot_entry_id;
+
+	tpm_event_log_reader_t *event_log_reader;
+	tpm_event_t *		event_log;
+
+	/* Per-PCR index of the event log, built at load time */
+	struct predictor_pcr_events {
+		unsigned int	count;
+		tpm_event_t **	events;
+	} pcr_events[PCR_BANK_REGISTER_MAX];
+
+	struct {
+		int		type;
+		bool		after;
+		char *		value;
+	} stop_event;
+
+	/* Number of worker processes used for rehashing events */
+	unsigned int		jobs;
+
+	/* When tracking dependencies: what the lookahead done while
+	 * queueing the rehash jobs depended on. */
+	dependency_list_t *	context_deps;
+
+	void			(*report_fn)(struct predictor *, const tpm_pcr_bank_t *, unsigned int);
+
+	/* One bank per hash algorithm; all of them are predicted in a single pass */
+	unsigned int		num_banks;
+	tpm_pcr_bank_t		prediction[PREDICTOR_MAX_BANKS];
+};
+
+#define GRUB_PCR_SNAPSHOT_PATH	"/sys/firmware/efi/efivars/GrubPcrSnapshot-7ce323f2-b841-4d30-a0e9-5474a76c9a3f"
+
+unsigned int opt_use_pesign = 0;
+
+static void	predictor_report_plain(struct predictor *pred, const tpm_pcr_bank_t *bank, unsigned int pcr_index);
+static void	predictor_report_tpm2_tools(struct predictor *pred, const tpm_pcr_bank_t *bank, unsigned int pcr_index);
+static void	predictor_report_binary(struct predictor *pred, const tpm_pcr_bank_t *bank, unsigned int pcr_index);
+static void	predictor_drop_dependencies(struct predictor *pred);
+
+static void
+pcr_bank_load_initial_values(tpm_pcr_bank_t *bank, unsigned int pcr_mask, const tpm_algo_info_t *algo_info, const char *source)
+{
+	pcr_bank_initialize(bank, pcr_mask, algo_info);
+	if (!strcmp(source, "zero")
+	 || !strcmp(source, "eventlog"))
+		pcr_bank_init_from_zero(bank);
+	else if (!strcmp(source, "current"))
+		pcr_bank_init_from_current(bank);
+	else if (!strcmp(source, "snapshot"))
+		pcr_bank_init_from_snapshot(bank, GRUB_PCR_SNAPSHOT_PATH);
+	else
+		fatal("don't know how to load PCR bank with initial values: unsupported source \"%s\"\n", source);
+}
+
+static inline tpm_evdigest_t *
+predictor_get_pcr_state(struct predictor *pred, const tpm_pcr_bank_t *bank, unsigned int index)
+{
+	return pcr_bank_get_register((tpm_pcr_bank_t *) bank, index, NULL);
+}
+
+static inline bool
+predictor_wants_pcr(const struct predictor *pred, unsigned int pcr_index)
+{
+	return pcr_index < PCR_BANK_REGISTER_MAX && (pred->pcr_mask & (1 << pcr_index));
+}
+
+/*
+ * Build an index of events per PCR register, so that we can quickly find
+ * the events relevant to the PCRs we've been asked to predict.
+ */
+static void
+predictor_index_eventlog(struct predictor *pred)
+{
+	struct predictor_pcr_events *idx;
+	tpm_event_t *ev;
+	unsigned int i;
+
+	for (ev = pred->event_log; ev; ev = ev->next) {
+		if (ev->pcr_index < PCR_BANK_REGISTER_MAX)
+			pred->pcr_events[ev->pcr_index].count++;
+	}
+
+	for (i = 0, idx = pred->pcr_events; i < PCR_BANK_REGISTER_MAX; ++i, ++idx) {
+		if (idx->count)
+			idx->events = calloc(idx->count, sizeof(idx->events[0]));
+		idx->count = 0;
+	}
+
+	for (ev = pred->event_log; ev; ev = ev->next) {
+		if (ev->pcr_index < PCR_BANK_REGISTER_MAX) {
+			idx = &pred->pcr_events[ev->pcr_index];
+			idx->events[idx->count++] = ev;
+		}
+	}
+}
+
+/*
+ * The system's event log is read at most once per process, and all predictions
+ * made by this process share its events, including their parsed form. This
+ * is what makes --batch and serve mode cheaper than running pcr-oracle
+ * several times.
+ */
+static tpm_event_log_reader_t *	predictor_system_event_log;
+static tpm_event_t *		predictor_system_events;
+static bool			predictor_share_event_log = true;
+
+void
+predictor_set_share_event_log(bool share)
+{
+	predictor_share_event_log = share;
+}
+
+/*
+ * Forget the shared event log, so that it is read afresh on next use.
+ * Like the other discard functions, this leaks rather than frees, since
+ * we may get here after a fatal error in the middle of parsing it.
+ */
+void
+predictor_discard_system_eventlog(void)
+{
+	predictor_system_event_log = NULL;
+	predictor_system_events = NULL;
+}
+
+static tpm_event_t *
+predictor_read_events(tpm_event_log_reader_t *log)
+{
+	tpm_event_t *head = NULL, *ev, **tail;
+
+	tail = &head;
+	while ((ev = event_log_read_next(log)) != NULL) {
+		*tail = ev;
+		tail = &ev->next;
+	}
+
+	return head;
+}
+
+bool
+predictor_read_system_eventlog(void)
+{
+	if (predictor_system_event_log != NULL)
+		return true;
+
+	if ((predictor_system_event_log = event_log_open(NULL)) == NULL)
+		return false;
+
+	predictor_system_events = predictor_read_events(predictor_system_event_log);
+	return true;
+}
+
+static void
+predictor_load_eventlog(struct predictor *pred)
+{
+	tpm_event_log_reader_t *log;
+	uint8_t pcr0_locality;
+
+	if (pred->tpm_event_log_path == NULL && predictor_share_event_log) {
+		if (!predictor_read_system_eventlog())
+			fatal("Failed to open TPM event log, giving up.\n");
+
+		log = predictor_system_event_log;
+		pred->event_log = predictor_system_events;
+	} else {
+		if ((log = event_log_open(pred->tpm_event_log_path)) == NULL)
+			fatal("Failed to open TPM event log, giving up.\n");
+
+		pred->event_log = predictor_read_events(log);
+	}
+
+	if (event_log_get_locality(log, 0, &pcr0_locality)) {
+		unsigned int i;
+
+		for (i = 0; i < pred->num_banks; ++i)
+			pcr_bank_set_locality(&pred->prediction[i], 0, pcr0_locality);
+	}
+
+	/* We check the TPM version after processing the log. Version info for TPMv2
+	 * is usually hidden in the first event. */
+	if (event_log_get_tpm_version(log) != 2) {
+		warning("Encountered TPM event log apparently generated by a TPMv%u device\n",
+				event_log_get_tpm_version(log));
+		warning("Things will most likely fail\n");
+	}
+
+	debug("Successfully read %u events from TPM event log\n", event_log_get_event_count(log));
+	predictor_index_eventlog(pred);
+
+	/* The events live in memory owned by the reader, so keep it around */
+	pred->event_log_reader = log;
+}
+
+/*
+ * If algos is empty, we predict the bank given by the PCR selection.
+ * Otherwise, we predict one bank per algorithm.
+ */
+struct predictor *
+predictor_new(const tpm_pcr_selection_t *pcr_selection,
+		unsigned int num_algos, const tpm_algo_info_t * const *algos,
+		const char *source,
+		const char *tpm_eventlog_path,
+		const char *output_format,
+		const char *boot_entry_id)
+{
+	struct predictor *pred;
+	unsigned int i;
+
+	if (source == NULL)
+		source = "zero";
+
+	if (num_algos == 0) {
+		algos = &pcr_selection->algo_info;
+		num_algos = 1;
+	}
+
+	if (num_algos > PREDICTOR_MAX_BANKS)
+		fatal("Too many hash algorithms (at most %u are supported)\n", PREDICTOR_MAX_BANKS);
+
+	pred = calloc(1, sizeof(*pred));
+	pred->pcr_mask = pcr_selection->pcr_mask;
+	pred->initial_source = source;
+	pred->boot_entry_id = boot_entry_id;
+	pred->jobs = 1;
+
+	if (!output_format || !strcasecmp(output_format, "plain"))
+		pred->report_fn = predictor_report_plain;
+	else
+	if (!strcasecmp(output_format, "tpm2-tools"))
+		pred->report_fn = predictor_report_tpm2_tools;
+	else
+	if (!strcasecmp(output_format, "binary"))
+		pred->report_fn = predictor_report_binary;
+	else
+		fatal("Unsupported output format \"%s\"\n", output_format);
+
+	for (i = 0; i < num_algos; ++i) {
+		const tpm_algo_info_t *algo_info = algos[i];
+
+		debug("Initializing predictor for %s:%s from %s\n", algo_info->openssl_name,
+				print_pcr_mask(pred->pcr_mask), source);
+		pcr_bank_load_initial_values(&pred->prediction[i],
+				pcr_selection->pcr_mask,
+				algo_info,
+				source);
+	}
+	pred->num_banks = num_algos;
+
+	/* Have the runtime hash files for all banks at once */
+	runtime_set_digest_algorithms(num_algos, algos);
+
+	if (!strcmp(source, "eventlog")) {
+		pred->tpm_event_log_path = tpm_eventlog_path;
+		predictor_load_eventlog(pred);
+	}
+
+	debug("Created new predictor\n");
+	return pred;
+}
+
+void
+predictor_free(struct predictor *pred)
+{
+	unsigned int i;
+
+	for (i = 0; i < PCR_BANK_REGISTER_MAX; ++i) {
+		if (pred->pcr_events[i].events)
+			free(pred->pcr_events[i].events);
+	}
+
+	/* The system event log is shared, and stays around */
+	if (pred->event_log_reader && pred->event_log_reader != predictor_system_event_log)
+		event_log_close(pred->event_log_reader);
+
+	predictor_drop_dependencies(pred);
+	drop_string(&pred->stop_event.value);
+	free(pred);
+}
+
+void
+predictor_set_jobs(struct predictor *pred, unsigned int jobs)
+{
+	pred->jobs = jobs;
+}
+
+const tpm_pcr_bank_t *
+predictor_get_bank(const struct predictor *pred, unsigned int index)
+{
+	if (index >= pred->num_banks)
+		return NULL;
+	return &pred->prediction[index];
+}
+
+static bool
+__stop_event_parse(char *event_spec, char **name_p, char **value_p)
+{
+	char *s;
+
+	if (!(s = strchr(event_spec, '='))) {
+		*name_p = event_spec;
+		*value_p = NULL;
+		return true;
+	}
+
+	*s++ = '\0';
+	if (*event_spec == '\0')
+		return false;
+
+	*name_p = event_spec;
+	*value_p = s;
+	return true;
+}
+
+void
+predictor_set_stop_event(struct predictor *pred, const char *event_desc, bool after)
+{
+	char *copy, *name, *value;
+
+	copy = strdup(event_desc);
+	if (!__stop_event_parse(copy, &name, &value))
+		fatal("Cannot parse stop event \"%s\"\n", event_desc);
+
+	if (!strcmp(name, "grub-command")) {
+		pred->stop_event.type = STOP_EVENT_GRUB_COMMAND;
+	} else
+	if (!strcmp(name, "grub-file")) {
+		pred->stop_event.type = STOP_EVENT_GRUB_FILE;
+	} else {
+		fatal("Unsupported event type \"%s\" in stop event \"%s\"\n", name, event_desc);
+	}
+
+	pred->stop_event.value = strdup(value);
+	pred->stop_event.after = after;
+	free(copy);
+}
+
+static void
+pcr_bank_extend_register(tpm_pcr_bank_t *bank, unsigned int pcr_index, const tpm_evdigest_t *d)
+{
+	tpm_evdigest_t *pcr;
+
+	if (!pcr_bank_register_is_valid(bank, pcr_index)) {
+		error("Unable to extend PCR %s:%u: register was not initialized\n",
+				bank->algo_name, pcr_index);
+		return;
+	}
+
+	pcr = &bank->pcr[pcr_index];
+	if (pcr->algo != d->algo)
+		fatal("Cannot update PCR %u: algorithm mismatch\n", pcr_index);
+
+	if (!digest_extend(pcr, d))
+		fatal("Cannot update PCR %u: digest failed\n", pcr_index);
+}
+
+/*
+ * Extend the given PCR in all banks with the digest of the data
+ */
+static void
+predictor_extend_data(struct predictor *pred, unsigned int pcr_index, const void *data, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < pred->num_banks; ++i) {
+		tpm_pcr_bank_t *bank = &pred->prediction[i];
+		const tpm_evdigest_t *md;
+
+		md = digest_compute(bank->algo_info, data, size);
+		pcr_bank_extend_register(bank, pcr_index, md);
+	}
+}
+
+static void
+predictor_update_string(struct predictor *pred, unsigned int pcr_index, const char *value)
+{
+	debug("Extending PCR %u with string \"%s\"\n", pcr_index, value);
+	predictor_extend_data(pred, pcr_index, value, strlen(value));
+}
+
+static void
+predictor_update_file(struct predictor *pred, unsigned int pcr_index, const char *filename)
+{
+	buffer_t *buffer;
+
+	buffer = runtime_read_file(filename, 0);
+	predictor_extend_data(pred, pcr_index,
+			buffer_read_pointer(buffer),
+			buffer_available(buffer));
+	buffer_free(buffer);
+}
+
+static bool
+__check_stop_event(tpm_event_t *ev, int type, const char *value, tpm_event_log_scan_ctx_t *ctx)
+{
+	const char *grub_arg = NULL;
+	const char *grub_cmd = NULL;
+	tpm_parsed_event_t *parsed;
+
+	switch (type) {
+	case STOP_EVENT_NONE:
+		return false;
+
+	case STOP_EVENT_GRUB_COMMAND:
+		if (ev->pcr_index != 8
+		 || ev->event_type != TPM2_EVENT_IPL)
+			return false;
+
+		if (!(parsed = tpm_event_parse(ev, ctx)))
+			return false;
+
+		if (parsed->event_subtype != GRUB_EVENT_COMMAND)
+			return false;
+
+		if (!(grub_arg = parsed->grub_command.argv[0]))
+			return false;
+
+		grub_cmd = grub_arg;
+		while (grub_cmd != NULL && !isalpha(*grub_cmd))
+			grub_cmd++;
+
+		return !strcmp(grub_cmd, value);
+
+	case STOP_EVENT_GRUB_FILE:
+		if (ev->pcr_index != 9
+		 || ev->event_type != TPM2_EVENT_IPL)
+			return false;
+
+		if (!(parsed = tpm_event_parse(ev, ctx)))
+			return false;
+
+		if (parsed->event_subtype != GRUB_EVENT_FILE)
+			return false;
+
+		if (!(grub_arg = parsed->grub_file.path)) {
+			return false;
+		} else {
+			unsigned int match_len = strlen(value);
+			unsigned int path_len = strlen(grub_arg);
+
+			if (path_len > match_len
+			 && grub_arg[path_len - match_len - 1] == '/'
+			 && !strcmp(value, grub_arg + path_len - match_len)) {
+				debug("grub file path \"%s\" matched \"%s\"\n",
+						grub_arg, value);
+				return true;
+			}
+		}
+
+		return !strcmp(grub_arg, value);
+	}
+
+	return false;
+}
+
+/*
+ * Scan ahead to a future event that will help us understand the current one.
+ */
+
+/*
+ * Lookahead: when processing the GPT event, we need to know which hard disk
+ * we're talking about.
+ */
+static void
+__predictor_lookahead_efi_partition(tpm_event_t *ev, tpm_event_log_rehash_ctx_t *ctx)
+{
+	struct efi_gpt_event *gpt = &ev->__parsed->efi_gpt_event;
+
+	while ((ev = ev->next) != NULL) {
+		tpm_parsed_event_t *parsed;
+
+		if (ev->event_type != TPM2_EFI_BOOT_SERVICES_APPLICATION)
+			continue;
+
+		/* BSA events have already been parsed during the pre-scan */
+		if (!(parsed = ev->__parsed))
+			continue;
+
+		assign_string(&gpt->efi_partition, parsed->efi_bsa_event.efi_partition);
+		return;
+	}
+}
+
+/*
+ * Lookahead: when processing the BSA event that loads the shim loader, scan ahead
+ * to the next BSA event (which is probably grub getting loaded).
+ * We need this in order to process the "Shim" pseudo variable event that the
+ * shim loader produces when verifying the authenticode signature.
+ */
+static void
+__predictor_lookahead_shim_loaded(tpm_event_t *ev, tpm_event_log_rehash_ctx_t *ctx)
+{
+	tpm_parsed_event_t *parsed;
+
+	while ((ev = ev->next) != NULL) {
+		if (ev->event_type != TPM2_EFI_BOOT_SERVICES_APPLICATION)
+			continue;
+
+		/* BSA events have already been parsed during the pre-scan */
+		if (!(parsed = ev->__parsed))
+			continue;
+
+		if (!parsed->efi_bsa_event.img_info)
+			continue;
+
+		debug("Inspecting EFI application %s(%s)\n",
+				parsed->efi_bsa_event.efi_partition,
+				parsed->efi_bsa_event.efi_application);
+		ctx->next_stage_img = parsed->efi_bsa_event.img_info;
+
+#ifdef TESTING_ONLY
+		if (ctx->next_stage_img) {
+			parsed_cert_t *signer;
+			buffer_t *record;
+
+			signer = efi_application_extract_signer(parsed);
+			if (signer != NULL) {
+				debug("Application was signed by %s\n", parsed_cert_subject(signer));
+				record = efi_application_locate_authority_record("shim-vendor-cert", signer);
+				buffer_free(record);
+			}
+		}
+#endif
+
+		return;
+	}
+}
+
+static bool
+int_list_contains(const int *list, unsigned int value)
+{
+	while (*list != -1) {
+		if (*list++ == value)
+			return true;
+	}
+	return false;
+}
+
+static int
+predictor_get_event_strategy(unsigned int event_type)
+{
+	static int rehash_types[] = {
+		TPM2_EFI_BOOT_SERVICES_APPLICATION,
+		TPM2_EFI_BOOT_SERVICES_DRIVER,
+		TPM2_EFI_VARIABLE_BOOT,
+		TPM2_EFI_VARIABLE_AUTHORITY,
+		TPM2_EFI_VARIABLE_DRIVER_CONFIG,
+
+		/* IPL: used by grub2 for PCR 8 and PCR9 */
+		TPM2_EVENT_IPL,
+
+		/* EVENT_TAG: used by the kernel for PCR9, to measure the cmdline and initrd */
+		TPM2_EVENT_EVENT_TAG,
+
+		/*
+		 * EFI_GPT_EVENT: used in updates of PCR5, seems to be a hash of several GPT headers.
+		 *	We should probably rebuild in case someone changed the partitioning.
+		 *	However, not needed as long as we don't seal against PCR5.
+		 */
+		TPM2_EFI_GPT_EVENT,
+
+		-1,
+	};
+	static int copy_types[] = {
+		TPM2_EVENT_S_CRTM_CONTENTS,
+		TPM2_EVENT_S_CRTM_VERSION,
+		TPM2_EFI_PLATFORM_FIRMWARE_BLOB,
+		TPM2_EFI_PLATFORM_FIRMWARE_BLOB2,
+		TPM2_EVENT_SEPARATOR,
+		TPM2_EVENT_POST_CODE,
+		TPM2_EFI_HANDOFF_TABLES,
+		TPM2_EFI_HANDOFF_TABLES2,
+		TPM2_EFI_ACTION,
+		TPM2_EVENT_ACTION,
+		TPM2_EVENT_NONHOST_CODE,
+		TPM2_EVENT_NONHOST_CONFIG,
+		TPM2_EVENT_NONHOST_INFO,
+		TPM2_EVENT_PLATFORM_CONFIG_FLAGS,
+
+		-1
+	};
+
+	if (event_type == TPM2_EVENT_NO_ACTION)
+		return EVENT_STRATEGY_NO_ACTION;
+
+	if (int_list_contains(rehash_types, event_type))
+		return EVENT_STRATEGY_PARSE_REHASH;
+	if (int_list_contains(copy_types, event_type))
+		return EVENT_STRATEGY_COPY;
+
+	return EVENT_STRATEGY_PARSE_NONE;
+}
+
+/*
+ * grub records commands in PCR 8, and files in PCR 9 (see __check_stop_event),
+ * so there's no need to look at anything else when searching for the stop event.
+ */
+static tpm_event_t *
+predictor_find_stop_event(struct predictor *pred, tpm_event_log_scan_ctx_t *ctx)
+{
+	const struct predictor_pcr_events *idx;
+	unsigned int i;
+
+	switch (pred->stop_event.type) {
+	case STOP_EVENT_GRUB_COMMAND:
+		idx = &pred->pcr_events[8];
+		break;
+
+	case STOP_EVENT_GRUB_FILE:
+		idx = &pred->pcr_events[9];
+		break;
+
+	default:
+		return NULL;
+	}
+
+	for (i = 0; i < idx->count; ++i) {
+		tpm_event_t *ev = idx->events[i];
+
+		if (__check_stop_event(ev, pred->stop_event.type, pred->stop_event.value, ctx))
+			return ev;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the last event that extends any of the PCRs we predict.
+ */
+static const tpm_event_t *
+predictor_find_last_relevant_event(struct predictor *pred)
+{
+	const tpm_event_t *last = NULL;
+	unsigned int pcr_index;
+
+	for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
+		const struct predictor_pcr_events *idx = &pred->pcr_events[pcr_index];
+		const tpm_event_t *ev;
+
+		if (!predictor_wants_pcr(pred, pcr_index) || idx->count == 0)
+			continue;
+
+		ev = idx->events[idx->count - 1];
+		if (last == NULL || ev->event_index > last->event_index)
+			last = ev;
+	}
+
+	return last;
+}
+
+/*
+ * Parse an event, and remember what parsing it depended on; the per-event
+ * rehash cache needs this. The event may have been parsed by an earlier
+ * action in the same process (see --batch), in which case we just report
+ * the dependencies recorded back then.
+ */
+static tpm_parsed_event_t *
+predictor_parse_event(tpm_event_t *ev, tpm_event_log_scan_ctx_t *scan_ctx)
+{
+	dependency_list_t *outer;
+	tpm_parsed_event_t *parsed;
+
+	if ((parsed = ev->__parsed) != NULL) {
+		/* Parsing a BSA event passes its EFI partition on to the
+		 * events that follow; make sure we still do that. */
+		if (ev->event_type == TPM2_EFI_BOOT_SERVICES_APPLICATION
+		 && parsed->efi_bsa_event.efi_application
+		 && parsed->efi_bsa_event.efi_partition)
+			assign_string(&scan_ctx->efi_partition, parsed->efi_bsa_event.efi_partition);
+	} else {
+		if (ev->parse_deps)
+			dependency_list_free(ev->parse_deps);
+		ev->parse_deps = dependency_list_new();
+
+		outer = dependency_record_start(ev->parse_deps);
+		parsed = tpm_event_parse(ev, scan_ctx);
+		dependency_record_stop(outer);
+	}
+
+	if (ev->parse_deps)
+		dependency_add_list(ev->parse_deps);
+	return parsed;
+}
+
+/*
+ * During the pre-scan, we propagate EFI partition information from one BSA event
+ * to the next.
+ *
+ * We only parse the events of the PCRs we have been asked to predict. The
+ * exception are BSA events that the lookahead helpers need while processing
+ * a GPT or BSA event in one of these PCRs: in this case, we also parse the
+ * BSA events that follow, up to and including the first one that refers to
+ * an EFI application we were able to inspect.
+ */
+static void
+predictor_pre_scan_eventlog(struct predictor *pred, tpm_event_t **stop_event_p)
+{
+	tpm_event_log_scan_ctx_t scan_ctx;
+	const tpm_event_t *last_event;
+	tpm_event_t *ev, *stop_event;
+	bool want_bsa = false;
+
+	tpm_event_log_scan_ctx_init(&scan_ctx);
+
+	*stop_event_p = stop_event = predictor_find_stop_event(pred, &scan_ctx);
+	last_event = predictor_find_last_relevant_event(pred);
+
+	for (ev = pred->event_log; ev; ev = ev->next) {
+		bool selected, parse_it = false;
+
+		if (stop_event && ev->event_index > stop_event->event_index)
+			break;
+		if (!want_bsa && (last_event == NULL || ev->event_index > last_event->event_index))
+			break;
+
+		ev->rehash_strategy = predictor_get_event_strategy(ev->event_type);
+		/* debug("%s -> %d\n", tpm_event_type_to_string(ev->event_type), ev->rehash_strategy); */
+
+		selected = predictor_wants_pcr(pred, ev->pcr_index);
+		if (selected && ev->rehash_strategy == EVENT_STRATEGY_PARSE_REHASH)
+			parse_it = true;
+
+		if (ev->event_type == TPM2_EFI_BOOT_SERVICES_APPLICATION && want_bsa)
+			parse_it = true;
+
+		if (parse_it && !predictor_parse_event(ev, &scan_ctx)) {
+			/* Provide better error logging */
+			error("Unable to parse %s event from TPM log\n", tpm_event_type_to_string(ev->event_type));
+			if (opt_debug)
+				__tpm_event_print(ev, debug);
+			fatal("Aborting.\n");
+		}
+
+		if (ev->event_type == TPM2_EFI_BOOT_SERVICES_APPLICATION) {
+			if (ev->__parsed && ev->__parsed->efi_bsa_event.img_info)
+				want_bsa = false;
+			if (selected)
+				want_bsa = true;
+		} else
+		if (ev->event_type == TPM2_EFI_GPT_EVENT && selected) {
+			want_bsa = true;
+		}
+	}
+	tpm_event_log_scan_ctx_destroy(&scan_ctx);
+}
+
+/*
+ * Read all EFI variables referenced by the events we are about to re-hash
+ * in one pass. When re-hashing in parallel, this makes sure every variable
+ * is read once by the parent rather than once per worker process.
+ */
+static void
+predictor_preload_efi_variables(struct predictor *pred, const tpm_event_t *stop_event)
+{
+	const char **names = NULL;
+	unsigned int i, count = 0;
+	tpm_event_t *ev;
+
+	for (ev = pred->event_log; ev; ev = ev->next) {
+		const char *var_name;
+
+		if (stop_event && ev->event_index > stop_event->event_index)
+			break;
+
+		if (!predictor_wants_pcr(pred, ev->pcr_index)
+		 || ev->rehash_strategy != EVENT_STRATEGY_PARSE_REHASH
+		 || ev->__parsed == NULL)
+			continue;
+
+		if (ev->event_type != TPM2_EFI_VARIABLE_AUTHORITY
+		 && ev->event_type != TPM2_EFI_VARIABLE_BOOT
+		 && ev->event_type != TPM2_EFI_VARIABLE_DRIVER_CONFIG)
+			continue;
+
+		if (!(var_name = tpm_efi_variable_event_extract_full_varname(ev->__parsed)))
+			continue;
+
+		for (i = 0; i < count && strcmp(names[i], var_name); ++i)
+			;
+		if (i < count)
+			continue;
+
+		if ((count % 16) == 0) {
+			names = realloc(names, (count + 16) * sizeof(names[0]));
+			if (names == NULL)
+				fatal("%s: out of memory\n", __func__);
+		}
+		names[count++] = strdup(var_name);
+	}
+
+	runtime_preload_efi_variables(count, names);
+
+	for (i = 0; i < count; ++i)
+		free((char *) names[i]);
+	free(names);
+}
+
+/*
+ * Helpers for building cache keys. Every item is length-prefixed so that
+ * adjacent fields cannot run into each other.
+ */
+static inline void
+__cache_key_add_u32(digest_ctx_t *ctx, uint32_t value)
+{
+	digest_ctx_update(ctx, &value, sizeof(value));
+}
+
+static void
+__cache_key_add_data(digest_ctx_t *ctx, const void *data, unsigned int len)
+{
+	__cache_key_add_u32(ctx, len);
+	digest_ctx_update(ctx, data, len);
+}
+
+static void
+__cache_key_add_string(digest_ctx_t *ctx, const char *s)
+{
+	if (s == NULL)
+		__cache_key_add_u32(ctx, ~0U);
+	else
+		__cache_key_add_data(ctx, s, strlen(s));
+}
+
+static void
+__cache_key_add_digest(digest_ctx_t *ctx, const tpm_evdigest_t *md)
+{
+	__cache_key_add_u32(ctx, md->algo? md->algo->tcg_id : 0);
+	__cache_key_add_data(ctx, md->data, md->size);
+}
+
+static void
+__cache_key_add_file(digest_ctx_t *ctx, const char *path)
+{
+	cache_file_id_t id;
+	struct stat stb;
+
+	memset(&id, 0, sizeof(id));
+	if (path && stat(path, &stb) >= 0)
+		cache_file_id_from_stat(&id, &stb);
+
+	__cache_key_add_string(ctx, path);
+	digest_ctx_update(ctx, &id, sizeof(id));
+}
+
+static char *
+__cache_key_final(digest_ctx_t *ctx)
+{
+	char *key;
+
+	key = strdup(digest_print_value(digest_ctx_final(ctx, NULL)));
+	digest_ctx_free(ctx);
+	return key;
+}
+
+/*
+ * Re-hashing an event can be expensive (think authenticode digests of large
+ * PE images, or hashing the initrd), but the results do not depend on each
+ * other. So we first collect the events that need re-hashing, together with
+ * the rehash context they would see when processed in log order. Then we
+ * compute all digests, possibly in parallel, and finally fold them into the
+ * PCR banks in log order.
+ */
+struct predictor_rehash_job {
+	tpm_event_t *		ev;
+	tpm_event_log_rehash_ctx_t ctx;
+
+	/* one digest per PCR bank */
+	bool			okay[PREDICTOR_MAX_BANKS];
+	tpm_evdigest_t		digest[PREDICTOR_MAX_BANKS];
+
+	/* what the digests were computed from, if we're tracking that */
+	dependency_list_t *	deps;
+
+	/* per-event rehash cache */
+	char *			memo_key;
+	bool			memo_hit;
+};
+
+struct predictor_rehash_queue {
+	unsigned int		num_algos;
+	const tpm_algo_info_t *	algos[PREDICTOR_MAX_BANKS];
+
+	unsigned int		count;
+	unsigned int		size;
+	struct predictor_rehash_job *jobs;
+};
+
+/* What a worker process sends back to us. This is followed by
+ * deps_len bytes containing the job's encoded dependencies. */
+struct predictor_rehash_result {
+	unsigned int		index;
+	bool			okay[PREDICTOR_MAX_BANKS];
+	tpm_evdigest_t		digest[PREDICTOR_MAX_BANKS];
+	unsigned int		consulted;
+	unsigned int		deps_len;
+};
+
+static void
+predictor_rehash_queue_init(struct predictor_rehash_queue *q, const struct predictor *pred)
+{
+	unsigned int i;
+
+	memset(q, 0, sizeof(*q));
+	for (i = 0; i < pred->num_banks; ++i)
+		q->algos[q->num_algos++] = pred->prediction[i].algo_info;
+}
+
+static void
+predictor_rehash_queue_add(struct predictor_rehash_queue *q, tpm_event_t *ev, const tpm_event_log_rehash_ctx_t *ctx)
+{
+	struct predictor_rehash_job *job;
+
+	if (q->count >= q->size) {
+		q->size += 64;
+		q->jobs = realloc(q->jobs, q->size * sizeof(q->jobs[0]));
+		if (q->jobs == NULL)
+			fatal("out of memory");
+	}
+
+	job = &q->jobs[q->count++];
+	memset(job, 0, sizeof(*job));
+	job->ev = ev;
+	job->ctx = *ctx;
+}
+
+static void
+predictor_rehash_queue_destroy(struct predictor_rehash_queue *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->count; ++i) {
+		if (q->jobs[i].deps)
+			dependency_list_free(q->jobs[i].deps);
+		if (q->jobs[i].memo_key)
+			free(q->jobs[i].memo_key);
+	}
+
+	if (q->jobs)
+		free(q->jobs);
+	memset(q, 0, sizeof(*q));
+}
+
+/*
+ * Compute the new digest of an event for all PCR banks.
+ * The event has already been parsed in the pre-scan.
+ */
+static void
+predictor_rehash_job_run(struct predictor_rehash_queue *q, struct predictor_rehash_job *job)
+{
+	dependency_list_t *outer = NULL;
+	unsigned int i;
+
+	/* If we're recording dependencies, track them per job */
+	if (dependency_is_recording()) {
+		job->deps = dependency_list_new();
+		outer = dependency_record_start(job->deps);
+	}
+
+	for (i = 0; i < q->num_algos; ++i) {
+		const tpm_evdigest_t *md;
+
+		job->ctx.algo = q->algos[i];
+		md = tpm_parsed_event_rehash(job->ev, job->ev->__parsed, &job->ctx);
+		if (md != NULL) {
+			job->digest[i] = *md;
+			job->okay[i] = true;
+		}
+	}
+
+	if (job->deps) {
+		dependency_record_stop(outer);
+		dependency_add_list(job->deps);
+	}
+}
+
+static bool
+__read_from_worker(int fd, void *data, unsigned int size, bool eof_okay)
+{
+	unsigned int done = 0;
+	int n;
+
+	while (done < size) {
+		n = read(fd, (char *) data + done, size - done);
+		if (n < 0)
+			fatal("unable to read from worker process: %m\n");
+		if (n == 0) {
+			if (done || !eof_okay)
+				fatal("short read from worker process\n");
+			return false;
+		}
+		done += n;
+	}
+
+	return true;
+}
+
+static bool
+__read_rehash_result(int fd, struct predictor_rehash_result *res, dependency_list_t **deps_p)
+{
+	buffer_t *bp;
+
+	if (!__read_from_worker(fd, res, sizeof(*res), true))
+		return false;
+
+	*deps_p = NULL;
+	if (res->deps_len) {
+		bp = buffer_alloc_write(res->deps_len);
+		__read_from_worker(fd, buffer_write_pointer(bp), res->deps_len, false);
+		bp->wpos = res->deps_len;
+
+		if (!(*deps_p = dependency_list_decode(bp)))
+			fatal("worker process sent bad dependency list\n");
+		buffer_free(bp);
+	}
+
+	return true;
+}
+
+static void
+__write_rehash_result(int fd, const struct predictor_rehash_job *job, unsigned int index)
+{
+	struct predictor_rehash_result res;
+	buffer_t *bp = NULL;
+
+	memset(&res, 0, sizeof(res));
+	res.index = index;
+	memcpy(res.okay, job->okay, sizeof(res.okay));
+	memcpy(res.digest, job->digest, sizeof(res.digest));
+	res.consulted = job->ctx.consulted;
+
+	if (job->deps) {
+		bp = buffer_alloc_write(65536);
+		if (dependency_list_encode(bp, job->deps)) {
+			res.deps_len = buffer_available(bp);
+		} else {
+			/* Not fatal; the result just won't be cached */
+			debug("unable to encode dependencies of job %u\n", index);
+			buffer_free(bp);
+			bp = NULL;
+		}
+	}
+
+	if (write(fd, &res, sizeof(res)) != sizeof(res))
+		fatal("unable to send digest to parent process: %m\n");
+
+	if (bp) {
+		if (write(fd, buffer_read_pointer(bp), res.deps_len) != res.deps_len)
+			fatal("unable to send dependencies to parent process: %m\n");
+		buffer_free(bp);
+	}
+}
+
+/*
+ * Worker processes are forked off the predictor, so they share all parsed
+ * events with us. Worker number w takes care of pending jobs w, w + N, w + 2N,
+ * ... and sends the resulting digests back through a pipe.
+ */
+static bool
+predictor_rehash_parallel(struct predictor_rehash_queue *q, const unsigned int *pending,
+			unsigned int num_pending, unsigned int num_workers)
+{
+	pid_t pids[num_workers];
+	int fds[num_workers];
+	unsigned int w, i;
+	bool okay = true;
+
+	debug("Re-hashing %u events using %u worker processes\n", num_pending, num_workers);
+
+	/* Make sure the workers do not inherit any pending output */
+	fflush(NULL);
+
+	for (w = 0; w < num_workers; ++w) {
+		int p[2];
+
+		if (pipe(p) < 0)
+			fatal("unable to create pipe: %m\n");
+
+		if ((pids[w] = fork()) < 0)
+			fatal("unable to fork worker process: %m\n");
+
+		if (pids[w] == 0) {
+			unsigned int k;
+
+			close(p[0]);
+			for (k = 0; k < w; ++k)
+				close(fds[k]);
+
+			for (i = w; i < num_pending; i += num_workers) {
+				struct predictor_rehash_job *job = &q->jobs[pending[i]];
+
+				predictor_rehash_job_run(q, job);
+				__write_rehash_result(p[1], job, pending[i]);
+			}
+
+			/* We skip atexit handlers, so unmount whatever
+			 * partitions this worker mounted */
+			runtime_close_partitions();
+			_exit(0);
+		}
+
+		close(p[1]);
+		fds[w] = p[0];
+	}
+
+	for (w = 0; w < num_workers; ++w) {
+		struct predictor_rehash_result res;
+		dependency_list_t *deps;
+		int status;
+
+		while (__read_rehash_result(fds[w], &res, &deps)) {
+			struct predictor_rehash_job *job;
+
+			if (res.index >= q->count)
+				fatal("worker process returned bad job index %u\n", res.index);
+
+			job = &q->jobs[res.index];
+			memcpy(job->okay, res.okay, sizeof(job->okay));
+			memcpy(job->digest, res.digest, sizeof(job->digest));
+			job->ctx.consulted = res.consulted;
+
+			if (deps != NULL) {
+				if (dependency_is_recording())
+					dependency_add_list(deps);
+				job->deps = deps;
+			}
+		}
+		close(fds[w]);
+
+		if (waitpid(pids[w], &status, 0) < 0)
+			fatal("waitpid: %m\n");
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			error("Worker process %d failed\n", (int) pids[w]);
+			okay = false;
+		}
+	}
+
+	return okay;
+}
+
+/*
+ * Per-event rehash cache.
+ *
+ * When the prediction as a whole cannot be taken from the cache (say, because
+ * a new kernel was installed), most events will still hash to exactly what they
+ * did last time. So we also remember the digests of individual events, keyed by
+ * the event itself and everything that precedes it in the log (which is what
+ * parsing the event may have looked at). Each entry records what the digests
+ * were derived from, and which parts of the rehash context (the next stage
+ * loader, the boot entry) the event consulted. An entry is used only if none of
+ * these have changed.
+ *
+ * Entries are touched whenever they are used, and the least recently used ones
+ * are evicted when the cache grows beyond REHASH_CACHE_MAX_TOTAL.
+ */
+#define REHASH_CACHE_MAGIC		0x52484332
+#define REHASH_CACHE_MAX_SIZE		(256 * 1024)
+#define REHASH_CACHE_MAX_TOTAL		(16 * 1024 * 1024)
+
+static void
+__rehash_cache_key_add_event(digest_ctx_t *ctx, const tpm_event_t *ev)
+{
+	unsigned int i;
+
+	__cache_key_add_u32(ctx, ev->pcr_index);
+	__cache_key_add_u32(ctx, ev->event_type);
+	__cache_key_add_u32(ctx, ev->pcr_count);
+	for (i = 0; i < ev->pcr_count; ++i)
+		__cache_key_add_digest(ctx, &ev->pcr_values[i]);
+	__cache_key_add_data(ctx, ev->event_data, ev->event_size);
+}
+
+static void
+predictor_rehash_cache_keys(struct predictor *pred, struct predictor_rehash_queue *q)
+{
+	const tpm_algo_info_t *sha256 = digest_by_tpm_alg(TPM2_ALG_SHA256);
+	tpm_evdigest_t prefix;
+	unsigned int i, next_job = 0;
+	tpm_event_t *ev;
+
+	/* prefix is a hash chain over all events up to and including ev */
+	memset(&prefix, 0, sizeof(prefix));
+	for (ev = pred->event_log; ev && next_job < q->count; ev = ev->next) {
+		struct predictor_rehash_job *job;
+		digest_ctx_t *ctx;
+
+		ctx = digest_ctx_new(sha256);
+		__cache_key_add_digest(ctx, &prefix);
+		__rehash_cache_key_add_event(ctx, ev);
+		digest_ctx_final(ctx, &prefix);
+		digest_ctx_free(ctx);
+
+		if (q->jobs[next_job].ev != ev)
+			continue;
+
+		job = &q->jobs[next_job++];
+
+		ctx = digest_ctx_new(sha256);
+		__cache_key_add_string(ctx, "pcr-oracle rehash v1");
+		__cache_key_add_u32(ctx, q->num_algos);
+		for (i = 0; i < q->num_algos; ++i)
+			__cache_key_add_u32(ctx, q->algos[i]->tcg_id);
+		__cache_key_add_u32(ctx, job->ctx.use_pesign);
+		__cache_key_add_digest(ctx, &prefix);
+		job->memo_key = __cache_key_final(ctx);
+	}
+}
+
+/*
+ * Summarize those parts of the rehash context that the event consulted.
+ */
+static void
+predictor_rehash_context_id(const tpm_event_log_rehash_ctx_t *rehash_ctx, unsigned int consulted,
+			tpm_evdigest_t *md)
+{
+	digest_ctx_t *ctx;
+
+	ctx = digest_ctx_new(digest_by_tpm_alg(TPM2_ALG_SHA256));
+	__cache_key_add_u32(ctx, consulted);
+
+	if (consulted & REHASH_CONSULTED_BOOT_ENTRY) {
+		const uapi_boot_entry_t *entry = rehash_ctx->boot_entry;
+
+		__cache_key_add_u32(ctx, entry != NULL);
+		if (entry != NULL) {
+			__cache_key_add_string(ctx, entry->image_path);
+			__cache_key_add_string(ctx, entry->initrd_path);
+			__cache_key_add_string(ctx, entry->options);
+		}
+	}
+
+	if (consulted & REHASH_CONSULTED_NEXT_STAGE_IMG) {
+		parsed_cert_t *signer = NULL;
+		buffer_t *der = NULL;
+
+		if (rehash_ctx->next_stage_img
+		 && (signer = authenticode_get_signer(rehash_ctx->next_stage_img)) != NULL)
+			der = parsed_cert_encode(signer);
+
+		if (der != NULL)
+			__cache_key_add_data(ctx, buffer_read_pointer(der), buffer_available(der));
+		else
+			__cache_key_add_string(ctx, NULL);
+
+		if (der)
+			buffer_free(der);
+		if (signer)
+			parsed_cert_free(signer);
+	}
+
+	digest_ctx_final(ctx, md);
+	digest_ctx_free(ctx);
+}
+
+static bool
+predictor_rehash_cache_load(struct predictor *pred, struct predictor_rehash_queue *q,
+			struct predictor_rehash_job *job)
+{
+	tpm_evdigest_t digest[PREDICTOR_MAX_BANKS];
+	bool okay[PREDICTOR_MAX_BANKS];
+	tpm_evdigest_t context_id, stored_id;
+	dependency_list_t *deps = NULL;
+	uint32_t magic, consulted, num_algos;
+	unsigned int i;
+	bool ok = false;
+	buffer_t *bp;
+
+	if (!(bp = cache_read("rehash", job->memo_key)))
+		return false;
+
+	memset(&stored_id, 0, sizeof(stored_id));
+	if (!buffer_get_u32le(bp, &magic) || magic != REHASH_CACHE_MAGIC
+	 || !buffer_get_u32le(bp, &consulted)
+	 || !buffer_get_u32le(bp, &stored_id.size)
+	 || stored_id.size > sizeof(stored_id.data)
+	 || !buffer_get(bp, stored_id.data, stored_id.size)
+	 || !(deps = dependency_list_decode(bp))
+	 || !buffer_get_u32le(bp, &num_algos) || num_algos != q->num_algos)
+		goto out;
+
+	predictor_rehash_context_id(&job->ctx, consulted, &context_id);
+	if (context_id.size != stored_id.size
+	 || memcmp(context_id.data, stored_id.data, stored_id.size))
+		goto out;
+
+	memset(digest, 0, sizeof(digest));
+	for (i = 0; i < num_algos; ++i) {
+		const tpm_algo_info_t *algo = q->algos[i];
+		unsigned char data[sizeof(digest[i].data)];
+		uint32_t algo_id;
+		uint16_t size;
+		uint8_t flag;
+
+		if (!buffer_get_u32le(bp, &algo_id) || algo_id != algo->tcg_id
+		 || !buffer_get_u8(bp, &flag))
+			goto out;
+
+		okay[i] = !!flag;
+		if (!okay[i])
+			continue;
+
+		if (!buffer_get_u16le(bp, &size) || size != algo->digest_size
+		 || !buffer_get(bp, data, size))
+			goto out;
+		digest_set(&digest[i], algo, size, data);
+	}
+
+	if (!dependency_list_is_current(deps))
+		goto out;
+
+	memcpy(job->okay, okay, sizeof(okay));
+	memcpy(job->digest, digest, sizeof(digest));
+	job->ctx.consulted = consulted;
+	job->memo_hit = true;
+
+	/* The prediction as a whole still depends on everything this
+	 * event's digests were derived from */
+	dependency_add_list(deps);
+	cache_touch("rehash", job->memo_key);
+	ok = true;
+
+out:
+	if (deps)
+		dependency_list_free(deps);
+	buffer_free(bp);
+	return ok;
+}
+
+static bool
+predictor_rehash_cache_save(struct predictor *pred, struct predictor_rehash_queue *q,
+			const struct predictor_rehash_job *job)
+{
+	dependency_list_t *deps;
+	tpm_evdigest_t context_id;
+	unsigned int i, index;
+	buffer_t *bp;
+	bool ok;
+
+	deps = dependency_list_new();
+	dependency_list_merge(deps, job->deps);
+	index = job->ev->event_index;
+	if (job->ev->parse_deps)
+		dependency_list_merge(deps, job->ev->parse_deps);
+	if (pred->context_deps)
+		dependency_list_merge(deps, pred->context_deps);
+
+	predictor_rehash_context_id(&job->ctx, job->ctx.consulted, &context_id);
+
+	bp = buffer_alloc_write(REHASH_CACHE_MAX_SIZE);
+	ok = buffer_put_u32le(bp, REHASH_CACHE_MAGIC)
+	  && buffer_put_u32le(bp, job->ctx.consulted)
+	  && buffer_put_u32le(bp, context_id.size)
+	  && buffer_put(bp, context_id.data, context_id.size)
+	  && dependency_list_encode(bp, deps)
+	  && buffer_put_u32le(bp, q->num_algos);
+
+	for (i = 0; ok && i < q->num_algos; ++i) {
+		uint8_t flag = job->okay[i];
+
+		ok = buffer_put_u32le(bp, q->algos[i]->tcg_id)
+		  && buffer_put_u8(bp, &flag);
+		if (ok && flag)
+			ok = buffer_put_u16le(bp, job->digest[i].size)
+			  && buffer_put(bp, job->digest[i].data, job->digest[i].size);
+	}
+
+	if (ok)
+		ok = cache_write("rehash", job->memo_key, bp);
+	else
+		debug("Unable to encode rehash cache entry for event %u\n", index);
+
+	dependency_list_free(deps);
+	buffer_free(bp);
+	return ok;
+}
+
+static bool
+predictor_rehash_all(struct predictor *pred, struct predictor_rehash_queue *q)
+{
+	unsigned int i, num_workers, num_pending = 0, num_saved = 0;
+	unsigned int pending[q->count + 1];
+	bool use_cache, okay = true;
+
+	/* We can only tell whether a cached digest is still valid if we
+	 * know what it was derived from. */
+	use_cache = dependency_is_recording();
+	if (use_cache)
+		predictor_rehash_cache_keys(pred, q);
+
+	for (i = 0; i < q->count; ++i) {
+		struct predictor_rehash_job *job = &q->jobs[i];
+
+		if (use_cache && job->memo_key
+		 && predictor_rehash_cache_load(pred, q, job))
+			continue;
+		pending[num_pending++] = i;
+	}
+
+	if (use_cache)
+		debug("Rehash cache: %u of %u events cached\n", q->count - num_pending, q->count);
+
+	num_workers = pred->jobs;
+	if (num_workers > num_pending)
+		num_workers = num_pending;
+
+	if (num_workers > 1) {
+		okay = predictor_rehash_parallel(q, pending, num_pending, num_workers);
+	} else {
+		for (i = 0; i < num_pending; ++i)
+			predictor_rehash_job_run(q, &q->jobs[pending[i]]);
+	}
+
+	if (okay && use_cache) {
+		for (i = 0; i < num_pending; ++i) {
+			struct predictor_rehash_job *job = &q->jobs[pending[i]];
+
+			if (job->memo_key && job->deps
+			 && predictor_rehash_cache_save(pred, q, job))
+				num_saved++;
+		}
+
+		if (num_saved)
+			cache_trim("rehash", REHASH_CACHE_MAX_TOTAL);
+	}
+
+	return okay;
+}
+
+/*
+ * Extend one PCR bank with the new digest of an event
+ */
+static bool
+predictor_update_bank(struct predictor *pred, tpm_pcr_bank_t *bank, tpm_event_t *ev,
+		const struct predictor_rehash_job *job, unsigned int bank_index)
+{
+	const tpm_evdigest_t *old_digest, *new_digest;
+	const char *description = NULL;
+	bool okay = true;
+
+	if (!(old_digest = tpm_event_get_digest(ev, bank->algo_info)))
+		fatal("Event log lacks a hash for digest algorithm %s\n", bank->algo_name);
+
+	if (false) {
+		const tpm_evdigest_t *tmp_digest;
+
+		tmp_digest = digest_compute(bank->algo_info, ev->event_data, ev->event_size);
+		if (!tmp_digest) {
+			debug("cannot compute digest for event data\n");
+		} else if (!digest_equal(old_digest, tmp_digest)) {
+			debug("firmware did more than just hash the event data\n");
+			debug("  Old digest: %s\n", digest_print(old_digest));
+			debug("  New digest: %s\n", digest_print(tmp_digest));
+		}
+	}
+
+	switch (ev->rehash_strategy) {
+	case EVENT_STRATEGY_PARSE_REHASH:
+		new_digest = job->okay[bank_index]? &job->digest[bank_index] : NULL;
+		description = tpm_parsed_event_describe(ev->__parsed);
+		break;
+
+	case EVENT_STRATEGY_COPY:
+		new_digest = old_digest;
+		break;
+
+	case EVENT_STRATEGY_NO_ACTION:
+		return true;
+
+	default:
+		debug("Encountered unexpected event type %s\n",
+				tpm_event_type_to_string(ev->event_type));
+		new_digest = old_digest;
+	}
+
+	if (new_digest == NULL) {
+		error("Failed to re-hash event %u type %s\n",
+				ev->event_index,
+				tpm_event_type_to_string(ev->event_type));
+		new_digest = old_digest;
+		okay = false;
+	}
+
+	if (opt_debug && new_digest != old_digest) {
+		if (new_digest->size == old_digest->size
+		 && !memcmp(new_digest->data, old_digest->data, old_digest->size)) {
+			debug("Digest for %s did not change\n", description);
+		} else {
+			debug("Digest for %s changed\n", description);
+			debug("  Old digest: %s\n", digest_print(old_digest));
+			debug("  New digest: %s\n", digest_print(new_digest));
+		}
+	}
+
+	pcr_bank_extend_register(bank, ev->pcr_index, new_digest);
+	return okay;
+}
+
+/*
+ * Events that were parsed only so that the lookahead helpers could look at
+ * them are not covered by any rehash job. Anything parsing them depended on
+ * is part of the context of all jobs.
+ */
+static void
+predictor_add_lookahead_dependencies(struct predictor *pred, const struct predictor_rehash_queue *q)
+{
+	unsigned int next_job = 0;
+	tpm_event_t *ev;
+
+	for (ev = pred->event_log; ev; ev = ev->next) {
+		if (next_job < q->count && q->jobs[next_job].ev == ev) {
+			next_job++;
+			continue;
+		}
+
+		if (ev->parse_deps)
+			dependency_list_merge(pred->context_deps, ev->parse_deps);
+	}
+}
+
+static void
+predictor_drop_dependencies(struct predictor *pred)
+{
+	if (pred->context_deps)
+		dependency_list_free(pred->context_deps);
+	pred->context_deps = NULL;
+}
+
+static bool
+predictor_update_eventlog(struct predictor *pred)
+{
+	struct predictor_rehash_queue rehash_queue;
+	tpm_event_log_rehash_ctx_t rehash_ctx;
+	tpm_event_t *ev, *stop_event = NULL;
+	dependency_list_t *outer = NULL;
+	unsigned int next_job = 0;
+	bool okay = true;
+
+	predictor_pre_scan_eventlog(pred, &stop_event);
+	if (pred->jobs > 1)
+		predictor_preload_efi_variables(pred, stop_event);
+
+	tpm_event_log_rehash_ctx_init(&rehash_ctx, pred->prediction[0].algo_info);
+	rehash_ctx.use_pesign = opt_use_pesign;
+
+	/* The argument given to --next-kernel will be either "auto" or the
+	 * systemd ID of the next kernel entry to be booted.
+	 * FIXME: we should probably hide this behind a target_platform function.
+	 */
+	if (pred->boot_entry_id != NULL
+	 && !(rehash_ctx.boot_entry = sdb_identify_boot_entry(pred->boot_entry_id)))
+		fatal("unable to identify next kernel \"%s\"\n", pred->boot_entry_id);
+
+	predictor_rehash_queue_init(&rehash_queue, pred);
+
+	/* The lookahead helpers may inspect events and EFI applications that
+	 * are not part of any rehash job. Any cached digest depends on those. */
+	if (dependency_is_recording()) {
+		pred->context_deps = dependency_list_new();
+		outer = dependency_record_start(pred->context_deps);
+	}
+
+	/* Stage 1: collect the events that need re-hashing */
+	for (ev = pred->event_log; ev; ev = ev->next) {
+		if (ev == stop_event && !pred->stop_event.after)
+			break;
+
+		if (predictor_wants_pcr(pred, ev->pcr_index)) {
+			/* By the time we encounter the GPT event, we usually haven't seen any
+			 * BOOT_SERVICES event that would tell us which partition we're booting
+			 * from.
+			 * Scan ahead to the first BSA event to extract the EFI partition.
+			 */
+			if (ev->event_type == TPM2_EFI_GPT_EVENT)
+				__predictor_lookahead_efi_partition(ev, &rehash_ctx);
+
+			/* The shim loader emits an event that tells us which certificate it
+			 * used to verify the second stage loader. We try to predict that
+			 * by checking the second stage loader's authenticode sig.
+			 */
+			if (ev->event_type == TPM2_EFI_BOOT_SERVICES_APPLICATION)
+				__predictor_lookahead_shim_loaded(ev, &rehash_ctx);
+
+			if (ev->rehash_strategy == EVENT_STRATEGY_PARSE_REHASH)
+				predictor_rehash_queue_add(&rehash_queue, ev, &rehash_ctx);
+		}
+
+		if (ev == stop_event)
+			break;
+	}
+
+	if (pred->context_deps) {
+		dependency_record_stop(outer);
+		predictor_add_lookahead_dependencies(pred, &rehash_queue);
+		dependency_add_list(pred->context_deps);
+	}
+
+	/* Stage 2: compute the new digests */
+	if (!predictor_rehash_all(pred, &rehash_queue))
+		fatal("Unable to re-hash TPM event log\n");
+
+	/* Stage 3: extend the PCRs in log order */
+	for (ev = pred->event_log; ev; ev = ev->next) {
+		bool stop = false;
+
+		stop = (ev == stop_event);
+		if (stop && !pred->stop_event.after) {
+			debug("Stopped processing event log before indicated event\n");
+			break;
+		}
+
+		if (predictor_wants_pcr(pred, ev->pcr_index)) {
+			const struct predictor_rehash_job *job = NULL;
+			unsigned int i;
+
+			debug("\n");
+			__tpm_event_print(ev, debug);
+
+			if (ev->rehash_strategy == EVENT_STRATEGY_PARSE_REHASH) {
+				assert(next_job < rehash_queue.count);
+				job = &rehash_queue.jobs[next_job++];
+				assert(job->ev == ev);
+			}
+
+			for (i = 0; i < pred->num_banks; ++i) {
+				if (!predictor_update_bank(pred, &pred->prediction[i], ev, job, i))
+					okay = false;
+			}
+		}
+
+		if (stop) {
+			debug("Stopped processing event log after indicated event\n");
+			break;
+		}
+	}
+
+	predictor_rehash_queue_destroy(&rehash_queue);
+	tpm_event_log_rehash_ctx_destroy(&rehash_ctx);
+	predictor_drop_dependencies(pred);
+	return okay;
+}
+
+static const char *
+get_next_arg(int *index_p, int argc, char **argv)
+{
+	int i = *index_p;
+
+	if (i >= argc) {
+		error("Missing argument\n");
+		return NULL;
+	}
+	*index_p += 1;
+	return argv[i];
+}
+
+bool
+predictor_update_all(struct predictor *pred, int argc, char **argv)
+{
+	int i = 0, pcr_index = -1;
+
+	if (!strcmp(pred->initial_source, "eventlog")) {
+		if (!predictor_update_eventlog(pred))
+			return false;
+	}
+
+	/* If the mask contains exactly one PCR, default pcr_index to that */
+	if (!(pred->pcr_mask & (pred->pcr_mask - 1))) {
+		unsigned int mask = pred->pcr_mask;
+
+		/* integer log2 */
+		for (pcr_index = 0; !(mask & 1); pcr_index++)
+			mask >>= 1;
+	}
+
+	while (i < argc) {
+		const char *type, *arg;
+
+		if (!(type = get_next_arg(&i, argc, argv)))
+			return false;
+		if (isdigit(*type)) {
+			if (!parse_pcr_index(type, (unsigned int *) &pcr_index)) {
+				error("unable to parse PCR index \"%s\"\n", type);
+				return false;
+			}
+			if (!(type = get_next_arg(&i, argc, argv)))
+				return false;
+		}
+
+		if (!strcmp(type, "eventlog")) {
+			/* do the event log dance */
+			continue;
+		}
+
+		if (!(arg = get_next_arg(&i, argc, argv)))
+			return false;
+		if (pcr_index < 0) {
+			error("Unable to infer which PCR to update for %s %s\n", type, arg);
+			return false;
+		}
+
+		if (!strcmp(type, "string")) {
+			predictor_update_string(pred, pcr_index, arg);
+		} else
+		if (!strcmp(type, "file")) {
+			predictor_update_file(pred, pcr_index, arg);
+		} else {
+			error("Unsupported keyword \"%s\" while trying to update predictor\n", type);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Package hooks tend to run pcr-oracle after every transaction, even if
+ * nothing in the boot chain has changed. So we cache the final prediction,
+ * keyed by the event log and the command line, together with the list of
+ * files, EFI variables etc. it was derived from. A cached prediction is
+ * used only if none of these have changed.
+ *
+ * Since the key changes with every boot, old entries are never hit again.
+ * Like the rehash cache, this one is kept within PREDICTION_CACHE_MAX_TOTAL
+ * by evicting the least recently used entries.
+ */
+#define PREDICTION_CACHE_MAGIC		0x50524332
+#define PREDICTION_CACHE_MAX_SIZE	(1024 * 1024)
+#define PREDICTION_CACHE_MAX_TOTAL	(1024 * 1024)
+#define SIGNED_POLICY_CACHE_MAX_TOTAL	(16 * 1024)
+
+char *
+predictor_cache_key(struct predictor *pred, int argc, char **argv)
+{
+	digest_ctx_t *ctx;
+	tpm_event_t *ev;
+	unsigned int i;
+
+	if (!cache_is_enabled() || strcmp(pred->initial_source, "eventlog"))
+		return NULL;
+
+	ctx = digest_ctx_new(digest_by_name("sha256"));
+	__cache_key_add_string(ctx, "pcr-oracle prediction v1");
+
+	__cache_key_add_u32(ctx, pred->pcr_mask);
+	__cache_key_add_u32(ctx, pred->num_banks);
+	for (i = 0; i < pred->num_banks; ++i)
+		__cache_key_add_u32(ctx, pred->prediction[i].algo_info->tcg_id);
+
+	__cache_key_add_u32(ctx, pred->stop_event.type);
+	__cache_key_add_u32(ctx, pred->stop_event.after);
+	__cache_key_add_string(ctx, pred->stop_event.value);
+	__cache_key_add_string(ctx, pred->boot_entry_id);
+	__cache_key_add_u32(ctx, opt_use_pesign);
+
+	__cache_key_add_u32(ctx, argc);
+	for (i = 0; i < argc; ++i)
+		__cache_key_add_string(ctx, argv[i]);
+
+	for (ev = pred->event_log; ev; ev = ev->next) {
+		__cache_key_add_u32(ctx, ev->pcr_index);
+		__cache_key_add_u32(ctx, ev->event_type);
+		__cache_key_add_u32(ctx, ev->pcr_count);
+		for (i = 0; i < ev->pcr_count; ++i)
+			__cache_key_add_digest(ctx, &ev->pcr_values[i]);
+		__cache_key_add_data(ctx, ev->event_data, ev->event_size);
+	}
+
+	return __cache_key_final(ctx);
+}
+
+bool
+predictor_cache_load(struct predictor *pred, const char *key, dependency_list_t **deps_ret)
+{
+	tpm_pcr_bank_t banks[PREDICTOR_MAX_BANKS];
+	dependency_list_t *deps = NULL;
+	uint32_t magic, num_banks;
+	unsigned int i, pcr_index;
+	bool ok = false;
+	buffer_t *bp;
+
+	if (!(bp = cache_read("prediction", key)))
+		return false;
+
+	if (!buffer_get_u32le(bp, &magic) || magic != PREDICTION_CACHE_MAGIC
+	 || !(deps = dependency_list_decode(bp))) {
+		debug("Ignoring bad prediction cache entry %s\n", key);
+		goto out;
+	}
+
+	if (!dependency_list_is_current(deps)) {
+		debug("Cached prediction is out of date\n");
+		goto out;
+	}
+
+	if (!buffer_get_u32le(bp, &num_banks) || num_banks != pred->num_banks)
+		goto out;
+
+	memcpy(banks, pred->prediction, sizeof(banks));
+	for (i = 0; i < num_banks; ++i) {
+		tpm_pcr_bank_t *bank = &banks[i];
+		uint32_t algo_id, valid_mask;
+
+		if (!buffer_get_u32le(bp, &algo_id) || algo_id != bank->algo_info->tcg_id
+		 || !buffer_get_u32le(bp, &valid_mask))
+			goto out;
+
+		for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
+			unsigned char data[sizeof(bank->pcr[0].data)];
+			uint16_t size;
+
+			if (!(valid_mask & (1 << pcr_index)))
+				continue;
+
+			if (!buffer_get_u16le(bp, &size)
+			 || size != bank->algo_info->digest_size
+			 || !buffer_get(bp, data, size))
+				goto out;
+
+			digest_set(&bank->pcr[pcr_index], bank->algo_info, size, data);
+		}
+		bank->valid_mask = valid_mask;
+	}
+
+	memcpy(pred->prediction, banks, sizeof(banks));
+	debug("Using cached prediction %s\n", key);
+	cache_touch("prediction", key);
+	ok = true;
+
+	if (deps_ret) {
+		*deps_ret = deps;
+		deps = NULL;
+	}
+
+out:
+	if (deps)
+		dependency_list_free(deps);
+	buffer_free(bp);
+	return ok;
+}
+
+void
+predictor_cache_save(struct predictor *pred, const char *key, const dependency_list_t *deps)
+{
+	unsigned int i, pcr_index;
+	buffer_t *bp;
+	bool ok;
+
+	bp = buffer_alloc_write(PREDICTION_CACHE_MAX_SIZE);
+
+	ok = buffer_put_u32le(bp, PREDICTION_CACHE_MAGIC)
+	  && dependency_list_encode(bp, deps)
+	  && buffer_put_u32le(bp, pred->num_banks);
+
+	for (i = 0; ok && i < pred->num_banks; ++i) {
+		const tpm_pcr_bank_t *bank = &pred->prediction[i];
+
+		ok = buffer_put_u32le(bp, bank->algo_info->tcg_id)
+		  && buffer_put_u32le(bp, bank->valid_mask);
+
+		for (pcr_index = 0; ok && pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
+			const tpm_evdigest_t *md = &bank->pcr[pcr_index];
+
+			if (!pcr_bank_register_is_valid(bank, pcr_index))
+				continue;
+
+			ok = buffer_put_u16le(bp, md->size)
+			  && buffer_put(bp, md->data, md->size);
+		}
+	}
+
+	if (ok) {
+		debug("Caching prediction %s (%u dependencies)\n", key, dependency_list_count(deps));
+		if (cache_write("prediction", key, bp))
+			cache_trim("prediction", PREDICTION_CACHE_MAX_TOTAL);
+	} else {
+		debug("Unable to encode prediction for caching\n");
+	}
+
+	buffer_free(bp);
+}
+
+/*
+ * When signing a policy, remember the identity of the output file. If we're
+ * asked to sign the same prediction with the same key again, and the output
+ * file hasn't been touched in between, there's nothing to do.
+ */
+char *
+predictor_signed_policy_key(struct predictor *pred, const char *target_name,
+		const stored_key_t *private_key, const char *input_path,
+		const char *output_path, const char *policy_name)
+{
+	digest_ctx_t *ctx;
+	unsigned int i, pcr_index;
+
+	if (!cache_is_enabled() || output_path == NULL)
+		return NULL;
+
+	ctx = digest_ctx_new(digest_by_name("sha256"));
+	__cache_key_add_string(ctx, "pcr-oracle signed policy v1");
+
+	for (i = 0; i < pred->num_banks; ++i) {
+		const tpm_pcr_bank_t *bank = &pred->prediction[i];
+
+		__cache_key_add_u32(ctx, bank->valid_mask);
+		for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
+			if (pcr_bank_register_is_valid(bank, pcr_index))
+				__cache_key_add_digest(ctx, &bank->pcr[pcr_index]);
+		}
+	}
+
+	__cache_key_add_string(ctx, target_name);
+	__cache_key_add_file(ctx, private_key->path);
+
+	/* Some targets update the input file in place */
+	if (input_path && strcmp(input_path, output_path))
+		__cache_key_add_file(ctx, input_path);
+	else
+		__cache_key_add_string(ctx, input_path);
+
+	__cache_key_add_string(ctx, output_path);
+	__cache_key_add_string(ctx, policy_name);
+
+	return __cache_key_final(ctx);
+}
+
+bool
+predictor_signed_policy_is_current(const char *key, const char *output_path)
+{
+	cache_file_id_t cached_id, id;
+	struct stat stb;
+	buffer_t *bp;
+	bool ok;
+
+	if (stat(output_path, &stb) < 0)
+		return false;
+	cache_file_id_from_stat(&id, &stb);
+
+	if (!(bp = cache_read("signed-policy", key)))
+		return false;
+
+	ok = cache_file_id_get(bp, &cached_id) && cache_file_id_equal(&id, &cached_id);
+	if (ok)
+		cache_touch("signed-policy", key);
+	buffer_free(bp);
+	return ok;
+}
+
+void
+predictor_signed_policy_update(const char *key, const char *output_path)
+{
+	cache_file_id_t id;
+	struct stat stb;
+	buffer_t *bp;
+
+	if (stat(output_path, &stb) < 0)
+		return;
+	cache_file_id_from_stat(&id, &stb);
+
+	bp = buffer_alloc_write(sizeof(id));
+	if (cache_file_id_put(bp, &id)
+	 && cache_write("signed-policy", key, bp))
+		cache_trim("signed-policy", SIGNED_POLICY_CACHE_MAX_TOTAL);
+	buffer_free(bp);
+}
+
+static unsigned int
+predictor_verify_bank(struct predictor *pred, const tpm_pcr_bank_t *bank, const char *source)
+{
+	tpm_pcr_bank_t actual;
+	unsigned int pcr_index;
+	unsigned int num_mismatches = 0;
+
+	pcr_bank_load_initial_values(&actual, pred->pcr_mask, bank->algo_info, source);
+
+	/* Now compare the digests */
+	for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
+		tpm_evdigest_t *md_predicted, *md_actual;
+
+		md_predicted = predictor_get_pcr_state(pred, bank, pcr_index);
+		if (md_predicted == NULL)
+			continue;
+
+		if (!pcr_bank_register_is_valid(&actual, pcr_index)) {
+			md_actual = NULL;
+		} else {
+			md_actual = pcr_bank_get_register(&actual, pcr_index, NULL);
+		}
+
+		if (md_actual == NULL) {
+			/* quietly skip any PCRs we never extended.
+			 * This happens when the PCR mask was "all" */
+			if (digest_is_zero(md_predicted))
+				continue;
+
+			debug("PCR %u not present in %s\n", pcr_index, source);
+			printf("%s:%u %s MISSING\n", bank->algo_name, pcr_index, digest_print_value(md_predicted));
+			num_mismatches += 1;
+			continue;
+		}
+
+		if (digest_equal(md_predicted, md_actual)) {
+			printf("%s:%u %s OK\n", bank->algo_name, pcr_index, digest_print_value(md_predicted));
+		} else {
+			printf("%s:%u %s MISMATCH", bank->algo_name, pcr_index, digest_print_value(md_predicted));
+			printf("; actual=%s\n", digest_print_value(md_actual));
+			num_mismatches += 1;
+		}
+	}
+
+	return num_mismatches;
+}
+
+unsigned int
+predictor_verify(struct predictor *pred, const char *source)
+{
+	unsigned int i, num_mismatches = 0;
+
+	printf("Verifying predicted state versus \"%s\"\n", source);
+	for (i = 0; i < pred->num_banks; ++i)
+		num_mismatches += predictor_verify_bank(pred, &pred->prediction[i], source);
+
+	if (num_mismatches)
+		error("Found %u mismatches\n", num_mismatches);
+	return num_mismatches;
+}
+
+void
+predictor_report(struct predictor *pred)
+{
+	unsigned int i, pcr_index;
+
+	for (i = 0; i < pred->num_banks; ++i) {
+		const tpm_pcr_bank_t *bank = &pred->prediction[i];
+
+		/* Like tpm2_pcrread, label each bank when there's more than one */
+		if (pred->num_banks > 1 && pred->report_fn == predictor_report_tpm2_tools)
+			printf("%s:\n", bank->algo_name);
+
+		for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
+			if (pcr_bank_register_is_valid(bank, pcr_index))
+				pred->report_fn(pred, bank, pcr_index);
+		}
+	}
+}
+
+static void
+predictor_report_plain(struct predictor *pred, const tpm_pcr_bank_t *bank, unsigned int pcr_index)
+{
+	unsigned int i;
+	tpm_evdigest_t *pcr;
+
+	if (!(pcr = predictor_get_pcr_state(pred, bank, pcr_index)))
+		return;
+
+	printf("%s:%u ", bank->algo_name, pcr_index);
+	for (i = 0; i < pcr->size; i++)
+		printf("%02x", pcr->data[i]);
+	printf("\n");
+}
+
+static void
+predictor_report_tpm2_tools(struct predictor *pred, const tpm_pcr_bank_t *bank, unsigned int pcr_index)
+{
+	unsigned int i;
+	tpm_evdigest_t *pcr;
+
+	if (!(pcr = predictor_get_pcr_state(pred, bank, pcr_index)))
+		return;
+
+	printf("  %-2d: 0x", pcr_index);
+	for (i = 0; i < pcr->size; i++)
+		printf("%02X", pcr->data[i]);
+	printf("\n");
+}
+
+/*
+ * With several banks, the values of all banks are written back to back,
+ * in the order in which the algorithms were given.
+ */
+static void
+predictor_report_binary(struct predictor *pred, const tpm_pcr_bank_t *bank, unsigned int pcr_index)
+{
+	tpm_evdigest_t *pcr;
+
+	if (!(pcr = predictor_get_pcr_state(pred, bank, pcr_index)))
+		return;
+	if (fwrite(pcr->data, pcr->size, 1, stdout) != 1)
+		fatal("failed to write hash to stdout");
+}
@@ -0,0 +1,62 @@
+/*
+ *   Copyright (C) 2022, 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include "types.h"
+#include "runtime.h"
+#include "pcr.h"
+
+#define PREDICTOR_MAX_BANKS	RUNTIME_MAX_DIGEST_ALGOS
+
+struct predictor;
+
+extern unsigned int	opt_use_pesign;
+
+extern struct predictor *predictor_new(const tpm_pcr_selection_t *pcr_selection,
+				unsigned int num_algos, const tpm_algo_info_t * const *algos,
+				const char *source,
+				const char *tpm_eventlog_path,
+				const char *output_format,
+				const char *boot_entry_id);
+extern void		predictor_free(struct predictor *);
+extern void		predictor_set_jobs(struct predictor *, unsigned int jobs);
+extern void		predictor_set_stop_event(struct predictor *, const char *event_desc, bool after);
+extern const tpm_pcr_bank_t *predictor_get_bank(const struct predictor *, unsigned int index);
+extern bool		predictor_update_all(struct predictor *, int argc, char **argv);
+extern unsigned int	predictor_verify(struct predictor *, const char *source);
+extern void		predictor_report(struct predictor *);
+
+extern bool		predictor_read_system_eventlog(void);
+extern void		predictor_discard_system_eventlog(void);
+extern void		predictor_set_share_event_log(bool);
+
+extern char *		predictor_cache_key(struct predictor *, int argc, char **argv);
+extern bool		predictor_cache_load(struct predictor *, const char *key, dependency_list_t **deps_ret);
+extern void		predictor_cache_save(struct predictor *, const char *key, const dependency_list_t *deps);
+
+extern char *		predictor_signed_policy_key(struct predictor *, const char *target_name,
+				const stored_key_t *private_key, const char *input_path,
+				const char *output_path, const char *policy_name);
+extern bool		predictor_signed_policy_is_current(const char *key, const char *output_path);
+extern void		predictor_signed_policy_update(const char *key, const char *output_path);
+
+#endif /* PREDICTOR_H */
@@ -54,6 +54,14 @@ tpm_rsa_key_alloc(const char *path, EVP_PKEY *pkey, bool priv)
 }
 
 
+tpm_rsa_key_t *
+tpm_rsa_key_dup(const tpm_rsa_key_t *key)
+{
+	if (!EVP_PKEY_up_ref(key->pkey))
+		return NULL;
+	return tpm_rsa_key_alloc(key->path, key->pkey, key->is_private);
+}
+
 void
 tpm_rsa_key_free(tpm_rsa_key_t *key)
 {
@@ -31,6 +31,7 @@ extern bool		tpm_rsa_key_write_public(const char *pathname,
 				const tpm_rsa_key_t *key);
 extern bool		tpm_rsa_key_write_private(const char *pathname,
 				const tpm_rsa_key_t *key);
+extern tpm_rsa_key_t *	tpm_rsa_key_dup(const tpm_rsa_key_t *key);
 extern void		tpm_rsa_key_free(tpm_rsa_key_t *key);
 extern tpm_rsa_key_t *	tpm_rsa_generate(unsigned int bits);
 extern int		tpm_rsa_sign(const tpm_rsa_key_t *,
@@ -20,6 +20,7 @@
 
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
@@ -31,20 +32,45 @@
 #include "bufparser.h"
 #include "digest.h"
 #include "testcase.h"
+#include "cache.h"
+#include "depend.h"
+#include "fat.h"
 #include "util.h"
 
 struct file_locator {
 	char *		partition;
 	char *		relative_path;
 
+	char *		full_path;
+};
+
+/*
+ * EFI partitions we have access to. If the partition is mounted
+ * already, we use that mount. Otherwise, we read it directly from the
+ * block device if it holds a FAT file system, and as a last resort we
+ * mount it privately and keep it mounted until we exit.
+ */
+struct runtime_partition {
+	struct runtime_partition *next;
+	char *		device;
+	fat_volume_t *	fat;
 	char *		mount_point;
-	bool		is_mounted;
+	pid_t		mounted_by;	/* process that made the private mount, if any */
+};
 
-	char *		full_path;
+/*
+ * Remember the results of looking up block devices, which are
+ * repeated for every EFI application in the event log.
+ */
+struct runtime_name_cache {
+	struct runtime_name_cache *next;
+	char *		key;
+	char *		value;
 };
 
 struct block_dev_io {
 	int		fd;
+	char *		device;
 	unsigned int	sector_size;
 
 	testcase_block_dev_t *recording;
@@ -53,6 +79,51 @@ struct block_dev_io {
 static testcase_t *	testcase_recording;
 static testcase_t *	testcase_playback;
 
+/*
+ * When predicting several PCR banks at once, the same file gets hashed
+ * once per bank. In order to read each file only once, we compute the
+ * digests for all algorithms in one go, and remember them.
+ */
+struct runtime_file_digests {
+	struct runtime_file_digests *next;
+	char *		path;
+	unsigned int	count;
+	tpm_evdigest_t	md[RUNTIME_MAX_DIGEST_ALGOS];
+};
+
+/*
+ * EFI variables such as db, MokListRT or SbatLevel are consulted several
+ * times while processing a single event log. Reading efivarfs goes through
+ * the firmware on some platforms, so we read each variable only once per
+ * run, and remember variables that do not exist as well.
+ */
+struct runtime_efi_variable {
+	struct runtime_efi_variable *next;
+	char *		name;
+	buffer_t *	data;		/* NULL if the variable does not exist */
+};
+
+/*
+ * EFI applications mapped and not yet released. Normally, this list is
+ * empty between predictions; after a fatal error, it's what we need to
+ * unmap.
+ */
+struct runtime_mapping {
+	struct runtime_mapping *next;
+	buffer_t *	data;
+};
+
+static const tpm_algo_info_t *	runtime_digest_algos[RUNTIME_MAX_DIGEST_ALGOS];
+static unsigned int		runtime_num_digest_algos;
+static struct runtime_file_digests *runtime_file_digests;
+static struct runtime_efi_variable *runtime_efi_variables;
+static struct runtime_mapping *	runtime_mappings;
+
+static struct runtime_partition *runtime_partitions;
+static bool			runtime_partition_atexit;
+static struct runtime_name_cache *runtime_partuuid_cache;
+static struct runtime_name_cache *runtime_disk_cache;
+
 /*
  * Testcase handling
  */
@@ -61,6 +132,9 @@ runtime_record_testcase(testcase_t *tc)
 {
 	debug("Starting testcase recording\n");
 	testcase_recording = tc;
+
+	/* We need to capture all the files we look at */
+	cache_set_enabled(false);
 }
 
 void
@@ -68,65 +142,308 @@ runtime_replay_testcase(testcase_t *tc)
 {
 	debug("Starting testcase playback\n");
 	testcase_playback = tc;
+
+	/* The persistent cache describes the host, not the testcase */
+	cache_set_enabled(false);
 }
 
-file_locator_t *
-runtime_locate_file(const char *device_path, const char *file_path)
+void
+runtime_set_digest_algorithms(unsigned int count, const tpm_algo_info_t * const *algos)
+{
+	unsigned int i;
+
+	if (count > RUNTIME_MAX_DIGEST_ALGOS)
+		fatal("%s: too many digest algorithms\n", __func__);
+
+	for (i = 0; i < count; ++i)
+		runtime_digest_algos[i] = algos[i];
+	runtime_num_digest_algos = count;
+}
+
+/*
+ * Returns the set of digest algorithms configured above, or NULL if there's
+ * none.
+ */
+const tpm_algo_info_t * const *
+runtime_get_digest_algorithms(unsigned int *count)
+{
+	if (runtime_num_digest_algos == 0)
+		return NULL;
+
+	*count = runtime_num_digest_algos;
+	return runtime_digest_algos;
+}
+
+static const tpm_evdigest_t *
+runtime_digest_file(const tpm_algo_info_t *algo, const char *path)
+{
+	struct runtime_file_digests *fdig;
+	buffer_t *buffer;
+	unsigned int i;
+
+	dependency_add_file(path);
+
+	if (runtime_num_digest_algos <= 1)
+		return digest_from_file(algo, path, 0);
+
+	for (fdig = runtime_file_digests; fdig; fdig = fdig->next) {
+		if (!strcmp(fdig->path, path))
+			goto found;
+	}
+
+	buffer = runtime_read_file(path, 0);
+
+	fdig = calloc(1, sizeof(*fdig));
+	fdig->path = strdup(path);
+	if (digest_multi_compute(runtime_num_digest_algos, runtime_digest_algos,
+				buffer_read_pointer(buffer), buffer_available(buffer),
+				fdig->md))
+		fdig->count = runtime_num_digest_algos;
+	buffer_free(buffer);
+
+	fdig->next = runtime_file_digests;
+	runtime_file_digests = fdig;
+
+found:
+	for (i = 0; i < fdig->count; ++i) {
+		if (fdig->md[i].algo == algo)
+			return &fdig->md[i];
+	}
+
+	/* Not one of the algorithms we were told about */
+	return digest_from_file(algo, path, 0);
+}
+
+/*
+ * /proc/self/mountinfo escapes blanks and a few other characters as \ooo
+ */
+static void
+__mountinfo_unescape(char *s)
+{
+	char *d = s;
+
+	while (*s) {
+		if (s[0] == '\\'
+		 && s[1] >= '0' && s[1] <= '3'
+		 && s[2] >= '0' && s[2] <= '7'
+		 && s[3] >= '0' && s[3] <= '7') {
+			*d++ = ((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0');
+			s += 4;
+		} else {
+			*d++ = *s++;
+		}
+	}
+	*d = '\0';
+}
+
+/*
+ * Check whether the partition is mounted already. We only consider
+ * mounts of the file system root, not bind mounts of subdirectories.
+ */
+static char *
+runtime_find_existing_mount(const char *device_path)
+{
+	char linebuf[4096];
+	struct stat stb;
+	char *result = NULL;
+	FILE *fp;
+
+	if (stat(device_path, &stb) < 0 || !S_ISBLK(stb.st_mode))
+		return NULL;
+
+	if (!(fp = fopen("/proc/self/mountinfo", "r")))
+		return NULL;
+
+	while (fgets(linebuf, sizeof(linebuf), fp)) {
+		unsigned int major, minor;
+		char root[PATH_MAX], mount_point[PATH_MAX];
+
+		/* 36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue */
+		if (sscanf(linebuf, "%*u %*u %u:%u %4095s %4095s", &major, &minor, root, mount_point) != 4)
+			continue;
+
+		if (makedev(major, minor) != stb.st_rdev || strcmp(root, "/"))
+			continue;
+
+		__mountinfo_unescape(mount_point);
+		result = strdup(mount_point);
+		break;
+	}
+
+	fclose(fp);
+	return result;
+}
+
+static struct runtime_partition *
+runtime_get_partition(const char *device_path)
+{
+	struct runtime_partition *part;
+
+	for (part = runtime_partitions; part; part = part->next) {
+		if (!strcmp(part->device, device_path))
+			return part;
+	}
+
+	part = calloc(1, sizeof(*part));
+	part->device = strdup(device_path);
+
+	/* Do not bypass an existing mount; the page cache may hold data
+	 * that has not been written to disk yet. */
+	if ((part->mount_point = runtime_find_existing_mount(device_path)) != NULL)
+		debug("Using existing mount of %s on %s\n", device_path, part->mount_point);
+	else if (!testcase_playback)
+		part->fat = fat_volume_open(device_path);
+
+	/* Make sure we clean up when exiting */
+	if (!runtime_partition_atexit) {
+		runtime_partition_atexit = true;
+		atexit(runtime_close_partitions);
+	}
+
+	part->next = runtime_partitions;
+	runtime_partitions = part;
+	return part;
+}
+
+static const char *
+runtime_partition_mount_point(struct runtime_partition *part)
 {
 	char template[] = "/tmp/efimnt.XXXXXX";
-	char fullpath[PATH_MAX];
-	file_locator_t *loc;
 	char *dirname;
 
-	loc = calloc(1, sizeof(*loc));
-	assign_string(&loc->partition, device_path);
-	assign_string(&loc->relative_path, file_path);
+	if (part->mount_point)
+		return part->mount_point;
 
 	if (!(dirname = mkdtemp(template))) {
 		error("Cannot create temporary mount point for EFI partition");
 		return NULL;
 	}
 
-	if (mount(device_path, dirname, "vfat", 0, NULL) < 0) {
+	if (mount(part->device, dirname, "vfat", MS_RDONLY, NULL) < 0) {
 		(void) rmdir(dirname);
-		error("Unable to mount %s on %s\n", device_path, dirname);
+		error("Unable to mount %s on %s\n", part->device, dirname);
 		return NULL;
 	}
 
-	assign_string(&loc->mount_point, dirname);
-	loc->is_mounted = true;
+	debug("Mounted %s on %s\n", part->device, dirname);
+	part->mount_point = strdup(dirname);
+	part->mounted_by = getpid();
+	return part->mount_point;
+}
 
-	snprintf(fullpath, sizeof(fullpath), "%s/%s", dirname, file_path);
-	assign_string(&loc->full_path, fullpath);
+/*
+ * Worker processes we fork may be the first to mount a partition. Each
+ * process only unmounts what it mounted itself, so workers must call this
+ * before they _exit(), and must not tear down their parent's mounts.
+ */
+void
+runtime_close_partitions(void)
+{
+	struct runtime_partition *part;
+
+	while ((part = runtime_partitions) != NULL) {
+		runtime_partitions = part->next;
+
+		if (part->fat)
+			fat_volume_close(part->fat);
+
+		if (part->mounted_by == getpid()) {
+			/* If someone still has a file mapped, detach it. It goes
+			 * away when the last reference is dropped. */
+			if (umount(part->mount_point) < 0
+			 && (errno != EBUSY || umount2(part->mount_point, MNT_DETACH) < 0))
+				error("unable to unmount temporary directory %s: %m\n", part->mount_point);
+			else if (rmdir(part->mount_point) < 0)
+				error("unable to remove temporary directory %s: %m\n", part->mount_point);
+		}
+
+		free(part->device);
+		free(part->mount_point);
+		free(part);
+	}
+}
 
-	return loc;
+static void
+runtime_name_cache_free(struct runtime_name_cache **list)
+{
+	struct runtime_name_cache *entry;
+
+	while ((entry = *list) != NULL) {
+		*list = entry->next;
+		free(entry->key);
+		free(entry->value);
+		free(entry);
+	}
 }
 
+/*
+ * Drop all per-run state, after a fatal error. Entries are added to these
+ * lists only once they are complete, so we can safely free them. This
+ * also unmaps any EFI applications that were still being inspected, and
+ * closes the partitions along with their file descriptors.
+ */
 void
-file_locator_unmount(file_locator_t *loc)
+runtime_discard_caches(void)
 {
-	if (!loc->is_mounted)
-		return;
+	struct runtime_file_digests *fdig;
+	struct runtime_efi_variable *var;
+	struct runtime_mapping *map;
+
+	while ((map = runtime_mappings) != NULL) {
+		runtime_mappings = map->next;
+		buffer_unmap(map->data);
+		free(map);
+	}
 
-	if (umount(loc->mount_point) < 0)
-		fatal("unable to unmount temporary directory %s: %m\n", loc->mount_point);
+	runtime_close_partitions();
 
-	if (rmdir(loc->mount_point) < 0)
-		fatal("unable to remove temporary directory %s: %m\n", loc->mount_point);
+	while ((fdig = runtime_file_digests) != NULL) {
+		runtime_file_digests = fdig->next;
+		free(fdig->path);
+		free(fdig);
+	}
 
-	drop_string(&loc->mount_point);
-	drop_string(&loc->full_path);
-	loc->is_mounted = false;
+	while ((var = runtime_efi_variables) != NULL) {
+		runtime_efi_variables = var->next;
+		if (var->data)
+			buffer_free(var->data);
+		free(var->name);
+		free(var);
+	}
+
+	runtime_name_cache_free(&runtime_partuuid_cache);
+	runtime_name_cache_free(&runtime_disk_cache);
+}
+
+file_locator_t *
+runtime_locate_file(const char *device_path, const char *file_path)
+{
+	char fullpath[PATH_MAX];
+	const char *mount_point;
+	file_locator_t *loc;
+
+	if (!(mount_point = runtime_partition_mount_point(runtime_get_partition(device_path))))
+		return NULL;
+
+	loc = calloc(1, sizeof(*loc));
+	assign_string(&loc->partition, device_path);
+	assign_string(&loc->relative_path, file_path);
+
+	snprintf(fullpath, sizeof(fullpath), "%s/%s", mount_point, file_path);
+	assign_string(&loc->full_path, fullpath);
+
+	dependency_add_file(fullpath);
+
+	return loc;
 }
 
 void
 file_locator_free(file_locator_t *loc)
 {
-	file_locator_unmount(loc);
-
 	drop_string(&loc->partition);
 	drop_string(&loc->relative_path);
 	drop_string(&loc->full_path);
+	free(loc);
 }
 
 const char *
@@ -145,7 +462,7 @@ __system_read_efi_variable(const char *var_name)
 		return testcase_playback_efi_variable(testcase_playback, var_name);
 
 	/* First, try new efivars interface */
-	snprintf(filename, sizeof(filename), "/sys/firmware/efi/efivars/%s", var_name);
+	snprintf(filename, sizeof(filename), RUNTIME_EFIVARS_DIR "/%s", var_name);
 	result = buffer_read_file(filename, RUNTIME_SHORT_READ_OKAY | RUNTIME_MISSING_FILE_OKAY);
 	if (result != NULL) {
 		/* Skip over 4 bytes of variable attributes */
@@ -208,6 +525,7 @@ runtime_open_ima_measurements(void)
 buffer_t *
 runtime_read_file(const char *path, int flags)
 {
+	dependency_add_file(path);
 	return buffer_read_file(path, flags);
 }
 
@@ -217,10 +535,63 @@ runtime_write_file(const char *path, buffer_t *bp)
 	return buffer_write_file(path, bp);
 }
 
+static struct runtime_efi_variable *
+runtime_get_efi_variable(const char *var_name)
+{
+	struct runtime_efi_variable *var;
+
+	for (var = runtime_efi_variables; var; var = var->next) {
+		if (!strcmp(var->name, var_name))
+			return var;
+	}
+
+	var = calloc(1, sizeof(*var));
+	var->name = strdup(var_name);
+	var->data = __system_read_efi_variable(var_name);
+
+	var->next = runtime_efi_variables;
+	runtime_efi_variables = var;
+	return var;
+}
+
+/*
+ * Callers own the buffer they get back, and are free to consume it,
+ * so hand out a copy of the cached variable.
+ */
 buffer_t *
 runtime_read_efi_variable(const char *var_name)
 {
-	return __system_read_efi_variable(var_name);
+	struct runtime_efi_variable *var;
+	buffer_t *data, *result;
+	unsigned int len;
+
+	var = runtime_get_efi_variable(var_name);
+	dependency_add_efi_variable(var_name, var->data);
+
+	if ((data = var->data) == NULL)
+		return NULL;
+
+	len = buffer_available(data);
+	result = buffer_alloc_write(len);
+	buffer_put(result, buffer_read_pointer(data), len);
+	return result;
+}
+
+/*
+ * Read all the given variables in one go, so that they are shared by
+ * all the workers we fork later on.
+ */
+void
+runtime_preload_efi_variables(unsigned int count, const char **names)
+{
+	unsigned int i, found = 0;
+
+	for (i = 0; i < count; ++i) {
+		if (runtime_get_efi_variable(names[i])->data != NULL)
+			found++;
+	}
+
+	debug("Preloaded %u of %u EFI variables\n", found, count);
 }
 
 const tpm_evdigest_t *
@@ -236,7 +607,7 @@ runtime_digest_efi_file(const tpm_algo_info_t *algo, const char *path)
 	 * The caller should know from the previous EFI BSA event for eg grub.efi
 	 * which partition is the ESP that was used. */
 	snprintf(esp_path, sizeof(esp_path), "/efi%s", path);
-	md = digest_from_file(algo, esp_path, 0);
+	md = runtime_digest_file(algo, esp_path);
 	if (md && testcase_recording)
 		testcase_record_efi_digest(testcase_recording, path, md);
 
@@ -251,41 +622,195 @@ runtime_digest_rootfs_file(const tpm_algo_info_t *algo, const char *path)
 	if (testcase_playback)
 		return testcase_playback_rootfs_digest(testcase_playback, path, algo);
 
-	md = digest_from_file(algo, path, 0);
+	md = runtime_digest_file(algo, path);
 	if (md && testcase_recording)
 		testcase_record_rootfs_digest(testcase_recording, path, md);
 
 	return md;
 }
 
+/*
+ * Identify an EFI application for the purpose of caching.
+ */
+static bool
+__runtime_identify_efi_application(const char *partition, const char *application, cache_file_id_t *id)
+{
+	struct runtime_partition *part;
+	const tpm_evdigest_t *md;
+	fat_file_info_t info;
+	file_locator_t *loc;
+	const char *fullpath;
+	struct stat stb;
+	buffer_t *bp;
+	bool ok = false;
+
+	/* When reading the file system ourselves, use the first cluster
+	 * in lieu of an inode number, and the DOS time stamps. These have
+	 * a resolution of 2 seconds, and a same size rewrite may well reuse
+	 * the clusters; so also fold a digest of the first and last cluster
+	 * into the (otherwise unused) nanosecond fields. */
+	part = runtime_get_partition(partition);
+	if (part->fat && fat_volume_lookup(part->fat, application, &info)) {
+		if (stat(partition, &stb) < 0)
+			return false;
+
+		if (!(bp = fat_volume_read_file_ends(part->fat, &info)))
+			return false;
+		md = digest_buffer(digest_by_name("sha256"), bp);
+		buffer_free(bp);
+		if (md == NULL)
+			return false;
+
+		memset(id, 0, sizeof(*id));
+		id->dev = stb.st_rdev;
+		id->ino = info.first_cluster;
+		id->size = info.size;
+		id->mtime_sec = info.mtime;
+		id->ctime_sec = info.ctime;
+		memcpy(&id->mtime_nsec, md->data, sizeof(id->mtime_nsec));
+		memcpy(&id->ctime_nsec, md->data + sizeof(id->mtime_nsec), sizeof(id->ctime_nsec));
+		return true;
+	}
+
+	loc = runtime_locate_file(partition, application);
+	if (!loc)
+		return false;
+
+	if ((fullpath = file_locator_get_full_path(loc)) != NULL) {
+		if (stat(fullpath, &stb) < 0) {
+			debug("Cannot stat %s: %m\n", fullpath);
+		} else {
+			cache_file_id_from_stat(id, &stb);
+			ok = true;
+		}
+	}
+
+	file_locator_free(loc);
+	return ok;
+}
+
+static void
+runtime_add_efi_application_dependency(const char *partition, const char *application)
+{
+	cache_file_id_t id;
+
+	if (!dependency_is_recording())
+		return;
+
+	if (__runtime_identify_efi_application(partition, application, &id))
+		dependency_add_efi_application(partition, application, &id);
+	else
+		dependency_add_efi_application(partition, application, NULL);
+}
+
+bool
+runtime_identify_efi_application(const char *partition, const char *application, cache_file_id_t *id)
+{
+	if (!cache_is_enabled())
+		return false;
+
+	if (!__runtime_identify_efi_application(partition, application, id)) {
+		dependency_add_efi_application(partition, application, NULL);
+		return false;
+	}
+
+	dependency_add_efi_application(partition, application, id);
+	return true;
+}
+
+/*
+ * EFI applications can be large, and we only need them until we've
+ * computed their digests. Rather than copying them to the heap, map them.
+ * The buffer returned must be released using runtime_release_efi_application().
+ */
 buffer_t *
-runtime_read_efi_application(const char *partition, const char *application)
+runtime_map_efi_application(const char *partition, const char *application)
 {
-        file_locator_t *loc;
+	struct runtime_partition *part;
+	fat_file_info_t info;
+	file_locator_t *loc;
 	const char *fullpath;
-	buffer_t *result;
+	buffer_t *result = NULL;
 
 	if (testcase_playback)
 		return testcase_playback_efi_application(testcase_playback, partition, application);
 
 	debug("%s(%s, %s)\n", __func__, partition, application);
-        loc = runtime_locate_file(partition, application);
-        if (!loc)
-                return NULL;
+	runtime_add_efi_application_dependency(partition, application);
 
-	if ((fullpath = file_locator_get_full_path(loc)) != NULL)
-                result = runtime_read_file(fullpath, 0);
+	part = runtime_get_partition(partition);
+	if (part->fat && fat_volume_lookup(part->fat, application, &info)) {
+		result = fat_volume_read_file(part->fat, &info);
+	} else {
+		if (!(loc = runtime_locate_file(partition, application)))
+			return NULL;
 
-	file_locator_free(loc);
+		if ((fullpath = file_locator_get_full_path(loc)) != NULL)
+			result = buffer_map_file(fullpath);
+
+		file_locator_free(loc);
+	}
 
 	if (result && testcase_recording)
 		testcase_record_efi_application(testcase_recording, partition, application, result);
 
+	if (result) {
+		struct runtime_mapping *map;
+
+		map = calloc(1, sizeof(*map));
+		map->data = result;
+		map->next = runtime_mappings;
+		runtime_mappings = map;
+	}
+
 	return result;
 }
 
-char *
-runtime_disk_for_partition(const char *part_dev)
+void
+runtime_release_efi_application(buffer_t *bp)
+{
+	struct runtime_mapping **pos, *map;
+
+	if (testcase_playback) {
+		buffer_free(bp);
+		return;
+	}
+
+	for (pos = &runtime_mappings; (map = *pos) != NULL; pos = &map->next) {
+		if (map->data == bp) {
+			*pos = map->next;
+			free(map);
+			break;
+		}
+	}
+
+	buffer_unmap(bp);
+}
+
+static const char *
+runtime_name_cache_lookup(struct runtime_name_cache *list, const char *key)
+{
+	for (; list; list = list->next) {
+		if (!strcmp(list->key, key))
+			return list->value;
+	}
+	return NULL;
+}
+
+static void
+runtime_name_cache_add(struct runtime_name_cache **list, const char *key, const char *value)
+{
+	struct runtime_name_cache *entry;
+
+	entry = calloc(1, sizeof(*entry));
+	entry->key = strdup(key);
+	entry->value = strdup(value);
+	entry->next = *list;
+	*list = entry;
+}
+
+static char *
+__runtime_disk_for_partition(const char *part_dev)
 {
 	char *part_name;
 	char sys_block[PATH_MAX];
@@ -321,6 +846,7 @@ runtime_disk_for_partition(const char *part_dev)
 		error("Error insufficient buffer size for the link of %s\n", sys_block);
 		return NULL;
 	}
+	sys_device[link_size] = '\0';
 
 	*strrchr(sys_device, '/') = '\0';
 	disk_name = strrchr(sys_device, '/')+1;
@@ -340,7 +866,23 @@ runtime_disk_for_partition(const char *part_dev)
 }
 
 char *
-runtime_blockdev_by_partuuid(const char *uuid)
+runtime_disk_for_partition(const char *part_dev)
+{
+	const char *cached;
+	char *result;
+
+	if ((cached = runtime_name_cache_lookup(runtime_disk_cache, part_dev)) != NULL)
+		result = strdup(cached);
+	else
+	if ((result = __runtime_disk_for_partition(part_dev)) != NULL)
+		runtime_name_cache_add(&runtime_disk_cache, part_dev, result);
+
+	dependency_add_lookup(DEPENDENCY_PARTITION_DISK, part_dev, result);
+	return result;
+}
+
+static char *
+__runtime_blockdev_by_partuuid(const char *uuid)
 {
 	char pathbuf[PATH_MAX];
 	char *dev_name;
@@ -356,6 +898,22 @@ runtime_blockdev_by_partuuid(const char *uuid)
 	return dev_name;
 }
 
+char *
+runtime_blockdev_by_partuuid(const char *uuid)
+{
+	const char *cached;
+	char *result;
+
+	if ((cached = runtime_name_cache_lookup(runtime_partuuid_cache, uuid)) != NULL)
+		result = strdup(cached);
+	else
+	if ((result = __runtime_blockdev_by_partuuid(uuid)) != NULL)
+		runtime_name_cache_add(&runtime_partuuid_cache, uuid, result);
+
+	dependency_add_lookup(DEPENDENCY_PARTUUID, uuid, result);
+	return result;
+}
+
 block_dev_io_t *
 runtime_blockdev_open(const char *dev)
 {
@@ -370,6 +928,7 @@ runtime_blockdev_open(const char *dev)
 
 	io = calloc(1, sizeof(*io));
 	io->fd = fd;
+	io->device = strdup(dev);
 	io->sector_size = 512;
 
 	if (testcase_recording)
@@ -389,19 +948,20 @@ runtime_blockdev_close(block_dev_io_t *io)
 		io->recording = NULL;
 	}
 
+	free(io->device);
 	free(io);
 }
 
-unsigned int
-runtime_blockdev_bytes_to_sectors(const block_dev_io_t *io, unsigned int size)
+uint64_t
+runtime_blockdev_bytes_to_sectors(const block_dev_io_t *io, uint64_t size)
 {
 	return (size + io->sector_size - 1) / io->sector_size;
 }
 
 buffer_t *
-runtime_blockdev_read_lba(block_dev_io_t *io, unsigned int block, unsigned int count)
+runtime_blockdev_read_lba(block_dev_io_t *io, uint64_t block, unsigned int count)
 {
-	unsigned long offset = block * io->sector_size;
+	off_t offset = (off_t) block * io->sector_size;
 	unsigned int bytes;
 	buffer_t *result;
 	int n;
@@ -428,6 +988,7 @@ runtime_blockdev_read_lba(block_dev_io_t *io, unsigned int block, unsigned int c
 	if (io->recording)
 		testcase_block_dev_write(io->recording, offset, result);
 
+	dependency_add_blocks(io->device, block, count, result);
 	return result;
 
 failed:
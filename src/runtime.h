@@ -25,28 +25,42 @@
 
 #define RUNTIME_SHORT_READ_OKAY		0x0001
 #define RUNTIME_MISSING_FILE_OKAY	0x0002
+#define RUNTIME_WRITE_ATOMIC		0x0004
+#define RUNTIME_WRITE_NOFAIL		0x0008
+
+#define RUNTIME_MAX_DIGEST_ALGOS	4
+
+#define RUNTIME_EFIVARS_DIR		"/sys/firmware/efi/efivars"
 
 typedef struct file_locator	file_locator_t;
 typedef struct block_dev_io	block_dev_io_t;
 
 extern file_locator_t *	runtime_locate_file(const char *fs_dev, const char *path);
 extern void		file_locator_free(file_locator_t *);
+extern void		runtime_close_partitions(void);
+extern void		runtime_discard_caches(void);
 extern const char *	file_locator_get_full_path(const file_locator_t *);
 extern int		runtime_open_eventlog(const char *override_path);
 extern int		runtime_open_ima_measurements(void);
 extern buffer_t *	runtime_read_file(const char *pathname, int flags);
 extern bool		runtime_write_file(const char *pathname, buffer_t *);
 extern buffer_t *	runtime_read_efi_variable(const char *var_name);
-extern buffer_t *	runtime_read_efi_application(const char *partition, const char *application);
+extern void		runtime_preload_efi_variables(unsigned int count, const char **names);
+extern buffer_t *	runtime_map_efi_application(const char *partition, const char *application);
+extern void		runtime_release_efi_application(buffer_t *);
+extern bool		runtime_identify_efi_application(const char *partition, const char *application,
+					cache_file_id_t *);
 extern const tpm_evdigest_t *runtime_digest_efi_file(const tpm_algo_info_t *algo, const char *path);
 extern const tpm_evdigest_t *runtime_digest_rootfs_file(const tpm_algo_info_t *algo, const char *path);
+extern void		runtime_set_digest_algorithms(unsigned int count, const tpm_algo_info_t * const *algos);
+extern const tpm_algo_info_t * const *runtime_get_digest_algorithms(unsigned int *count);
 extern char *		runtime_disk_for_partition(const char *part_dev);
 extern char *		runtime_blockdev_by_partuuid(const char *uuid);
 extern block_dev_io_t *	runtime_blockdev_open(const char *dev);
-extern buffer_t *	runtime_blockdev_read_lba(block_dev_io_t *, unsigned int block, unsigned int count);
+extern buffer_t *	runtime_blockdev_read_lba(block_dev_io_t *, uint64_t block, unsigned int count);
 extern void		runtime_blockdev_close(block_dev_io_t *);
 
-extern unsigned int	runtime_blockdev_bytes_to_sectors(const block_dev_io_t *, unsigned int size);
+extern uint64_t		runtime_blockdev_bytes_to_sectors(const block_dev_io_t *, uint64_t size);
 
 extern void		runtime_record_testcase(testcase_t *);
 extern void		runtime_replay_testcase(testcase_t *);
@@ -30,12 +30,15 @@
 #include <json_object.h>
 
 #include "sd-boot.h"
+#include "depend.h"
+#include "bufparser.h"
+#include "runtime.h" /* for the write flags */
 #include "util.h"
 
 static const char *
 read_entry_token(void)
 {
-	static char id[SDB_LINE_MAX];
+	static __thread char id[SDB_LINE_MAX];
 
 	return read_single_line_file("/etc/kernel/entry-token", id, sizeof(id));
 }
@@ -43,7 +46,7 @@ read_entry_token(void)
 static const char *
 read_os_release(const char *key)
 {
-	static char id[128];
+	static __thread char id[128];
 	char line[SDB_LINE_MAX];
 	unsigned int n, k;
 	FILE *fp;
@@ -94,8 +97,9 @@ fail:
 static const char *
 read_machine_id(void)
 {
-	static char id[SDB_LINE_MAX];
+	static __thread char id[SDB_LINE_MAX];
 
+	dependency_add_file("/etc/machine-id");
 	return read_single_line_file("/etc/machine-id", id, sizeof(id));
 }
 
@@ -109,6 +113,11 @@ get_valid_kernel_entry_tokens(void)
 	static uapi_kernel_entry_tokens_t valid_tokens;
 	const char *token;
 
+	/* We only read these files once, but everyone asking depends on them */
+	dependency_add_file("/etc/kernel/entry-token");
+	dependency_add_file("/etc/machine-id");
+	dependency_add_file("/etc/os-release");
+
 	if (valid_tokens.count != 0)
 		return &valid_tokens; /* I've been here before */
 
@@ -281,6 +290,8 @@ sdb_policy_file_add_entry(const char *filename, const char *policy_name, const c
 	struct json_object *doc = NULL;
 	struct json_object *bank_obj = NULL;
 	struct json_object *entry = NULL;
+	buffer_t *bp = NULL;
+	const char *text;
 	bool ok = false;
 
 	if (access(filename, R_OK) == 0) {
@@ -320,8 +331,13 @@ sdb_policy_file_add_entry(const char *filename, const char *policy_name, const c
 	json_object_object_add(entry, "sig",
 			json_object_new_string(print_base64_value(signature, signature_len)));
 
-	if (json_object_to_file_ext(filename, doc, JSON_C_TO_STRING_PRETTY)) {
-		error("%s: unable to write json file: %s\n", filename, json_util_get_last_err());
+	/* Do not use json_object_to_file_ext(); it would truncate the file
+	 * in place rather than replacing it atomically */
+	text = json_object_to_json_string_ext(doc, JSON_C_TO_STRING_PRETTY);
+	bp = buffer_alloc_write(strlen(text) + 1);
+	if (!buffer_put(bp, text, strlen(text)) || !buffer_put(bp, "\n", 1)
+	 || !buffer_write_file_ext(filename, bp, RUNTIME_WRITE_ATOMIC)) {
+		error("%s: unable to write json file\n", filename);
 		goto out;
 	}
 
@@ -331,5 +347,7 @@ out:
 	if (doc)
 		json_object_put(doc);
 
+	if (bp)
+		buffer_free(bp);
 	return ok;
 }
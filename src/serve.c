@@ -0,0 +1,318 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "serve.h"
+#include "util.h"
+
+/*
+ * Daemon mode.
+ *
+ * Requests arrive over a unix socket. A request is a 32bit little endian
+ * argument count, followed by that many arguments, each of which is a 32bit
+ * little endian length followed by the argument string. The arguments are
+ * what one would pass to pcr-oracle on the command line, minus argv[0].
+ *
+ * Each connection is handled by a process forked off the daemon, so that
+ * it inherits whatever state the daemon has warmed up (the TPM context, the
+ * event log), and requests can be handled concurrently. That process in turn
+ * forks a worker that runs the request with its standard output and error
+ * captured, and relays these as frames to the client, followed by a
+ * SERVE_FRAME_EXIT frame that carries the exit status.
+ */
+static bool
+__serve_read(int fd, void *data, unsigned int size)
+{
+	unsigned int done = 0;
+	int n;
+
+	while (done < size) {
+		n = read(fd, (char *) data + done, size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+static bool
+__serve_write(int fd, const void *data, unsigned int size)
+{
+	unsigned int done = 0;
+	int n;
+
+	while (done < size) {
+		n = write(fd, (const char *) data + done, size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+static bool
+__serve_read_u32(int fd, uint32_t *vp)
+{
+	unsigned char b[4];
+
+	if (!__serve_read(fd, b, 4))
+		return false;
+	*vp = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+	return true;
+}
+
+static bool
+serve_send_frame(int fd, int type, const void *data, uint32_t len)
+{
+	unsigned char hdr[5];
+
+	hdr[0] = type;
+	hdr[1] = len;
+	hdr[2] = len >> 8;
+	hdr[3] = len >> 16;
+	hdr[4] = len >> 24;
+	return __serve_write(fd, hdr, sizeof(hdr)) && __serve_write(fd, data, len);
+}
+
+static char **
+serve_read_request(int fd, int *argc_ret)
+{
+	uint32_t argc, len, i;
+	char **argv;
+
+	if (!__serve_read_u32(fd, &argc) || argc > SERVE_MAX_ARGS)
+		return NULL;
+
+	/* argv[0] plus NULL terminator */
+	argv = calloc(argc + 2, sizeof(argv[0]));
+	argv[0] = strdup("pcr-oracle");
+
+	for (i = 1; i <= argc; ++i) {
+		if (!__serve_read_u32(fd, &len) || len > SERVE_MAX_ARG_LEN)
+			goto failed;
+
+		argv[i] = malloc(len + 1);
+		if (!__serve_read(fd, argv[i], len))
+			goto failed;
+		argv[i][len] = '\0';
+	}
+
+	*argc_ret = argc + 1;
+	return argv;
+
+failed:
+	for (i = 0; i <= argc; ++i)
+		free(argv[i]);
+	free(argv);
+	return NULL;
+}
+
+static int
+serve_run_worker(int sock, int argc, char **argv, serve_handler_fn_t *handler)
+{
+	int out[2], err[2];
+	struct pollfd pfd[2];
+	unsigned char status_buf[4];
+	int status, exit_code, open_fds = 2;
+	pid_t pid;
+
+	if (pipe(out) < 0 || pipe(err) < 0)
+		fatal("unable to create pipe: %m\n");
+
+	fflush(NULL);
+	if ((pid = fork()) < 0)
+		fatal("unable to fork: %m\n");
+
+	if (pid == 0) {
+		close(sock);
+		close(out[0]);
+		close(err[0]);
+		dup2(out[1], 1);
+		dup2(err[1], 2);
+		close(out[1]);
+		close(err[1]);
+
+		/* Make getopt start over */
+		optind = 0;
+		exit(handler(argc, argv));
+	}
+
+	close(out[1]);
+	close(err[1]);
+
+	pfd[0].fd = out[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = err[0];
+	pfd[1].events = POLLIN;
+
+	while (open_fds) {
+		char buffer[4096];
+		unsigned int i;
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fatal("poll: %m\n");
+		}
+
+		for (i = 0; i < 2; ++i) {
+			int n;
+
+			if (pfd[i].fd < 0 || pfd[i].revents == 0)
+				continue;
+
+			n = read(pfd[i].fd, buffer, sizeof(buffer));
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			if (n <= 0) {
+				close(pfd[i].fd);
+				pfd[i].fd = -1;
+				open_fds--;
+				continue;
+			}
+
+			/* If the client went away, we still let the worker finish */
+			serve_send_frame(sock, i == 0? SERVE_FRAME_STDOUT : SERVE_FRAME_STDERR, buffer, n);
+		}
+	}
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			fatal("waitpid: %m\n");
+	}
+
+	if (WIFEXITED(status))
+		exit_code = WEXITSTATUS(status);
+	else
+		exit_code = 128 + WTERMSIG(status);
+
+	status_buf[0] = exit_code;
+	status_buf[1] = exit_code >> 8;
+	status_buf[2] = exit_code >> 16;
+	status_buf[3] = exit_code >> 24;
+	serve_send_frame(sock, SERVE_FRAME_EXIT, status_buf, sizeof(status_buf));
+	return exit_code;
+}
+
+static int
+serve_connection(int sock, serve_handler_fn_t *handler)
+{
+	char **argv;
+	int argc;
+
+	/* We need to reap our worker */
+	signal(SIGCHLD, SIG_DFL);
+
+	if (!(argv = serve_read_request(sock, &argc))) {
+		debug("Ignoring malformed request\n");
+		return 1;
+	}
+
+	debug("Handling request: %s\n", argc > 1? argv[1] : "(none)");
+	serve_run_worker(sock, argc, argv, handler);
+	close(sock);
+	return 0;
+}
+
+static int
+serve_listen(const char *socket_path)
+{
+	struct sockaddr_un sun;
+	mode_t old_umask;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(sun.sun_path))
+		fatal("Socket path %s is too long\n", socket_path);
+	strcpy(sun.sun_path, socket_path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		fatal("Unable to create socket: %m\n");
+
+	if (unlink(socket_path) < 0 && errno != ENOENT)
+		fatal("Unable to remove %s: %m\n", socket_path);
+
+	/* Only root gets to talk to us */
+	old_umask = umask(0177);
+	if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0)
+		fatal("Unable to bind to %s: %m\n", socket_path);
+	umask(old_umask);
+
+	if (listen(fd, 16) < 0)
+		fatal("Unable to listen on %s: %m\n", socket_path);
+
+	return fd;
+}
+
+int
+serve_loop(const char *socket_path, serve_handler_fn_t *handler)
+{
+	int lfd;
+
+	lfd = serve_listen(socket_path);
+
+	/* Connection handlers are reaped automatically */
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+
+	infomsg("Listening on %s\n", socket_path);
+	while (true) {
+		pid_t pid;
+		int sock;
+
+		if ((sock = accept(lfd, NULL, NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fatal("accept: %m\n");
+		}
+
+		fflush(NULL);
+		if ((pid = fork()) < 0) {
+			error("Unable to fork: %m\n");
+			close(sock);
+			continue;
+		}
+
+		if (pid == 0) {
+			close(lfd);
+			exit(serve_connection(sock, handler));
+		}
+
+		close(sock);
+	}
+}
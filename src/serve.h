@@ -0,0 +1,43 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "types.h"
+
+#define PCR_ORACLE_SOCKET_PATH	"/run/pcr-oracle.sock"
+
+/*
+ * Frames sent by the daemon in response to a request. Each frame is
+ * a type byte, followed by a 32bit little endian length and the data.
+ */
+#define SERVE_FRAME_STDOUT	'O'
+#define SERVE_FRAME_STDERR	'E'
+#define SERVE_FRAME_EXIT	'X'
+
+#define SERVE_MAX_ARGS		256
+#define SERVE_MAX_ARG_LEN	65536
+
+typedef int		serve_handler_fn_t(int argc, char **argv);
+
+extern int		serve_loop(const char *socket_path, serve_handler_fn_t *handler);
+
+#endif /* SERVE_H */
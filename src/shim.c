@@ -72,7 +72,7 @@ shim_variable_get_rtname(const char *name)
 const char *
 shim_variable_get_full_rtname(const char *name)
 {
-	static char namebuf[128];
+	static __thread char namebuf[128];
 	const shim_variable_t *var;
 
 	if (!(var = shim_variable_find(name)))
@@ -20,19 +20,60 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "store.h"
 #include "util.h"
 #include "tpm.h"
+#include "cache.h"
 
 /* We do not have automatic conversion of TPM2B_PUBLIC to RSA yet (and so far we haven't needed it) */
 #undef WITH_NATIVE_TO_RSA_CONVERSTION
 
+/*
+ * When running several actions in one process (see --batch), they usually
+ * sign with the same key. Keep the last private key we read, and hand out
+ * references to it as long as the file has not changed.
+ */
+static struct {
+	char *			path;
+	cache_file_id_t		id;
+	tpm_rsa_key_t *		key;
+} stored_key_last_private;
+
+static tpm_rsa_key_t *
+stored_key_read_pem_private(const char *path)
+{
+	cache_file_id_t id;
+	struct stat stb;
+	tpm_rsa_key_t *key;
+
+	if (stat(path, &stb) < 0)
+		return tpm_rsa_key_read_private(path);
+	cache_file_id_from_stat(&id, &stb);
+
+	if (stored_key_last_private.key
+	 && !strcmp(stored_key_last_private.path, path)
+	 && cache_file_id_equal(&stored_key_last_private.id, &id)
+	 && (key = tpm_rsa_key_dup(stored_key_last_private.key)) != NULL)
+		return key;
+
+	if (!(key = tpm_rsa_key_read_private(path)))
+		return NULL;
+
+	if (stored_key_last_private.key)
+		tpm_rsa_key_free(stored_key_last_private.key);
+	stored_key_last_private.key = tpm_rsa_key_dup(key);
+	stored_key_last_private.id = id;
+	assign_string(&stored_key_last_private.path, path);
+	return key;
+}
+
 tpm_rsa_key_t *
 stored_key_read_rsa_private(const stored_key_t *sk)
 {
 	switch (sk->format) {
 	case STORED_KEY_FMT_PEM:
-		return tpm_rsa_key_read_private(sk->path);
+		return stored_key_read_pem_private(sk->path);
 	}
 
 	error("Unable to read RSA private key from file \"%s\": unsupported format\n", sk->path);
@@ -44,6 +44,9 @@ struct testcase {
 	char *			hash_log;
 
 	FILE *			hash_log_fp;
+
+	/* set once we started recording PCR values */
+	bool			pcrs_recorded;
 };
 
 struct testcase_block_dev {
@@ -65,7 +68,7 @@ get_basename(const char *path)
 static inline const char *
 get_dirname(const char *path)
 {
-	static char rpath[PATH_MAX];
+	static __thread char rpath[PATH_MAX];
 	char *s;
 
 	strncpy(rpath, path, sizeof rpath);
@@ -417,11 +420,21 @@ testcase_playback_block_dev(testcase_t *tc, const char *dev_path)
 FILE *
 testcase_record_pcrs(testcase_t *tc, const char *name)
 {
+	char path[PATH_MAX];
 	int fd;
 
+	/* When predicting several PCR banks, we get called once per bank */
+	if (tc->pcrs_recorded) {
+		snprintf(path, sizeof(path), "%s/%s", tc->base_directory, name);
+		if ((fd = open(path, O_WRONLY | O_APPEND)) < 0)
+			fatal("Unable to open %s: %m\n", path);
+		return fdopen(fd, "a");
+	}
+
 	if ((fd = testcase_create_file(tc->base_directory, name)) < 0)
 		return NULL;
 
+	tc->pcrs_recorded = true;
 	return fdopen(fd, "w");
 }
 
@@ -440,7 +453,7 @@ testcase_playback_pcrs(testcase_t *tc, const char *name)
 static const char *
 canon_path(const char *path)
 {
-	static char rpath[PATH_MAX];
+	static __thread char rpath[PATH_MAX];
 	char *save_path, *comp, *s;
 	char *components[PATH_MAX / 2];
 	unsigned int i, ncomponents = 0;
@@ -521,7 +534,7 @@ testcase_playback_digest(testcase_t *tc, const char *klass, const char *path, co
 {
 	FILE *fp = testcase_hash_log_open(tc, "r");
 	const char *algo_name = algo->openssl_name;
-	static tpm_evdigest_t md;
+	static __thread tpm_evdigest_t md;
 	char linebuf[256];
 
 	path = canon_path(path);
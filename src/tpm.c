@@ -24,6 +24,8 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include <tss2_esys.h>
 #include <tss2_sys.h>
@@ -33,12 +35,50 @@
 
 #include "oracle.h"
 #include "tpm.h"
+#include "digest.h"
 #include "util.h"
 #include "config.h"
 
 uint32_t	esys_tr_rh_null = ~0;
 uint32_t	esys_tr_rh_owner = ~0;
 
+/* When several processes talk to the TPM concurrently (see serve.c), each of
+ * them takes this lock before doing so, and holds it until it exits. */
+static int	tss_lock_fd = -1;
+static bool	tss_lock_held;
+
+void
+tss_serialize_access(void)
+{
+	char path[] = "/tmp/pcr-oracle-lock.XXXXXX";
+
+	if (tss_lock_fd >= 0)
+		return;
+
+	if ((tss_lock_fd = mkstemp(path)) < 0)
+		fatal("Unable to create TPM lock file: %m\n");
+	unlink(path);
+}
+
+static void
+tss_lock(void)
+{
+	struct flock fl;
+
+	if (tss_lock_fd < 0 || tss_lock_held)
+		return;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+
+	while (fcntl(tss_lock_fd, F_SETLKW, &fl) < 0) {
+		if (errno != EINTR)
+			fatal("Unable to lock TPM: %m\n");
+	}
+	tss_lock_held = true;
+}
+
 void
 tss_print_error(int rc, const char *msg)
 {
@@ -63,6 +103,8 @@ tss_esys_context(void)
 {
 	static ESYS_CONTEXT  *esys_ctx;
 
+	tss_lock();
+
 	if (esys_ctx == NULL) {
 		TSS2_RC rc;
 
@@ -85,6 +127,41 @@ tss_esys_context(void)
 	return esys_ctx;
 }
 
+/*
+ * The name of an object is its name algorithm, followed by the digest of
+ * its marshaled public area.
+ */
+bool
+tss_public_name(const TPM2B_PUBLIC *pub_key, TPM2B_NAME *name)
+{
+	uint8_t data[sizeof(TPMT_PUBLIC)];
+	const tpm_algo_info_t *algo;
+	const tpm_evdigest_t *md;
+	size_t len = 0, name_len = 0;
+	TSS2_RC rc;
+
+	if (!(algo = digest_by_tpm_alg(pub_key->publicArea.nameAlg))) {
+		error("Unsupported name algorithm %u\n", pub_key->publicArea.nameAlg);
+		return false;
+	}
+
+	rc = Tss2_MU_TPMT_PUBLIC_Marshal(&pub_key->publicArea, data, sizeof(data), &len);
+	if (!tss_check_error(rc, "Unable to marshal public key"))
+		return false;
+
+	if (!(md = digest_compute(algo, data, len)))
+		return false;
+
+	rc = Tss2_MU_TPMI_ALG_HASH_Marshal(pub_key->publicArea.nameAlg, name->name, sizeof(name->name), &name_len);
+	if (!tss_check_error(rc, "Unable to marshal name algorithm"))
+		return false;
+
+	assert(name_len + md->size <= sizeof(name->name));
+	memcpy(name->name + name_len, md->data, md->size);
+	name->size = name_len + md->size;
+	return true;
+}
+
 bool
 tpm_selftest(bool fulltest)
 {
@@ -125,3 +202,37 @@ tpm_rsa_bits_test(unsigned int rsa_bits)
 
 	return okay;
 }
+
+bool
+tpm_ecc_curve_test(unsigned int curve_id)
+{
+	ESYS_CONTEXT *esys_ctx = tss_esys_context();
+	TPMT_PUBLIC_PARMS ecc_parms = {
+		.type = TPM2_ALG_ECC,
+		.parameters = {
+			.eccDetail = {
+				.symmetric = { TPM2_ALG_NULL },
+				.scheme = { TPM2_ALG_NULL },
+				.curveID = curve_id,
+				.kdf = { TPM2_ALG_NULL },
+			}
+		}
+	};
+	TSS2_RC rc;
+	bool okay = false;
+
+	/* Suppress the messages from tpm2-tss */
+	setenv("TSS2_LOG", "all+NONE", 1);
+
+	rc = Esys_TestParms(esys_ctx, ESYS_TR_NONE, ESYS_TR_NONE,
+			ESYS_TR_NONE, &ecc_parms);
+	if (rc == TSS2_RC_SUCCESS)
+		okay = true;
+	else if ((rc & ~(TPM2_RC_P | TPM2_RC_N_MASK)) != TPM2_RC_CURVE
+	      && (rc & ~(TPM2_RC_P | TPM2_RC_N_MASK)) != TPM2_RC_VALUE
+	      && (rc & ~(TPM2_RC_P | TPM2_RC_N_MASK)) != TPM2_RC_ASYMMETRIC) {
+		tss_check_error(rc, "Esys_TestParms failed");
+	}
+
+	return okay;
+}
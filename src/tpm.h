@@ -29,10 +29,12 @@ extern uint32_t		esys_tr_rh_null;
 extern uint32_t		esys_tr_rh_owner;
 
 extern ESYS_CONTEXT *	tss_esys_context(void);
+extern void		tss_serialize_access(void);
 extern void		tss_print_error(int rc, const char *msg);
 
 extern TPM2B_PUBLIC *	tss_read_public_key(const char *);
 extern bool		tss_write_public_key(const char *, const TPM2B_PUBLIC *);
+extern bool		tss_public_name(const TPM2B_PUBLIC *, TPM2B_NAME *);
 
 static inline bool
 tss_check_error(int rc, const char *msg)
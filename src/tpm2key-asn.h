@@ -94,6 +94,7 @@ typedef struct {
 	ASN1_OCTET_STRING *privkey;
 } TSSPRIVKEY;
 
+#define OID_importableKey		"2.23.133.10.1.4"
 #define OID_sealedData			"2.23.133.10.1.5"
 
 /* This is the PEM guard tag */
@@ -187,6 +187,97 @@ cleanup:
 	return false;
 }
 
+/*
+ * An importable key carries the encrypted seed of the duplication in the
+ * secret field. The private portion is only usable after TPM2_Import.
+ */
+bool
+tpm2key_add_import_secret(TSSPRIVKEY *tpm2key, const TPM2B_ENCRYPTED_SECRET *seed)
+{
+	buffer_t *bp;
+	TPM2_RC rc;
+	bool ok = false;
+
+	bp = buffer_alloc_write(sizeof(*seed));
+
+	rc = Tss2_MU_TPM2B_ENCRYPTED_SECRET_Marshal(seed, bp->data, bp->size, &bp->wpos);
+	if (rc != TSS2_RC_SUCCESS)
+		goto out;
+
+	if (tpm2key->secret == NULL)
+		tpm2key->secret = ASN1_OCTET_STRING_new();
+	ASN1_STRING_set(tpm2key->secret, bp->data, buffer_available(bp));
+
+	ASN1_OBJECT_free(tpm2key->type);
+	tpm2key->type = OBJ_txt2obj(OID_importableKey, 1);
+	ok = true;
+
+out:
+	buffer_free(bp);
+	return ok;
+}
+
+static bool
+__tpm2key_has_type(const TSSPRIVKEY *tpm2key, const char *type_oid)
+{
+	char oid[128];
+
+	if (OBJ_obj2txt(oid, sizeof(oid), tpm2key->type, 1) == 0)
+		return false;
+	return !strcmp(oid, type_oid);
+}
+
+bool
+tpm2key_is_importable(const TSSPRIVKEY *tpm2key)
+{
+	return __tpm2key_has_type(tpm2key, OID_importableKey);
+}
+
+bool
+tpm2key_get_import_secret(const TSSPRIVKEY *tpm2key, TPM2B_ENCRYPTED_SECRET *seed)
+{
+	size_t offset = 0;
+	TPM2_RC rc;
+
+	if (tpm2key->secret == NULL)
+		return false;
+
+	rc = Tss2_MU_TPM2B_ENCRYPTED_SECRET_Unmarshal(tpm2key->secret->data,
+			tpm2key->secret->length, &offset, seed);
+	return rc == TSS2_RC_SUCCESS;
+}
+
+/*
+ * After TPM2_Import, the key turns into a regular sealed key with the private
+ * portion returned by the TPM.
+ */
+bool
+tpm2key_set_imported(TSSPRIVKEY *tpm2key, const TPM2B_PRIVATE *sealed_priv)
+{
+	buffer_t *bp;
+	TPM2_RC rc;
+	bool ok = false;
+
+	bp = buffer_alloc_write(sizeof(*sealed_priv));
+
+	rc = Tss2_MU_TPM2B_PRIVATE_Marshal(sealed_priv, bp->data, bp->size, &bp->wpos);
+	if (rc != TSS2_RC_SUCCESS)
+		goto out;
+
+	ASN1_STRING_set(tpm2key->privkey, bp->data, buffer_available(bp));
+
+	ASN1_OCTET_STRING_free(tpm2key->secret);
+	tpm2key->secret = NULL;
+
+	ASN1_OBJECT_free(tpm2key->type);
+	tpm2key->type = OBJ_txt2obj(OID_sealedData, 1);
+	ok = true;
+
+out:
+	buffer_free(bp);
+	return ok;
+}
+
 bool
 tpm2key_read_file(const char *path, TSSPRIVKEY **tpm2key)
 {
@@ -213,6 +304,12 @@ tpm2key_read_file(const char *path, TSSPRIVKEY **tpm2key)
 		goto error;
 	}
 
+	if (!strcmp(OID_importableKey, oid)) {
+		if (key->secret == NULL) {
+			error("%s: importable key lacks the encrypted seed\n", path);
+			goto error;
+		}
+	} else
 	if (strcmp(OID_sealedData, oid) != 0) {
 		error("%s is not a sealed key in TPM 2.0 Key Format\n");
 		goto error;
@@ -233,7 +330,7 @@ error:
 }
 
 bool
-tpm2key_write_file(const char *path, TSSPRIVKEY *tpm2key)
+tpm2key_write_file(const char *path, TSSPRIVKEY *tpm2key, int flags)
 {
 	buffer_t write_buf;
 	unsigned char *der_buf = NULL;
@@ -248,7 +345,7 @@ tpm2key_write_file(const char *path, TSSPRIVKEY *tpm2key)
 
 	buffer_init_write(&write_buf, der_buf, der_size);
 	write_buf.wpos = der_size;
-	ok = buffer_write_file(path, &write_buf);
+	ok = buffer_write_file_ext(path, &write_buf, flags);
 
 	free(der_buf);
 
@@ -36,8 +36,19 @@ bool	tpm2key_add_authpolicy_policyauthorize(TSSPRIVKEY *tpm2key,
 			const TPMT_SIGNATURE *signature,
 			bool append);
 
+bool	tpm2key_add_import_secret(TSSPRIVKEY *tpm2key,
+			const TPM2B_ENCRYPTED_SECRET *seed);
+
+bool	tpm2key_is_importable(const TSSPRIVKEY *tpm2key);
+
+bool	tpm2key_get_import_secret(const TSSPRIVKEY *tpm2key,
+			TPM2B_ENCRYPTED_SECRET *seed);
+
+bool	tpm2key_set_imported(TSSPRIVKEY *tpm2key,
+			const TPM2B_PRIVATE *sealed_priv);
+
 bool	tpm2key_read_file(const char *path, TSSPRIVKEY **tpm2key);
 
-bool	tpm2key_write_file(const char *path, const TSSPRIVKEY *tpm2key);
+bool	tpm2key_write_file(const char *path, const TSSPRIVKEY *tpm2key, int flags);
 
 #endif
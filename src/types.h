@@ -28,6 +28,7 @@ typedef struct buffer		buffer_t;
 typedef struct tpm_evdigest	tpm_evdigest_t;
 typedef struct tpm_algo_info	tpm_algo_info_t;
 typedef struct digest_ctx	digest_ctx_t;
+typedef struct digest_multi_ctx	digest_multi_ctx_t;
 typedef struct win_cert		win_cert_t;
 typedef struct cert_table	cert_table_t;
 typedef struct parsed_cert	parsed_cert_t;
@@ -36,6 +37,8 @@ typedef struct testcase		testcase_t;
 typedef struct stored_key	stored_key_t;
 typedef struct target_platform	target_platform_t;
 typedef struct uapi_boot_entry	uapi_boot_entry_t;
+typedef struct cache_file_id	cache_file_id_t;
+typedef struct dependency_list	dependency_list_t;
 
 #endif /* TYPES_H */
 
@@ -30,6 +30,7 @@
 #include <errno.h>
 
 #include "uapi.h"
+#include "depend.h"
 #include "util.h"
 
 #define UAPI_LINE_MAX		1024
@@ -62,6 +63,7 @@ uapi_boot_entry_load(const char *path)
 	char line[UAPI_LINE_MAX];
 	FILE *fp;
 
+	dependency_add_file(path);
 	if (!(fp = fopen(path, "r"))) {
 		error("Unable to open %s: %m\n", path);
 		return NULL;
@@ -157,6 +159,8 @@ uapi_find_matching_boot_entry(const char *dir_path,
 	struct dirent *d;
 	DIR *dir;
 
+	/* The directory changes whenever an entry is added or removed */
+	dependency_add_file(dir_path);
 	if (!(dir = opendir(dir_path))) {
 		if (errno != ENOENT)
 			error("Cannot open %s for reading: %m\n", dir_path);
@@ -27,6 +27,9 @@
 #include "util.h"
 #include "digest.h"
 
+unsigned int		opt_debug = 0;
+__thread fatal_trap_t *	fatal_trap;
+
 bool
 parse_pcr_index(const char *word, unsigned int *ret)
 {
@@ -94,7 +97,7 @@ parse_pcr_mask(const char *word, uint32_t *ret)
 const char *
 print_pcr_mask(unsigned int mask)
 {
-	static char buffer[128];
+	static __thread char buffer[128];
 	unsigned int i;
 	char *pos;
 
@@ -167,7 +170,7 @@ parse_octet_string(const char *string, unsigned char *buffer, size_t bufsz)
 const char *
 print_octet_string(const unsigned char *data, unsigned int len)
 {
-	static char buffer[3 * 64 + 1];
+	static __thread char buffer[3 * 64 + 1];
 
 	if (len < 32) {
 		unsigned int i;
@@ -209,7 +212,7 @@ print_hex_string_buffer(const unsigned char *data, unsigned int len, char *buffe
 const char *
 print_hex_string(const unsigned char *data, unsigned int len)
 {
-	static char buffer[2 * 64 + 1];
+	static __thread char buffer[2 * 64 + 1];
 
 	if (len <= 64)
 		return print_hex_string_buffer(data, len, buffer, sizeof(buffer));
@@ -221,7 +224,7 @@ print_hex_string(const unsigned char *data, unsigned int len)
 const char *
 print_base64_value(const unsigned char *data, unsigned int len)
 {
-	static char buffer[2048];
+	static __thread char buffer[2048];
 	static const char table[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 	unsigned int b64_len, i;
 	char *b;
@@ -258,7 +261,7 @@ const tpm_evdigest_t *
 parse_digest(const char *string, const char *algo)
 {
 	static const tpm_algo_info_t *algo_info;
-	static tpm_evdigest_t md;
+	static __thread tpm_evdigest_t md;
 
 	if (!(algo_info = digest_by_name(algo)))
 		fatal("%s: unknown digest name \"%s\"\n", __func__, algo);
@@ -463,7 +466,7 @@ version_string_compare(const char *ver_a, const char *ver_b)
 const char *
 path_unix2dos(const char *path)
 {
-	static char result[PATH_MAX];
+	static __thread char result[PATH_MAX];
 	char *s;
 
 	if (strlen(path) >= sizeof(result))
@@ -481,7 +484,7 @@ path_unix2dos(const char *path)
 const char *
 path_dos2unix(const char *path)
 {
-	static char result[PATH_MAX];
+	static __thread char result[PATH_MAX];
 	char *s;
 
 	if (strlen(path) >= sizeof(result))
@@ -25,10 +25,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <setjmp.h>
 
 #include "types.h"
 
+/*
+ * Code that embeds pcr-oracle (see libpcroracle.c) cannot have us exit
+ * on a fatal error. It installs a trap instead; fatal() records the message
+ * in it, and jumps back to where the trap was set.
+ */
+typedef struct fatal_trap {
+	struct fatal_trap *	prev;
+	jmp_buf			env;
+	char			message[1024];
+} fatal_trap_t;
+
 extern unsigned int	opt_debug;
+extern __thread fatal_trap_t *fatal_trap;
 
 static inline void
 debug(const char *fmt, ...)
@@ -94,6 +107,12 @@ fatal(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
+	if (fatal_trap != NULL) {
+		vsnprintf(fatal_trap->message, sizeof(fatal_trap->message), fmt, ap);
+		va_end(ap);
+		longjmp(fatal_trap->env, 1);
+	}
+
 	fprintf(stderr, "Fatal: ");
 	vfprintf(stderr, fmt, ap);
 	va_end(ap);
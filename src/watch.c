@@ -0,0 +1,345 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "watch.h"
+#include "depend.h"
+#include "runtime.h"
+#include "bufparser.h"
+#include "util.h"
+
+/*
+ * Watch mode.
+ *
+ * Every round of prediction and signing happens in a child process, which
+ * returns from watch_loop() and runs the regular code path. Before signing,
+ * it sends us the list of everything the prediction depended on. We watch
+ * these (plus the places where new kernels and boot entries usually show up)
+ * with inotify, wait for things to settle, and start the next round.
+ *
+ * Since the child uses the prediction and rehash caches, a new round only
+ * re-hashes the events affected by whatever changed.
+ */
+static const char *	watch_default_paths[] = {
+	"/boot",
+	"/boot/efi",
+	"/boot/efi/EFI",
+	"/boot/efi/loader/entries",
+	"/efi",
+	"/efi/EFI",
+	"/efi/loader/entries",
+	RUNTIME_EFIVARS_DIR,
+	NULL
+};
+
+#define WATCH_FILE_EVENTS	(IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+#define WATCH_DIR_EVENTS	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB)
+
+struct watch_set {
+	int			fd;
+	unsigned int		count;
+};
+
+static void
+watch_add(struct watch_set *ws, const char *path, uint32_t mask)
+{
+	if (inotify_add_watch(ws->fd, path, mask | IN_MASK_ADD) < 0) {
+		if (errno != ENOENT && errno != ENOTDIR)
+			debug("Cannot watch %s: %m\n", path);
+		return;
+	}
+
+	debug2("Watching %s\n", path);
+	ws->count++;
+}
+
+/*
+ * Watch the file itself, and its directory. Package managers usually
+ * replace files rather than modify them in place.
+ */
+static void
+watch_add_dependency(const char *path, void *user_data)
+{
+	struct watch_set *ws = user_data;
+	char dir[PATH_MAX], *s;
+
+	watch_add(ws, path, WATCH_FILE_EVENTS);
+
+	if (strlen(path) >= sizeof(dir))
+		return;
+	strcpy(dir, path);
+	if ((s = strrchr(dir, '/')) == NULL)
+		return;
+	if (s == dir)
+		s++;
+	*s = '\0';
+
+	watch_add(ws, dir, WATCH_DIR_EVENTS);
+}
+
+static bool
+watch_set_init(struct watch_set *ws, const dependency_list_t *deps)
+{
+	unsigned int i;
+
+	memset(ws, 0, sizeof(*ws));
+	if ((ws->fd = inotify_init1(IN_CLOEXEC)) < 0) {
+		error("Unable to initialize inotify: %m\n");
+		return false;
+	}
+
+	for (i = 0; watch_default_paths[i]; ++i)
+		watch_add(ws, watch_default_paths[i], WATCH_DIR_EVENTS);
+
+	if (deps)
+		dependency_list_foreach_path(deps, watch_add_dependency, ws);
+
+	debug("Watching %u files and directories\n", ws->count);
+	if (ws->count == 0) {
+		error("Nothing to watch\n");
+		close(ws->fd);
+		return false;
+	}
+
+	return true;
+}
+
+static void
+watch_set_destroy(struct watch_set *ws)
+{
+	if (ws->fd >= 0)
+		close(ws->fd);
+	ws->fd = -1;
+}
+
+/*
+ * Wait for the first change, then keep consuming events until nothing
+ * has happened for debounce_seconds. This way, a package transaction
+ * that installs a kernel, an initrd and a boot entry results in a single
+ * round of prediction.
+ */
+static bool
+watch_set_wait(struct watch_set *ws, unsigned int debounce_seconds)
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd;
+	int timeout = -1;
+	int n;
+
+	pfd.fd = ws->fd;
+	pfd.events = POLLIN;
+
+	while (true) {
+		n = poll(&pfd, 1, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error("poll: %m\n");
+			return false;
+		}
+
+		if (n == 0)
+			return true;
+
+		n = read(ws->fd, buffer, sizeof(buffer));
+		if (n < 0 && errno != EINTR && errno != EAGAIN) {
+			error("Unable to read inotify events: %m\n");
+			return false;
+		}
+
+		if (opt_debug > 1) {
+			char *pos = buffer;
+
+			while (n > 0 && pos < buffer + n) {
+				struct inotify_event *ev = (struct inotify_event *) pos;
+
+				debug2("inotify: wd %d mask 0x%x %s\n", ev->wd, ev->mask, ev->len? ev->name : "");
+				pos += sizeof(*ev) + ev->len;
+			}
+		}
+
+		if (timeout < 0)
+			infomsg("Change detected, waiting for things to settle\n");
+		timeout = debounce_seconds * 1000;
+	}
+}
+
+/*
+ * Called by the child process once the prediction is done.
+ */
+void
+watch_report_dependencies(int fd, const dependency_list_t *deps)
+{
+	buffer_t *bp;
+	uint32_t len;
+
+	bp = buffer_alloc_write(1024 * 1024);
+	if (!dependency_list_encode(bp, deps))
+		fatal("Unable to encode dependencies\n");
+
+	len = buffer_available(bp);
+	if (write(fd, &len, sizeof(len)) != sizeof(len)
+	 || write(fd, buffer_read_pointer(bp), len) != len)
+		fatal("Unable to send dependencies to parent process: %m\n");
+
+	buffer_free(bp);
+}
+
+static dependency_list_t *
+watch_read_dependencies(int fd)
+{
+	dependency_list_t *deps = NULL;
+	unsigned int done = 0;
+	buffer_t *bp;
+	uint32_t len;
+	int n;
+
+	if (read(fd, &len, sizeof(len)) != sizeof(len))
+		return NULL;
+
+	if (len > 16 * 1024 * 1024) {
+		error("Child process sent bogus dependency list\n");
+		return NULL;
+	}
+
+	bp = buffer_alloc_write(len);
+	while (done < len) {
+		n = read(fd, buffer_write_pointer(bp), len - done);
+		if (n <= 0)
+			goto out;
+		bp->wpos += n;
+		done += n;
+	}
+
+	deps = dependency_list_decode(bp);
+
+out:
+	buffer_free(bp);
+	return deps;
+}
+
+/*
+ * Check whether anything the last round depended on changed while that
+ * round was running, i.e. before we were watching it. This happens in a
+ * child process, too, so that the runtime's per-run caches (EFI variables,
+ * mounted partitions) never live in the long-running parent.
+ */
+static bool
+watch_dependencies_changed(const dependency_list_t *deps)
+{
+	int status;
+	pid_t pid;
+
+	fflush(NULL);
+	if ((pid = fork()) < 0) {
+		error("unable to fork: %m\n");
+		return true;
+	}
+
+	if (pid == 0) {
+		bool current = dependency_list_is_current(deps);
+
+		runtime_close_partitions();
+		fflush(NULL);
+		_exit(current? 0 : 1);
+	}
+
+	if (waitpid(pid, &status, 0) < 0)
+		fatal("waitpid: %m\n");
+
+	return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+/*
+ * This returns only in the child processes, handing them the file
+ * descriptor to report their dependencies on.
+ */
+int
+watch_loop(unsigned int debounce_seconds)
+{
+	dependency_list_t *deps = NULL;
+	struct watch_set ws;
+
+	while (true) {
+		dependency_list_t *new_deps;
+		int p[2], status;
+		pid_t pid;
+
+		fflush(NULL);
+		if (pipe(p) < 0)
+			fatal("unable to create pipe: %m\n");
+
+		if ((pid = fork()) < 0)
+			fatal("unable to fork: %m\n");
+
+		if (pid == 0) {
+			close(p[0]);
+			if (deps)
+				dependency_list_free(deps);
+			return p[1];
+		}
+
+		close(p[1]);
+		new_deps = watch_read_dependencies(p[0]);
+		close(p[0]);
+
+		if (waitpid(pid, &status, 0) < 0)
+			fatal("waitpid: %m\n");
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			error("Updating the PCR policy failed; will retry after the next change\n");
+
+		/* If the child failed before it got to report anything, keep
+		 * watching what we watched before. */
+		if (new_deps) {
+			if (deps)
+				dependency_list_free(deps);
+			deps = new_deps;
+		}
+
+		if (!watch_set_init(&ws, deps))
+			fatal("Unable to watch for changes\n");
+
+		/* The watches are armed only now; catch whatever changed
+		 * while the child was predicting and signing. Only do this
+		 * when it reported a fresh list, lest a child that keeps
+		 * failing early makes us spin. */
+		if (new_deps && watch_dependencies_changed(deps)) {
+			infomsg("Inputs changed during the update, starting another round\n");
+			watch_set_destroy(&ws);
+			continue;
+		}
+
+		infomsg("Waiting for changes\n");
+		if (!watch_set_wait(&ws, debounce_seconds))
+			fatal("Unable to watch for changes\n");
+
+		watch_set_destroy(&ws);
+	}
+}
@@ -0,0 +1,32 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "types.h"
+
+/* How long the system has to be quiet before we re-predict */
+#define WATCH_DEBOUNCE_SECONDS	5
+
+extern int		watch_loop(unsigned int debounce_seconds);
+extern void		watch_report_dependencies(int fd, const dependency_list_t *);
+
+#endif /* WATCH_H */
@@ -69,3 +69,18 @@ if [ -s recovered ] && ! cmp secret recovered; then
 else
 	echo "GOOD: After changing a PCR, the secret can no longer be unsealed"
 fi
+
+echo "Re-hashing the event log in parallel must not change the prediction"
+PREDICT_MASK=0,2,4,7,9,14
+$pcr_oracle --from eventlog --no-cache --jobs 1 predict $PREDICT_MASK >predict-serial
+# The second run with the cache enabled uses what the first one stored
+for opts in "--no-cache --jobs 4" "--jobs 4" "--jobs 4"; do
+	echo "pcr-oracle $opts predict $PREDICT_MASK"
+	$pcr_oracle --from eventlog $opts predict $PREDICT_MASK >predict-parallel
+	if ! cmp predict-serial predict-parallel; then
+		echo "BAD: Prediction with $opts differs from serial prediction"
+		diff -u predict-serial predict-parallel || true
+		exit 1
+	fi
+done
+echo "GOOD: Parallel and cached predictions match the serial one"
@@ -123,3 +123,96 @@ for attempt in first second; do
 
 	echo "Now recreate the signed PCR policy"
 done
+
+function check_recovered {
+
+	if ! cmp secret recovered; then
+		echo "BAD: Unable to recover original secret"
+		echo "Secret:"
+		od -tx1c secret
+		echo "Recovered:"
+		od -tx1c recovered
+		exit 1
+	else
+		echo "NICE: we were able to recover the original secret"
+	fi
+}
+
+for srk_type in rsa ecc; do
+	echo "Seal the secret offline, to the exported $srk_type SRK of this machine"
+	rm -f srk-public sealed-offline sealed-imported recovered
+	call_oracle \
+		--srk-type $srk_type \
+		--output srk-public \
+		export-srk
+
+	call_oracle \
+		--srk-type $srk_type \
+		--srk-public srk-public \
+		--from current \
+		--input secret \
+		--output sealed-offline \
+		seal-secret $PCR_MASK
+
+	echo "Unseal the importable key; this imports it and rewrites the file"
+	cp sealed-offline sealed-imported
+	call_oracle \
+		--srk-type $srk_type \
+		--input sealed-imported \
+		--output recovered \
+		unseal-secret
+	check_recovered
+
+	if cmp -s sealed-offline sealed-imported; then
+		echo "BAD: The key file was not updated with the imported key"
+		exit 1
+	fi
+
+	echo "Unseal the imported key"
+	rm -f recovered
+	call_oracle \
+		--srk-type $srk_type \
+		--input sealed-imported \
+		--output recovered \
+		unseal-secret
+	check_recovered
+done
+
+echo "Seal several secrets in one go"
+echo "This is another secret" >secret2
+rm -f sealed sealed2 recovered recovered2
+call_oracle \
+	--from current \
+	--input secret --output sealed \
+	--input secret2 --output sealed2 \
+	seal-secret $PCR_MASK
+
+for manifest in no yes; do
+	if [ "$manifest" = "yes" ]; then
+		echo "Seal several secrets listed in a manifest"
+		rm -f sealed sealed2
+		printf "secret sealed\nsecret2 sealed2\n" >manifest
+		call_oracle \
+			--from current \
+			--seal-manifest manifest \
+			seal-secret $PCR_MASK
+	fi
+
+	rm -f recovered recovered2
+	call_oracle \
+		--input sealed \
+		--output recovered \
+		unseal-secret
+	check_recovered
+
+	call_oracle \
+		--input sealed2 \
+		--output recovered2 \
+		unseal-secret
+	if ! cmp secret2 recovered2; then
+		echo "BAD: Unable to recover the second secret"
+		exit 1
+	else
+		echo "NICE: we were able to recover the second secret"
+	fi
+done